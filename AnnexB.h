@@ -0,0 +1,130 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <span>
+#include <vector>
+
+// start code + NAL type = Access Unit Delimiter + Slice types = ANY
+constexpr uint8_t ACCESS_UNIT_DELIMITER[6]{0, 0, 0, 1, 9, 0xE0};
+constexpr uint8_t START_CODE[4]{0, 0, 0, 1};
+
+constexpr uint8_t NAL_TYPE_SLICE = 1;
+constexpr uint8_t NAL_TYPE_IDR_SLICE = 5;
+constexpr uint8_t NAL_TYPE_SEI = 6;
+constexpr uint8_t NAL_TYPE_SPS = 7;
+constexpr uint8_t NAL_TYPE_PPS = 8;
+constexpr uint8_t NAL_TYPE_ACCESS_UNIT_DELIMITER = 9;
+
+struct NalUnitInfo
+{
+    // Of the NAL header byte, the start code is right in front of it
+    uint32_t offset;
+    // From the header byte up to the next start code, without trailing zero bytes
+    uint32_t size;
+    uint8_t type;
+    uint8_t refIdc;
+};
+
+// NAL units of one access unit in stream order, offsets are relative to the start of its data
+using NalIndex = std::vector<NalUnitInfo>;
+
+// Offset of the first 00 00 01 at or after from, or data.size() if there is none. 4 byte start codes are found at
+// their second byte. Compares 16 bytes at a time with SSE2 on hosts that have it, uses FindStartCodeScalar elsewhere.
+size_t FindStartCode(std::span<const uint8_t> data, size_t from = 0);
+// Word at a time search, kept for measuring against the scalar search on the console
+size_t FindStartCodeWords(std::span<const uint8_t> data, size_t from = 0);
+// Byte at a time search skipping ahead on bytes above 1, and the fallback for the ends the wider searches can't load
+size_t FindStartCodeScalar(std::span<const uint8_t> data, size_t from = 0);
+
+// Appends the NAL units of Annex-B data to index, with offsets relative to data plus base
+void IndexNalUnits(std::span<const uint8_t> data, NalIndex& index, uint32_t base = 0);
+const NalUnitInfo* FindNalUnit(const NalIndex& index, uint8_t type);
+// Payload of the first NAL unit of the given type in Annex-B data, starting with the NAL header byte
+std::optional<std::span<const uint8_t>> FindNalUnit(std::span<const uint8_t> data, uint8_t type);
+
+// Splits an Annex-B byte stream into access units as it arrives, in chunks of any size.
+// A new access unit starts at a delimiter, SEI, SPS or PPS, or at a slice with first_mb_in_slice 0, once the current
+// one has a slice. Every access unit is handed out starting with an access unit delimiter, like the ones of
+// MP4SampleSource, together with the index of its NAL units built on the way.
+class AnnexBSplitter
+{
+  public:
+    struct Unit
+    {
+        std::vector<uint8_t> data;
+        NalIndex nals;
+        // Stream offset of the header of the access unit's first NAL unit, counting all bytes fed since Reset
+        uint64_t position;
+        // Has an IDR slice
+        bool sync;
+        // Has a slice with a nonzero nal_ref_idc
+        bool reference;
+    };
+
+    struct Stats
+    {
+        uint64_t units;
+        // Dropped for exceeding the size limit, or for having no slice
+        uint64_t dropped;
+    };
+
+    explicit AnnexBSplitter(size_t maxUnitSize);
+
+    void Reset();
+    void Feed(std::span<const uint8_t> data);
+    // Completes the access unit in progress at the end of the stream
+    void Flush();
+
+    [[nodiscard]] bool HasUnit() const;
+    // Returns false if no access unit is complete yet
+    bool TakeUnit(Unit& unit);
+    void Recycle(std::vector<uint8_t>&& buffer);
+
+    [[nodiscard]] uint64_t GetPosition() const;
+    [[nodiscard]] Stats GetStats() const;
+
+  private:
+    enum class State
+    {
+        Scanning,
+        NalHeader,
+        SliceHeader,
+    };
+
+    void OnStartCode();
+    void OnNalHeader(uint8_t header);
+    void EndNalUnit();
+    void OnSliceHeader(uint8_t firstByte);
+    // Completes the current access unit before the start code at m_startCodeStart
+    void CompleteUnit();
+    std::vector<uint8_t> TakeBuffer();
+
+  private:
+    size_t m_maxUnitSize;
+    State m_state = State::Scanning;
+    uint64_t m_position = 0;
+
+    // Access unit in progress, behind room for a delimiter
+    std::vector<uint8_t> m_current;
+    uint64_t m_currentPosition = 0;
+    // Bytes before the first start code are dropped
+    bool m_unitStarted = false;
+    // Nothing but the start code of the next NAL unit is kept of an oversized access unit
+    bool m_overflow = false;
+    bool m_hasSlice = false;
+    bool m_firstIsDelimiter = false;
+    bool m_sync = false;
+    bool m_reference = false;
+    // Index in m_current of the start code before the NAL header being parsed
+    size_t m_startCodeStart = 0;
+    uint8_t m_nalHeader = 0;
+    uint64_t m_nalHeaderPosition = 0;
+    // NAL units of the access unit in progress, the size of the last one is set once it ends
+    NalIndex m_nals;
+
+    std::deque<Unit> m_units;
+    std::vector<std::vector<uint8_t>> m_freeBuffers;
+    Stats m_stats{};
+};
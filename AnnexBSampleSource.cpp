@@ -0,0 +1,90 @@
+#include "AnnexBSampleSource.h"
+
+#include <whb/log.h>
+
+AnnexBSampleSource::AnnexBSampleSource(const StreamSourceConfig& config) : StreamSampleSource(config)
+{
+    if (m_config.frameRateNumerator == 0 || m_config.frameRateDenominator == 0)
+    {
+        m_config.frameRateNumerator = 30000;
+        m_config.frameRateDenominator = 1001;
+    }
+}
+
+uint64_t AnnexBSampleSource::GetRestampDuration() const
+{
+    return m_frameDuration;
+}
+
+const char* AnnexBSampleSource::GetFormatName() const
+{
+    return "raw H.264";
+}
+
+bool AnnexBSampleSource::Detect(std::span<const uint8_t> header)
+{
+    // leading zero bytes are allowed before the first start code
+    size_t zeros = 0;
+    while (zeros < header.size() && header[zeros] == 0)
+        zeros++;
+    return zeros >= 2 && zeros < header.size() && header[zeros] == 1;
+}
+
+bool AnnexBSampleSource::OpenStream(std::span<const uint8_t> header)
+{
+    if (!Detect(header))
+        return false;
+    m_flushed = false;
+    m_nextDts = 0;
+    m_info.timescale = m_config.frameRateNumerator;
+    m_frameDuration = m_config.frameRateDenominator;
+    return true;
+}
+
+size_t AnnexBSampleSource::GetReadUnit() const
+{
+    return 1;
+}
+
+bool AnnexBSampleSource::ReadAccessUnit(AccessUnit& unit)
+{
+    AnnexBSplitter::Unit split{};
+    while (!m_splitter.TakeUnit(split))
+    {
+        if (m_flushed)
+            return false;
+        if (m_ring->Size() == 0 && ReadInput() == 0)
+        {
+            m_splitter.Flush();
+            m_flushed = true;
+            continue;
+        }
+        const auto data = m_ring->ReadSpan();
+        m_splitter.Feed(data);
+        m_ring->Consume(data.size());
+    }
+
+    unit.data = std::move(split.data);
+    unit.nals = std::move(split.nals);
+    unit.dts = m_nextDts;
+    unit.pts = m_nextDts;
+    unit.sync = split.sync;
+    unit.reference = split.reference;
+    m_nextDts += m_frameDuration;
+    return true;
+}
+
+void AnnexBSampleSource::OnTrackInfo(AccessUnit& first)
+{
+    if (m_info.frameRateNumerator != 0)
+    {
+        m_info.timescale = m_info.frameRateNumerator;
+        m_frameDuration = m_info.frameRateDenominator;
+        WHBLogPrintf("Playing at %.3f fps from the SPS timing info",
+                     static_cast<double>(m_info.timescale) / m_frameDuration);
+    }
+    // access units skipped before the start point don't count
+    first.dts = 0;
+    first.pts = 0;
+    m_nextDts = m_frameDuration;
+}
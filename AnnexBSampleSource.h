@@ -0,0 +1,29 @@
+#pragma once
+#include "StreamSampleSource.h"
+
+// Raw Annex-B .h264 elementary stream. It carries no timestamps, access units are stamped in decode order at the
+// frame rate of the SPS timing info, or config.frameRateNumerator / config.frameRateDenominator frames per second
+// without one.
+class AnnexBSampleSource : public StreamSampleSource
+{
+  public:
+    explicit AnnexBSampleSource(const StreamSourceConfig& config = {});
+
+    [[nodiscard]] uint64_t GetRestampDuration() const override;
+    [[nodiscard]] const char* GetFormatName() const override;
+
+    // The stream starts with a start code, after any number of zero bytes
+    static bool Detect(std::span<const uint8_t> header);
+
+  protected:
+    bool OpenStream(std::span<const uint8_t> header) override;
+    [[nodiscard]] size_t GetReadUnit() const override;
+    bool ReadAccessUnit(AccessUnit& unit) override;
+    void OnTrackInfo(AccessUnit& first) override;
+
+  private:
+    bool m_flushed = false;
+    int64_t m_nextDts = 0;
+    // In units of m_info.timescale
+    uint32_t m_frameDuration = 0;
+};
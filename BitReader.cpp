@@ -0,0 +1,84 @@
+#include "BitReader.h"
+
+BitReader::BitReader(std::span<const uint8_t> data) : m_data(data)
+{
+}
+
+uint32_t BitReader::ReadBits(unsigned count)
+{
+    uint32_t value = 0;
+    for (unsigned i = 0; i < count; ++i)
+    {
+        uint32_t bit = 0;
+        if (m_position < m_data.size() * 8)
+            bit = (m_data[m_position / 8] >> (7 - m_position % 8)) & 1;
+        else
+            m_overrun = true;
+        value = (value << 1) | bit;
+        m_position++;
+    }
+    return value;
+}
+
+bool BitReader::ReadFlag()
+{
+    return ReadBits(1) != 0;
+}
+
+uint32_t BitReader::ReadUE()
+{
+    unsigned zeros = 0;
+    while (!ReadFlag())
+    {
+        // also ends the loop at the end of the data, where every bit reads as zero
+        if (++zeros > 31)
+        {
+            m_overrun = true;
+            return 0;
+        }
+    }
+    if (zeros == 0)
+        return 0;
+    // 2^zeros - 1 + the bits after the one, without overflowing for 31 zeros
+    return (uint32_t{1} << zeros) - 1 + ReadBits(zeros);
+}
+
+int32_t BitReader::ReadSE()
+{
+    const uint32_t code = ReadUE();
+    // 1, 2, 3, 4 -> 1, -1, 2, -2
+    const auto magnitude = static_cast<int32_t>((code + 1) / 2);
+    return code % 2 ? magnitude : -magnitude;
+}
+
+void BitReader::SkipBits(size_t count)
+{
+    m_position += count;
+    if (m_position > m_data.size() * 8)
+        m_overrun = true;
+}
+
+bool BitReader::HasMoreData() const
+{
+    size_t end = m_data.size();
+    while (end > 0 && m_data[end - 1] == 0)
+        end--;
+    if (end == 0)
+        return false;
+    // position of the stop bit, the lowest one bit of the last nonzero byte
+    const uint8_t last = m_data[end - 1];
+    unsigned trailing = 0;
+    while (!((last >> trailing) & 1))
+        trailing++;
+    return m_position < end * 8 - trailing - 1;
+}
+
+bool BitReader::Overrun() const
+{
+    return m_overrun;
+}
+
+size_t BitReader::BitsLeft() const
+{
+    return m_position < m_data.size() * 8 ? m_data.size() * 8 - m_position : 0;
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+// MSB first reader of the fixed length and exp-Golomb fields of an H.264 RBSP, emulation prevention bytes already
+// removed. Reading past the end returns zero bits and sets the overrun flag instead of failing each call, so a
+// parser checks Overrun once after a group of fields.
+class BitReader
+{
+  public:
+    explicit BitReader(std::span<const uint8_t> data);
+
+    // count is at most 32
+    uint32_t ReadBits(unsigned count);
+    bool ReadFlag();
+    // ue(v), also sets the overrun flag for codes longer than 32 bits
+    uint32_t ReadUE();
+    // se(v)
+    int32_t ReadSE();
+    void SkipBits(size_t count);
+
+    // more_rbsp_data(): anything but the stop bit and the zero bits after it is left
+    [[nodiscard]] bool HasMoreData() const;
+    [[nodiscard]] bool Overrun() const;
+    [[nodiscard]] size_t BitsLeft() const;
+
+  private:
+    std::span<const uint8_t> m_data;
+    size_t m_position = 0;
+    bool m_overrun = false;
+};
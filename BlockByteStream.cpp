@@ -0,0 +1,341 @@
+#include "BlockByteStream.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <utility>
+
+constexpr uint64_t NO_BLOCK = std::numeric_limits<uint64_t>::max();
+constexpr size_t BLOCK_ALIGNMENT = 0x40;
+
+std::unique_ptr<FileBlockReader> FileBlockReader::Open(const std::filesystem::path& path)
+{
+    std::error_code error;
+    const auto size = std::filesystem::file_size(path, error);
+    if (error)
+        return nullptr;
+    auto* file = std::fopen(path.c_str(), "rb");
+    if (!file)
+        return nullptr;
+    // Blocks are large already, stdio buffering would only add a copy
+    std::setvbuf(file, nullptr, _IONBF, 0);
+    return std::unique_ptr<FileBlockReader>(new FileBlockReader(file, size));
+}
+
+FileBlockReader::FileBlockReader(std::FILE* file, uint64_t size) : m_file(file), m_size(size)
+{
+}
+
+FileBlockReader::~FileBlockReader()
+{
+    std::fclose(m_file);
+}
+
+size_t FileBlockReader::ReadAt(uint64_t offset, void* buffer, size_t size)
+{
+    std::scoped_lock l{m_mutex};
+    if (fseeko(m_file, static_cast<off_t>(offset), SEEK_SET) != 0)
+        return 0;
+    return std::fread(buffer, 1, size, m_file);
+}
+
+uint64_t FileBlockReader::GetSize() const
+{
+    return m_size;
+}
+
+uint64_t FileBlockReader::UpdateSize()
+{
+    std::scoped_lock l{m_mutex};
+    if (fseeko(m_file, 0, SEEK_END) == 0)
+    {
+        const auto end = ftello(m_file);
+        if (end >= 0)
+            m_size = static_cast<uint64_t>(end);
+    }
+    return m_size;
+}
+
+AP4_Result BlockByteStream::Create(const std::filesystem::path& path, const Config& config, BlockByteStream*& stream)
+{
+    stream = nullptr;
+    auto reader = FileBlockReader::Open(path);
+    if (!reader)
+        return AP4_ERROR_CANNOT_OPEN_FILE;
+    stream = new BlockByteStream(std::move(reader), config);
+    return AP4_SUCCESS;
+}
+
+BlockByteStream::BlockByteStream(std::unique_ptr<BlockReader> reader, const Config& config)
+    : m_reader(std::move(reader)), m_config(config), m_size(m_reader->GetSize()), m_lastBlock(NO_BLOCK),
+      m_prefetchRequest(NO_BLOCK)
+{
+    m_config.blockSize = std::max<size_t>(m_config.blockSize, BLOCK_ALIGNMENT);
+    m_config.blockSize = (m_config.blockSize + BLOCK_ALIGNMENT - 1) / BLOCK_ALIGNMENT * BLOCK_ALIGNMENT;
+    // Prefetching and reading around a pinned block need a block besides the one being read from
+    m_config.cacheBlocks = std::max(m_config.cacheBlocks, 2u);
+
+    m_blocks.resize(m_config.cacheBlocks);
+    for (auto& block : m_blocks)
+    {
+        block.index = NO_BLOCK;
+        block.data.reset(static_cast<uint8_t*>(std::aligned_alloc(BLOCK_ALIGNMENT, m_config.blockSize)));
+    }
+    if (m_config.prefetch)
+        m_prefetchThread = std::thread([this] { PrefetchLoop(); });
+}
+
+BlockByteStream::~BlockByteStream()
+{
+    if (m_prefetchThread.joinable())
+    {
+        {
+            std::scoped_lock l{m_mutex};
+            m_stopPrefetch = true;
+        }
+        m_prefetchWake.notify_one();
+        m_prefetchThread.join();
+    }
+}
+
+AP4_Result BlockByteStream::ReadPartial(void* buffer, AP4_Size bytesToRead, AP4_Size& bytesRead)
+{
+    bytesRead = 0;
+    if (bytesToRead == 0)
+        return AP4_SUCCESS;
+    if (m_position >= m_size)
+        return AP4_ERROR_EOS;
+
+    const auto toRead = static_cast<size_t>(std::min<uint64_t>(bytesToRead, m_size - m_position));
+    if (toRead >= m_config.blockSize)
+    {
+        const auto read = m_reader->ReadAt(m_position, buffer, toRead);
+        {
+            std::scoped_lock l{m_mutex};
+            m_stats.bytesRead += read;
+            m_stats.readCalls++;
+            m_stats.cacheMisses++;
+        }
+        if (read == 0)
+            return AP4_ERROR_READ_FAILED;
+        m_position += read;
+        bytesRead = read;
+        return AP4_SUCCESS;
+    }
+
+    const auto blockIndex = m_position / m_config.blockSize;
+    std::unique_lock l{m_mutex};
+    auto* block = AcquireBlockLocked(blockIndex, l);
+    if (!block)
+        return AP4_ERROR_READ_FAILED;
+
+    const auto blockOffset = static_cast<size_t>(m_position - blockIndex * m_config.blockSize);
+    if (blockOffset >= block->size)
+        return AP4_ERROR_EOS;
+    const auto count = std::min(toRead, block->size - blockOffset);
+    std::memcpy(buffer, block->data.get() + blockOffset, count);
+    block->lastUse = ++m_useCounter;
+    PrefetchAfterLocked(blockIndex, l);
+
+    m_position += count;
+    bytesRead = count;
+    return AP4_SUCCESS;
+}
+
+std::span<const uint8_t> BlockByteStream::Pin(uint64_t offset)
+{
+    if (offset >= m_size)
+        return {};
+
+    const auto blockIndex = offset / m_config.blockSize;
+    std::unique_lock l{m_mutex};
+    auto* block = AcquireBlockLocked(blockIndex, l);
+    if (!block)
+        return {};
+
+    const auto blockOffset = static_cast<size_t>(offset - blockIndex * m_config.blockSize);
+    if (blockOffset >= block->size)
+        return {};
+    block->pins++;
+    block->lastUse = ++m_useCounter;
+    const std::span<const uint8_t> view{block->data.get() + blockOffset, block->size - blockOffset};
+    PrefetchAfterLocked(blockIndex, l);
+    return view;
+}
+
+void BlockByteStream::Unpin(std::span<const uint8_t> view)
+{
+    if (view.empty())
+        return;
+    {
+        std::scoped_lock l{m_mutex};
+        // by its data, the block may have been dropped from the cache by UpdateSize meanwhile
+        const auto it = std::find_if(m_blocks.begin(), m_blocks.end(), [&](const Block& b) {
+            return view.data() >= b.data.get() && view.data() < b.data.get() + m_config.blockSize;
+        });
+        if (it != m_blocks.end() && it->pins > 0)
+            it->pins--;
+    }
+    // a read may be waiting for a block to evict
+    m_blockLoaded.notify_all();
+}
+
+AP4_Result BlockByteStream::WritePartial(const void*, AP4_Size, AP4_Size& bytesWritten)
+{
+    bytesWritten = 0;
+    return AP4_ERROR_NOT_SUPPORTED;
+}
+
+AP4_Result BlockByteStream::Seek(AP4_Position position)
+{
+    if (position > m_size)
+        return AP4_ERROR_OUT_OF_RANGE;
+    m_position = position;
+    return AP4_SUCCESS;
+}
+
+AP4_Result BlockByteStream::Tell(AP4_Position& position)
+{
+    position = m_position;
+    return AP4_SUCCESS;
+}
+
+AP4_Result BlockByteStream::GetSize(AP4_LargeSize& size)
+{
+    size = m_size;
+    return AP4_SUCCESS;
+}
+
+void BlockByteStream::AddReference()
+{
+    m_references++;
+}
+
+void BlockByteStream::Release()
+{
+    if (--m_references == 0)
+        delete this;
+}
+
+BlockByteStream::Stats BlockByteStream::GetStats() const
+{
+    std::scoped_lock l{m_mutex};
+    return m_stats;
+}
+
+uint64_t BlockByteStream::UpdateSize()
+{
+    const auto size = m_reader->UpdateSize();
+    std::scoped_lock l{m_mutex};
+    if (size == m_size)
+        return m_size;
+    for (auto& block : m_blocks)
+    {
+        // blocks still loading check their size against the new end when they arrive
+        if (!block.loading && block.index != NO_BLOCK && block.size < m_config.blockSize)
+            block.index = NO_BLOCK;
+    }
+    m_size = size;
+    return m_size;
+}
+
+BlockByteStream::Block* BlockByteStream::FindBlockLocked(uint64_t index)
+{
+    const auto it =
+        std::find_if(m_blocks.begin(), m_blocks.end(), [index](const Block& b) { return b.index == index; });
+    return it != m_blocks.end() ? &*it : nullptr;
+}
+
+BlockByteStream::Block* BlockByteStream::PickVictimLocked()
+{
+    Block* victim = nullptr;
+    for (auto& block : m_blocks)
+    {
+        if (!block.loading && block.pins == 0 && (!victim || block.lastUse < victim->lastUse))
+            victim = &block;
+    }
+    return victim;
+}
+
+BlockByteStream::Block* BlockByteStream::AcquireBlockLocked(uint64_t index, std::unique_lock<std::mutex>& lock)
+{
+    while (true)
+    {
+        if (auto* block = FindBlockLocked(index))
+        {
+            if (block->loading)
+            {
+                m_blockLoaded.wait(lock);
+                continue;
+            }
+            m_stats.cacheHits++;
+            return block;
+        }
+
+        auto* victim = PickVictimLocked();
+        if (!victim)
+        {
+            m_blockLoaded.wait(lock);
+            continue;
+        }
+        m_stats.cacheMisses++;
+        return LoadBlockLocked(*victim, index, lock) ? victim : nullptr;
+    }
+}
+
+bool BlockByteStream::LoadBlockLocked(Block& block, uint64_t index, std::unique_lock<std::mutex>& lock)
+{
+    block.index = index;
+    block.loading = true;
+    block.size = 0;
+    const auto size = static_cast<size_t>(std::min<uint64_t>(m_config.blockSize, m_size - index * m_config.blockSize));
+
+    lock.unlock();
+    const auto read = m_reader->ReadAt(index * m_config.blockSize, block.data.get(), size);
+    lock.lock();
+
+    m_stats.bytesRead += read;
+    m_stats.readCalls++;
+    block.loading = false;
+    block.size = read;
+    block.lastUse = ++m_useCounter;
+    // a block cut short by a read error or by the file growing meanwhile is handed out once but not kept
+    if (read < std::min<uint64_t>(m_config.blockSize, m_size - index * m_config.blockSize))
+        block.index = NO_BLOCK;
+    m_blockLoaded.notify_all();
+    return read > 0;
+}
+
+void BlockByteStream::PrefetchAfterLocked(uint64_t index, std::unique_lock<std::mutex>& lock)
+{
+    // Reading on in the same or the following block counts as sequential
+    const bool sequential = m_lastBlock != NO_BLOCK && (index == m_lastBlock || index == m_lastBlock + 1);
+    m_lastBlock = index;
+    const auto next = index + 1;
+    if (m_config.prefetch && sequential && next * m_config.blockSize < m_size && !FindBlockLocked(next))
+    {
+        m_prefetchRequest = next;
+        lock.unlock();
+        m_prefetchWake.notify_one();
+    }
+}
+
+void BlockByteStream::PrefetchLoop()
+{
+    std::unique_lock l{m_mutex};
+    while (true)
+    {
+        m_prefetchWake.wait(l, [this] { return m_stopPrefetch || m_prefetchRequest != NO_BLOCK; });
+        if (m_stopPrefetch)
+            break;
+        const auto index = std::exchange(m_prefetchRequest, NO_BLOCK);
+        if (FindBlockLocked(index))
+            continue;
+        auto* victim = PickVictimLocked();
+        // Never evict the block being read from for a prefetch
+        if (!victim || victim->index == m_lastBlock)
+            continue;
+        if (LoadBlockLocked(*victim, index, l))
+            m_stats.prefetchedBlocks++;
+    }
+}
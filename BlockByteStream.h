@@ -0,0 +1,145 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+
+#include <bento4/Ap4ByteStream.h>
+
+// Random access to the raw bytes of a file, has to be safe to call from several threads
+class BlockReader
+{
+  public:
+    virtual ~BlockReader() = default;
+    // Returns the number of bytes read, less than size only at the end of the file or on error
+    virtual size_t ReadAt(uint64_t offset, void* buffer, size_t size) = 0;
+    [[nodiscard]] virtual uint64_t GetSize() const = 0;
+    // Checks the size again, for files still being written
+    virtual uint64_t UpdateSize() = 0;
+};
+
+// stdio backend, works with the SD card on console as well as with files on the host
+class FileBlockReader : public BlockReader
+{
+  public:
+    // Returns nullptr if the file can't be opened
+    static std::unique_ptr<FileBlockReader> Open(const std::filesystem::path& path);
+    ~FileBlockReader() override;
+
+    size_t ReadAt(uint64_t offset, void* buffer, size_t size) override;
+    [[nodiscard]] uint64_t GetSize() const override;
+    uint64_t UpdateSize() override;
+
+  private:
+    FileBlockReader(std::FILE* file, uint64_t size);
+
+  private:
+    std::FILE* m_file;
+    uint64_t m_size;
+    std::mutex m_mutex;
+};
+
+// Byte stream reading its source in large aligned blocks kept in a small LRU cache.
+// While access is sequential the next block is read ahead on a background thread.
+// Reads of at least a block go straight to the caller's buffer, and Pin hands out cached bytes without copying them.
+class BlockByteStream : public AP4_ByteStream
+{
+  public:
+    struct Config
+    {
+        size_t blockSize = 1024 * 1024;
+        unsigned cacheBlocks = 4;
+        bool prefetch = true;
+    };
+
+    struct Stats
+    {
+        // Bytes and calls that went to the BlockReader
+        uint64_t bytesRead;
+        uint64_t readCalls;
+        uint64_t prefetchedBlocks;
+        // ReadPartial and Pin calls served from the cache, including ones that waited for a prefetch in flight
+        uint64_t cacheHits;
+        uint64_t cacheMisses;
+
+        [[nodiscard]] double HitRate() const
+        {
+            const auto total = cacheHits + cacheMisses;
+            return total ? static_cast<double>(cacheHits) / total : 0.0;
+        }
+    };
+
+    static AP4_Result Create(const std::filesystem::path& path, const Config& config, BlockByteStream*& stream);
+
+    BlockByteStream(std::unique_ptr<BlockReader> reader, const Config& config);
+
+    // AP4_ByteStream
+    AP4_Result ReadPartial(void* buffer, AP4_Size bytesToRead, AP4_Size& bytesRead) override;
+    AP4_Result WritePartial(const void* buffer, AP4_Size bytesToWrite, AP4_Size& bytesWritten) override;
+    AP4_Result Seek(AP4_Position position) override;
+    AP4_Result Tell(AP4_Position& position) override;
+    AP4_Result GetSize(AP4_LargeSize& size) override;
+
+    // AP4_Referenceable
+    void AddReference() override;
+    void Release() override;
+
+    // The bytes from offset to the end of the cached block holding it, read like ReadPartial would but not copied.
+    // The block stays cached until the view is passed to Unpin. Empty at the end of the file or on read errors.
+    std::span<const uint8_t> Pin(uint64_t offset);
+    void Unpin(std::span<const uint8_t> view);
+
+    [[nodiscard]] Stats GetStats() const;
+    // Picks up data appended to the file since it was opened, cached blocks that may have been cut short are dropped.
+    // Has to be called from the thread reading the stream.
+    uint64_t UpdateSize();
+
+  private:
+    struct Block
+    {
+        uint64_t index;
+        std::unique_ptr<uint8_t, decltype(&std::free)> data{nullptr, std::free};
+        size_t size = 0;
+        uint64_t lastUse = 0;
+        bool loading = false;
+        unsigned pins = 0;
+    };
+
+    // Use Release
+    ~BlockByteStream() override;
+
+    Block* FindBlockLocked(uint64_t index);
+    // Least recently used block that isn't being loaded or pinned, nullptr if every block is
+    Block* PickVictimLocked();
+    // Returns the block with its data, loading it if needed. nullptr on read errors.
+    Block* AcquireBlockLocked(uint64_t index, std::unique_lock<std::mutex>& lock);
+    bool LoadBlockLocked(Block& block, uint64_t index, std::unique_lock<std::mutex>& lock);
+    // After a read from the block, prefetches the following one if access is sequential. May unlock.
+    void PrefetchAfterLocked(uint64_t index, std::unique_lock<std::mutex>& lock);
+    void PrefetchLoop();
+
+  private:
+    std::unique_ptr<BlockReader> m_reader;
+    Config m_config;
+    uint64_t m_size;
+    uint64_t m_position = 0;
+    std::atomic_uint m_references{1};
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_blockLoaded;
+    std::vector<Block> m_blocks;
+    uint64_t m_useCounter = 0;
+    uint64_t m_lastBlock;
+    Stats m_stats{};
+
+    std::condition_variable m_prefetchWake;
+    uint64_t m_prefetchRequest;
+    bool m_stopPrefetch = false;
+    std::thread m_prefetchThread;
+};
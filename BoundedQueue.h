@@ -0,0 +1,132 @@
+#pragma once
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+// Fixed capacity FIFO between threads. Pop sleeps while the queue is empty and Push sleeps while it is full.
+// Items are moved in and out under the lock, nothing else is done while holding it.
+// Storage is a ring allocated up front, so pushing and popping never allocates.
+template <typename T>
+class BoundedQueue
+{
+  public:
+    explicit BoundedQueue(size_t capacity) : m_items(capacity > 0 ? capacity : 1)
+    {
+    }
+
+    // Returns false if the queue was closed, the item is dropped then
+    bool Push(T item)
+    {
+        std::unique_lock l{m_mutex};
+        m_notFull.wait(l, [this] { return m_closed || m_count < m_items.size(); });
+        if (m_closed)
+            return false;
+        PushLocked(std::move(item));
+        l.unlock();
+        m_notEmpty.notify_one();
+        return true;
+    }
+
+    // Returns false without waiting if the queue is full or closed
+    bool TryPush(T item)
+    {
+        std::unique_lock l{m_mutex};
+        if (m_closed || m_count >= m_items.size())
+            return false;
+        PushLocked(std::move(item));
+        l.unlock();
+        m_notEmpty.notify_one();
+        return true;
+    }
+
+    // Returns std::nullopt once the queue is closed
+    std::optional<T> Pop()
+    {
+        std::unique_lock l{m_mutex};
+        m_notEmpty.wait(l, [this] { return m_closed || m_count > 0; });
+        if (m_closed)
+            return std::nullopt;
+        return PopLocked(l);
+    }
+
+    std::optional<T> TryPop()
+    {
+        std::unique_lock l{m_mutex};
+        if (m_closed || m_count == 0)
+            return std::nullopt;
+        return PopLocked(l);
+    }
+
+    // Wakes up all waiting threads, later calls fail until Reopen
+    void Close()
+    {
+        {
+            std::scoped_lock l{m_mutex};
+            m_closed = true;
+        }
+        m_notEmpty.notify_all();
+        m_notFull.notify_all();
+    }
+
+    void Reopen()
+    {
+        std::scoped_lock l{m_mutex};
+        m_closed = false;
+    }
+
+    // Returns the number of items dropped
+    size_t Clear()
+    {
+        size_t dropped;
+        {
+            std::scoped_lock l{m_mutex};
+            dropped = m_count;
+            for (; m_count > 0; --m_count)
+            {
+                m_items[m_head].reset();
+                m_head = (m_head + 1) % m_items.size();
+            }
+        }
+        m_notFull.notify_all();
+        return dropped;
+    }
+
+    [[nodiscard]] size_t Size() const
+    {
+        std::scoped_lock l{m_mutex};
+        return m_count;
+    }
+
+    [[nodiscard]] size_t Capacity() const
+    {
+        return m_items.size();
+    }
+
+  private:
+    void PushLocked(T&& item)
+    {
+        m_items[(m_head + m_count) % m_items.size()].emplace(std::move(item));
+        m_count++;
+    }
+
+    std::optional<T> PopLocked(std::unique_lock<std::mutex>& l)
+    {
+        auto item = std::move(m_items[m_head]);
+        m_items[m_head].reset();
+        m_head = (m_head + 1) % m_items.size();
+        m_count--;
+        l.unlock();
+        m_notFull.notify_one();
+        return item;
+    }
+
+  private:
+    std::vector<std::optional<T>> m_items;
+    size_t m_head = 0;
+    size_t m_count = 0;
+    bool m_closed = false;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_notEmpty;
+    std::condition_variable m_notFull;
+};
@@ -0,0 +1,269 @@
+#include "ColorConvert.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Coefficients are fixed point with this many fraction bits, small enough for 16 bit lanes
+constexpr int FRACTION_BITS = 13;
+// Lowest and highest sums of a channel before clamping, with room to spare
+constexpr int CLAMP_LOW = -384;
+constexpr int CLAMP_HIGH = 640;
+
+// In fixed point, a channel is luma * y + cb * u + cr * v + offset, the offset holds the -0.0625 and -0.5 of the
+// shader and the rounding
+struct Coefficients
+{
+    int32_t y;
+    int32_t rv;
+    int32_t gu;
+    int32_t gv;
+    int32_t bu;
+    int32_t rOffset;
+    int32_t gOffset;
+    int32_t bOffset;
+};
+
+struct Matrix
+{
+    double y;
+    double rv;
+    double gu;
+    double gv;
+    double bu;
+};
+
+static Matrix MatrixFor(const ColorSpace& space)
+{
+    // the limited range BT.601 values are the shader's
+    if (space.matrix == ColorMatrix::Bt709)
+        return space.fullRange ? Matrix{1.0, 1.5748, -0.187324, -0.468124, 1.8556}
+                               : Matrix{1.164383, 1.792741, -0.213249, -0.532909, 2.112402};
+    return space.fullRange ? Matrix{1.0, 1.402, -0.344136, -0.714136, 1.772}
+                           : Matrix{1.164383, 1.596027, -0.391762, -0.812968, 2.017232};
+}
+
+static int32_t ToFixed(double value)
+{
+    return static_cast<int32_t>(std::lround(value * (1 << FRACTION_BITS)));
+}
+
+static Coefficients CoefficientsFor(const ColorSpace& space)
+{
+    const Matrix m = MatrixFor(space);
+    // 0.0625 and 0.5 of the normalised values in steps of 8 bits
+    const double lumaOffset = space.fullRange ? 0.0 : 0.0625 * 255;
+    const double chromaOffset = 0.5 * 255;
+    const double base = 0.5 - m.y * lumaOffset;
+    return {ToFixed(m.y),
+            ToFixed(m.rv),
+            ToFixed(m.gu),
+            ToFixed(m.gv),
+            ToFixed(m.bu),
+            ToFixed(base - m.rv * chromaOffset),
+            ToFixed(base - (m.gu + m.gv) * chromaOffset),
+            ToFixed(base - m.bu * chromaOffset)};
+}
+
+static uint8_t Clamp(int32_t sum)
+{
+    return static_cast<uint8_t>(std::clamp(sum >> FRACTION_BITS, 0, 255));
+}
+
+// Bytes R, G, B, A in memory
+static uint32_t PackPixel(uint32_t r, uint32_t g, uint32_t b)
+{
+    if constexpr (std::endian::native == std::endian::big)
+        return r << 24 | g << 16 | b << 8 | 0xFF;
+    else
+        return 0xFF000000 | b << 16 | g << 8 | r;
+}
+
+ColorSpace ColorSpaceFor(uint8_t matrixCoefficients, bool fullRange)
+{
+    return {matrixCoefficients == 1 ? ColorMatrix::Bt709 : ColorMatrix::Bt601, fullRange};
+}
+
+NV12Image CropFrame(const DecodedFrame& frame, unsigned width, unsigned height, unsigned cropLeft, unsigned cropTop)
+{
+    cropLeft &= ~1u;
+    cropTop &= ~1u;
+    const uint8_t* const data = frame.buffer.data();
+    const size_t pitch = static_cast<size_t>(frame.pitch);
+    // interleaved UV, so the chroma of cropLeft pixels is cropLeft bytes in as well
+    return {data + cropTop * pitch + cropLeft, data + (frame.height + cropTop / 2) * pitch + cropLeft, pitch, width,
+            height};
+}
+
+void ConvertNV12ToRGBAScalar(const NV12Image& image, const ColorSpace& space, uint8_t* rgba, size_t rgbaPitch)
+{
+    const Coefficients c = CoefficientsFor(space);
+    for (unsigned line = 0; line < image.height; ++line)
+    {
+        const uint8_t* luma = image.luma + line * image.pitch;
+        const uint8_t* chroma = image.chroma + line / 2 * image.pitch;
+        uint8_t* out = rgba + line * rgbaPitch;
+        for (unsigned x = 0; x < image.width; ++x)
+        {
+            const int32_t y = luma[x] * c.y;
+            const int32_t u = chroma[x & ~1u];
+            const int32_t v = chroma[(x & ~1u) + 1];
+            out[x * 4] = Clamp(y + v * c.rv + c.rOffset);
+            out[x * 4 + 1] = Clamp(y + u * c.gu + v * c.gv + c.gOffset);
+            out[x * 4 + 2] = Clamp(y + u * c.bu + c.bOffset);
+            out[x * 4 + 3] = 0xFF;
+        }
+    }
+}
+
+// Tables of the terms of each channel and the clamp of their sum, the chroma ones hold the offsets
+struct BlockTables
+{
+    std::array<int32_t, 256> y;
+    std::array<int32_t, 256> rv;
+    std::array<int32_t, 256> gu;
+    std::array<int32_t, 256> gv;
+    std::array<int32_t, 256> bu;
+    std::array<uint8_t, CLAMP_HIGH - CLAMP_LOW> clamp;
+};
+
+static void FillTables(const Coefficients& c, BlockTables& tables)
+{
+    for (int32_t i = 0; i < 256; ++i)
+    {
+        tables.y[i] = i * c.y;
+        tables.rv[i] = i * c.rv + c.rOffset;
+        tables.gu[i] = i * c.gu + c.gOffset;
+        tables.gv[i] = i * c.gv;
+        tables.bu[i] = i * c.bu + c.bOffset;
+    }
+    for (int32_t i = CLAMP_LOW; i < CLAMP_HIGH; ++i)
+        tables.clamp[i - CLAMP_LOW] = static_cast<uint8_t>(std::clamp(i, 0, 255));
+}
+
+static uint32_t BlockPixel(const BlockTables& tables, uint8_t luma, int32_t r, int32_t g, int32_t b)
+{
+    const int32_t y = tables.y[luma];
+    const uint8_t* const clamp = tables.clamp.data() - CLAMP_LOW;
+    return PackPixel(clamp[(y + r) >> FRACTION_BITS], clamp[(y + g) >> FRACTION_BITS],
+                     clamp[(y + b) >> FRACTION_BITS]);
+}
+
+void ConvertNV12ToRGBABlocks(const NV12Image& image, const ColorSpace& space, uint8_t* rgba, size_t rgbaPitch)
+{
+    BlockTables tables;
+    FillTables(CoefficientsFor(space), tables);
+    for (unsigned line = 0; line < image.height; line += 2)
+    {
+        const uint8_t* luma = image.luma + line * image.pitch;
+        const uint8_t* chroma = image.chroma + line / 2 * image.pitch;
+        uint8_t* out = rgba + line * rgbaPitch;
+        // the second line of an odd height is the first one again, written twice
+        const bool pair = line + 1 < image.height;
+        const uint8_t* lumaBelow = pair ? luma + image.pitch : luma;
+        uint8_t* outBelow = pair ? out + rgbaPitch : out;
+        for (unsigned x = 0; x < image.width; x += 2)
+        {
+            const int32_t r = tables.rv[chroma[x + 1]];
+            const int32_t g = tables.gu[chroma[x]] + tables.gv[chroma[x + 1]];
+            const int32_t b = tables.bu[chroma[x]];
+            const uint32_t pixels[]{BlockPixel(tables, luma[x], r, g, b), BlockPixel(tables, lumaBelow[x], r, g, b)};
+            std::memcpy(out + x * 4, &pixels[0], 4);
+            std::memcpy(outBelow + x * 4, &pixels[1], 4);
+            if (x + 1 == image.width)
+                break;
+            const uint32_t right[]{BlockPixel(tables, luma[x + 1], r, g, b),
+                                   BlockPixel(tables, lumaBelow[x + 1], r, g, b)};
+            std::memcpy(out + x * 4 + 4, &right[0], 4);
+            std::memcpy(outBelow + x * 4 + 4, &right[1], 4);
+        }
+    }
+}
+
+#if defined(__SSE2__)
+// Eight pixels of one channel from the luma and the chroma pairs with each sample twice, as 16 bit lanes
+static __m128i ConvertChannel(__m128i lumaChroma0, __m128i lumaChroma1, __m128i coefficients, __m128i offset)
+{
+    const __m128i low = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(lumaChroma0, coefficients), offset), FRACTION_BITS);
+    const __m128i high =
+        _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(lumaChroma1, coefficients), offset), FRACTION_BITS);
+    return _mm_packs_epi32(low, high);
+}
+
+static __m128i CoefficientPair(int32_t first, int32_t second)
+{
+    return _mm_set1_epi32(static_cast<int32_t>(static_cast<uint32_t>(static_cast<uint16_t>(first)) |
+                                               static_cast<uint32_t>(static_cast<uint16_t>(second)) << 16));
+}
+#endif
+
+void ConvertNV12ToRGBA(const NV12Image& image, const ColorSpace& space, uint8_t* rgba, size_t rgbaPitch)
+{
+#if defined(__SSE2__)
+    const Coefficients c = CoefficientsFor(space);
+    // luma with cr, luma with cb, and cb with cr for the part of green that isn't luma
+    const __m128i yv = CoefficientPair(c.y, c.rv);
+    const __m128i yu = CoefficientPair(c.y, c.bu);
+    const __m128i yOnly = CoefficientPair(c.y, 0);
+    const __m128i uv = CoefficientPair(c.gu, c.gv);
+    const __m128i rOffset = _mm_set1_epi32(c.rOffset);
+    const __m128i gOffset = _mm_set1_epi32(c.gOffset);
+    const __m128i bOffset = _mm_set1_epi32(c.bOffset);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alpha = _mm_set1_epi8(static_cast<char>(0xFF));
+
+    const unsigned vectorWidth = image.width & ~7u;
+    for (unsigned line = 0; line < image.height; ++line)
+    {
+        const uint8_t* luma = image.luma + line * image.pitch;
+        const uint8_t* chroma = image.chroma + line / 2 * image.pitch;
+        uint8_t* out = rgba + line * rgbaPitch;
+        for (unsigned x = 0; x < vectorWidth; x += 8)
+        {
+            const __m128i y = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(luma + x)), zero);
+            // four cb, cr pairs for the eight pixels
+            const __m128i cbcr = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(chroma + x)), zero);
+            const __m128i u = _mm_shufflehi_epi16(_mm_shufflelo_epi16(cbcr, _MM_SHUFFLE(2, 2, 0, 0)),
+                                                  _MM_SHUFFLE(2, 2, 0, 0));
+            const __m128i v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(cbcr, _MM_SHUFFLE(3, 3, 1, 1)),
+                                                  _MM_SHUFFLE(3, 3, 1, 1));
+
+            const __m128i yv0 = _mm_unpacklo_epi16(y, v);
+            const __m128i yv1 = _mm_unpackhi_epi16(y, v);
+            const __m128i yu0 = _mm_unpacklo_epi16(y, u);
+            const __m128i yu1 = _mm_unpackhi_epi16(y, u);
+            const __m128i uv0 = _mm_unpacklo_epi16(u, v);
+            const __m128i uv1 = _mm_unpackhi_epi16(u, v);
+
+            const __m128i r = ConvertChannel(yv0, yv1, yv, rOffset);
+            const __m128i b = ConvertChannel(yu0, yu1, yu, bOffset);
+            // the luma term once more with the zero coefficient of its pair, so u isn't counted twice
+            const __m128i gLow = _mm_add_epi32(_mm_madd_epi16(yu0, yOnly), _mm_madd_epi16(uv0, uv));
+            const __m128i gHigh = _mm_add_epi32(_mm_madd_epi16(yu1, yOnly), _mm_madd_epi16(uv1, uv));
+            const __m128i g = _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(gLow, gOffset), FRACTION_BITS),
+                                              _mm_srai_epi32(_mm_add_epi32(gHigh, gOffset), FRACTION_BITS));
+
+            // saturating packs clamp to 0-255
+            const __m128i rg = _mm_unpacklo_epi8(_mm_packus_epi16(r, zero), _mm_packus_epi16(g, zero));
+            const __m128i ba = _mm_unpacklo_epi8(_mm_packus_epi16(b, zero), alpha);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x * 4), _mm_unpacklo_epi16(rg, ba));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x * 4 + 16), _mm_unpackhi_epi16(rg, ba));
+        }
+    }
+    if (vectorWidth != image.width)
+    {
+        const NV12Image rest{image.luma + vectorWidth, image.chroma + vectorWidth, image.pitch,
+                             image.width - vectorWidth, image.height};
+        ConvertNV12ToRGBAScalar(rest, space, rgba + vectorWidth * 4, rgbaPitch);
+    }
+#else
+    // the console has no vector unit for integers
+    ConvertNV12ToRGBABlocks(image, space, rgba, rgbaPitch);
+#endif
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include "OutputQueue.h"
+
+// YCbCr to RGB matrix of the stream's VUI
+enum class ColorMatrix
+{
+    Bt601,
+    Bt709,
+};
+
+struct ColorSpace
+{
+    ColorMatrix matrix = ColorMatrix::Bt601;
+    // Y and CbCr use the whole 0-255 range instead of 16-235 and 16-240
+    bool fullRange = false;
+};
+
+// From the ISO/IEC 23091-2 code of H264TrackInfo::matrixCoefficients, BT.601 unless it says BT.709 like the shader
+ColorSpace ColorSpaceFor(uint8_t matrixCoefficients, bool fullRange);
+
+// Part of an NV12 picture: luma rows pitch bytes apart and interleaved CbCr rows of half the height, pitch bytes apart
+// as well. Odd sizes share the chroma of the last pair.
+struct NV12Image
+{
+    const uint8_t* luma;
+    const uint8_t* chroma;
+    size_t pitch;
+    unsigned width;
+    unsigned height;
+};
+
+// The shown part of a decoded frame, with the crop offsets rounded down to even like Gfx does
+NV12Image CropFrame(const DecodedFrame& frame, unsigned width, unsigned height, unsigned cropLeft, unsigned cropTop);
+
+// Writes RGBA8 rows rgbaPitch bytes apart with the math of shaders/nv12torgb.frag, offsets of 0.0625 and 0.5 of the
+// normalised values included, rounded to nearest. The three give the same result: SSE2 on hosts that have it, the
+// console gets ConvertNV12ToRGBABlocks.
+void ConvertNV12ToRGBA(const NV12Image& image, const ColorSpace& space, uint8_t* rgba, size_t rgbaPitch);
+// Tables per 2x2 block sharing a chroma sample, one word stored per pixel
+void ConvertNV12ToRGBABlocks(const NV12Image& image, const ColorSpace& space, uint8_t* rgba, size_t rgbaPitch);
+// A pixel at a time
+void ConvertNV12ToRGBAScalar(const NV12Image& image, const ColorSpace& space, uint8_t* rgba, size_t rgbaPitch);
@@ -0,0 +1,190 @@
+#include "Downscaler.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Row sums have to fit 16 bits, column sums of those 32
+constexpr unsigned ROW_WEIGHT_BITS = 7;
+constexpr unsigned COLUMN_WEIGHT_BITS = 14;
+constexpr unsigned SUM_BITS = ROW_WEIGHT_BITS + COLUMN_WEIGHT_BITS;
+
+// Rows are summed up without rounding, the columns of those sums round once
+static void FilterLineScalar(const uint8_t* source, size_t pitch, const uint16_t* weights, unsigned count,
+                             uint16_t* line, unsigned size)
+{
+    for (unsigned x = 0; x < size; ++x)
+    {
+        unsigned sum = 0;
+        for (unsigned k = 0; k < count; ++k)
+            sum += source[k * pitch + x] * weights[k];
+        line[x] = static_cast<uint16_t>(sum);
+    }
+}
+
+// Four pixels at a time as two words of two 16 bit lanes, no sum carries into the lane above as it stays below 2^15
+static void FilterLineWords(const uint8_t* source, size_t pitch, const uint16_t* weights, unsigned count,
+                            uint16_t* line, unsigned size)
+{
+    constexpr uint32_t LANES = 0x00FF00FF;
+    unsigned x = 0;
+    for (; x + 4 <= size; x += 4)
+    {
+        uint32_t even = 0;
+        uint32_t odd = 0;
+        for (unsigned k = 0; k < count; ++k)
+        {
+            uint32_t word;
+            std::memcpy(&word, source + k * pitch + x, sizeof(word));
+            even += (word & LANES) * weights[k];
+            odd += (word >> 8 & LANES) * weights[k];
+        }
+        // the lower lane holds the byte that comes first in memory only on little endian
+        if constexpr (std::endian::native == std::endian::big)
+            std::swap(even, odd);
+        line[x] = static_cast<uint16_t>(even);
+        line[x + 1] = static_cast<uint16_t>(odd);
+        line[x + 2] = static_cast<uint16_t>(even >> 16);
+        line[x + 3] = static_cast<uint16_t>(odd >> 16);
+    }
+    FilterLineScalar(source + x, pitch, weights, count, line + x, size - x);
+}
+
+#if defined(__SSE2__)
+static void FilterLineSse2(const uint8_t* source, size_t pitch, const uint16_t* weights, unsigned count,
+                           uint16_t* line, unsigned size)
+{
+    const __m128i zero = _mm_setzero_si128();
+    unsigned x = 0;
+    for (; x + 16 <= size; x += 16)
+    {
+        __m128i low = zero;
+        __m128i high = zero;
+        for (unsigned k = 0; k < count; ++k)
+        {
+            const __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + k * pitch + x));
+            const __m128i weight = _mm_set1_epi16(static_cast<short>(weights[k]));
+            low = _mm_add_epi16(low, _mm_mullo_epi16(_mm_unpacklo_epi8(pixels, zero), weight));
+            high = _mm_add_epi16(high, _mm_mullo_epi16(_mm_unpackhi_epi8(pixels, zero), weight));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(line + x), low);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(line + x + 8), high);
+    }
+    FilterLineScalar(source + x, pitch, weights, count, line + x, size - x);
+}
+#endif
+
+NV12Downscaler::NV12Downscaler(unsigned sourceWidth, unsigned sourceHeight, unsigned width, unsigned height)
+    : m_sourceWidth(sourceWidth), m_sourceHeight(sourceHeight),
+      m_width(std::max(std::min(width, sourceWidth) & ~1u, 2u)),
+      m_height(std::max(std::min(height, sourceHeight) & ~1u, 2u)),
+      m_lumaRows(MakeFilter(sourceHeight, m_height, ROW_WEIGHT_BITS)),
+      m_lumaColumns(MakeFilter(sourceWidth, m_width, COLUMN_WEIGHT_BITS)),
+      m_chromaRows(MakeFilter(sourceHeight / 2, m_height / 2, ROW_WEIGHT_BITS)),
+      m_chromaColumns(MakeFilter(sourceWidth / 2, m_width / 2, COLUMN_WEIGHT_BITS)), m_line(sourceWidth)
+{
+}
+
+unsigned NV12Downscaler::GetWidth() const
+{
+    return m_width;
+}
+
+unsigned NV12Downscaler::GetHeight() const
+{
+    return m_height;
+}
+
+NV12Downscaler::Filter NV12Downscaler::MakeFilter(unsigned sourceSize, unsigned size, unsigned weightBits)
+{
+    const unsigned one = 1 << weightBits;
+    Filter filter;
+    filter.taps.reserve(size);
+    const double scale = static_cast<double>(sourceSize) / size;
+    for (unsigned i = 0; i < size; ++i)
+    {
+        // the output pixel covers [start, end) of the source, the pixels at either end only partly
+        const double start = i * scale;
+        const double end = std::min((i + 1) * scale, static_cast<double>(sourceSize));
+        const auto first = static_cast<unsigned>(start);
+        const auto last = std::max(static_cast<unsigned>(std::ceil(end)), first + 1);
+
+        Taps taps{first, last - first, static_cast<unsigned>(filter.weights.size())};
+        unsigned sum = 0;
+        for (unsigned k = first; k < last; ++k)
+        {
+            const double covered = std::min(end, k + 1.0) - std::max(start, static_cast<double>(k));
+            const auto weight = static_cast<uint16_t>(std::lround(covered / (end - start) * one));
+            filter.weights.push_back(weight);
+            sum += weight;
+        }
+        // rounding errors go to the biggest weight, so the taps always add up to one
+        auto* weights = filter.weights.data() + taps.weights;
+        auto* biggest = std::max_element(weights, weights + taps.count);
+        *biggest = static_cast<uint16_t>(*biggest + one - sum);
+        filter.taps.push_back(taps);
+    }
+    return filter;
+}
+
+void NV12Downscaler::ScalePlane(const uint8_t* source, size_t sourcePitch, const Filter& rows, const Filter& columns,
+                                unsigned channels, uint8_t* destination, size_t destinationPitch,
+                                LineFunction filterLine)
+{
+    const unsigned lineSize = static_cast<unsigned>(columns.taps.back().first + columns.taps.back().count) * channels;
+    for (size_t row = 0; row < rows.taps.size(); ++row)
+    {
+        const Taps& rowTaps = rows.taps[row];
+        filterLine(source + rowTaps.first * sourcePitch, sourcePitch, rows.weights.data() + rowTaps.weights,
+                   rowTaps.count, m_line.data(), lineSize);
+
+        uint8_t* out = destination + row * destinationPitch;
+        for (const Taps& taps : columns.taps)
+        {
+            const uint16_t* weights = columns.weights.data() + taps.weights;
+            const uint16_t* in = m_line.data() + taps.first * channels;
+            for (unsigned channel = 0; channel < channels; ++channel)
+            {
+                uint32_t sum = 1 << (SUM_BITS - 1);
+                for (unsigned k = 0; k < taps.count; ++k)
+                    sum += in[k * channels + channel] * weights[k];
+                *out++ = static_cast<uint8_t>(sum >> SUM_BITS);
+            }
+        }
+    }
+}
+
+void NV12Downscaler::ScaleImage(const NV12Image& source, uint8_t* luma, size_t lumaPitch, uint8_t* chroma,
+                                size_t chromaPitch, LineFunction filterLine)
+{
+    ScalePlane(source.luma, source.pitch, m_lumaRows, m_lumaColumns, 1, luma, lumaPitch, filterLine);
+    ScalePlane(source.chroma, source.pitch, m_chromaRows, m_chromaColumns, 2, chroma, chromaPitch, filterLine);
+}
+
+void NV12Downscaler::Scale(const NV12Image& source, uint8_t* luma, size_t lumaPitch, uint8_t* chroma,
+                           size_t chromaPitch)
+{
+#if defined(__SSE2__)
+    ScaleImage(source, luma, lumaPitch, chroma, chromaPitch, FilterLineSse2);
+#else
+    // the console has no vector unit for integers
+    ScaleImage(source, luma, lumaPitch, chroma, chromaPitch, FilterLineWords);
+#endif
+}
+
+void NV12Downscaler::ScaleWords(const NV12Image& source, uint8_t* luma, size_t lumaPitch, uint8_t* chroma,
+                                size_t chromaPitch)
+{
+    ScaleImage(source, luma, lumaPitch, chroma, chromaPitch, FilterLineWords);
+}
+
+void NV12Downscaler::ScaleScalar(const NV12Image& source, uint8_t* luma, size_t lumaPitch, uint8_t* chroma,
+                                 size_t chromaPitch)
+{
+    ScaleImage(source, luma, lumaPitch, chroma, chromaPitch, FilterLineScalar);
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "ColorConvert.h"
+
+// Shrinks NV12 pictures by averaging the area of the source each output pixel covers, any factor in each direction.
+// Rows are filtered first, over the whole source width, then columns of the filtered line. Row weights have 7 bits so
+// the sums fit 16 bit lanes, two of those to a word on the console, column weights 14.
+class NV12Downscaler
+{
+  public:
+    // Output sizes at most the source's, rounded down to even like the chroma
+    NV12Downscaler(unsigned sourceWidth, unsigned sourceHeight, unsigned width, unsigned height);
+
+    [[nodiscard]] unsigned GetWidth() const;
+    [[nodiscard]] unsigned GetHeight() const;
+
+    // Into planes of the output size, chroma interleaved like the source and half the height. source has to be of the
+    // size given to the constructor. SSE2 on hosts that have it, ScaleWords on the console.
+    void Scale(const NV12Image& source, uint8_t* luma, size_t lumaPitch, uint8_t* chroma, size_t chromaPitch);
+    void ScaleWords(const NV12Image& source, uint8_t* luma, size_t lumaPitch, uint8_t* chroma, size_t chromaPitch);
+    void ScaleScalar(const NV12Image& source, uint8_t* luma, size_t lumaPitch, uint8_t* chroma, size_t chromaPitch);
+
+  private:
+    // The source pixels of one output pixel along one direction
+    struct Taps
+    {
+        unsigned first;
+        unsigned count;
+        // Into Filter::weights
+        unsigned weights;
+    };
+
+    struct Filter
+    {
+        std::vector<Taps> taps;
+        // Of each of the taps, fixed point summing up to one
+        std::vector<uint16_t> weights;
+    };
+
+    using LineFunction = void (*)(const uint8_t* source, size_t pitch, const uint16_t* weights, unsigned count,
+                                  uint16_t* line, unsigned size);
+
+    static Filter MakeFilter(unsigned sourceSize, unsigned size, unsigned weightBits);
+    void ScalePlane(const uint8_t* source, size_t sourcePitch, const Filter& rows, const Filter& columns,
+                    unsigned channels, uint8_t* destination, size_t destinationPitch, LineFunction filterLine);
+    void ScaleImage(const NV12Image& source, uint8_t* luma, size_t lumaPitch, uint8_t* chroma, size_t chromaPitch,
+                    LineFunction filterLine);
+
+  private:
+    unsigned m_sourceWidth;
+    unsigned m_sourceHeight;
+    unsigned m_width;
+    unsigned m_height;
+    Filter m_lumaRows;
+    Filter m_lumaColumns;
+    Filter m_chromaRows;
+    Filter m_chromaColumns;
+    // One row of the source filtered vertically, not rounded yet
+    std::vector<uint16_t> m_line;
+};
@@ -0,0 +1,413 @@
+#include "FragmentedSampleTable.h"
+
+#include <algorithm>
+
+#include <bento4/Ap4ByteStream.h>
+#include <bento4/Ap4Utils.h>
+
+constexpr uint32_t BOX_MOOF = MakeBoxType("moof");
+constexpr uint32_t BOX_TRAF = MakeBoxType("traf");
+constexpr uint32_t BOX_TFHD = MakeBoxType("tfhd");
+constexpr uint32_t BOX_TFDT = MakeBoxType("tfdt");
+constexpr uint32_t BOX_TRUN = MakeBoxType("trun");
+
+// tfhd flags
+constexpr uint32_t TFHD_BASE_DATA_OFFSET = 0x000001;
+constexpr uint32_t TFHD_SAMPLE_DESCRIPTION_INDEX = 0x000002;
+constexpr uint32_t TFHD_DEFAULT_DURATION = 0x000008;
+constexpr uint32_t TFHD_DEFAULT_SIZE = 0x000010;
+constexpr uint32_t TFHD_DEFAULT_FLAGS = 0x000020;
+
+// trun flags
+constexpr uint32_t TRUN_DATA_OFFSET = 0x000001;
+constexpr uint32_t TRUN_FIRST_SAMPLE_FLAGS = 0x000004;
+constexpr uint32_t TRUN_DURATION = 0x000100;
+constexpr uint32_t TRUN_SIZE = 0x000200;
+constexpr uint32_t TRUN_FLAGS = 0x000400;
+constexpr uint32_t TRUN_CTS_OFFSET = 0x000800;
+
+constexpr uint32_t SAMPLE_IS_NON_SYNC = 0x10000;
+
+// Reads big endian fields off the front of a box payload
+class FieldReader
+{
+  public:
+    explicit FieldReader(std::span<const uint8_t> data) : m_data(data)
+    {
+    }
+
+    bool Read32(uint32_t& value)
+    {
+        if (m_data.size() < 4)
+            return false;
+        value = AP4_BytesToUInt32BE(m_data.data());
+        m_data = m_data.subspan(4);
+        return true;
+    }
+
+    bool Read64(uint64_t& value)
+    {
+        if (m_data.size() < 8)
+            return false;
+        value = AP4_BytesToUInt64BE(m_data.data());
+        m_data = m_data.subspan(8);
+        return true;
+    }
+
+  private:
+    std::span<const uint8_t> m_data;
+};
+
+std::unique_ptr<FragmentedSampleTable> FragmentedSampleTable::Create(AP4_ByteStream& stream,
+                                                                     const MP4VideoTrackBoxes& boxes)
+{
+    std::unique_ptr<FragmentedSampleTable> table(new FragmentedSampleTable(stream, boxes));
+    if (!table->Extend())
+        return nullptr;
+    return table;
+}
+
+FragmentedSampleTable::FragmentedSampleTable(AP4_ByteStream& stream, const MP4VideoTrackBoxes& boxes)
+    : m_stream(stream), m_trackId(boxes.trackId), m_defaultDuration(boxes.defaultSampleDuration),
+      m_defaultSize(boxes.defaultSampleSize), m_defaultFlags(boxes.defaultSampleFlags), m_scanOffset(boxes.moovEnd)
+{
+}
+
+uint32_t FragmentedSampleTable::Count() const
+{
+    if (m_fragments.empty())
+        return 0;
+    return m_fragments.back().firstSample + m_fragments.back().sampleCount;
+}
+
+uint64_t FragmentedSampleTable::Offset(uint32_t sample) const
+{
+    uint32_t index;
+    const auto* samples = GetSamples(sample, index);
+    return samples ? samples->offsets[index] : 0;
+}
+
+uint32_t FragmentedSampleTable::Size(uint32_t sample) const
+{
+    uint32_t index;
+    const auto* samples = GetSamples(sample, index);
+    return samples ? samples->sizes[index] : 0;
+}
+
+uint64_t FragmentedSampleTable::Dts(uint32_t sample) const
+{
+    uint32_t index;
+    const auto* samples = GetSamples(sample, index);
+    return samples ? samples->dts[index] : 0;
+}
+
+int32_t FragmentedSampleTable::CtsOffset(uint32_t sample) const
+{
+    uint32_t index;
+    const auto* samples = GetSamples(sample, index);
+    return samples ? samples->ctsOffsets[index] : 0;
+}
+
+uint64_t FragmentedSampleTable::Duration(uint32_t sample) const
+{
+    uint32_t index;
+    const auto* samples = GetSamples(sample, index);
+    return samples ? samples->durations[index] : 0;
+}
+
+bool FragmentedSampleTable::IsSync(uint32_t sample) const
+{
+    uint32_t index;
+    const auto* samples = GetSamples(sample, index);
+    return samples && samples->sync[index];
+}
+
+uint32_t FragmentedSampleTable::FindSample(uint64_t time) const
+{
+    while (m_fragments.back().endDts <= time && ReadNextFragment())
+    {
+    }
+
+    const auto next = std::upper_bound(m_fragments.begin(), m_fragments.end(), time,
+                                       [](uint64_t t, const Fragment& fragment) { return t < fragment.baseDts; });
+    if (next == m_fragments.begin())
+        return 0;
+    const auto& fragment = *std::prev(next);
+
+    uint32_t index;
+    const auto* samples = GetSamples(fragment.firstSample, index);
+    if (!samples)
+        return fragment.firstSample;
+    const auto inFragment = std::upper_bound(samples->dts.begin(), samples->dts.end(), time);
+    if (inFragment == samples->dts.begin())
+        return fragment.firstSample;
+    return fragment.firstSample + static_cast<uint32_t>(std::distance(samples->dts.begin(), inFragment) - 1);
+}
+
+uint32_t FragmentedSampleTable::FindSyncSample(uint32_t sample) const
+{
+    // walk back through the fragments until one has a sync sample at or before sample, fragment wraps past 0
+    for (auto fragment = FindFragment(sample); fragment < m_fragments.size(); --fragment)
+    {
+        const auto& summary = m_fragments[fragment];
+        if (summary.syncCount == 0)
+            continue;
+        uint32_t index;
+        const auto* samples = GetSamples(summary.firstSample, index);
+        if (!samples)
+            break;
+        const auto last = std::min(sample - summary.firstSample, summary.sampleCount - 1);
+        for (uint32_t i = last + 1; i-- > 0;)
+        {
+            if (samples->sync[i])
+                return summary.firstSample + i;
+        }
+    }
+    return 0;
+}
+
+uint32_t FragmentedSampleTable::SyncSampleCount() const
+{
+    uint32_t count = 0;
+    for (const auto& fragment : m_fragments)
+        count += fragment.syncCount;
+    return count;
+}
+
+bool FragmentedSampleTable::Extend()
+{
+    return ReadNextFragment();
+}
+
+bool FragmentedSampleTable::IsExtensible() const
+{
+    return true;
+}
+
+bool FragmentedSampleTable::ReadNextFragment() const
+{
+    AP4_LargeSize fileSize = 0;
+    if (AP4_FAILED(m_stream.GetSize(fileSize)))
+        return false;
+
+    const uint64_t dts = m_fragments.empty() ? 0 : m_fragments.back().endDts;
+    BoxHeader box;
+    // a box still being written doesn't fit yet and ends the search for now
+    while (ReadBoxHeader(m_stream, m_scanOffset, fileSize, box))
+    {
+        const auto offset = m_scanOffset;
+        if (box.type != BOX_MOOF)
+        {
+            m_scanOffset = box.End();
+            continue;
+        }
+
+        auto& slot = PickSlot();
+        uint64_t baseDts;
+        if (!ParseFragment(offset, box, dts, baseDts, slot))
+        {
+            slot.fragment = UINT32_MAX;
+            return false;
+        }
+        if (slot.sizes.empty())
+        {
+            // only samples of other tracks
+            slot.fragment = UINT32_MAX;
+            m_scanOffset = box.End();
+            continue;
+        }
+
+        // all of the fragment's sample data has to be in the file already
+        uint64_t dataEnd = 0;
+        for (size_t i = 0; i < slot.sizes.size(); ++i)
+            dataEnd = std::max(dataEnd, slot.offsets[i] + slot.sizes[i]);
+        if (dataEnd > fileSize)
+        {
+            slot.fragment = UINT32_MAX;
+            return false;
+        }
+
+        Fragment fragment{};
+        fragment.offset = offset;
+        fragment.firstSample = Count();
+        fragment.sampleCount = slot.sizes.size();
+        fragment.syncCount = std::count(slot.sync.begin(), slot.sync.end(), 1);
+        fragment.baseDts = baseDts;
+        fragment.endDts = slot.dts.back() + slot.durations.back();
+        slot.fragment = m_fragments.size();
+        m_fragments.push_back(fragment);
+        m_scanOffset = box.End();
+        return true;
+    }
+    return false;
+}
+
+bool FragmentedSampleTable::ParseFragment(uint64_t offset, const BoxHeader& moof, uint64_t dts, uint64_t& baseDts,
+                                          FragmentSamples& samples) const
+{
+    samples.offsets.clear();
+    samples.sizes.clear();
+    samples.dts.clear();
+    samples.durations.clear();
+    samples.ctsOffsets.clear();
+    samples.sync.clear();
+    baseDts = dts;
+
+    std::vector<uint8_t> payload;
+    if (!ReadBoxPayload(m_stream, moof, payload))
+        return false;
+
+    std::span<const uint8_t> trafs{payload};
+    MemoryBox traf;
+    while (TakeBox(trafs, traf))
+    {
+        if (traf.type != BOX_TRAF)
+            continue;
+
+        const auto tfhd = FindBox(traf.payload, BOX_TFHD);
+        if (!tfhd)
+            return false;
+        FieldReader header{*tfhd};
+        uint32_t flags, trackId;
+        if (!header.Read32(flags) || !header.Read32(trackId))
+            return false;
+        if (trackId != m_trackId)
+            continue;
+
+        // Without an explicit base the data is relative to the moof box. That is what default-base-is-moof says, and
+        // it is also right for the first traf of a fragment, which is all there is with one traf per track.
+        uint64_t base = offset;
+        uint32_t unused;
+        uint32_t defaultDuration = m_defaultDuration;
+        uint32_t defaultSize = m_defaultSize;
+        uint32_t defaultFlags = m_defaultFlags;
+        if ((flags & TFHD_BASE_DATA_OFFSET) && !header.Read64(base))
+            return false;
+        if ((flags & TFHD_SAMPLE_DESCRIPTION_INDEX) && !header.Read32(unused))
+            return false;
+        if ((flags & TFHD_DEFAULT_DURATION) && !header.Read32(defaultDuration))
+            return false;
+        if ((flags & TFHD_DEFAULT_SIZE) && !header.Read32(defaultSize))
+            return false;
+        if ((flags & TFHD_DEFAULT_FLAGS) && !header.Read32(defaultFlags))
+            return false;
+
+        if (const auto tfdt = FindBox(traf.payload, BOX_TFDT); tfdt && tfdt->size() >= 4)
+        {
+            FieldReader time{tfdt->subspan(4)};
+            uint32_t time32;
+            if ((*tfdt)[0] == 1)
+            {
+                if (!time.Read64(baseDts))
+                    return false;
+            }
+            else
+            {
+                if (!time.Read32(time32))
+                    return false;
+                baseDts = time32;
+            }
+        }
+        dts = baseDts;
+
+        uint64_t dataOffset = base;
+        std::span<const uint8_t> runs = traf.payload;
+        MemoryBox trun;
+        while (TakeBox(runs, trun))
+        {
+            if (trun.type != BOX_TRUN || trun.payload.empty())
+                continue;
+            FieldReader run{trun.payload};
+            uint32_t versionAndFlags, count;
+            if (!run.Read32(versionAndFlags) || !run.Read32(count))
+                return false;
+            const uint32_t runFlags = versionAndFlags & 0xFFFFFF;
+            uint32_t firstFlags = 0;
+            if (runFlags & TRUN_DATA_OFFSET)
+            {
+                uint32_t relative;
+                if (!run.Read32(relative))
+                    return false;
+                dataOffset = base + static_cast<int32_t>(relative);
+            }
+            if ((runFlags & TRUN_FIRST_SAMPLE_FLAGS) && !run.Read32(firstFlags))
+                return false;
+
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                uint32_t duration = defaultDuration;
+                uint32_t size = defaultSize;
+                uint32_t sampleFlags = i == 0 && (runFlags & TRUN_FIRST_SAMPLE_FLAGS) ? firstFlags : defaultFlags;
+                uint32_t ctsOffset = 0;
+                if ((runFlags & TRUN_DURATION) && !run.Read32(duration))
+                    return false;
+                if ((runFlags & TRUN_SIZE) && !run.Read32(size))
+                    return false;
+                if ((runFlags & TRUN_FLAGS) && !run.Read32(sampleFlags))
+                    return false;
+                if ((runFlags & TRUN_CTS_OFFSET) && !run.Read32(ctsOffset))
+                    return false;
+
+                samples.offsets.push_back(dataOffset);
+                samples.sizes.push_back(size);
+                samples.dts.push_back(dts);
+                samples.durations.push_back(duration);
+                // version 0 offsets are unsigned, negative ones written that way are common enough to read as signed
+                samples.ctsOffsets.push_back(static_cast<int32_t>(ctsOffset));
+                samples.sync.push_back((sampleFlags & SAMPLE_IS_NON_SYNC) == 0);
+                dataOffset += size;
+                dts += duration;
+            }
+        }
+    }
+    samples.lastUse = ++m_useCounter;
+    return true;
+}
+
+const FragmentedSampleTable::FragmentSamples* FragmentedSampleTable::GetSamples(uint32_t sample,
+                                                                               uint32_t& index) const
+{
+    const auto fragment = FindFragment(sample);
+    if (fragment == UINT32_MAX)
+        return nullptr;
+    index = sample - m_fragments[fragment].firstSample;
+
+    for (auto& slot : m_slots)
+    {
+        if (slot.fragment == fragment)
+        {
+            slot.lastUse = ++m_useCounter;
+            return &slot;
+        }
+    }
+
+    // read again after being evicted
+    auto& slot = PickSlot();
+    const auto& summary = m_fragments[fragment];
+    BoxHeader moof;
+    uint64_t baseDts;
+    if (!ReadBoxHeader(m_stream, summary.offset, UINT64_MAX, moof) ||
+        !ParseFragment(summary.offset, moof, summary.baseDts, baseDts, slot) ||
+        slot.sizes.size() != summary.sampleCount)
+    {
+        slot.fragment = UINT32_MAX;
+        return nullptr;
+    }
+    slot.fragment = fragment;
+    return &slot;
+}
+
+FragmentedSampleTable::FragmentSamples& FragmentedSampleTable::PickSlot() const
+{
+    return *std::min_element(m_slots.begin(), m_slots.end(),
+                             [](const FragmentSamples& a, const FragmentSamples& b) { return a.lastUse < b.lastUse; });
+}
+
+uint32_t FragmentedSampleTable::FindFragment(uint32_t sample) const
+{
+    if (sample >= Count())
+        return UINT32_MAX;
+    const auto next = std::upper_bound(m_fragments.begin(), m_fragments.end(), sample,
+                                       [](uint32_t s, const Fragment& fragment) { return s < fragment.firstSample; });
+    return static_cast<uint32_t>(std::distance(m_fragments.begin(), next) - 1);
+}
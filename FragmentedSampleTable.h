@@ -0,0 +1,83 @@
+#pragma once
+#include <array>
+#include <memory>
+#include <vector>
+
+#include "MP4Boxes.h"
+#include "SampleTable.h"
+
+// Sample table of a fragmented MP4 file, built from the moof boxes following moov.
+// Fragments are found one at a time as playback or a seek reaches them, so opening only reads the first one and a
+// file that is still being written can be followed. Besides a small summary per fragment, only the samples of the
+// last two fragments used are kept decoded.
+class FragmentedSampleTable : public SampleTable
+{
+  public:
+    // Reads the first fragment, returns nullptr if there is none. The stream has to outlive the table.
+    static std::unique_ptr<FragmentedSampleTable> Create(AP4_ByteStream& stream, const MP4VideoTrackBoxes& boxes);
+
+    [[nodiscard]] uint32_t Count() const override;
+    [[nodiscard]] uint64_t Offset(uint32_t sample) const override;
+    [[nodiscard]] uint32_t Size(uint32_t sample) const override;
+    [[nodiscard]] uint64_t Dts(uint32_t sample) const override;
+    [[nodiscard]] int32_t CtsOffset(uint32_t sample) const override;
+    [[nodiscard]] uint64_t Duration(uint32_t sample) const override;
+    [[nodiscard]] bool IsSync(uint32_t sample) const override;
+
+    // Reads further fragments until time is covered
+    [[nodiscard]] uint32_t FindSample(uint64_t time) const override;
+    [[nodiscard]] uint32_t FindSyncSample(uint32_t sample) const override;
+    [[nodiscard]] uint32_t SyncSampleCount() const override;
+
+    bool Extend() override;
+    [[nodiscard]] bool IsExtensible() const override;
+
+  private:
+    struct Fragment
+    {
+        // Start of the moof box
+        uint64_t offset;
+        uint32_t firstSample;
+        uint32_t sampleCount;
+        uint32_t syncCount;
+        uint64_t baseDts;
+        uint64_t endDts;
+    };
+
+    struct FragmentSamples
+    {
+        uint32_t fragment = UINT32_MAX;
+        uint64_t lastUse = 0;
+        std::vector<uint64_t> offsets;
+        std::vector<uint32_t> sizes;
+        std::vector<uint64_t> dts;
+        std::vector<uint32_t> durations;
+        std::vector<int32_t> ctsOffsets;
+        std::vector<uint8_t> sync;
+    };
+
+    FragmentedSampleTable(AP4_ByteStream& stream, const MP4VideoTrackBoxes& boxes);
+
+    bool ReadNextFragment() const;
+    // Parses the moof box at offset into samples, dts is used if it has no tfdt box
+    bool ParseFragment(uint64_t offset, const BoxHeader& moof, uint64_t dts, uint64_t& baseDts,
+                       FragmentSamples& samples) const;
+    // Decoded samples of the fragment holding sample, nullptr if it can't be read
+    const FragmentSamples* GetSamples(uint32_t sample, uint32_t& index) const;
+    FragmentSamples& PickSlot() const;
+    uint32_t FindFragment(uint32_t sample) const;
+
+  private:
+    AP4_ByteStream& m_stream;
+    uint32_t m_trackId;
+    uint32_t m_defaultDuration;
+    uint32_t m_defaultSize;
+    uint32_t m_defaultFlags;
+
+    // Extend reads fragments, and FindSample calls it, so those are mutable too
+    mutable std::vector<Fragment> m_fragments;
+    // Next top level box to look at for a fragment
+    mutable uint64_t m_scanOffset;
+    mutable std::array<FragmentSamples, 2> m_slots;
+    mutable uint64_t m_useCounter = 0;
+};
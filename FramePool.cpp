@@ -0,0 +1,131 @@
+#include "FramePool.h"
+
+#include <algorithm>
+#include <new>
+
+static size_t AlignUp(size_t value, size_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+FramePool::Handle::Handle(FramePool* pool, uint32_t slot) : m_pool(pool), m_slot(slot)
+{
+}
+
+FramePool::Handle::Handle(const Handle& other) : m_pool(other.m_pool), m_slot(other.m_slot)
+{
+    if (m_pool)
+        m_pool->m_slots[m_slot].refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+FramePool::Handle::Handle(Handle&& other) noexcept : m_pool(other.m_pool), m_slot(other.m_slot)
+{
+    other.m_pool = nullptr;
+}
+
+FramePool::Handle& FramePool::Handle::operator=(const Handle& other)
+{
+    if (this != &other)
+    {
+        Reset();
+        m_pool = other.m_pool;
+        m_slot = other.m_slot;
+        if (m_pool)
+            m_pool->m_slots[m_slot].refs.fetch_add(1, std::memory_order_relaxed);
+    }
+    return *this;
+}
+
+FramePool::Handle& FramePool::Handle::operator=(Handle&& other) noexcept
+{
+    if (this != &other)
+    {
+        Reset();
+        m_pool = other.m_pool;
+        m_slot = other.m_slot;
+        other.m_pool = nullptr;
+    }
+    return *this;
+}
+
+FramePool::Handle::~Handle()
+{
+    Reset();
+}
+
+uint8_t* FramePool::Handle::data() const
+{
+    return m_pool ? m_pool->m_slots[m_slot].data : nullptr;
+}
+
+size_t FramePool::Handle::size() const
+{
+    return m_pool ? m_pool->m_frameSize : 0;
+}
+
+FramePool::Handle::operator bool() const
+{
+    return m_pool != nullptr;
+}
+
+void FramePool::Handle::Reset()
+{
+    if (m_pool)
+        m_pool->Release(m_slot);
+    m_pool = nullptr;
+}
+
+FramePool::FramePool(size_t frameSize, unsigned frameCount, MemoryArena* arena)
+    : m_frameSize(frameSize),
+      m_buffer(MemoryArena::Allocate<uint8_t>(arena, AlignUp(frameSize, BUFFER_ALIGNMENT) * frameCount,
+                                               BUFFER_ALIGNMENT)),
+      m_slots(std::make_unique<Slot[]>(frameCount)), m_slotCount(frameCount)
+{
+    const auto stride = AlignUp(frameSize, BUFFER_ALIGNMENT);
+    if (!m_buffer && frameCount > 0)
+        throw std::bad_alloc();
+
+    m_freeSlots.reserve(frameCount);
+    // Reversed so the first buffers are handed out first
+    for (auto i = frameCount; i > 0; --i)
+    {
+        m_slots[i - 1].data = m_buffer.get() + (i - 1) * stride;
+        m_freeSlots.push_back(i - 1);
+    }
+}
+
+FramePool::Handle FramePool::Acquire()
+{
+    std::scoped_lock l{m_mutex};
+    if (m_freeSlots.empty())
+    {
+        m_exhausted++;
+        return {};
+    }
+    const auto slot = m_freeSlots.back();
+    m_freeSlots.pop_back();
+    m_slots[slot].refs.store(1, std::memory_order_relaxed);
+    m_acquired++;
+    m_peakInUse = std::max(m_peakInUse, m_slotCount - static_cast<unsigned>(m_freeSlots.size()));
+    return {this, slot};
+}
+
+size_t FramePool::GetFrameSize() const
+{
+    return m_frameSize;
+}
+
+FramePool::Stats FramePool::GetStats() const
+{
+    std::scoped_lock l{m_mutex};
+    return {m_slotCount, m_slotCount - static_cast<unsigned>(m_freeSlots.size()), m_peakInUse, m_acquired,
+            m_exhausted};
+}
+
+void FramePool::Release(uint32_t slot)
+{
+    if (m_slots[slot].refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+        return;
+    std::scoped_lock l{m_mutex};
+    m_freeSlots.push_back(slot);
+}
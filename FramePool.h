@@ -0,0 +1,85 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "MemoryArena.h"
+
+// Fixed number of equally sized frame buffers carved from one allocation.
+// Buffers are handed out as reference counted handles and return to the pool when the last handle is dropped,
+// so no memory is allocated after construction. Handles must not outlive the pool.
+class FramePool
+{
+    struct Slot
+    {
+        uint8_t* data = nullptr;
+        std::atomic_uint refs{0};
+    };
+
+  public:
+    class Handle
+    {
+      public:
+        Handle() = default;
+        Handle(const Handle& other);
+        Handle(Handle&& other) noexcept;
+        Handle& operator=(const Handle& other);
+        Handle& operator=(Handle&& other) noexcept;
+        ~Handle();
+
+        [[nodiscard]] uint8_t* data() const;
+        [[nodiscard]] size_t size() const;
+        explicit operator bool() const;
+
+        void Reset();
+
+      private:
+        friend class FramePool;
+        Handle(FramePool* pool, uint32_t slot);
+
+      private:
+        FramePool* m_pool = nullptr;
+        uint32_t m_slot = 0;
+    };
+
+    struct Stats
+    {
+        unsigned capacity;
+        unsigned inUse;
+        unsigned peakInUse;
+        uint64_t acquired;
+        // Acquire calls that found no free buffer
+        uint64_t exhausted;
+    };
+
+    static constexpr size_t BUFFER_ALIGNMENT = 0x100;
+
+    // Buffers come from the heap without an arena
+    FramePool(size_t frameSize, unsigned frameCount, MemoryArena* arena = nullptr);
+
+    FramePool(const FramePool&) = delete;
+    FramePool& operator=(const FramePool&) = delete;
+
+    // Returns an empty handle if every buffer is in use
+    Handle Acquire();
+
+    [[nodiscard]] size_t GetFrameSize() const;
+    [[nodiscard]] Stats GetStats() const;
+
+  private:
+    void Release(uint32_t slot);
+
+  private:
+    size_t m_frameSize;
+    MemoryArena::Pointer<uint8_t> m_buffer;
+    std::unique_ptr<Slot[]> m_slots;
+    unsigned m_slotCount;
+
+    mutable std::mutex m_mutex;
+    std::vector<uint32_t> m_freeSlots;
+    unsigned m_peakInUse = 0;
+    uint64_t m_acquired = 0;
+    uint64_t m_exhausted = 0;
+};
@@ -0,0 +1,110 @@
+#include "FrameSkipper.h"
+
+#include <algorithm>
+#include <limits>
+
+#include <whb/log.h>
+
+constexpr int64_t NO_CLOCK = std::numeric_limits<int64_t>::min();
+
+static int64_t ToMediaTime(std::chrono::milliseconds duration, uint32_t timescale)
+{
+    return duration.count() * timescale / 1000;
+}
+
+FrameSkipper::FrameSkipper(const Config& config, uint32_t timescale)
+    : m_enabled(config.enabled && timescale != 0), m_timescale(std::max<uint32_t>(timescale, 1)),
+      m_nonReferenceLag(ToMediaTime(config.nonReferenceLag, m_timescale)),
+      m_syncLag(std::max(ToMediaTime(config.syncLag, m_timescale), m_nonReferenceLag)), m_clockTime(NO_CLOCK)
+{
+}
+
+void FrameSkipper::SetClockTime(std::optional<int64_t> time)
+{
+    m_clockTime = time.value_or(NO_CLOCK);
+}
+
+void FrameSkipper::Reset()
+{
+    m_clockTime = NO_CLOCK;
+    m_mode = Mode::DecodeAll;
+}
+
+bool FrameSkipper::ShouldDecode(int64_t timestamp, bool reference, bool sync)
+{
+    const int64_t clockTime = m_clockTime;
+    if (!m_enabled || clockTime == NO_CLOCK)
+    {
+        m_decoded++;
+        return true;
+    }
+
+    const int64_t lag = clockTime - timestamp;
+    switch (m_mode.load())
+    {
+    case Mode::DecodeAll:
+        if (lag > m_nonReferenceLag)
+            SetMode(Mode::SkipNonReference, lag);
+        break;
+    case Mode::SkipNonReference:
+        // dropping non-reference pictures wasn't enough
+        if (lag > m_syncLag)
+            SetMode(Mode::SkipToSync, lag);
+        // only once fully caught up, so it doesn't flip back and forth at the threshold
+        else if (lag <= 0)
+            SetMode(Mode::DecodeAll, lag);
+        break;
+    case Mode::SkipToSync:
+        if (sync)
+            SetMode(lag > m_nonReferenceLag ? Mode::SkipNonReference : Mode::DecodeAll, lag);
+        break;
+    }
+
+    switch (m_mode.load())
+    {
+    case Mode::SkipToSync:
+        m_droppedToSync++;
+        return false;
+    case Mode::SkipNonReference:
+        if (!reference)
+        {
+            m_droppedNonReference++;
+            return false;
+        }
+        break;
+    case Mode::DecodeAll:
+        break;
+    }
+    m_decoded++;
+    return true;
+}
+
+FrameSkipper::Mode FrameSkipper::GetMode() const
+{
+    return m_mode;
+}
+
+FrameSkipper::Stats FrameSkipper::GetStats() const
+{
+    return {m_decoded, m_droppedNonReference, m_droppedToSync, m_nonReferenceSkips, m_syncSkips, m_recoveries};
+}
+
+void FrameSkipper::SetMode(Mode mode, int64_t lag)
+{
+    switch (mode)
+    {
+    case Mode::DecodeAll:
+        m_recoveries++;
+        break;
+    case Mode::SkipNonReference:
+        m_nonReferenceSkips++;
+        break;
+    case Mode::SkipToSync:
+        // the only one that visibly freezes the picture
+        m_syncSkips++;
+        WHBLogPrintf("Decoder %lld ms behind, skipping to the next sync frame",
+                     static_cast<long long>(lag * 1000 / m_timescale));
+        break;
+    }
+    m_mode = mode;
+}
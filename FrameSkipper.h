@@ -0,0 +1,73 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+
+// Decides before decoding whether an access unit is still worth decoding once playback has fallen behind the
+// presentation clock. Past config.nonReferenceLag non-reference pictures are dropped, nothing refers to them. If the
+// lag keeps growing past config.syncLag everything up to the next sync picture is dropped too, which catches up in one
+// step at the cost of a freeze. Lag is measured from a frame's timestamp to the clock when it is about to be decoded.
+// ShouldDecode runs on the decoder thread, the clock is set from the presenting thread.
+class FrameSkipper
+{
+  public:
+    enum class Mode
+    {
+        DecodeAll,
+        SkipNonReference,
+        SkipToSync,
+    };
+
+    struct Config
+    {
+        bool enabled = true;
+        std::chrono::milliseconds nonReferenceLag{80};
+        std::chrono::milliseconds syncLag{400};
+    };
+
+    struct Stats
+    {
+        uint64_t decoded;
+        uint64_t droppedNonReference;
+        uint64_t droppedToSync;
+        // Mode changes
+        uint64_t nonReferenceSkips;
+        uint64_t syncSkips;
+        uint64_t recoveries;
+    };
+
+    // timescale is the one of the timestamps and the clock, 0 turns skipping off
+    FrameSkipper(const Config& config, uint32_t timescale);
+
+    // Media time of the presentation clock, std::nullopt while it is stopped. Nothing is dropped without a clock.
+    void SetClockTime(std::optional<int64_t> time);
+    // Forgets the clock and decodes everything again, for seeks
+    void Reset();
+
+    // False if the access unit is to be dropped instead of decoded
+    bool ShouldDecode(int64_t timestamp, bool reference, bool sync);
+
+    [[nodiscard]] Mode GetMode() const;
+    [[nodiscard]] Stats GetStats() const;
+
+  private:
+    void SetMode(Mode mode, int64_t lag);
+
+  private:
+    bool m_enabled;
+    uint32_t m_timescale;
+    // In timescale units
+    int64_t m_nonReferenceLag;
+    int64_t m_syncLag;
+
+    std::atomic<int64_t> m_clockTime;
+    std::atomic<Mode> m_mode{Mode::DecodeAll};
+
+    std::atomic<uint64_t> m_decoded{0};
+    std::atomic<uint64_t> m_droppedNonReference{0};
+    std::atomic<uint64_t> m_droppedToSync{0};
+    std::atomic<uint64_t> m_nonReferenceSkips{0};
+    std::atomic<uint64_t> m_syncSkips{0};
+    std::atomic<uint64_t> m_recoveries{0};
+};
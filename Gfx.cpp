@@ -1,15 +1,22 @@
 #include "Gfx.h"
+#include "Thread.h"
+#include "Trace.h"
 
 #include <nv12torgb_gsh.h>
 
+#include <atomic>
+#include <cstring>
+
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
 #include <gx2/draw.h>
+#include <gx2/event.h>
 #include <gx2/mem.h>
 #include <gx2/surface.h>
 #include <gx2/utils.h>
 
+#include <proc_ui/procui.h>
 #include <whb/gfx.h>
 #include <whb/log.h>
 
@@ -32,6 +39,19 @@ constexpr static glm::vec2 TEX_COORDS[4]{{0.0, 1.0}, {1.0, 1.0}, {1.0, 0.0}, {0.
 
 constexpr static glm::vec2 VTX_COORDS[4]{{-1.0, -1.0}, {+1.0, -1.0}, {+1.0, +1.0}, {-1.0, +1.0}};
 
+// In the order of Gfx::m_scalers and Slot::scaled
+constexpr Gfx::DrawTargets TARGETS[]{Gfx::DrawTargets::TV, Gfx::DrawTargets::DRC};
+constexpr const char* TARGET_NAMES[]{"TV", "DRC"};
+
+// The colour buffers are lost while in the background, so the next Draw has to render again
+static std::atomic_bool g_foregroundAcquired{false};
+
+static uint32_t OnForegroundAcquired(void*)
+{
+    g_foregroundAcquired = true;
+    return 0;
+}
+
 void CommonTexInit(GX2Texture& tex)
 {
     tex.viewNumMips = 1;
@@ -44,7 +64,7 @@ void CommonTexInit(GX2Texture& tex)
     tex.surface.depth = 1;
 }
 
-Gfx::Gfx()
+Gfx::Gfx(MemoryArena* arena, unsigned textureSets) : m_arena(arena), m_ring(textureSets)
 {
     if (!WHBGfxLoadGFDShaderGroup(&m_shaderGroup, 0, nv12torgb_gsh))
     {
@@ -62,58 +82,139 @@ Gfx::Gfx()
     GX2InitSampler(&m_uvSampler, GX2_TEX_CLAMP_MODE_CLAMP_BORDER, GX2_TEX_XY_FILTER_MODE_POINT);
     GX2InitSamplerBorderType(&m_uvSampler, GX2_TEX_BORDER_TYPE_BLACK);
 
-    CommonTexInit(m_yTexture);
-    CommonTexInit(m_uvTexture);
-
-    // Y -> R
-    m_yTexture.compMap = GX2_COMP_MAP(GX2_SQ_SEL_R, GX2_SQ_SEL_0, GX2_SQ_SEL_0, GX2_SQ_SEL_1);
-    m_yTexture.surface.format = GX2_SURFACE_FORMAT_UNORM_R8;
-    // U -> R, V -> G
-    m_uvTexture.compMap = GX2_COMP_MAP(GX2_SQ_SEL_R, GX2_SQ_SEL_G, GX2_SQ_SEL_0, GX2_SQ_SEL_1);
-    m_uvTexture.surface.format = GX2_SURFACE_FORMAT_UNORM_R8_G8;
-
     WHBGfxInitShaderAttribute(&m_shaderGroup, "inPosCoord", 0, 0, GX2_ATTRIB_FORMAT_FLOAT_32_32_32_32);
     WHBGfxInitShaderAttribute(&m_shaderGroup, "inTexCoord", 1, 0, GX2_ATTRIB_FORMAT_FLOAT_32_32_32_32);
 
     WHBGfxInitFetchShader(&m_shaderGroup);
+
+    ProcUIRegisterCallback(PROCUI_CALLBACK_ACQUIRE, OnForegroundAcquired, nullptr, 100);
+    m_slots.resize(m_ring.GetSlotCount());
+    m_uploadThread = std::thread([this] { this->UploadLoop(); });
 }
 Gfx::~Gfx()
 {
-    if (m_yTexture.surface.image)
-        std::free(m_yTexture.surface.image);
-    if (m_uvTexture.surface.image)
-        std::free(m_uvTexture.surface.image);
+    m_uploadJobs.Close();
+    m_uploadThread.join();
     WHBGfxFreeShaderGroup(&m_shaderGroup);
 }
 
-void Gfx::SetFrameDimensions(unsigned width, unsigned height)
+void Gfx::AllocateTextures(TextureSet& textures, unsigned width, unsigned height)
 {
-    m_yTexture.surface.width = width;
-    m_yTexture.surface.height = height;
-    m_uvTexture.surface.width = width / 2;
-    m_uvTexture.surface.height = height / 2;
+    CommonTexInit(textures.y);
+    CommonTexInit(textures.uv);
 
-    GX2CalcSurfaceSizeAndAlignment(&m_yTexture.surface);
-    GX2InitTextureRegs(&m_yTexture);
+    // Y -> R
+    textures.y.compMap = GX2_COMP_MAP(GX2_SQ_SEL_R, GX2_SQ_SEL_0, GX2_SQ_SEL_0, GX2_SQ_SEL_1);
+    textures.y.surface.format = GX2_SURFACE_FORMAT_UNORM_R8;
+    // U -> R, V -> G
+    textures.uv.compMap = GX2_COMP_MAP(GX2_SQ_SEL_R, GX2_SQ_SEL_G, GX2_SQ_SEL_0, GX2_SQ_SEL_1);
+    textures.uv.surface.format = GX2_SURFACE_FORMAT_UNORM_R8_G8;
+
+    textures.y.surface.width = width;
+    textures.y.surface.height = height;
+    textures.uv.surface.width = width / 2;
+    textures.uv.surface.height = height / 2;
+
+    GX2CalcSurfaceSizeAndAlignment(&textures.y.surface);
+    GX2InitTextureRegs(&textures.y);
+
+    GX2CalcSurfaceSizeAndAlignment(&textures.uv.surface);
+    GX2InitTextureRegs(&textures.uv);
+
+    textures.yImage = MemoryArena::Allocate<void>(m_arena, textures.y.surface.imageSize, textures.y.surface.alignment);
+    textures.uvImage =
+        MemoryArena::Allocate<void>(m_arena, textures.uv.surface.imageSize, textures.uv.surface.alignment);
+    textures.y.surface.image = textures.yImage.get();
+    textures.uv.surface.image = textures.uvImage.get();
+    if (!textures.yImage || !textures.uvImage)
+    {
+        throw GfxException("Failed to allocate texture surfaces");
+    }
+}
+
+// Size of each target's colour buffer, in the order of TARGETS
+static std::array<std::pair<unsigned, unsigned>, 2> TargetSizes()
+{
+    const GX2ColorBuffer* tv = WHBGfxGetTVColourBuffer();
+    const GX2ColorBuffer* drc = WHBGfxGetDRCColourBuffer();
+    return {{{tv->surface.width, tv->surface.height}, {drc->surface.width, drc->surface.height}}};
+}
 
-    GX2CalcSurfaceSizeAndAlignment(&m_uvTexture.surface);
-    GX2InitTextureRegs(&m_uvTexture);
+void Gfx::AllocateSlots()
+{
+    // Freed first, so a new size reuses the same space in the arena
+    m_ring.Reset();
+    for (auto& slot : m_slots)
+        slot = {};
+    m_redraw = true;
+    if (m_width == 0)
+        return;
+
+    const auto sizes = TargetSizes();
+    for (size_t i = 0; i < m_scalers.size(); ++i)
+    {
+        m_scalers[i].reset();
+        const bool scaled = (m_targets & m_scaledTargets & TARGETS[i]) != DrawTargets::None;
+        const auto [targetWidth, targetHeight] = sizes[i];
+        // Targets at least as big as the frames draw them as they are
+        if (!scaled || (targetWidth >= m_width && targetHeight >= m_height))
+            continue;
+        m_scalers[i].emplace(m_width, m_height, targetWidth, targetHeight);
+        WHBLogPrintf("Scaling %u x %u to %u x %u for the %s", m_width, m_height, m_scalers[i]->GetWidth(),
+                     m_scalers[i]->GetHeight(), TARGET_NAMES[i]);
+    }
+
+    for (auto& slot : m_slots)
+    {
+        if (UsesFullTextures())
+            AllocateTextures(slot.full, m_width, m_height);
+        for (size_t i = 0; i < m_scalers.size(); ++i)
+        {
+            if (m_scalers[i])
+                AllocateTextures(slot.scaled[i], m_scalers[i]->GetWidth(), m_scalers[i]->GetHeight());
+        }
+    }
+}
 
-    if (m_yTexture.surface.image)
-        std::free(m_yTexture.surface.image);
-    if (m_uvTexture.surface.image)
-        std::free(m_uvTexture.surface.image);
+void Gfx::SetFrameDimensions(unsigned width, unsigned height, unsigned cropLeft, unsigned cropTop)
+{
+    // Playlist items of the same size keep their textures
+    if (m_width == width && m_height == height && m_cropLeft == (cropLeft & ~1u) && m_cropTop == (cropTop & ~1u))
+        return;
+
+    std::scoped_lock l{m_uploadMutex};
+    m_generation++;
+    m_width = width;
+    m_height = height;
+    m_cropLeft = cropLeft & ~1u;
+    m_cropTop = cropTop & ~1u;
+    AllocateSlots();
+}
 
-    m_yTexture.surface.image = std::aligned_alloc(m_yTexture.surface.alignment, m_yTexture.surface.imageSize);
-    m_uvTexture.surface.image = std::aligned_alloc(m_uvTexture.surface.alignment, m_uvTexture.surface.imageSize);
+bool Gfx::UsesFullTextures() const
+{
+    for (size_t i = 0; i < m_scalers.size(); ++i)
+    {
+        if ((m_targets & TARGETS[i]) != DrawTargets::None && !m_scalers[i])
+            return true;
+    }
+    return false;
 }
 
 template <size_t PixelWidth>
 void CopyToSurface(GX2Surface& targetSurface, const uint8_t* sourceData, uint32_t sourcePixelPitch)
 {
+    TRACE_SCOPE("CopyToSurface");
     const auto surfaceImage = static_cast<uint8_t*>(targetSurface.image);
     const auto surfacePitch = targetSurface.pitch == 0 ? targetSurface.width : targetSurface.pitch;
 
+    // Rows line up, so it's one copy from the start of the first to the end of the last
+    if (surfacePitch == sourcePixelPitch)
+    {
+        std::memcpy(surfaceImage, sourceData,
+                    ((targetSurface.height - 1) * surfacePitch + targetSurface.width) * PixelWidth);
+        return;
+    }
     for (auto line = 0u; line < targetSurface.height; ++line)
     {
         std::memcpy(surfaceImage + line * surfacePitch * PixelWidth, sourceData + line * sourcePixelPitch * PixelWidth,
@@ -121,50 +222,113 @@ void CopyToSurface(GX2Surface& targetSurface, const uint8_t* sourceData, uint32_
     }
 }
 
-bool Gfx::SetFrameBuffer(const H264Decoder::OutputFrameInfo& frameInfo)
+void Gfx::Upload(const H264Decoder::OutputFrameInfo& frame, Slot& slot)
 {
-    CopyToSurface<1>(m_yTexture.surface, frameInfo.buffer.data(), frameInfo.pitch);
-    GX2Invalidate(GX2_INVALIDATE_MODE_CPU_TEXTURE, m_yTexture.surface.image, m_yTexture.surface.imageSize);
-    CopyToSurface<2>(m_uvTexture.surface, frameInfo.buffer.data() + frameInfo.height * frameInfo.pitch,
-                     frameInfo.pitch / 2);
-    GX2Invalidate(GX2_INVALIDATE_MODE_CPU_TEXTURE, m_uvTexture.surface.image, m_uvTexture.surface.imageSize);
+    if (slot.full.y.surface.image)
+    {
+        const uint8_t* luma = frame.buffer.data() + m_cropTop * frame.pitch + m_cropLeft;
+        CopyToSurface<1>(slot.full.y.surface, luma, frame.pitch);
+        GX2Invalidate(GX2_INVALIDATE_MODE_CPU_TEXTURE, slot.full.y.surface.image, slot.full.y.surface.imageSize);
+        // interleaved UV, so the chroma of m_cropLeft pixels is m_cropLeft bytes in as well
+        const uint8_t* chroma = frame.buffer.data() + (frame.height + m_cropTop / 2) * frame.pitch + m_cropLeft;
+        CopyToSurface<2>(slot.full.uv.surface, chroma, frame.pitch / 2);
+        GX2Invalidate(GX2_INVALIDATE_MODE_CPU_TEXTURE, slot.full.uv.surface.image, slot.full.uv.surface.imageSize);
+    }
 
-    return true;
+    const NV12Image image = CropFrame(frame, m_width, m_height, m_cropLeft, m_cropTop);
+    for (size_t i = 0; i < m_scalers.size(); ++i)
+    {
+        if (!m_scalers[i])
+            continue;
+        TRACE_SCOPE("Downscale");
+        auto& y = slot.scaled[i].y.surface;
+        auto& uv = slot.scaled[i].uv.surface;
+        // surface pitches are in pixels
+        const size_t yPitch = y.pitch == 0 ? y.width : y.pitch;
+        const size_t uvPitch = (uv.pitch == 0 ? uv.width : uv.pitch) * 2;
+        m_scalers[i]->Scale(image, static_cast<uint8_t*>(y.image), yPitch, static_cast<uint8_t*>(uv.image), uvPitch);
+        GX2Invalidate(GX2_INVALIDATE_MODE_CPU_TEXTURE, y.image, y.imageSize);
+        GX2Invalidate(GX2_INVALIDATE_MODE_CPU_TEXTURE, uv.image, uv.imageSize);
+    }
 }
 
-void Gfx::SetVideoDrawTargets(DrawTargets targets)
+void Gfx::UploadLoop()
 {
+    SetCurrentThreadName("Gfx upload");
+    // Sleeps in Pop between frames, the queue is only closed by the destructor
+    while (auto job = m_uploadJobs.Pop())
+    {
+        std::scoped_lock l{m_uploadMutex};
+        if (job->generation != m_generation)
+            continue;
+        const unsigned slot = m_ring.BeginUpload();
+        Upload(job->frame, m_slots[slot]);
+        m_ring.FinishUpload(slot);
+    }
+}
+
+bool Gfx::SetFrameBuffer(const H264Decoder::OutputFrameInfo& frameInfo)
+{
+    UploadJob job{frameInfo, m_generation};
+    if (m_uploadJobs.TryPush(job))
+        return true;
+    // The upload thread is still on the frame before, scaling it takes a few ms. The one waiting behind it is a vsync
+    // late already and makes way for this one, so the presenter doesn't wait for the upload.
+    m_uploadJobs.TryPop();
+    return m_uploadJobs.Push(std::move(job));
+}
+
+void Gfx::SetVideoDrawTargets(DrawTargets targets, DrawTargets scaledTargets)
+{
+    std::scoped_lock l{m_uploadMutex};
+    m_generation++;
     m_targets = targets;
+    m_scaledTargets = scaledTargets;
+    AllocateSlots();
 }
 
 void Gfx::Draw()
 {
+    TRACE_SCOPE("Gfx::Draw");
+    const bool acquired = g_foregroundAcquired.exchange(false);
+    const bool newFrame = m_ring.TakeReady().has_value();
+    if (!newFrame && !m_redraw && !acquired)
+    {
+        GX2WaitForVsync();
+        return;
+    }
+    m_redraw = false;
+
+    const auto drawn = m_ring.GetDrawn();
+    const Slot* slot = drawn ? &m_slots[*drawn] : nullptr;
     WHBGfxBeginRender();
     if ((m_targets & DrawTargets::TV) != DrawTargets::None)
     {
         WHBGfxBeginRenderTV();
-        DrawInternal();
+        DrawInternal(slot ? (m_scalers[0] ? &slot->scaled[0] : &slot->full) : nullptr);
         WHBGfxFinishRenderTV();
     }
     if ((m_targets & DrawTargets::DRC) != DrawTargets::None)
     {
         WHBGfxBeginRenderDRC();
-        DrawInternal();
+        DrawInternal(slot ? (m_scalers[1] ? &slot->scaled[1] : &slot->full) : nullptr);
         WHBGfxFinishRenderDRC();
     }
     WHBGfxFinishRender();
 }
 
-void Gfx::DrawInternal()
+void Gfx::DrawInternal(const TextureSet* textures)
 {
     WHBGfxClearColor(0.3, 0.3, 0.3, 1.0);
+    if (!textures)
+        return;
 
     GX2SetFetchShader(&m_shaderGroup.fetchShader);
     GX2SetVertexShader(m_shaderGroup.vertexShader);
     GX2SetPixelShader(m_shaderGroup.pixelShader);
 
-    GX2SetPixelTexture(&m_yTexture, m_shaderGroup.pixelShader->samplerVars[0].location);
-    GX2SetPixelTexture(&m_uvTexture, m_shaderGroup.pixelShader->samplerVars[1].location);
+    GX2SetPixelTexture(&textures->y, m_shaderGroup.pixelShader->samplerVars[0].location);
+    GX2SetPixelTexture(&textures->uv, m_shaderGroup.pixelShader->samplerVars[1].location);
 
     GX2SetPixelSampler(&m_ySampler, m_shaderGroup.pixelShader->samplerVars[0].location);
     GX2SetPixelSampler(&m_uvSampler, m_shaderGroup.pixelShader->samplerVars[1].location);
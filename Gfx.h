@@ -1,11 +1,20 @@
 #pragma once
+#include <array>
 #include <exception>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <whb/gfx.h>
 
+#include "BoundedQueue.h"
+#include "Downscaler.h"
 #include "H264.h"
+#include "MemoryArena.h"
+#include "UploadRing.h"
 
 class GfxException : public std::exception
 {
@@ -29,30 +38,91 @@ class Gfx
         DRC = 1 << 1
     };
 
-    // WHBGfxInit and GLSL_Init have to be run before this
-    explicit Gfx();
+    // Frames kept after SetFrameBuffer returned: the one waiting for the upload thread and the one being uploaded
+    static constexpr unsigned HELD_FRAMES = 2;
+
+    // WHBGfxInit and GLSL_Init have to be run before this. Texture surfaces are carved from arena if there is one,
+    // frames are uploaded into textureSets of them in turn, 2 to UploadRing::MAX_SLOTS.
+    explicit Gfx(MemoryArena* arena = nullptr, unsigned textureSets = UploadRing::MAX_SLOTS);
     ~Gfx();
 
-    void SetFrameDimensions(unsigned width, unsigned height);
+    // Size of the shown part of the decoded frames, and its top left corner in them
+    void SetFrameDimensions(unsigned width, unsigned height, unsigned cropLeft = 0, unsigned cropTop = 0);
 
-    // NV 12 format frame
+    // NV 12 format frame. Uploaded on the upload thread into a texture set that isn't drawn, the current frame stays
+    // on screen until Draw finds it finished. Doesn't wait for the upload thread, a frame it hasn't started on yet is
+    // replaced. Returns false if the upload thread stopped.
     bool SetFrameBuffer(const H264Decoder::OutputFrameInfo& frameInfo);
 
-    // Bitmask
-    void SetVideoDrawTargets(DrawTargets targets);
+    // Bitmasks. Targets in scaledTargets smaller than the frames draw from a copy shrunk to their size on the upload
+    // thread, which filters better and reads less texture memory than sampling the full size one.
+    void SetVideoDrawTargets(DrawTargets targets, DrawTargets scaledTargets = DrawTargets::None);
 
+    // Once per vsync. Only renders if a frame finished uploading or something else changed since the last time, the
+    // scan buffers keep showing the last frame otherwise.
     void Draw();
 
   private:
-    void DrawInternal();
+    // Y and UV textures of one size
+    struct TextureSet
+    {
+        GX2Texture y{};
+        GX2Texture uv{};
+        // Back the surface images
+        MemoryArena::Pointer<void> yImage;
+        MemoryArena::Pointer<void> uvImage;
+    };
+
+    // Everything a frame is uploaded into
+    struct Slot
+    {
+        // Left empty while every target draws a scaled copy
+        TextureSet full;
+        // TV and DRC, empty for targets drawing the full size textures
+        std::array<TextureSet, 2> scaled;
+    };
+
+    struct UploadJob
+    {
+        H264Decoder::OutputFrameInfo frame;
+        // Frames queued before the textures were reallocated are dropped
+        unsigned generation;
+    };
+
+    void AllocateTextures(TextureSet& textures, unsigned width, unsigned height);
+    // For the current frame size and targets, from scratch
+    void AllocateSlots();
+    [[nodiscard]] bool UsesFullTextures() const;
+    void Upload(const H264Decoder::OutputFrameInfo& frame, Slot& slot);
+    void UploadLoop();
+    // Only clears without textures
+    void DrawInternal(const TextureSet* textures);
 
   private:
-    GX2Texture m_yTexture{};
-    GX2Texture m_uvTexture{};
+    MemoryArena* m_arena;
+    std::vector<Slot> m_slots;
+    UploadRing m_ring;
+    // TV and DRC, none for targets drawing the full size textures
+    std::array<std::optional<NV12Downscaler>, 2> m_scalers;
     GX2Sampler m_ySampler{};
     GX2Sampler m_uvSampler{};
     WHBGfxShaderGroup m_shaderGroup{};
     DrawTargets m_targets{};
+    DrawTargets m_scaledTargets{};
+    // Of the shown part, 0 until SetFrameDimensions
+    unsigned m_width = 0;
+    unsigned m_height = 0;
+    // Even, chroma is subsampled in both directions
+    unsigned m_cropLeft = 0;
+    unsigned m_cropTop = 0;
+    // Draw renders even without a new frame, the textures or targets changed
+    bool m_redraw = true;
+
+    // Held by the upload thread while it uploads, and by whatever changes what it reads
+    std::mutex m_uploadMutex;
+    unsigned m_generation = 0;
+    BoundedQueue<UploadJob> m_uploadJobs{1};
+    std::thread m_uploadThread;
 };
 
 WUT_ENUM_BITMASK_TYPE(Gfx::DrawTargets);
@@ -1,20 +1,55 @@
 #include "H264.h"
+#include "ParameterSets.h"
+#include "Trace.h"
 
+#include <cmath>
+#include <cstring>
 #include <format>
 #include <mutex>
 #include <utility>
 
 #include <whb/log.h>
 
-void* H264Alloc(uint32_t size)
+// The decoder's output pitch is aligned to 256 bytes
+constexpr unsigned OUTPUT_PITCH_ALIGNMENT = 0x100;
+
+static unsigned AlignUp(unsigned value, unsigned alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+// NV12 frame as written by the decoder
+static size_t OutputFrameSize(unsigned width, unsigned height)
+{
+    return AlignUp(width, OUTPUT_PITCH_ALIGNMENT) * AlignUp(height, MACROBLOCK_SIZE) * 3 / 2;
+}
+
+// Memory the decoder needs, sized for the lowest level that holds the stream's frames if fitLevel is set
+static uint32_t MemoryRequirement(H264Profile profile, unsigned level, unsigned width, unsigned height,
+                                  unsigned dpbFrames, bool fitLevel)
 {
-    while (true)
+    uint32_t h264MemReq;
+    H264Error h264Error = H264_ERROR_GENERIC;
+    const unsigned fittedLevel =
+        fitLevel && dpbFrames != 0 ? LowestLevelFor(width / MACROBLOCK_SIZE, height / MACROBLOCK_SIZE, dpbFrames) : 0;
+    unsigned chosenLevel = level;
+    if (fittedLevel != 0 && fittedLevel < level)
+    {
+        h264Error = H264DECMemoryRequirement(profile, fittedLevel, width, height, &h264MemReq);
+        if (!h264Error)
+            chosenLevel = fittedLevel;
+    }
+    // the stream's own level if fitting didn't apply or the decoder rejected the fitted one
+    if (h264Error)
+        h264Error = H264DECMemoryRequirement(profile, level, width, height, &h264MemReq);
+    if (h264Error)
     {
-        auto* ptr = std::aligned_alloc(0x100, size);
-        if (H264DECCheckMemSegmentation(ptr, size) == H264_ERROR_OK)
-            return ptr;
-        free(ptr);
+        throw H264DecoderException("Failed to get memory requirement", h264Error);
     }
+    WHBLogPrintf("Decoder sized for level %u, stream level %u, %u frame DPB", chosenLevel, level, dpbFrames);
+    WHBLogPrintf("Decoder memory %u KiB, frame buffer %u KiB", h264MemReq / 1024,
+                 static_cast<unsigned>(OutputFrameSize(width, height) / 1024));
+    return h264MemReq;
 }
 
 H264DecoderException::H264DecoderException(std::string_view str) : m_content(str)
@@ -40,19 +75,34 @@ int32_t H264Decoder::GetStartPoint(std::span<const uint8_t> buffer)
     return decStartOffset;
 }
 
-H264Decoder::H264Decoder(H264Profile profile, unsigned level, unsigned width, unsigned height)
-    : m_frameBuffer(static_cast<uint8_t*>(H264Alloc(width * height * 3)), std::free), m_context(nullptr, nullptr),
-      m_messageBuffer(80)
+bool H264Decoder::CheckMemory(const void* data, size_t size)
 {
-    uint32_t h264MemReq;
-    auto h264Error = H264DECMemoryRequirement(profile, level, width, height, &h264MemReq);
-    if (h264Error)
+    return H264DECCheckMemSegmentation(const_cast<void*>(data), size) == H264_ERROR_OK;
+}
+
+H264Decoder::H264Decoder(H264Profile profile, unsigned level, unsigned width, unsigned height, unsigned dpbFrames,
+                         const Config& config)
+    : m_memoryRequirement(MemoryRequirement(profile, level, width, height, dpbFrames, config.fitLevelToStream)),
+      m_ownArena(config.arena ? nullptr
+                              : std::make_unique<MemoryArena>(
+                                    AlignUp(m_memoryRequirement, MemoryArena::DEFAULT_ALIGNMENT) +
+                                        AlignUp(OutputFrameSize(width, height), MemoryArena::DEFAULT_ALIGNMENT),
+                                    CheckMemory)),
+      m_arena(config.arena ? config.arena : m_ownArena.get()),
+      m_frameBuffer(MemoryArena::Allocate<uint8_t>(m_arena, OutputFrameSize(width, height))),
+      m_context(MemoryArena::Allocate<void>(m_arena, m_memoryRequirement)), m_framesIn(config.inputQueueDepth),
+      m_releasedBuffers(config.inputQueueDepth + 1),
+      m_framesOut(OutputFrameSize(width, height),
+                  OutputQueue::DepthForBudget(config.outputBudget, OutputFrameSize(width, height)),
+                  config.consumerHeldFrames, config.outputPolicy, config.arena),
+      m_skipper(config.skip, config.timescale), m_core(config.core), m_restampDuration(config.restampDuration)
+{
+    if (!m_frameBuffer || !m_context)
     {
-        throw H264DecoderException("Failed to get memory requirement", h264Error);
+        throw H264DecoderException("Decoder memory doesn't fit the arena");
     }
-    m_context = CtxPointer(H264Alloc(h264MemReq), std::free);
 
-    h264Error = H264DECInitParam(h264MemReq, m_context.get());
+    H264Error h264Error = H264DECInitParam(m_memoryRequirement, m_context.get());
     if (h264Error)
     {
         throw H264DecoderException("Failed to init decoder", h264Error);
@@ -74,75 +124,269 @@ H264Decoder::H264Decoder(H264Profile profile, unsigned level, unsigned width, un
     {
         throw H264DecoderException("Failed to open session", h264Error);
     }
-    m_running = true;
-
-    OSInitMessageQueueEx(&m_frameOutQueue, m_messageBuffer.data(), m_messageBuffer.size(), "decoderOutputQueue");
     m_thread = std::thread([this] { this->DecoderLoop(); });
 }
 
 H264Decoder::~H264Decoder()
 {
-    m_running = false;
+    Interrupt();
     m_thread.join();
 }
 
-void H264Decoder::SubmitFrame(std::span<const uint8_t> data, double timestamp)
+void H264Decoder::SubmitFrame(std::span<const uint8_t> data, int64_t timestamp, bool reference, bool sync)
+{
+    TRACE_SCOPE("SubmitFrame");
+    m_submittedFrames++;
+    m_framesIn.Push({data, {}, timestamp, reference, sync, m_framesOut.GetEpoch()});
+}
+
+bool H264Decoder::TrySubmitFrame(std::span<const uint8_t> data, int64_t timestamp, bool reference, bool sync)
 {
-    std::scoped_lock l{m_mutexIn};
-    m_framesIn.emplace_back(data, timestamp);
+    TRACE_SCOPE("SubmitFrame");
+    m_submittedFrames++;
+    if (m_framesIn.TryPush({data, {}, timestamp, reference, sync, m_framesOut.GetEpoch()}))
+        return true;
+    m_submittedFrames--;
+    return false;
+}
+
+void H264Decoder::SubmitFrame(std::vector<uint8_t>&& data, int64_t timestamp, bool reference, bool sync)
+{
+    TRACE_SCOPE("SubmitFrame");
+    InputFrameInfo frame{{}, std::move(data), timestamp, reference, sync, m_framesOut.GetEpoch()};
+    // Moving the vector keeps its storage, so the span stays valid
+    frame.buffer = frame.owned;
+    m_submittedFrames++;
+    m_framesIn.Push(std::move(frame));
+}
+
+void H264Decoder::SubmitEndOfStream()
+{
+    m_submittedFrames++;
+    m_framesIn.Push({{}, {}, 0, false, false, m_framesOut.GetEpoch(), true});
+}
+
+std::optional<std::vector<uint8_t>> H264Decoder::TakeReleasedBuffer()
+{
+    return m_releasedBuffers.TryPop();
+}
+
+void H264Decoder::Interrupt()
+{
+    m_framesIn.Close();
+    m_framesOut.Close();
+}
+
+bool H264Decoder::CanSubmitFrame() const
+{
+    return m_framesIn.Size() < m_framesIn.Capacity();
+}
+
+bool H264Decoder::IsIdle() const
+{
+    return m_finishedFrames == m_submittedFrames;
 }
 
 std::optional<H264Decoder::OutputFrameInfo> H264Decoder::GetDecodedFrame()
 {
-    OSMessage message;
-    if (!OSReceiveMessage(&m_frameOutQueue, &message, OS_MESSAGE_FLAGS_NONE))
-    {
-        return std::nullopt;
-    }
-    auto* out = static_cast<OutputFrameInfo*>(message.message);
-    auto ret = std::make_optional(std::move(*out));
-    delete out;
-    return ret;
+    return m_framesOut.TryPop();
+}
+
+void H264Decoder::SetOutputPolicy(OutputQueue::Policy policy)
+{
+    m_framesOut.SetPolicy(policy);
+}
+
+void H264Decoder::SetClockTime(std::optional<int64_t> time)
+{
+    m_skipper.SetClockTime(time);
+}
+
+FrameSkipper::Stats H264Decoder::GetSkipStats() const
+{
+    return m_skipper.GetStats();
+}
+
+OutputQueue::Stats H264Decoder::GetOutputStats() const
+{
+    return m_framesOut.GetStats();
+}
+
+FramePool::Stats H264Decoder::GetFramePoolStats() const
+{
+    return m_framesOut.GetPoolStats();
+}
+
+StageStats::Snapshot H264Decoder::GetStageStats() const
+{
+    return m_stageStats.Get();
+}
+
+void H264Decoder::BeginSeek(int64_t targetTimestamp)
+{
+    m_finishedFrames += m_framesIn.Clear();
+    m_seekStart = std::chrono::steady_clock::now();
+    m_seekSkippedFrames = 0;
+    m_presentFrom = targetTimestamp;
+    m_seeking = true;
+    m_skipper.Reset();
+    // Starts a new epoch, so the pictures the decoder still holds from before the seek are flushed instead of output
+    m_framesOut.Clear();
+}
+
+std::chrono::microseconds H264Decoder::GetLastSeekDuration() const
+{
+    return m_lastSeekDuration;
+}
+
+void H264Decoder::DropQueuedFrames()
+{
+    m_finishedFrames += m_framesIn.Clear();
+    m_presentFrom = std::numeric_limits<int64_t>::min();
+    m_seeking = false;
+    m_skipper.Reset();
+    m_framesOut.Clear();
+}
+
+void H264Decoder::DropDecodedFrames()
+{
+    m_framesOut.Clear();
+}
+
+void H264Decoder::SetOutputImmediately(bool immediately)
+{
+    m_outputImmediately = immediately;
 }
 
 void H264Decoder::DecoderLoop()
 {
-    while (m_running)
+    SetCurrentThreadName("H264 decoder");
+    if (m_core != ANY_CORE)
+        SetCurrentThreadCore(m_core);
+
+    // Sleeps in Pop while there is no input, the queue is only closed by the destructor
+    auto waitStart = StageStats::Clock::now();
+    while (auto frame = m_framesIn.Pop())
     {
-        std::scoped_lock l{m_mutexIn};
-        if (m_framesIn.empty())
+        const auto decodeStart = StageStats::Clock::now();
+        m_stageStats.AddIdle(decodeStart - waitStart);
+
+        if (!frame->endOfStream && !m_skipper.ShouldDecode(frame->timestamp, frame->reference, frame->sync))
+        {
+            // keeps its place in the output order when restamping
+            m_outputFrames++;
+            if (!frame->owned.empty())
+                m_releasedBuffers.TryPush(std::move(frame->owned));
+            m_finishedFrames++;
+            waitStart = StageStats::Clock::now();
+            m_stageStats.AddBusy(waitStart - decodeStart);
             continue;
-        auto frame = m_framesIn.front();
-        H264DECBegin(m_context.get());
-        H264DECSetBitstream(m_context.get(), const_cast<uint8_t*>(frame.buffer.data()), frame.buffer.size(),
-                            frame.timestamp);
-        H264DECExecute(m_context.get(), m_frameBuffer.get());
-        H264DECEnd(m_context.get());
-        m_framesIn.pop_front();
+        }
+
+        if (frame->epoch != m_decodingEpoch)
+        {
+            m_discardOutput = true;
+            H264DECFlush(m_context.get());
+            m_discardOutput = false;
+            m_decodingEpoch = frame->epoch;
+        }
+
+        if (frame->endOfStream)
+        {
+            TRACE_SCOPE("H264DECFlush");
+            H264DECFlush(m_context.get());
+        }
+        else
+        {
+            m_referenceFlags[m_nextReferenceFlag] = {frame->timestamp, frame->reference};
+            m_nextReferenceFlag = (m_nextReferenceFlag + 1) % m_referenceFlags.size();
+
+            TRACE_COUNTER("Decoder backlog", static_cast<int64_t>(m_submittedFrames - m_finishedFrames));
+            H264DECBegin(m_context.get());
+            // Timestamps stay exact as doubles up to 2^53
+            H264DECSetBitstream(m_context.get(), const_cast<uint8_t*>(frame->buffer.data()), frame->buffer.size(),
+                                static_cast<double>(frame->timestamp));
+            {
+                TRACE_SCOPE("H264DECExecute");
+                H264DECExecute(m_context.get(), m_frameBuffer.get());
+            }
+            H264DECEnd(m_context.get());
+            if (m_outputImmediately)
+                H264DECFlush(m_context.get());
+        }
+
+        if (!frame->owned.empty())
+            m_releasedBuffers.TryPush(std::move(frame->owned));
+        m_finishedFrames++;
+        waitStart = StageStats::Clock::now();
+        m_stageStats.AddBusy(waitStart - decodeStart);
     }
     H264DECClose(m_context.get());
 }
 
+bool H264Decoder::IsReference(int64_t timestamp) const
+{
+    for (const auto& flag : m_referenceFlags)
+    {
+        if (flag.timestamp == timestamp)
+            return flag.reference;
+    }
+    return true;
+}
+
 void H264Decoder::DecodeCallback(H264DecodeOutput* output)
 {
+    TRACE_SCOPE("DecodeCallback");
     if (output->frameCount < 1)
         return;
     auto* origin = static_cast<H264Decoder*>(output->userMemory);
+    if (origin->m_discardOutput)
+        return;
+    const unsigned epoch = origin->m_decodingEpoch;
 
     for (auto i = 0; i < output->frameCount; ++i)
     {
         const auto& current = output->decodeResults[i];
-        const unsigned frameByteCount = current->height * current->nextLine * 3 / 2;
-        auto frameSpan = std::span(static_cast<uint8_t*>(current->framebuffer), frameByteCount);
+        const auto timestamp = std::llround(current->timestamp);
+        // A seek started while the frame was decoded
+        if (epoch != origin->m_framesOut.GetEpoch())
+            return;
+        if (timestamp < origin->m_presentFrom)
+        {
+            origin->m_seekSkippedFrames++;
+            continue;
+        }
+        if (origin->m_seeking)
+        {
+            origin->m_lastSeekDuration = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - origin->m_seekStart.load());
+            origin->m_seeking = false;
+            WHBLogPrintf("Seek took %lld us, skipped %u frames",
+                         static_cast<long long>(origin->m_lastSeekDuration.load().count()),
+                         origin->m_seekSkippedFrames.load());
+        }
 
-        auto* frameInfo = new OutputFrameInfo{{frameSpan.begin(), frameSpan.end()},
-                                              current->width,
-                                              current->height,
-                                              current->nextLine,
-                                              current->timestamp};
+        // counted before anything is dropped, so the frames after a drop keep their time
+        const int64_t outputTimestamp = origin->m_restampDuration != 0
+                                            ? static_cast<int64_t>(origin->m_outputFrames++ * origin->m_restampDuration)
+                                            : timestamp;
+        const unsigned frameByteCount = current->height * current->nextLine * 3 / 2;
+        if (frameByteCount > origin->m_framesOut.GetFrameSize())
+        {
+            WHBLogPrintf("Frame of %u bytes does not fit frame pool", frameByteCount);
+            continue;
+        }
+        const bool reference = origin->IsReference(timestamp);
+        // Blocks here with OutputQueue::Policy::Block while the consumer is behind
+        auto buffer = origin->m_framesOut.AcquireBuffer(reference);
+        if (!buffer)
+            continue;
+        std::memcpy(buffer.data(), current->framebuffer, frameByteCount);
 
-        WHBLogPrintf("Frame ts: %f", current->timestamp);
-        OSMessage msg{frameInfo, {}};
-        OSSendMessage(&origin->m_frameOutQueue, &msg, OS_MESSAGE_FLAGS_NONE);
+        TRACE_INSTANT("Frame output", outputTimestamp);
+        // Dropped if a seek started while it waited for the buffer
+        origin->m_framesOut.Push(
+            {std::move(buffer), current->width, current->height, current->nextLine, outputTimestamp, reference},
+            epoch);
     }
 }
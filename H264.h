@@ -1,16 +1,25 @@
 #pragma once
 
-#include <deque>
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <memory>
 #include <optional>
 #include <span>
 #include <exception>
+#include <limits>
 #include <thread>
 #include <vector>
 
-#include <coreinit/messagequeue.h>
 #include <h264/decode.h>
 
+#include "BoundedQueue.h"
+#include "FrameSkipper.h"
+#include "MemoryArena.h"
+#include "OutputQueue.h"
+#include "StageStats.h"
+#include "Thread.h"
+
 class H264DecoderException : public std::exception
 {
   public:
@@ -31,48 +40,156 @@ enum H264Profile
     H264_PROFILE_HIGH = 100
 };
 
+struct H264DecoderConfig
+{
+    size_t inputQueueDepth = 8;
+    // Memory for queued output frames, the queue depth is derived from it
+    size_t outputBudget = 16 * 1024 * 1024;
+    OutputQueue::Policy outputPolicy = OutputQueue::Policy::Block;
+    // Decoded frames the consumer holds on to at once after taking them, the frame pool has room for them on top of
+    // the queue
+    unsigned consumerHeldFrames = 2;
+    // Core the decoder thread runs on
+    int core = ANY_CORE;
+    // If nonzero, output frames are stamped in output order this far apart instead of passing the submitted
+    // timestamps through, for streams that only have decode order times
+    uint64_t restampDuration = 0;
+    // Size the decoder's picture buffer for the frames the stream says it needs instead of everything its level
+    // allows, by asking for the memory of the lowest level that holds them
+    bool fitLevelToStream = true;
+    // Timescale of the submitted timestamps and the clock passed to SetClockTime, 0 turns frame skipping off
+    uint32_t timescale = 0;
+    FrameSkipper::Config skip{};
+    // Decoder memory, the working frame buffer and the output frame pool are carved from it, so all of it has to
+    // pass H264Decoder::CheckMemory. Without one the decoder reserves an arena of its own for the memory it works in
+    // and the frame pool comes from the heap.
+    MemoryArena* arena = nullptr;
+};
+
 class H264Decoder
 {
-    using CtxPointer = std::unique_ptr<void, decltype(&std::free)>;
-    using FrameBufPointer = std::unique_ptr<uint8_t, decltype(&std::free)>;
     struct InputFrameInfo
     {
         std::span<const uint8_t> buffer;
-        double timestamp;
+        // Backs buffer if the decoder took ownership of the data
+        std::vector<uint8_t> owned;
+        int64_t timestamp;
+        bool reference;
+        bool sync;
+        // Of the output queue when submitted
+        unsigned epoch;
+        // Submitted by SubmitEndOfStream, no data
+        bool endOfStream = false;
     };
 
   public:
-    struct OutputFrameInfo
-    {
-        std::vector<uint8_t> buffer;
-        int32_t width;
-        int32_t height;
-        int32_t pitch;
-        double timestamp;
-    };
+    using OutputFrameInfo = DecodedFrame;
+
+    using Config = H264DecoderConfig;
 
   public:
     static int32_t GetStartPoint(std::span<const uint8_t> buffer);
-
-    explicit H264Decoder(H264Profile profile, unsigned level, unsigned width, unsigned height);
+    // True if the decoder can work in the memory, the predicate of its arena
+    static bool CheckMemory(const void* data, size_t size);
+    // width and height are the coded size of the pictures, whole macroblocks. dpbFrames is the number of frames the
+    // stream keeps for reference and reordering, 0 if unknown.
+    H264Decoder(H264Profile profile, unsigned level, unsigned width, unsigned height, unsigned dpbFrames,
+                const Config& config = {});
     ~H264Decoder();
-    void SubmitFrame(std::span<const uint8_t> data, double timestamp);
+    // The data has to stay valid until the frame is decoded. Blocks while the input queue is full.
+    // Timestamps are passed through to the output frames, non-reference frames can be dropped by the output policy or
+    // skipped when decoding falls behind. Skipping to the next sync frame waits for a frame submitted with sync.
+    void SubmitFrame(std::span<const uint8_t> data, int64_t timestamp, bool reference = true, bool sync = false);
+    // Returns false instead of blocking if the input queue is full
+    bool TrySubmitFrame(std::span<const uint8_t> data, int64_t timestamp, bool reference = true, bool sync = false);
+    // Takes ownership of the data, it can be taken back for reuse with TakeReleasedBuffer once decoded
+    void SubmitFrame(std::vector<uint8_t>&& data, int64_t timestamp, bool reference = true, bool sync = false);
+    std::optional<std::vector<uint8_t>> TakeReleasedBuffer();
+    // After the last frame of the stream, blocks like SubmitFrame. The decoder outputs the pictures it still holds for
+    // reordering once the frames before are decoded, as nothing follows to push them out, and is idle once they are
+    // queued.
+    void SubmitEndOfStream();
+    // Wakes up a blocked SubmitFrame and stops decoding, everything submitted afterwards is dropped
+    void Interrupt();
+    // With a single submitting thread, SubmitFrame won't block if this is true
+    [[nodiscard]] bool CanSubmitFrame() const;
+    // Nothing queued and nothing being decoded
+    [[nodiscard]] bool IsIdle() const;
     std::optional<OutputFrameInfo> GetDecodedFrame();
 
+    void SetOutputPolicy(OutputQueue::Policy policy);
+    // Presentation clock the frame skipper measures the lag against, std::nullopt while it is stopped
+    void SetClockTime(std::optional<int64_t> time);
+    [[nodiscard]] FrameSkipper::Stats GetSkipStats() const;
+    [[nodiscard]] OutputQueue::Stats GetOutputStats() const;
+    [[nodiscard]] FramePool::Stats GetFramePoolStats() const;
+    // Busy while decoding, idle while waiting for input
+    [[nodiscard]] StageStats::Snapshot GetStageStats() const;
+
+    // Drops all queued input and output and the pictures still held by the decoder. Frames are decoded but not output
+    // until one with a timestamp at or after targetTimestamp arrives, frames leading up to it should be submitted
+    // starting from a sync sample.
+    void BeginSeek(int64_t targetTimestamp);
+    // Time from BeginSeek to the output of the target frame of the last finished seek
+    [[nodiscard]] std::chrono::microseconds GetLastSeekDuration() const;
+
+    // Drops all queued input and output and the pictures still held by the decoder, without waiting for a target
+    // frame like BeginSeek. For trick play jumping between sync frames.
+    void DropQueuedFrames();
+    // Drops the queued output and the output of everything submitted so far, which frees a decoder stalled on a full
+    // output queue. Unlike the two above it leaves the input alone, so it can be called while another thread submits.
+    void DropDecodedFrames();
+    // Flushes the decoder after every frame so each picture is output as soon as it is decoded instead of once the
+    // following frames push it out of the reorder buffer. Only for trick play, where every frame is a sync frame.
+    void SetOutputImmediately(bool immediately);
+
   private:
     static void DecodeCallback(H264DecodeOutput* output);
     void DecoderLoop();
+    [[nodiscard]] bool IsReference(int64_t timestamp) const;
 
   private:
-    FrameBufPointer m_frameBuffer;
-    CtxPointer m_context;
-    std::vector<OSMessage> m_messageBuffer;
+    uint32_t m_memoryRequirement;
+    std::unique_ptr<MemoryArena> m_ownArena;
+    MemoryArena* m_arena;
+    MemoryArena::Pointer<uint8_t> m_frameBuffer;
+    MemoryArena::Pointer<void> m_context;
 
-    std::deque<InputFrameInfo> m_framesIn{};
-    std::mutex m_mutexIn{};
+    BoundedQueue<InputFrameInfo> m_framesIn;
+    BoundedQueue<std::vector<uint8_t>> m_releasedBuffers;
 
-    OSMessageQueue m_frameOutQueue;
+    OutputQueue m_framesOut;
+    FrameSkipper m_skipper;
+
+    // Reference flags of recently submitted frames, the decoder only passes the timestamp through.
+    // Only touched on the decoder thread.
+    struct ReferenceFlag
+    {
+        int64_t timestamp;
+        bool reference;
+    };
+    std::array<ReferenceFlag, 32> m_referenceFlags{};
+    size_t m_nextReferenceFlag = 0;
 
     std::thread m_thread;
-    std::atomic_bool m_running;
+    int m_core;
+    uint64_t m_restampDuration;
+    // Only touched on the decoder thread
+    uint64_t m_outputFrames = 0;
+    StageStats m_stageStats;
+    // Frames accepted by the input queue and frames done decoding, equal when idle
+    std::atomic<uint64_t> m_submittedFrames{0};
+    std::atomic<uint64_t> m_finishedFrames{0};
+
+    std::atomic_bool m_outputImmediately{false};
+    // Epoch of the output queue the frame being decoded was submitted in. BeginSeek and DropQueuedFrames start a new
+    // one, the decoder thread then flushes the pictures of the old one without outputting them, and output of frames
+    // from the old one still being decoded is dropped. Only touched on the decoder thread.
+    unsigned m_decodingEpoch = 0;
+    bool m_discardOutput = false;
+    std::atomic<int64_t> m_presentFrom{std::numeric_limits<int64_t>::min()};
+    std::atomic_bool m_seeking{false};
+    std::atomic<std::chrono::steady_clock::time_point> m_seekStart{};
+    std::atomic<std::chrono::microseconds> m_lastSeekDuration{};
+    std::atomic_uint m_seekSkippedFrames{0};
 };
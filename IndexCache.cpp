@@ -0,0 +1,222 @@
+#include "IndexCache.h"
+#include "MP4.h"
+#include "SampleIndex.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <string>
+
+#include <whb/log.h>
+
+// Samples walked and array elements written between checks for cancellation
+constexpr size_t CANCEL_CHECK_INTERVAL = 16384;
+
+// "VPIX" read in native byte order, so a cache written on a host of the other endianness is rejected too
+constexpr uint32_t MAGIC = 0x56504958;
+
+struct IndexCacheHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t fileSize;
+    int64_t modified;
+    uint32_t pathSize;
+    uint32_t prefixSize;
+    uint32_t width;
+    uint32_t height;
+    uint32_t profile;
+    uint32_t level;
+    uint32_t timescale;
+    uint32_t naluLengthSize;
+    uint64_t duration;
+    uint32_t sampleCount;
+    uint32_t syncCount;
+};
+// Written as is, no padding may differ between compilers
+static_assert(sizeof(IndexCacheHeader) == 72);
+
+using File = std::unique_ptr<std::FILE, decltype(&std::fclose)>;
+
+template <typename T>
+static bool ReadArray(std::FILE* file, std::vector<T>& array, size_t count)
+{
+    array.resize(count);
+    return std::fread(array.data(), sizeof(T), count, file) == count;
+}
+
+template <typename T>
+static bool WriteArray(std::FILE* file, const std::vector<T>& array, const std::atomic_bool& cancel)
+{
+    for (size_t i = 0; i < array.size(); i += CANCEL_CHECK_INTERVAL)
+    {
+        const auto count = std::min(array.size() - i, CANCEL_CHECK_INTERVAL);
+        if (cancel || std::fwrite(array.data() + i, sizeof(T), count, file) != count)
+            return false;
+    }
+    return true;
+}
+
+static uint64_t ExpectedSize(const IndexCacheHeader& header)
+{
+    // offsets and dts are 64 bit, sizes and composition offsets 32 bit
+    return sizeof(IndexCacheHeader) + header.pathSize + header.prefixSize + uint64_t{header.sampleCount} * 24 +
+           uint64_t{header.syncCount} * 4;
+}
+
+std::optional<IndexCache::Key> IndexCache::GetKey(const std::filesystem::path& video)
+{
+    std::error_code error;
+    const auto size = std::filesystem::file_size(video, error);
+    if (error)
+        return std::nullopt;
+    const auto modified = std::filesystem::last_write_time(video, error);
+    if (error)
+        return std::nullopt;
+    return Key{size, static_cast<int64_t>(modified.time_since_epoch().count())};
+}
+
+std::filesystem::path IndexCache::GetPath(const std::filesystem::path& video)
+{
+    auto path = video;
+    path += ".vpidx";
+    return path;
+}
+
+bool IndexCache::Load(const std::filesystem::path& video, const Key& key, H264TrackInfo& info,
+                      std::vector<uint8_t>& prefix, unsigned& naluLengthSize, SampleIndex& index)
+{
+    const auto cachePath = GetPath(video);
+    std::error_code error;
+    const auto cacheSize = std::filesystem::file_size(cachePath, error);
+    if (error)
+        return false;
+    File file{std::fopen(cachePath.c_str(), "rb"), std::fclose};
+    if (!file)
+        return false;
+
+    IndexCacheHeader header;
+    if (std::fread(&header, sizeof(header), 1, file.get()) != 1)
+        return false;
+    if (header.magic != MAGIC || header.version != VERSION || header.fileSize != key.fileSize ||
+        header.modified != key.modified || ExpectedSize(header) != cacheSize)
+        return false;
+
+    std::string path(header.pathSize, '\0');
+    if (std::fread(path.data(), 1, path.size(), file.get()) != path.size() || path != video.string())
+        return false;
+
+    if (!ReadArray(file.get(), prefix, header.prefixSize))
+        return false;
+
+    index.Clear();
+    if (!ReadArray(file.get(), index.m_offsets, header.sampleCount) ||
+        !ReadArray(file.get(), index.m_sizes, header.sampleCount) ||
+        !ReadArray(file.get(), index.m_dts, header.sampleCount) ||
+        !ReadArray(file.get(), index.m_ctsOffsets, header.sampleCount) ||
+        !ReadArray(file.get(), index.m_syncSamples, header.syncCount))
+        return false;
+    index.SetDuration(header.duration);
+
+    info = {};
+    info.width = header.width;
+    info.height = header.height;
+    info.profile = header.profile;
+    info.level = header.level;
+    info.sampleCount = header.sampleCount;
+    info.timescale = header.timescale;
+    info.duration = header.duration;
+    naluLengthSize = header.naluLengthSize;
+    return true;
+}
+
+bool IndexCache::Save(const std::filesystem::path& video, const Key& key, const H264TrackInfo& info,
+                      const std::vector<uint8_t>& prefix, unsigned naluLengthSize, const SampleTable& table,
+                      const std::atomic_bool& cancel)
+{
+    const auto path = video.string();
+    const auto count = table.Count();
+
+    IndexCacheHeader header{};
+    header.magic = MAGIC;
+    header.version = VERSION;
+    header.fileSize = key.fileSize;
+    header.modified = key.modified;
+    header.pathSize = path.size();
+    header.prefixSize = prefix.size();
+    header.width = info.width;
+    header.height = info.height;
+    header.profile = info.profile;
+    header.level = info.level;
+    header.timescale = info.timescale;
+    header.naluLengthSize = naluLengthSize;
+    header.duration = info.duration;
+    header.sampleCount = count;
+
+    std::vector<uint64_t> offsets(count);
+    std::vector<uint32_t> sizes(count);
+    std::vector<uint64_t> dts(count);
+    std::vector<int32_t> ctsOffsets(count);
+    std::vector<uint32_t> syncSamples;
+    syncSamples.reserve(table.SyncSampleCount());
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        if (i % CANCEL_CHECK_INTERVAL == 0 && cancel)
+            return false;
+        offsets[i] = table.Offset(i);
+        sizes[i] = table.Size(i);
+        dts[i] = table.Dts(i);
+        ctsOffsets[i] = table.CtsOffset(i);
+        if (table.IsSync(i))
+            syncSamples.push_back(i);
+    }
+    header.syncCount = syncSamples.size();
+
+    // written under a temporary name so a cache cut short by a crash or a full card is never picked up
+    const auto cachePath = GetPath(video);
+    auto temporaryPath = cachePath;
+    temporaryPath += ".tmp";
+    {
+        File file{std::fopen(temporaryPath.c_str(), "wb"), std::fclose};
+        if (!file)
+            return false;
+        const bool written = std::fwrite(&header, sizeof(header), 1, file.get()) == 1 &&
+                             std::fwrite(path.data(), 1, path.size(), file.get()) == path.size() &&
+                             WriteArray(file.get(), prefix, cancel) && WriteArray(file.get(), offsets, cancel) &&
+                             WriteArray(file.get(), sizes, cancel) && WriteArray(file.get(), dts, cancel) &&
+                             WriteArray(file.get(), ctsOffsets, cancel) && WriteArray(file.get(), syncSamples, cancel);
+        const bool closed = std::fclose(file.release()) == 0;
+        if (!written || !closed)
+        {
+            std::error_code error;
+            std::filesystem::remove(temporaryPath, error);
+            return false;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temporaryPath, cachePath, error);
+    if (error)
+    {
+        WHBLogPrintf("Failed to write index cache %s", cachePath.c_str());
+        std::filesystem::remove(temporaryPath, error);
+        return false;
+    }
+    return true;
+}
+
+IndexCacheWriter::IndexCacheWriter(const std::filesystem::path& video, const IndexCache::Key& key,
+                                   const H264TrackInfo& info, const std::vector<uint8_t>& prefix,
+                                   unsigned naluLengthSize, std::unique_ptr<SampleTable> table)
+{
+    m_thread = std::thread([this, video, key, info, prefix, naluLengthSize, table = std::move(table)] {
+        if (!IndexCache::Save(video, key, info, prefix, naluLengthSize, *table, m_cancel) && !m_cancel)
+            WHBLogPrint("Failed to save the index cache");
+    });
+}
+
+IndexCacheWriter::~IndexCacheWriter()
+{
+    m_cancel = true;
+    m_thread.join();
+}
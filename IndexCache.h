@@ -0,0 +1,57 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <vector>
+
+struct H264TrackInfo;
+class SampleIndex;
+class SampleTable;
+
+// Sidecar file next to a video holding everything parsed from it on open: track info, SPS/PPS prefix and the full
+// sample index. Reopening the video then reads a header and a few arrays, no matter how many samples it has.
+// The file is in native byte order and only valid for the exact path, size and modification time it was written for.
+class IndexCache
+{
+  public:
+    static constexpr uint32_t VERSION = 1;
+
+    struct Key
+    {
+        uint64_t fileSize;
+        int64_t modified;
+    };
+
+    // std::nullopt if the video can't be stat'ed
+    static std::optional<Key> GetKey(const std::filesystem::path& video);
+    static std::filesystem::path GetPath(const std::filesystem::path& video);
+
+    // Fails if there is no cache for this key or it can't be used, the outputs are unspecified then
+    static bool Load(const std::filesystem::path& video, const Key& key, H264TrackInfo& info,
+                     std::vector<uint8_t>& prefix, unsigned& naluLengthSize, SampleIndex& index);
+    // Gives up, writing nothing, once cancel is set
+    static bool Save(const std::filesystem::path& video, const Key& key, const H264TrackInfo& info,
+                     const std::vector<uint8_t>& prefix, unsigned naluLengthSize, const SampleTable& table,
+                     const std::atomic_bool& cancel);
+};
+
+// Saves the cache of a parsed file on a thread of its own, so the walk over all samples and the write to the card
+// hold up neither playback nor closing the file. The table has to be one the source doesn't use.
+// Destroying the writer before it's done cancels the save, which only waits for the write call in flight.
+class IndexCacheWriter
+{
+  public:
+    IndexCacheWriter(const std::filesystem::path& video, const IndexCache::Key& key, const H264TrackInfo& info,
+                     const std::vector<uint8_t>& prefix, unsigned naluLengthSize, std::unique_ptr<SampleTable> table);
+    ~IndexCacheWriter();
+
+    IndexCacheWriter(const IndexCacheWriter&) = delete;
+    IndexCacheWriter& operator=(const IndexCacheWriter&) = delete;
+
+  private:
+    std::atomic_bool m_cancel{false};
+    std::thread m_thread;
+};
@@ -0,0 +1,267 @@
+#include "LazySampleTable.h"
+
+#include <algorithm>
+
+#include <bento4/Ap4Utils.h>
+
+// Version, flags and entry count in front of the entries of every table but stsz
+constexpr size_t TABLE_HEADER_SIZE = 8;
+// stsz has the constant sample size in front of the sample count
+constexpr size_t STSZ_HEADER_SIZE = 12;
+constexpr size_t STTS_ENTRY_SIZE = 8;
+constexpr size_t CTTS_ENTRY_SIZE = 8;
+constexpr size_t STSC_ENTRY_SIZE = 12;
+
+static uint32_t Read32(const std::vector<uint8_t>& table, size_t offset)
+{
+    return AP4_BytesToUInt32BE(&table[offset]);
+}
+
+static uint32_t EntryCount(const std::vector<uint8_t>& table)
+{
+    return table.size() >= TABLE_HEADER_SIZE ? Read32(table, 4) : 0;
+}
+
+static bool EntriesFit(const std::vector<uint8_t>& table, size_t entrySize)
+{
+    return table.size() >= TABLE_HEADER_SIZE &&
+           (table.size() - TABLE_HEADER_SIZE) / entrySize >= EntryCount(table);
+}
+
+std::unique_ptr<LazySampleTable> LazySampleTable::Create(MP4VideoTrackBoxes&& boxes)
+{
+    std::unique_ptr<LazySampleTable> table(new LazySampleTable(std::move(boxes)));
+    if (!table->Validate())
+        return nullptr;
+    return table;
+}
+
+LazySampleTable::LazySampleTable(MP4VideoTrackBoxes&& boxes) : m_boxes(std::move(boxes))
+{
+    if (m_boxes.stsz.size() >= STSZ_HEADER_SIZE)
+    {
+        m_constantSize = Read32(m_boxes.stsz, 4);
+        m_count = Read32(m_boxes.stsz, 8);
+    }
+    m_chunkCount = EntryCount(m_boxes.stco);
+    m_stts.entryCount = EntryCount(m_boxes.stts);
+    m_ctts.entryCount = EntryCount(m_boxes.ctts);
+    m_stsc.entryCount = EntryCount(m_boxes.stsc);
+}
+
+bool LazySampleTable::Validate() const
+{
+    if (m_boxes.stsz.size() < STSZ_HEADER_SIZE || m_count == 0)
+        return false;
+    if (m_constantSize == 0 && (m_boxes.stsz.size() - STSZ_HEADER_SIZE) / 4 < m_count)
+        return false;
+    if (!EntriesFit(m_boxes.stco, m_boxes.co64 ? 8 : 4) || m_chunkCount == 0)
+        return false;
+    if (!EntriesFit(m_boxes.stts, STTS_ENTRY_SIZE) || !EntriesFit(m_boxes.stsc, STSC_ENTRY_SIZE))
+        return false;
+    if (m_stts.entryCount == 0 || m_stsc.entryCount == 0)
+        return false;
+    if (!m_boxes.ctts.empty() && !EntriesFit(m_boxes.ctts, CTTS_ENTRY_SIZE))
+        return false;
+    if (!m_boxes.stss.empty() && !EntriesFit(m_boxes.stss, 4))
+        return false;
+    // First chunks have to be 1-based and increasing, and samples per chunk of zero would make lookups divide by zero.
+    // Every sample has to be in a chunk, a sample past them would have no offset.
+    uint64_t covered = 0;
+    for (uint32_t i = 0; i < m_stsc.entryCount; ++i)
+    {
+        const auto entry = TABLE_HEADER_SIZE + i * STSC_ENTRY_SIZE;
+        const auto firstChunk = Read32(m_boxes.stsc, entry);
+        const auto nextChunk =
+            i + 1 < m_stsc.entryCount ? Read32(m_boxes.stsc, entry + STSC_ENTRY_SIZE) : m_chunkCount + 1;
+        const auto samplesPerChunk = Read32(m_boxes.stsc, entry + 4);
+        if (firstChunk == 0 || firstChunk >= nextChunk || nextChunk > m_chunkCount + 1 || samplesPerChunk == 0)
+            return false;
+        covered += uint64_t{nextChunk - firstChunk} * samplesPerChunk;
+    }
+    return covered >= m_count;
+}
+
+uint32_t LazySampleTable::Count() const
+{
+    return m_count;
+}
+
+uint64_t LazySampleTable::Offset(uint32_t sample) const
+{
+    const auto run = FindRun(m_stsc, sample, &LazySampleTable::DecodeStscRun);
+    if (run == m_stsc.entryCount)
+        return 0;
+
+    const auto entry = TABLE_HEADER_SIZE + run * STSC_ENTRY_SIZE;
+    const auto firstChunk = Read32(m_boxes.stsc, entry);
+    const auto samplesPerChunk = Read32(m_boxes.stsc, entry + 4);
+    const auto inRun = sample - m_stsc.firstSample[run];
+    const auto chunkFirstSample = sample - inRun % samplesPerChunk;
+
+    uint64_t offset;
+    if (sample != chunkFirstSample && m_lastOffsetSample + 1 == sample)
+    {
+        offset = m_lastOffset + Size(sample - 1);
+    }
+    else
+    {
+        offset = ChunkOffset(firstChunk - 1 + inRun / samplesPerChunk);
+        for (uint32_t i = chunkFirstSample; i < sample; ++i)
+            offset += Size(i);
+    }
+    m_lastOffsetSample = sample;
+    m_lastOffset = offset;
+    return offset;
+}
+
+uint32_t LazySampleTable::Size(uint32_t sample) const
+{
+    if (m_constantSize != 0)
+        return m_constantSize;
+    return Read32(m_boxes.stsz, STSZ_HEADER_SIZE + size_t{sample} * 4);
+}
+
+uint64_t LazySampleTable::Dts(uint32_t sample) const
+{
+    auto run = FindRun(m_stts, sample, &LazySampleTable::DecodeSttsRun);
+    // samples past the end of stts continue the last delta
+    if (run == m_stts.entryCount)
+        run = m_stts.entryCount - 1;
+    const auto delta = Read32(m_boxes.stts, TABLE_HEADER_SIZE + run * STTS_ENTRY_SIZE + 4);
+    return m_stts.firstDts[run] + uint64_t{sample - m_stts.firstSample[run]} * delta;
+}
+
+int32_t LazySampleTable::CtsOffset(uint32_t sample) const
+{
+    if (m_ctts.entryCount == 0)
+        return 0;
+    const auto run = FindRun(m_ctts, sample, &LazySampleTable::DecodeCttsRun);
+    if (run == m_ctts.entryCount)
+        return 0;
+    // version 0 offsets are unsigned, but negative ones stored that way are common enough to read them as signed
+    return static_cast<int32_t>(Read32(m_boxes.ctts, TABLE_HEADER_SIZE + run * CTTS_ENTRY_SIZE + 4));
+}
+
+uint64_t LazySampleTable::Duration(uint32_t sample) const
+{
+    const auto dts = Dts(sample);
+    if (sample + 1 < m_count)
+        return Dts(sample + 1) - dts;
+    return m_boxes.duration > dts ? m_boxes.duration - dts : 0;
+}
+
+bool LazySampleTable::IsSync(uint32_t sample) const
+{
+    if (m_boxes.stss.empty())
+        return true;
+    return FindSyncSample(sample) == sample;
+}
+
+uint32_t LazySampleTable::FindSample(uint64_t time) const
+{
+    const auto endDts = [this] {
+        const auto last = m_stts.firstSample.size() - 1;
+        const auto entry = TABLE_HEADER_SIZE + last * STTS_ENTRY_SIZE;
+        return m_stts.firstDts[last] + uint64_t{Read32(m_boxes.stts, entry)} * Read32(m_boxes.stts, entry + 4);
+    };
+    while (!m_stts.Done() && (m_stts.firstSample.empty() || endDts() <= time))
+        DecodeSttsRun();
+
+    const auto next = std::upper_bound(m_stts.firstDts.begin(), m_stts.firstDts.end(), time);
+    if (next == m_stts.firstDts.begin())
+        return 0;
+    const auto run = static_cast<uint32_t>(std::distance(m_stts.firstDts.begin(), next) - 1);
+
+    const auto entry = TABLE_HEADER_SIZE + run * STTS_ENTRY_SIZE;
+    const auto count = Read32(m_boxes.stts, entry);
+    const auto delta = Read32(m_boxes.stts, entry + 4);
+    uint64_t inRun = count > 0 ? count - 1 : 0;
+    if (delta != 0)
+        inRun = std::min<uint64_t>((time - m_stts.firstDts[run]) / delta, inRun);
+    return static_cast<uint32_t>(std::min<uint64_t>(m_stts.firstSample[run] + inRun, m_count - 1));
+}
+
+uint32_t LazySampleTable::FindSyncSample(uint32_t sample) const
+{
+    if (m_boxes.stss.empty())
+        return sample;
+
+    // stss holds sorted 1-based sample numbers
+    uint32_t begin = 0;
+    uint32_t end = EntryCount(m_boxes.stss);
+    while (begin < end)
+    {
+        const auto middle = begin + (end - begin) / 2;
+        if (SyncSampleAt(middle) <= sample)
+            begin = middle + 1;
+        else
+            end = middle;
+    }
+    return begin == 0 ? 0 : SyncSampleAt(begin - 1);
+}
+
+uint32_t LazySampleTable::SyncSampleCount() const
+{
+    return m_boxes.stss.empty() ? m_count : EntryCount(m_boxes.stss);
+}
+
+void LazySampleTable::DecodeSttsRun() const
+{
+    const auto run = static_cast<uint32_t>(m_stts.firstSample.size());
+    uint64_t dts = 0;
+    if (run > 0)
+    {
+        const auto previous = TABLE_HEADER_SIZE + (run - 1) * STTS_ENTRY_SIZE;
+        dts = m_stts.firstDts.back() +
+              uint64_t{Read32(m_boxes.stts, previous)} * Read32(m_boxes.stts, previous + 4);
+    }
+    m_stts.firstSample.push_back(m_stts.end);
+    m_stts.firstDts.push_back(dts);
+    m_stts.end += Read32(m_boxes.stts, TABLE_HEADER_SIZE + run * STTS_ENTRY_SIZE);
+}
+
+void LazySampleTable::DecodeCttsRun() const
+{
+    const auto run = static_cast<uint32_t>(m_ctts.firstSample.size());
+    m_ctts.firstSample.push_back(m_ctts.end);
+    m_ctts.end += Read32(m_boxes.ctts, TABLE_HEADER_SIZE + run * CTTS_ENTRY_SIZE);
+}
+
+void LazySampleTable::DecodeStscRun() const
+{
+    const auto run = static_cast<uint32_t>(m_stsc.firstSample.size());
+    const auto entry = TABLE_HEADER_SIZE + run * STSC_ENTRY_SIZE;
+    const auto firstChunk = Read32(m_boxes.stsc, entry);
+    const auto nextChunk =
+        run + 1 < m_stsc.entryCount ? Read32(m_boxes.stsc, entry + STSC_ENTRY_SIZE) : m_chunkCount + 1;
+    const auto chunks = nextChunk > firstChunk ? nextChunk - firstChunk : 0;
+
+    m_stsc.firstSample.push_back(m_stsc.end);
+    const auto samples = uint64_t{chunks} * Read32(m_boxes.stsc, entry + 4);
+    m_stsc.end = static_cast<uint32_t>(std::min<uint64_t>(m_stsc.end + samples, UINT32_MAX));
+}
+
+uint32_t LazySampleTable::FindRun(Runs& runs, uint32_t sample, void (LazySampleTable::*decode)() const) const
+{
+    while (!runs.Done() && runs.end <= sample)
+        (this->*decode)();
+    if (runs.end <= sample)
+        return runs.entryCount;
+
+    const auto next = std::upper_bound(runs.firstSample.begin(), runs.firstSample.end(), sample);
+    return static_cast<uint32_t>(std::distance(runs.firstSample.begin(), next) - 1);
+}
+
+uint64_t LazySampleTable::ChunkOffset(uint32_t chunk) const
+{
+    if (chunk >= m_chunkCount)
+        return 0;
+    const auto entry = TABLE_HEADER_SIZE + size_t{chunk} * (m_boxes.co64 ? 8 : 4);
+    return m_boxes.co64 ? AP4_BytesToUInt64BE(&m_boxes.stco[entry]) : Read32(m_boxes.stco, entry);
+}
+
+uint32_t LazySampleTable::SyncSampleAt(uint32_t index) const
+{
+    return Read32(m_boxes.stss, TABLE_HEADER_SIZE + size_t{index} * 4) - 1;
+}
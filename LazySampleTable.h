@@ -0,0 +1,70 @@
+#pragma once
+#include <memory>
+#include <vector>
+
+#include "MP4Boxes.h"
+#include "SampleTable.h"
+
+// Sample table reading straight from the raw stbl boxes.
+// Sizes, chunk offsets and sync samples are looked up in place. The run length coded stts, ctts and stsc tables are
+// decoded only as far as the samples and times asked for, so opening a long file costs no more than a short one.
+class LazySampleTable : public SampleTable
+{
+  public:
+    // Returns nullptr if the tables are inconsistent
+    static std::unique_ptr<LazySampleTable> Create(MP4VideoTrackBoxes&& boxes);
+
+    [[nodiscard]] uint32_t Count() const override;
+    [[nodiscard]] uint64_t Offset(uint32_t sample) const override;
+    [[nodiscard]] uint32_t Size(uint32_t sample) const override;
+    [[nodiscard]] uint64_t Dts(uint32_t sample) const override;
+    [[nodiscard]] int32_t CtsOffset(uint32_t sample) const override;
+    [[nodiscard]] uint64_t Duration(uint32_t sample) const override;
+    [[nodiscard]] bool IsSync(uint32_t sample) const override;
+
+    [[nodiscard]] uint32_t FindSample(uint64_t time) const override;
+    [[nodiscard]] uint32_t FindSyncSample(uint32_t sample) const override;
+    [[nodiscard]] uint32_t SyncSampleCount() const override;
+
+  private:
+    // First sample and, for stts, first decode time of each run decoded so far.
+    // Runs are decoded in order and stay decoded.
+    struct Runs
+    {
+        std::vector<uint32_t> firstSample;
+        std::vector<uint64_t> firstDts;
+        uint32_t entryCount = 0;
+        // Samples covered by the decoded runs
+        uint32_t end = 0;
+
+        [[nodiscard]] bool Done() const
+        {
+            return firstSample.size() == entryCount;
+        }
+    };
+
+    explicit LazySampleTable(MP4VideoTrackBoxes&& boxes);
+    bool Validate() const;
+
+    void DecodeSttsRun() const;
+    void DecodeCttsRun() const;
+    void DecodeStscRun() const;
+    // Index of the decoded run holding sample, decoding further runs if needed. Returns the entry count past the end.
+    uint32_t FindRun(Runs& runs, uint32_t sample, void (LazySampleTable::*decode)() const) const;
+
+    [[nodiscard]] uint64_t ChunkOffset(uint32_t chunk) const;
+    [[nodiscard]] uint32_t SyncSampleAt(uint32_t index) const;
+
+  private:
+    MP4VideoTrackBoxes m_boxes;
+    uint32_t m_count = 0;
+    uint32_t m_constantSize = 0;
+    uint32_t m_chunkCount = 0;
+
+    mutable Runs m_stts;
+    mutable Runs m_ctts;
+    mutable Runs m_stsc;
+    // Last offset computed, consecutive samples of a chunk are then found without summing sizes again
+    mutable uint32_t m_lastOffsetSample = UINT32_MAX;
+    mutable uint64_t m_lastOffset = 0;
+};
@@ -30,10 +30,17 @@
 |   includes
 +---------------------------------------------------------------------*/
 #include "MP4.h"
+#include "AnnexB.h"
+#include "FragmentedSampleTable.h"
+#include "LazySampleTable.h"
+#include "ParameterSets.h"
+#include "SampleIndex.h"
 
 #include <algorithm>
 #include <cstdio>
+#include <cstring>
 #include <memory>
+#include <utility>
 
 #include <coreinit/debug.h>
 #include <whb/log.h>
@@ -41,113 +48,158 @@
 // Only including the needed Bento4 headers because of a compilation issue
 #include <bento4/Ap4AvcParser.h>
 #include <bento4/Ap4File.h>
-#include <bento4/Ap4FileByteStream.h>
 #include <bento4/Ap4Movie.h>
 #include <bento4/Ap4Sample.h>
 #include <bento4/Ap4SampleDescription.h>
 #include <bento4/Ap4Track.h>
 #include <bento4/Ap4Types.h>
 
+/*----------------------------------------------------------------------
+|   ReadNaluLength
++---------------------------------------------------------------------*/
+template <unsigned NaluLengthSize>
+static AP4_UI32 ReadNaluLength(const uint8_t* data)
+{
+    if constexpr (NaluLengthSize == 1)
+        return data[0];
+    else if constexpr (NaluLengthSize == 2)
+        return AP4_BytesToInt16BE(data);
+    else
+        return AP4_BytesToInt32BE(data);
+}
+
+/*----------------------------------------------------------------------
+|   WriteHeader
++---------------------------------------------------------------------*/
+// The header area in front of the NAL units is exactly sizeof(ACCESS_UNIT_DELIMITER) + prefix.size() bytes.
+// If the sample starts with its own delimiter, that NAL is moved to the front and the prefix placed behind it,
+// the bytes left over are zero which is valid padding before a start code.
+static void WriteHeader(uint8_t* header, const std::vector<uint8_t>& prefix, size_t delimiterSize)
+{
+    if (delimiterSize == 0)
+    {
+        std::copy_n(ACCESS_UNIT_DELIMITER, sizeof(ACCESS_UNIT_DELIMITER), header);
+        std::copy_n(prefix.data(), prefix.size(), header + sizeof(ACCESS_UNIT_DELIMITER));
+        return;
+    }
+    const auto delimiter = header + sizeof(ACCESS_UNIT_DELIMITER) + prefix.size();
+    std::memmove(header + sizeof(ACCESS_UNIT_DELIMITER), delimiter, delimiterSize);
+    std::copy_n(prefix.data(), prefix.size(), header + sizeof(ACCESS_UNIT_DELIMITER) + delimiterSize);
+    std::fill_n(header, sizeof(ACCESS_UNIT_DELIMITER), 0);
+}
+
 /*----------------------------------------------------------------------
 |   WriteSample
 +---------------------------------------------------------------------*/
-static void WriteSample(const AP4_DataBuffer& sample_data, AP4_DataBuffer& prefix, unsigned int nalu_length_size,
-                        std::vector<uint8_t>& output)
+// Reads a sample into output and converts it from length prefixed NAL units to an Annex-B access unit.
+// 4 byte lengths are the same size as a start code, so the sample is copied (or read, if it is large) straight into
+// place and only the length fields are rewritten. Shorter lengths need the NAL units spread apart, those are
+// converted from the run buffer, or from the scratch buffer for large samples.
+// The NAL units are indexed as they are converted, only the small header area is scanned for start codes.
+template <unsigned NaluLengthSize>
+static bool WriteSample(SampleRunReader& reader, uint32_t sample, uint32_t size, const std::vector<uint8_t>& prefix,
+                        std::vector<uint8_t>& scratch, std::vector<uint8_t>& output, NalIndex& nals, bool& reference)
 {
-    const unsigned char* data = sample_data.GetData();
-    unsigned int data_size = sample_data.GetDataSize();
+    const size_t sampleSize = size;
+    const size_t headerSize = sizeof(ACCESS_UNIT_DELIMITER) + prefix.size();
+    constexpr size_t startCodeSize = NaluLengthSize == 4 ? sizeof(START_CODE) : 3;
 
-    // allocate a buffer for the PES packet
-    AP4_DataBuffer frame_data;
-    unsigned char* frame_buffer = nullptr;
+    const auto buffered = reader.Fetch(sample);
+    if (!buffered)
+        return false;
+    const bool direct = buffered->size() != sampleSize;
 
-    // add a delimiter if we don't already have one
-    bool have_access_unit_delimiter = (data_size > nalu_length_size) &&
-                                      ((data[nalu_length_size] & 0x1F) == AP4_AVC_NAL_UNIT_TYPE_ACCESS_UNIT_DELIMITER);
-    if (!have_access_unit_delimiter)
+    const uint8_t* data;
+    uint8_t* out;
+    if constexpr (NaluLengthSize == 4)
     {
-        AP4_Size frame_data_size = frame_data.GetDataSize();
-        frame_data.SetDataSize(frame_data_size + 6);
-        frame_buffer = frame_data.UseData() + frame_data_size;
-
-        // start of access unit
-        frame_buffer[0] = 0;
-        frame_buffer[1] = 0;
-        frame_buffer[2] = 0;
-        frame_buffer[3] = 1;
-        frame_buffer[4] = 9;    // NAL type = Access Unit Delimiter;
-        frame_buffer[5] = 0xE0; // Slice types = ANY
-    }
-
-    // write the NAL units
-    bool prefix_added = false;
-    while (data_size)
+        output.resize(headerSize + sampleSize);
+        if (direct && !reader.ReadDirect(sample, output.data() + headerSize))
+            return false;
+        if (!direct)
+            std::copy_n(buffered->data(), sampleSize, output.data() + headerSize);
+        data = output.data() + headerSize;
+        out = output.data() + headerSize;
+    }
+    else
     {
-        // sanity check
-        if (data_size < nalu_length_size)
-            break;
-
-        // get the next NAL unit
-        AP4_UI32 nalu_size;
-        if (nalu_length_size == 1)
+        if (direct)
         {
-            nalu_size = *data++;
-            data_size--;
+            scratch.resize(sampleSize);
+            if (!reader.ReadDirect(sample, scratch.data()))
+                return false;
         }
-        else if (nalu_length_size == 2)
-        {
-            nalu_size = AP4_BytesToInt16BE(data);
-            data += 2;
-            data_size -= 2;
-        }
-        else if (nalu_length_size == 4)
+        // the output never grows by more than this, empty NAL units are dropped so each one is at least one byte
+        output.resize(headerSize + sampleSize + sampleSize / (NaluLengthSize + 1) * (startCodeSize - NaluLengthSize));
+        data = direct ? scratch.data() : buffered->data();
+        out = output.data() + headerSize;
+    }
+
+    size_t delimiterSize = 0;
+    size_t remaining = sampleSize;
+    bool first = true;
+    bool haveSlices = false;
+    reference = false;
+    nals.clear();
+    while (remaining >= NaluLengthSize)
+    {
+        const AP4_UI32 naluSize = ReadNaluLength<NaluLengthSize>(data);
+        // sanity check
+        if (naluSize > remaining - NaluLengthSize)
+            break;
+        if (naluSize == 0)
         {
-            nalu_size = AP4_BytesToInt32BE(data);
-            data += 4;
-            data_size -= 4;
+            data += NaluLengthSize;
+            remaining -= NaluLengthSize;
+            continue;
         }
+
+        // add a delimiter if we don't already have one
+        const uint8_t naluHeader = data[NaluLengthSize];
+        if (first && (naluHeader & 0x1F) == AP4_AVC_NAL_UNIT_TYPE_ACCESS_UNIT_DELIMITER)
+            delimiterSize = startCodeSize + naluSize;
+        // a leading delimiter is moved into the header and indexed with it
         else
+            nals.push_back({static_cast<uint32_t>(out + startCodeSize - output.data()), naluSize,
+                            static_cast<uint8_t>(naluHeader & 0x1F), static_cast<uint8_t>((naluHeader >> 5) & 3)});
+        first = false;
+
+        const auto naluType = naluHeader & 0x1F;
+        if (naluType == AP4_AVC_NAL_UNIT_TYPE_CODED_SLICE_OF_NON_IDR_PICTURE ||
+            naluType == AP4_AVC_NAL_UNIT_TYPE_CODED_SLICE_OF_IDR_PICTURE)
         {
-            break;
+            haveSlices = true;
+            // nal_ref_idc
+            reference |= (naluHeader & 0x60) != 0;
         }
-        if (nalu_size > data_size)
-            break;
 
-        // add the prefix if needed
-        if (prefix.GetDataSize() && !prefix_added && !have_access_unit_delimiter)
+        if constexpr (NaluLengthSize == 4)
         {
-            AP4_Size frame_data_size = frame_data.GetDataSize();
-            frame_data.SetDataSize(frame_data_size + prefix.GetDataSize());
-            frame_buffer = frame_data.UseData() + frame_data_size;
-            AP4_CopyMemory(frame_buffer, prefix.GetData(), prefix.GetDataSize());
-            prefix_added = true;
+            // in place unless an empty NAL unit was dropped earlier in the sample
+            if (out != data)
+                std::memmove(out + sizeof(START_CODE), data + NaluLengthSize, naluSize);
+            std::copy_n(START_CODE, sizeof(START_CODE), out);
         }
-
-        // add a start code before the NAL unit
-        AP4_Size frame_data_size = frame_data.GetDataSize();
-        frame_data.SetDataSize(frame_data_size + 3 + nalu_size);
-        frame_buffer = frame_data.UseData() + frame_data_size;
-        frame_buffer[0] = 0;
-        frame_buffer[1] = 0;
-        frame_buffer[2] = 1;
-        AP4_CopyMemory(frame_buffer + 3, data, nalu_size);
-
-        // add the prefix if needed
-        if (prefix.GetDataSize() && !prefix_added)
+        else
         {
-            AP4_Size frame_data_size = frame_data.GetDataSize();
-            frame_data.SetDataSize(frame_data_size + prefix.GetDataSize());
-            frame_buffer = frame_data.UseData() + frame_data_size;
-            AP4_CopyMemory(frame_buffer, prefix.GetData(), prefix.GetDataSize());
-            prefix_added = true;
+            std::copy_n(START_CODE + 1, startCodeSize, out);
+            std::memcpy(out + startCodeSize, data + NaluLengthSize, naluSize);
         }
 
-        // move to the next NAL unit
-        data += nalu_size;
-        data_size -= nalu_size;
+        data += NaluLengthSize + naluSize;
+        out += startCodeSize + naluSize;
+        remaining -= NaluLengthSize + naluSize;
     }
+    output.resize(out - output.data());
+    // Without slices there is nothing to decide on, keep it
+    if (!haveSlices)
+        reference = true;
 
-    std::copy_n(frame_data.GetData(), frame_data.GetDataSize(), std::back_inserter(output));
+    WriteHeader(output.data(), prefix, delimiterSize);
+    const auto sampleNals = nals.size();
+    IndexNalUnits({output.data(), headerSize + delimiterSize}, nals);
+    std::rotate(nals.begin(), nals.begin() + sampleNals, nals.end());
+    return true;
 }
 
 /*----------------------------------------------------------------------
@@ -162,6 +214,8 @@ static AP4_Result MakeFramePrefix(AP4_SampleDescription* sdesc, AP4_DataBuffer&
         return AP4_FAILURE;
     }
 
+    nalu_length_size = avc_desc->GetNaluLengthSize();
+
     const auto descFormat = sdesc->GetFormat();
     if (descFormat == AP4_SAMPLE_FORMAT_AVC3 || descFormat == AP4_SAMPLE_FORMAT_AVC4 ||
         descFormat == AP4_SAMPLE_FORMAT_DVAV)
@@ -171,7 +225,6 @@ static AP4_Result MakeFramePrefix(AP4_SampleDescription* sdesc, AP4_DataBuffer&
     }
 
     // make the SPS/PPS prefix
-    nalu_length_size = avc_desc->GetNaluLengthSize();
     for (unsigned int i = 0; i < avc_desc->GetSequenceParameters().ItemCount(); i++)
     {
         AP4_DataBuffer& buffer = avc_desc->GetSequenceParameters()[i];
@@ -200,97 +253,238 @@ static AP4_Result MakeFramePrefix(AP4_SampleDescription* sdesc, AP4_DataBuffer&
     return AP4_SUCCESS;
 }
 
-/*----------------------------------------------------------------------
-|   WriteSamples
-+---------------------------------------------------------------------*/
-static void WriteSamples(AP4_Track* track, AP4_SampleDescription* sdesc, std::vector<uint8_t>& output, std::vector<size_t>& sampleOffsets)
+// Same as above from the payload of an avcC box
+static bool MakeFramePrefix(const std::vector<uint8_t>& avcC, std::vector<uint8_t>& prefix)
 {
-    // make the frame prefix
-    unsigned int nalu_length_size = 0;
-    AP4_DataBuffer prefix;
-    if (AP4_FAILED(MakeFramePrefix(sdesc, prefix, nalu_length_size)))
-    {
-        WHBLogPrint("Failed to make frame prefix");
-        return;
-    }
-
-    AP4_Sample sample;
-    AP4_DataBuffer data;
-    AP4_Ordinal index = 0;
-    while (AP4_SUCCEEDED(track->ReadSample(index, sample, data)))
+    // SPS count in the low 5 bits, the PPS count is a full byte
+    size_t position = 5;
+    for (const uint8_t countMask : {0x1F, 0xFF})
     {
-        sampleOffsets.push_back(output.size());
-        WriteSample(data, prefix, nalu_length_size, output);
-        index++;
+        if (position >= avcC.size())
+            return false;
+        const unsigned count = avcC[position++] & countMask;
+        for (unsigned i = 0; i < count; i++)
+        {
+            if (avcC.size() - position < 2)
+                return false;
+            const size_t size = AP4_BytesToInt16BE(&avcC[position]);
+            position += 2;
+            if (avcC.size() - position < size)
+                return false;
+            prefix.insert(prefix.end(), START_CODE, START_CODE + sizeof(START_CODE));
+            prefix.insert(prefix.end(), avcC.begin() + position, avcC.begin() + position + size);
+            position += size;
+        }
     }
-    WHBLogPrintf("Wrote %d samples", index);
+    return true;
 }
+
 // 16.16 fixed to 32 bit float
 float fixed_to_floating_pt(uint32_t val)
 {
     return (val >> 16) + (val & 0xffff) / 65536.0f;
 }
+
+const char* ParserName(MP4Parser parser)
+{
+    switch (parser)
+    {
+    case MP4Parser::Native:
+        return "native";
+    case MP4Parser::Bento4:
+        return "Bento4";
+    case MP4Parser::IndexCache:
+        return "index cache";
+    }
+    return "unknown";
+}
+
 /*----------------------------------------------------------------------
-|   main
+|   MP4SampleSource
 +---------------------------------------------------------------------*/
-bool LoadAVCTrackFromMP4(const std::filesystem::path& path, H264TrackData& outTrackData)
+MP4SampleSource::MP4SampleSource(const MP4SourceConfig& config) : m_config(config)
+{
+    m_config.readAhead = std::max<size_t>(m_config.readAhead, 1);
+}
+
+MP4SampleSource::~MP4SampleSource()
 {
+    Close();
+}
 
-    AP4_Result result;
+bool MP4SampleSource::Open(const std::filesystem::path& path)
+{
+    Close();
+    const auto openStart = std::chrono::steady_clock::now();
 
-    // create the input stream
-    AP4_ByteStream* input = nullptr;
-    result = AP4_FileByteStream::Create(path.c_str(), AP4_FileByteStream::STREAM_MODE_READ, input);
+    // create the input stream, reads go through a block cache so small box and sample reads don't each hit the SD card
+    AP4_Result result = BlockByteStream::Create(path, m_config.stream, m_input);
     if (AP4_FAILED(result))
     {
         WHBLogPrintf("ERROR: cannot open input (%d)\n", result);
+        m_input = nullptr;
+        return false;
+    }
+
+    m_path = path;
+    if (m_config.indexCache)
+        m_cacheKey = IndexCache::GetKey(path);
+
+    m_openedWith = m_config.parser;
+    if (m_cacheKey && OpenFromCache())
+    {
+        m_openedWith = MP4Parser::IndexCache;
+        // already cached, nothing to write on close
+        m_cacheKey.reset();
+    }
+    else if (m_config.parser == MP4Parser::Native && !OpenNative())
+    {
+        WHBLogPrint("Native MP4 parser can't read the file, using Bento4");
+        m_openedWith = MP4Parser::Bento4;
+    }
+    if (m_openedWith == MP4Parser::Bento4 && !OpenBento4())
+    {
+        m_cacheKey.reset();
+        Close();
+        return false;
+    }
+    m_runReader.Attach(m_input, m_table.get());
+
+    m_nextSample = 0;
+    ReadStreamInfo();
+    if (m_cacheKey && m_cacheTable)
+    {
+        m_cacheWriter = std::make_unique<IndexCacheWriter>(m_path, *m_cacheKey, m_info, m_prefix, m_naluLengthSize,
+                                                           std::move(m_cacheTable));
+    }
+    m_cacheKey.reset();
+    m_openTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - openStart);
+    WHBLogPrintf("Opened in %lld us with the %s parser", static_cast<long long>(m_openTime.count()),
+                 ParserName(m_openedWith));
+    return true;
+}
+
+bool MP4SampleSource::OpenFromCache()
+{
+    auto index = std::make_unique<SampleIndex>();
+    unsigned naluLengthSize = 0;
+    if (!IndexCache::Load(m_path, *m_cacheKey, m_info, m_prefix, naluLengthSize, *index) ||
+        !SetNaluLengthSize(naluLengthSize))
+    {
+        m_info = {};
+        m_prefix.clear();
+        return false;
+    }
+    m_table = std::move(index);
+    return true;
+}
+
+bool MP4SampleSource::OpenNative()
+{
+    MP4VideoTrackBoxes boxes{};
+    if (!ReadVideoTrackBoxes(*m_input, boxes))
         return false;
+
+    // avcC: version, profile, compatibility, level, NAL unit length size
+    if (boxes.avcC.size() < 7 || boxes.timescale == 0)
+        return false;
+    m_info = {};
+    m_info.width = boxes.width;
+    m_info.height = boxes.height;
+    m_info.profile = boxes.avcC[1];
+    m_info.level = boxes.avcC[3];
+    m_info.timescale = boxes.timescale;
+    m_info.duration = boxes.duration;
+
+    m_prefix.clear();
+    // avc3 and avc4 carry SPS/PPS in the elementary stream
+    if ((boxes.format == MakeBoxType("avc1") || boxes.format == MakeBoxType("avc2")) &&
+        !MakeFramePrefix(boxes.avcC, m_prefix))
+        return false;
+    if (!SetNaluLengthSize((boxes.avcC[4] & 3) + 1))
+        return false;
+
+    if (boxes.fragmented)
+    {
+        // samples are found while playing, there is no complete index to cache
+        m_table = FragmentedSampleTable::Create(*m_input, boxes);
+        m_cacheKey.reset();
     }
+    else
+    {
+        // the cache is written from a table of its own, on the writer's thread
+        if (m_cacheKey)
+            m_cacheTable = LazySampleTable::Create(MP4VideoTrackBoxes{boxes});
+        m_table = LazySampleTable::Create(std::move(boxes));
+    }
+    if (!m_table)
+        return false;
+    m_info.sampleCount = m_table->Count();
+
+    WHBLogPrint("Video Track:\n");
+    WHBLogPrintf("  duration: %u ms\n", static_cast<unsigned>(m_info.duration * 1000 / m_info.timescale));
+    WHBLogPrintf("  sample count: %u\n", m_info.sampleCount);
+    WHBLogPrintf("  sync samples: %u\n", m_table->SyncSampleCount());
+    return true;
+}
 
-    // open the file
-    auto input_file = std::make_unique<AP4_File>(*input);
+bool MP4SampleSource::OpenBento4()
+{
+    // parse the file up to and including the moov box, sample data is read later
+    m_file = std::make_unique<AP4_File>(*m_input, true);
 
     // get the movie
-    AP4_Movie* movie = input_file->GetMovie();
+    AP4_Movie* movie = m_file->GetMovie();
     if (movie == nullptr)
     {
         WHBLogPrintf("ERROR: no movie in file\n");
-        input->Release();
         return false;
     }
 
     // get the video track
-    AP4_Track* video_track = movie->GetTrack(AP4_Track::TYPE_VIDEO);
-    if (video_track == nullptr)
+    m_track = movie->GetTrack(AP4_Track::TYPE_VIDEO);
+    if (m_track == nullptr)
     {
         WHBLogPrintf("ERROR: no video track found\n");
-        input->Release();
         return false;
     }
 
     // check that the track is of the right type
-    AP4_SampleDescription* sample_description = video_track->GetSampleDescription(0);
+    AP4_SampleDescription* sample_description = m_track->GetSampleDescription(0);
     if (sample_description == nullptr)
     {
         WHBLogPrintf("ERROR: unable to parse sample description\n");
-        input->Release();
         return false;
     }
-    outTrackData.width = fixed_to_floating_pt(video_track->GetWidth());
-    outTrackData.height = fixed_to_floating_pt(video_track->GetHeight());
+    m_info = {};
+    m_info.width = fixed_to_floating_pt(m_track->GetWidth());
+    m_info.height = fixed_to_floating_pt(m_track->GetHeight());
+    m_info.sampleCount = m_track->GetSampleCount();
+    m_info.timescale = m_track->GetMediaTimeScale();
+    m_info.duration = m_track->GetMediaDuration();
     // show info
     WHBLogPrint("Video Track:\n");
-    WHBLogPrintf("  duration: %u ms\n", video_track->GetDurationMs());
-    WHBLogPrintf("  sample count: %u\n", video_track->GetSampleCount());
+    WHBLogPrintf("  duration: %u ms\n", m_track->GetDurationMs());
+    WHBLogPrintf("  sample count: %u\n", m_info.sampleCount);
 
     switch (sample_description->GetType())
     {
     case AP4_SampleDescription::TYPE_AVC: {
-        WHBLogPrint("Writing samples");
         auto* avc_desc = AP4_DYNAMIC_CAST(AP4_AvcSampleDescription, sample_description);
-        outTrackData.profile = avc_desc->GetProfile();
-        outTrackData.level = avc_desc->GetLevel();
-        WriteSamples(video_track, sample_description, outTrackData.stream, outTrackData.sampleOffsets);
+        m_info.profile = avc_desc->GetProfile();
+        m_info.level = avc_desc->GetLevel();
+
+        // make the frame prefix
+        AP4_DataBuffer prefix;
+        unsigned naluLengthSize = 0;
+        if (AP4_FAILED(MakeFramePrefix(sample_description, prefix, naluLengthSize)))
+        {
+            WHBLogPrint("Failed to make frame prefix");
+            return false;
+        }
+        m_prefix.assign(prefix.GetData(), prefix.GetData() + prefix.GetDataSize());
+        if (!SetNaluLengthSize(naluLengthSize))
+            return false;
         break;
     }
 
@@ -303,6 +497,298 @@ bool LoadAVCTrackFromMP4(const std::filesystem::path& path, H264TrackData& outTr
         return false;
     }
 
-    input->Release();
+    auto index = std::make_unique<SampleIndex>();
+    if (!BuildSampleIndex(*index))
+        return false;
+    if (m_cacheKey)
+        m_cacheTable = std::make_unique<SampleIndex>(*index);
+    m_table = std::move(index);
+    return true;
+}
+
+void MP4SampleSource::ReadStreamInfo()
+{
+    // the track header only has the display size, which anamorphic and cropped streams don't decode to
+    if (ReadParameterSets(m_prefix, m_info))
+        return;
+    // avc3 and avc4 keep the parameter sets in the samples
+    FillWindow();
+    if (!m_window.empty() && ReadParameterSets(m_window.front().data, m_info))
+        return;
+    WHBLogPrint("No SPS found, sizing from the track header");
+    m_info.codedWidth = (m_info.width + MACROBLOCK_SIZE - 1) / MACROBLOCK_SIZE * MACROBLOCK_SIZE;
+    m_info.codedHeight = (m_info.height + MACROBLOCK_SIZE - 1) / MACROBLOCK_SIZE * MACROBLOCK_SIZE;
+}
+
+bool MP4SampleSource::SetNaluLengthSize(unsigned naluLengthSize)
+{
+    m_naluLengthSize = naluLengthSize;
+    switch (m_naluLengthSize)
+    {
+    case 1:
+        m_writeSample = WriteSample<1>;
+        return true;
+    case 2:
+        m_writeSample = WriteSample<2>;
+        return true;
+    case 4:
+        m_writeSample = WriteSample<4>;
+        return true;
+    default:
+        WHBLogPrintf("ERROR: invalid NAL unit length size %u\n", m_naluLengthSize);
+        return false;
+    }
+}
+
+void MP4SampleSource::Close()
+{
+    // a cache still being written is given up on, the file is parsed and cached again next time
+    m_cacheWriter.reset();
+    m_cacheTable.reset();
+    m_cacheKey.reset();
+    m_path.clear();
+    m_window.clear();
+    m_freeBuffers.clear();
+    m_scratch.clear();
+    m_prefix.clear();
+    m_writeSample = nullptr;
+    m_runReader.Detach();
+    m_track = nullptr;
+    m_file.reset();
+    if (m_input)
+    {
+        m_input->Release();
+        m_input = nullptr;
+    }
+    m_info = {};
+    m_table.reset();
+    m_naluLengthSize = 0;
+    m_nextSample = 0;
+}
+
+bool MP4SampleSource::IsOpen() const
+{
+    return m_table != nullptr;
+}
+
+std::optional<AccessUnit> MP4SampleSource::NextAccessUnit()
+{
+    if (m_window.empty())
+        FillWindow();
+    if (m_window.empty())
+        return std::nullopt;
+
+    auto unit = std::make_optional(std::move(m_window.front()));
+    m_window.pop_front();
+    return unit;
+}
+
+void MP4SampleSource::Recycle(std::vector<uint8_t>&& buffer)
+{
+    if (m_freeBuffers.size() >= m_config.readAhead)
+        return;
+    // keep the size, resizing down to the next sample is free while growing would zero the whole buffer again
+    m_freeBuffers.push_back(std::move(buffer));
+}
+
+std::optional<SeekPoint> MP4SampleSource::Seek(uint64_t time)
+{
+    if (!IsOpen() || m_table->Count() == 0)
+        return std::nullopt;
+
+    SeekPoint point{};
+    point.targetSample = m_table->FindSample(time);
+    point.syncSample = m_table->FindSyncSample(point.targetSample);
+    // The samples are found by decode time, but with composition offsets the sync sample can be shown after time
+    const auto target = static_cast<int64_t>(time);
+    while (point.syncSample > 0 && m_table->Pts(point.syncSample) > target)
+        point.syncSample = m_table->FindSyncSample(point.syncSample - 1);
+    // Frames shown from time on, the target sample's own time can be a frame or two later with B-frames
+    point.targetPts = std::max(target, m_table->Pts(point.syncSample));
+
+    while (!m_window.empty())
+    {
+        Recycle(std::move(m_window.front()));
+        m_window.pop_front();
+    }
+    m_nextSample = point.syncSample;
+    return point;
+}
+
+bool MP4SampleSource::CanSeek() const
+{
+    return IsOpen();
+}
+
+bool MP4SampleSource::CanReadSyncSamples() const
+{
+    return IsOpen();
+}
+
+std::optional<uint32_t> MP4SampleSource::FindSyncSample(uint64_t time)
+{
+    if (!IsOpen() || m_table->Count() == 0)
+        return std::nullopt;
+    return m_table->FindSyncSample(m_table->FindSample(time));
+}
+
+std::optional<AccessUnit> MP4SampleSource::ReadSample(uint32_t sample)
+{
+    if (!IsOpen() || sample >= m_table->Count())
+        return std::nullopt;
+
+    AccessUnit unit{};
+    if (!m_freeBuffers.empty())
+    {
+        unit.data = std::move(m_freeBuffers.back());
+        m_freeBuffers.pop_back();
+    }
+    const uint32_t next = std::exchange(m_nextSample, sample);
+    const bool read = ReadAccessUnit(unit);
+    m_nextSample = next;
+    if (!read)
+    {
+        WHBLogPrintf("ERROR: failed to read sample %u\n", sample);
+        return std::nullopt;
+    }
+    return unit;
+}
+
+const H264TrackInfo& MP4SampleSource::GetTrackInfo() const
+{
+    return m_info;
+}
+
+const SampleTable& MP4SampleSource::GetSampleTable() const
+{
+    return *m_table;
+}
+
+MP4Parser MP4SampleSource::GetParser() const
+{
+    return m_openedWith;
+}
+
+const char* MP4SampleSource::GetFormatName() const
+{
+    switch (m_openedWith)
+    {
+    case MP4Parser::Native:
+        return "MP4 (native parser)";
+    case MP4Parser::Bento4:
+        return "MP4 (Bento4)";
+    case MP4Parser::IndexCache:
+        return "MP4 (index cache)";
+    }
+    return "MP4";
+}
+
+std::chrono::microseconds MP4SampleSource::GetOpenTime() const
+{
+    return m_openTime;
+}
+
+bool MP4SampleSource::MayGrow() const
+{
+    return m_config.followGrowingFile && m_table && m_table->IsExtensible();
+}
+
+BlockByteStream::Stats MP4SampleSource::GetIoStats() const
+{
+    return m_input ? m_input->GetStats() : BlockByteStream::Stats{};
+}
+
+SampleRunReader::Stats MP4SampleSource::GetRunStats() const
+{
+    return m_runReader.GetStats();
+}
+
+bool MP4SampleSource::BuildSampleIndex(SampleIndex& index)
+{
+    index.Reserve(m_info.sampleCount);
+    AP4_Sample sample;
+    for (AP4_Ordinal i = 0; i < m_info.sampleCount; ++i)
+    {
+        if (AP4_FAILED(m_track->GetSample(i, sample)))
+        {
+            WHBLogPrintf("ERROR: sample %u missing from sample table\n", i);
+            return false;
+        }
+        index.Append(sample.GetOffset(), sample.GetSize(), sample.GetDts(),
+                       static_cast<int32_t>(sample.GetCts() - sample.GetDts()), sample.IsSync());
+    }
+    index.SetDuration(m_info.duration);
+    WHBLogPrintf("  sync samples: %u\n", index.SyncSampleCount());
+    return true;
+}
+
+bool MP4SampleSource::ReadAccessUnit(AccessUnit& unit)
+{
+    if (!m_writeSample(m_runReader, m_nextSample, m_table->Size(m_nextSample), m_prefix, m_scratch, unit.data,
+                       unit.nals, unit.reference))
+        return false;
+
+    unit.sampleIndex = m_nextSample;
+    unit.dts = static_cast<int64_t>(m_table->Dts(m_nextSample));
+    unit.pts = m_table->Pts(m_nextSample);
+    unit.sync = m_table->IsSync(m_nextSample);
+    m_nextSample++;
+    return true;
+}
+
+bool MP4SampleSource::ExtendTable()
+{
+    if (!m_table->IsExtensible())
+        return false;
+    if (m_config.followGrowingFile)
+        m_input->UpdateSize();
+    return m_table->Extend();
+}
+
+void MP4SampleSource::FillWindow()
+{
+    if (!IsOpen())
+        return;
+
+    while (m_window.size() < m_config.readAhead && (m_nextSample < m_table->Count() || ExtendTable()))
+    {
+        AccessUnit unit{};
+        if (!m_freeBuffers.empty())
+        {
+            unit.data = std::move(m_freeBuffers.back());
+            m_freeBuffers.pop_back();
+        }
+        if (!ReadAccessUnit(unit))
+        {
+            WHBLogPrintf("ERROR: failed to read sample %u\n", m_nextSample);
+            // skip the unreadable sample rather than stalling on it forever
+            m_nextSample++;
+            continue;
+        }
+        m_window.push_back(std::move(unit));
+    }
+}
+
+/*----------------------------------------------------------------------
+|   main
++---------------------------------------------------------------------*/
+bool LoadAVCTrackFromMP4(const std::filesystem::path& path, H264TrackData& outTrackData)
+{
+    MP4SampleSource source;
+    if (!source.Open(path))
+        return false;
+
+    static_cast<H264TrackInfo&>(outTrackData) = source.GetTrackInfo();
+
+    WHBLogPrint("Writing samples");
+    unsigned count = 0;
+    while (auto unit = source.NextAccessUnit())
+    {
+        outTrackData.sampleOffsets.push_back(outTrackData.stream.size());
+        outTrackData.stream.insert(outTrackData.stream.end(), unit->data.begin(), unit->data.end());
+        source.Recycle(std::move(*unit));
+        count++;
+    }
+    WHBLogPrintf("Wrote %u samples", count);
     return true;
 }
@@ -1,15 +1,135 @@
 #pragma once
+#include <chrono>
+#include <cstdint>
+#include <deque>
 #include <filesystem>
+#include <memory>
+#include <optional>
 #include <vector>
 
-struct H264TrackData
+#include "BlockByteStream.h"
+#include "IndexCache.h"
+#include "SampleRunReader.h"
+#include "SampleSource.h"
+#include "SampleTable.h"
+
+class AP4_File;
+class SampleIndex;
+class AP4_Track;
+
+struct H264TrackData : H264TrackInfo
 {
     std::vector<uint8_t> stream;
     std::vector<size_t> sampleOffsets;
-    unsigned width;
-    unsigned height;
-    unsigned profile;
-    unsigned level;
 };
 
+enum class MP4Parser
+{
+    // Walks the boxes itself and decodes the sample tables on demand, falls back to Bento4 for files it can't handle
+    Native,
+    // Builds Bento4's atom tree and a full sample index on open
+    Bento4,
+    // Not parsed at all, loaded from the index cache. Only reported by GetParser.
+    IndexCache,
+};
+
+const char* ParserName(MP4Parser parser);
+
+struct MP4SourceConfig
+{
+    // Access units converted ahead and buffered by the source
+    size_t readAhead = 8;
+    BlockByteStream::Config stream{};
+    MP4Parser parser = MP4Parser::Native;
+    // Load the sample index from an IndexCache file next to the video if there is a valid one, and write one in the
+    // background after a file had to be parsed
+    bool indexCache = true;
+    // Keep looking for new fragments at the end of a fragmented file, for files still being written
+    bool followGrowingFile = false;
+};
+
+// Pull based reader for the AVC track of an MP4 file, plain or fragmented.
+// Only the moov box, or the first fragment, is parsed on open, samples are read on demand and buffered in a window of
+// at most config.readAhead access units, so memory use does not depend on the length of the file.
+class MP4SampleSource : public SampleSource
+{
+  public:
+    explicit MP4SampleSource(const MP4SourceConfig& config = {});
+    ~MP4SampleSource() override;
+
+    MP4SampleSource(const MP4SampleSource&) = delete;
+    MP4SampleSource& operator=(const MP4SampleSource&) = delete;
+
+    bool Open(const std::filesystem::path& path) override;
+    void Close() override;
+    [[nodiscard]] bool IsOpen() const override;
+
+    std::optional<AccessUnit> NextAccessUnit() override;
+    // See MP4SourceConfig::followGrowingFile
+    [[nodiscard]] bool MayGrow() const override;
+    using SampleSource::Recycle;
+    void Recycle(std::vector<uint8_t>&& buffer) override;
+
+    // Access units still in the read-ahead window are discarded
+    std::optional<SeekPoint> Seek(uint64_t time) override;
+    [[nodiscard]] bool CanSeek() const override;
+    [[nodiscard]] bool CanReadSyncSamples() const override;
+    std::optional<uint32_t> FindSyncSample(uint64_t time) override;
+    std::optional<AccessUnit> ReadSample(uint32_t sample) override;
+
+    [[nodiscard]] const H264TrackInfo& GetTrackInfo() const override;
+    [[nodiscard]] const SampleTable& GetSampleTable() const;
+    // Parser the open file was read with and the time opening it took
+    [[nodiscard]] MP4Parser GetParser() const;
+    [[nodiscard]] const char* GetFormatName() const override;
+    [[nodiscard]] std::chrono::microseconds GetOpenTime() const override;
+    [[nodiscard]] BlockByteStream::Stats GetIoStats() const override;
+    [[nodiscard]] SampleRunReader::Stats GetRunStats() const override;
+
+  private:
+    using SampleWriter = bool (*)(SampleRunReader& reader, uint32_t sample, uint32_t size,
+                                  const std::vector<uint8_t>& prefix, std::vector<uint8_t>& scratch,
+                                  std::vector<uint8_t>& output, NalIndex& nals, bool& reference);
+
+    bool OpenFromCache();
+    bool OpenNative();
+    bool OpenBento4();
+    // Sizes and stream properties from the SPS, once the samples can be read
+    void ReadStreamInfo();
+    bool SetNaluLengthSize(unsigned naluLengthSize);
+    bool BuildSampleIndex(SampleIndex& index);
+    bool ReadAccessUnit(AccessUnit& unit);
+    bool ExtendTable();
+    void FillWindow();
+
+  private:
+    MP4SourceConfig m_config;
+    MP4Parser m_openedWith = MP4Parser::Native;
+    std::filesystem::path m_path;
+    // Set while opening a file with no valid index cache yet
+    std::optional<IndexCache::Key> m_cacheKey;
+    // Copy of the sample table for the cache writer
+    std::unique_ptr<SampleTable> m_cacheTable;
+    std::unique_ptr<IndexCacheWriter> m_cacheWriter;
+    std::chrono::microseconds m_openTime{0};
+
+    BlockByteStream* m_input = nullptr;
+    std::unique_ptr<AP4_File> m_file;
+    AP4_Track* m_track = nullptr;
+
+    H264TrackInfo m_info{};
+    std::unique_ptr<SampleTable> m_table;
+    SampleRunReader m_runReader;
+    std::vector<uint8_t> m_prefix;
+    unsigned m_naluLengthSize = 0;
+    // Picked on open for the track's NAL unit length size
+    SampleWriter m_writeSample = nullptr;
+    std::vector<uint8_t> m_scratch;
+    uint32_t m_nextSample = 0;
+
+    std::deque<AccessUnit> m_window;
+    std::vector<std::vector<uint8_t>> m_freeBuffers;
+};
+
+// Reads the whole track into memory, prefer MP4SampleSource for playback
 bool LoadAVCTrackFromMP4(const std::filesystem::path& path, H264TrackData& data);
@@ -0,0 +1,271 @@
+#include "MP4Boxes.h"
+
+#include <bento4/Ap4ByteStream.h>
+#include <bento4/Ap4Utils.h>
+#include <whb/log.h>
+
+constexpr uint32_t BOX_MOOV = MakeBoxType("moov");
+constexpr uint32_t BOX_TRAK = MakeBoxType("trak");
+constexpr uint32_t BOX_TKHD = MakeBoxType("tkhd");
+constexpr uint32_t BOX_MDIA = MakeBoxType("mdia");
+constexpr uint32_t BOX_MDHD = MakeBoxType("mdhd");
+constexpr uint32_t BOX_HDLR = MakeBoxType("hdlr");
+constexpr uint32_t BOX_MINF = MakeBoxType("minf");
+constexpr uint32_t BOX_STBL = MakeBoxType("stbl");
+constexpr uint32_t BOX_STSD = MakeBoxType("stsd");
+constexpr uint32_t BOX_STTS = MakeBoxType("stts");
+constexpr uint32_t BOX_CTTS = MakeBoxType("ctts");
+constexpr uint32_t BOX_STSS = MakeBoxType("stss");
+constexpr uint32_t BOX_STSZ = MakeBoxType("stsz");
+constexpr uint32_t BOX_STSC = MakeBoxType("stsc");
+constexpr uint32_t BOX_STCO = MakeBoxType("stco");
+constexpr uint32_t BOX_CO64 = MakeBoxType("co64");
+constexpr uint32_t BOX_AVCC = MakeBoxType("avcC");
+constexpr uint32_t BOX_MVEX = MakeBoxType("mvex");
+constexpr uint32_t BOX_TREX = MakeBoxType("trex");
+constexpr uint32_t HANDLER_VIDEO = MakeBoxType("vide");
+
+constexpr uint32_t SAMPLE_ENTRY_AVC1 = MakeBoxType("avc1");
+constexpr uint32_t SAMPLE_ENTRY_AVC2 = MakeBoxType("avc2");
+constexpr uint32_t SAMPLE_ENTRY_AVC3 = MakeBoxType("avc3");
+constexpr uint32_t SAMPLE_ENTRY_AVC4 = MakeBoxType("avc4");
+
+// stsd version, flags and entry count, then the header of the first entry
+constexpr size_t STSD_ENTRY_OFFSET = 8;
+// Sample entry header plus the fields of a visual sample entry, the avcC box follows
+constexpr size_t VISUAL_SAMPLE_ENTRY_SIZE = 8 + 78;
+
+bool ReadBoxHeader(AP4_ByteStream& stream, uint64_t offset, uint64_t end, BoxHeader& header)
+{
+    if (offset > end || end - offset < 8)
+        return false;
+
+    uint8_t bytes[16];
+    if (AP4_FAILED(stream.Seek(offset)) || AP4_FAILED(stream.Read(bytes, 8)))
+        return false;
+    uint64_t size = AP4_BytesToUInt32BE(bytes);
+    header.type = AP4_BytesToUInt32BE(bytes + 4);
+
+    uint64_t headerSize = 8;
+    if (size == 1)
+    {
+        if (end - offset < 16 || AP4_FAILED(stream.Read(bytes + 8, 8)))
+            return false;
+        size = AP4_BytesToUInt64BE(bytes + 8);
+        headerSize = 16;
+    }
+    else if (size == 0)
+    {
+        // extends to the end of the file
+        size = end - offset;
+    }
+    if (size < headerSize || size > end - offset)
+        return false;
+
+    header.offset = offset + headerSize;
+    header.size = size - headerSize;
+    return true;
+}
+
+std::optional<BoxHeader> FindBox(AP4_ByteStream& stream, uint64_t begin, uint64_t end, uint32_t type)
+{
+    BoxHeader header;
+    for (uint64_t offset = begin; ReadBoxHeader(stream, offset, end, header); offset = header.End())
+    {
+        if (header.type == type)
+            return header;
+    }
+    return std::nullopt;
+}
+
+bool ReadBoxPayload(AP4_ByteStream& stream, const BoxHeader& box, std::vector<uint8_t>& payload)
+{
+    if (box.size > UINT32_MAX)
+        return false;
+    payload.resize(box.size);
+    return AP4_SUCCEEDED(stream.Seek(box.offset)) &&
+           AP4_SUCCEEDED(stream.Read(payload.data(), static_cast<AP4_Size>(payload.size())));
+}
+
+static bool ReadChildPayload(AP4_ByteStream& stream, const BoxHeader& parent, uint32_t type,
+                             std::vector<uint8_t>& payload)
+{
+    const auto box = FindBox(stream, parent.offset, parent.End(), type);
+    return box && ReadBoxPayload(stream, *box, payload);
+}
+
+bool TakeBox(std::span<const uint8_t>& data, MemoryBox& box)
+{
+    if (data.size() < 8)
+        return false;
+    uint64_t size = AP4_BytesToUInt32BE(data.data());
+    box.type = AP4_BytesToUInt32BE(data.data() + 4);
+    size_t headerSize = 8;
+    if (size == 1)
+    {
+        if (data.size() < 16)
+            return false;
+        size = AP4_BytesToUInt64BE(data.data() + 8);
+        headerSize = 16;
+    }
+    else if (size == 0)
+    {
+        size = data.size();
+    }
+    if (size < headerSize || size > data.size())
+        return false;
+
+    box.payload = data.subspan(headerSize, size - headerSize);
+    data = data.subspan(size);
+    return true;
+}
+
+std::optional<std::span<const uint8_t>> FindBox(std::span<const uint8_t> data, uint32_t type)
+{
+    MemoryBox box;
+    while (TakeBox(data, box))
+    {
+        if (box.type == type)
+            return box.payload;
+    }
+    return std::nullopt;
+}
+
+static bool ReadSampleEntry(const std::vector<uint8_t>& stsd, MP4VideoTrackBoxes& track)
+{
+    if (stsd.size() < STSD_ENTRY_OFFSET + VISUAL_SAMPLE_ENTRY_SIZE || AP4_BytesToUInt32BE(&stsd[4]) == 0)
+        return false;
+
+    const uint8_t* entry = &stsd[STSD_ENTRY_OFFSET];
+    const uint64_t entrySize = AP4_BytesToUInt32BE(entry);
+    track.format = AP4_BytesToUInt32BE(entry + 4);
+    if (track.format != SAMPLE_ENTRY_AVC1 && track.format != SAMPLE_ENTRY_AVC2 &&
+        track.format != SAMPLE_ENTRY_AVC3 && track.format != SAMPLE_ENTRY_AVC4)
+        return false;
+    if (entrySize < VISUAL_SAMPLE_ENTRY_SIZE || entrySize > stsd.size() - STSD_ENTRY_OFFSET)
+        return false;
+
+    // child boxes of the sample entry
+    const auto avcC = FindBox(std::span{entry + VISUAL_SAMPLE_ENTRY_SIZE, entry + entrySize}, BOX_AVCC);
+    if (!avcC)
+        return false;
+    track.avcC.assign(avcC->begin(), avcC->end());
+    return true;
+}
+
+static bool ReadFragmentDefaults(AP4_ByteStream& stream, const BoxHeader& moov, MP4VideoTrackBoxes& track)
+{
+    track.fragmented = false;
+    std::vector<uint8_t> mvex;
+    if (!ReadChildPayload(stream, moov, BOX_MVEX, mvex))
+        return true;
+    track.fragmented = true;
+    track.moovEnd = moov.End();
+
+    // version and flags, track ID, sample description index, duration, size and flags
+    std::span<const uint8_t> boxes{mvex};
+    MemoryBox box;
+    while (TakeBox(boxes, box))
+    {
+        if (box.type == BOX_TREX && box.payload.size() >= 24 && AP4_BytesToUInt32BE(&box.payload[4]) == track.trackId)
+        {
+            track.defaultSampleDuration = AP4_BytesToUInt32BE(&box.payload[12]);
+            track.defaultSampleSize = AP4_BytesToUInt32BE(&box.payload[16]);
+            track.defaultSampleFlags = AP4_BytesToUInt32BE(&box.payload[20]);
+            return true;
+        }
+    }
+    // trex is mandatory for every track in mvex
+    return false;
+}
+
+static bool ReadTrack(AP4_ByteStream& stream, const BoxHeader& trak, MP4VideoTrackBoxes& track)
+{
+    std::vector<uint8_t> payload;
+    const auto mdia = FindBox(stream, trak.offset, trak.End(), BOX_MDIA);
+    if (!mdia || !ReadChildPayload(stream, *mdia, BOX_HDLR, payload) || payload.size() < 12 ||
+        AP4_BytesToUInt32BE(&payload[8]) != HANDLER_VIDEO)
+        return false;
+
+    // presentation size, 16.16 fixed point
+    if (!ReadChildPayload(stream, trak, BOX_TKHD, payload) || payload.empty())
+        return false;
+    const size_t sizeOffset = payload[0] == 1 ? 88 : 76;
+    if (payload.size() < sizeOffset + 8)
+        return false;
+    track.trackId = AP4_BytesToUInt32BE(&payload[payload[0] == 1 ? 20 : 12]);
+    track.width = AP4_BytesToUInt32BE(&payload[sizeOffset]) >> 16;
+    track.height = AP4_BytesToUInt32BE(&payload[sizeOffset + 4]) >> 16;
+
+    if (!ReadChildPayload(stream, *mdia, BOX_MDHD, payload) || payload.empty())
+        return false;
+    if (payload[0] == 1 && payload.size() >= 32)
+    {
+        track.timescale = AP4_BytesToUInt32BE(&payload[20]);
+        track.duration = AP4_BytesToUInt64BE(&payload[24]);
+    }
+    else if (payload[0] == 0 && payload.size() >= 20)
+    {
+        track.timescale = AP4_BytesToUInt32BE(&payload[12]);
+        track.duration = AP4_BytesToUInt32BE(&payload[16]);
+    }
+    else
+    {
+        return false;
+    }
+
+    const auto minf = FindBox(stream, mdia->offset, mdia->End(), BOX_MINF);
+    const auto stbl = minf ? FindBox(stream, minf->offset, minf->End(), BOX_STBL) : std::nullopt;
+    if (!stbl)
+        return false;
+
+    if (!ReadChildPayload(stream, *stbl, BOX_STSD, payload) || !ReadSampleEntry(payload, track))
+        return false;
+
+    // ctts and stss are optional
+    track.ctts.clear();
+    track.stss.clear();
+    if (const auto ctts = FindBox(stream, stbl->offset, stbl->End(), BOX_CTTS))
+    {
+        if (!ReadBoxPayload(stream, *ctts, track.ctts))
+            return false;
+    }
+    if (const auto stss = FindBox(stream, stbl->offset, stbl->End(), BOX_STSS))
+    {
+        if (!ReadBoxPayload(stream, *stss, track.stss))
+            return false;
+    }
+
+    track.co64 = false;
+    if (!ReadChildPayload(stream, *stbl, BOX_STCO, track.stco))
+    {
+        track.co64 = true;
+        if (!ReadChildPayload(stream, *stbl, BOX_CO64, track.stco))
+            return false;
+    }
+    return ReadChildPayload(stream, *stbl, BOX_STTS, track.stts) &&
+           ReadChildPayload(stream, *stbl, BOX_STSZ, track.stsz) &&
+           ReadChildPayload(stream, *stbl, BOX_STSC, track.stsc);
+}
+
+bool ReadVideoTrackBoxes(AP4_ByteStream& stream, MP4VideoTrackBoxes& track)
+{
+    AP4_LargeSize fileSize = 0;
+    if (AP4_FAILED(stream.GetSize(fileSize)))
+        return false;
+
+    const auto moov = FindBox(stream, 0, fileSize, BOX_MOOV);
+    if (!moov)
+    {
+        WHBLogPrint("No moov box found");
+        return false;
+    }
+
+    BoxHeader trak;
+    for (uint64_t offset = moov->offset; ReadBoxHeader(stream, offset, moov->End(), trak); offset = trak.End())
+    {
+        if (trak.type == BOX_TRAK && ReadTrack(stream, trak, track))
+            return ReadFragmentDefaults(stream, *moov, track);
+    }
+    return false;
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <vector>
+
+class AP4_ByteStream;
+
+constexpr uint32_t MakeBoxType(const char (&name)[5])
+{
+    return static_cast<uint32_t>(static_cast<uint8_t>(name[0])) << 24 |
+           static_cast<uint32_t>(static_cast<uint8_t>(name[1])) << 16 |
+           static_cast<uint32_t>(static_cast<uint8_t>(name[2])) << 8 |
+           static_cast<uint32_t>(static_cast<uint8_t>(name[3]));
+}
+
+struct BoxHeader
+{
+    uint32_t type;
+    // Position and size of the payload, after the size and type fields
+    uint64_t offset;
+    uint64_t size;
+
+    [[nodiscard]] uint64_t End() const
+    {
+        return offset + size;
+    }
+};
+
+// Reads the header of the box starting at offset, the box has to end at or before end
+bool ReadBoxHeader(AP4_ByteStream& stream, uint64_t offset, uint64_t end, BoxHeader& header);
+// First box of the given type in [begin, end), the others are skipped by their size without reading them
+std::optional<BoxHeader> FindBox(AP4_ByteStream& stream, uint64_t begin, uint64_t end, uint32_t type);
+bool ReadBoxPayload(AP4_ByteStream& stream, const BoxHeader& box, std::vector<uint8_t>& payload);
+
+// Box inside a payload that was already read
+struct MemoryBox
+{
+    uint32_t type;
+    std::span<const uint8_t> payload;
+};
+
+// Takes the next box off the front of data, false at the end or if the box doesn't fit
+bool TakeBox(std::span<const uint8_t>& data, MemoryBox& box);
+std::optional<std::span<const uint8_t>> FindBox(std::span<const uint8_t> data, uint32_t type);
+
+// The boxes of a video track needed for playback.
+// Sample tables are kept as they are in the file, including version and flags, and decoded by LazySampleTable.
+struct MP4VideoTrackBoxes
+{
+    unsigned width;
+    unsigned height;
+    uint32_t timescale;
+    uint64_t duration;
+    // Sample entry type, avc1 to avc4
+    uint32_t format;
+    // Payload of the avcC box
+    std::vector<uint8_t> avcC;
+
+    std::vector<uint8_t> stts;
+    std::vector<uint8_t> ctts;
+    std::vector<uint8_t> stss;
+    std::vector<uint8_t> stsz;
+    std::vector<uint8_t> stsc;
+    std::vector<uint8_t> stco;
+    // stco holds a co64 box
+    bool co64;
+
+    uint32_t trackId;
+    // Set if moov has an mvex box, the samples are then in movie fragments after moov
+    bool fragmented;
+    // trex defaults for the samples of fragments
+    uint32_t defaultSampleDuration;
+    uint32_t defaultSampleSize;
+    uint32_t defaultSampleFlags;
+    // Fragments are searched for from here
+    uint64_t moovEnd;
+};
+
+// Finds moov wherever it is in the file, mdat is skipped by its size, and reads the boxes of the first AVC track.
+// For fragmented files the track's trex defaults are read as well, its sample tables are then empty.
+// Fails for anything it doesn't handle, such as protected tracks or compact sample sizes.
+bool ReadVideoTrackBoxes(AP4_ByteStream& stream, MP4VideoTrackBoxes& track);
@@ -0,0 +1,128 @@
+#include "MemoryArena.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iterator>
+#include <new>
+#include <vector>
+
+// Buffer sizes are rounded up to this, so freed ranges don't leave slivers too small for anything
+constexpr size_t SIZE_GRANULE = 0x40;
+
+static size_t AlignUp(size_t value, size_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+void MemoryArena::Deleter::operator()(void* data) const
+{
+    if (arena)
+        arena->Free(data);
+    else
+        std::free(data);
+}
+
+MemoryArena::MemoryArena(size_t capacity, Predicate predicate) : m_capacity(AlignUp(capacity, REGION_ALIGNMENT))
+{
+    std::vector<void*> rejected;
+    for (unsigned attempt = 0; attempt < RESERVE_ATTEMPTS && !m_region; ++attempt)
+    {
+        auto* region = std::aligned_alloc(REGION_ALIGNMENT, m_capacity);
+        if (!region)
+            break;
+        if (!predicate || predicate(region, m_capacity))
+            m_region = static_cast<uint8_t*>(region);
+        else
+            rejected.push_back(region);
+    }
+    for (auto* region : rejected)
+        std::free(region);
+    if (!m_region)
+        throw std::bad_alloc();
+
+    m_free.emplace(0, m_capacity);
+}
+
+MemoryArena::~MemoryArena()
+{
+    std::free(m_region);
+}
+
+void* MemoryArena::Allocate(size_t size, size_t alignment)
+{
+    size = AlignUp(std::max<size_t>(size, 1), SIZE_GRANULE);
+    std::scoped_lock l{m_mutex};
+    for (auto it = m_free.begin(); it != m_free.end(); ++it)
+    {
+        const auto [offset, freeSize] = *it;
+        const auto address = reinterpret_cast<uintptr_t>(m_region) + offset;
+        const size_t start = offset + (AlignUp(address, alignment) - address);
+        if (start + size > offset + freeSize)
+            continue;
+
+        // Whatever is left on either side stays free
+        m_free.erase(it);
+        if (start > offset)
+            m_free.emplace(offset, start - offset);
+        if (start + size < offset + freeSize)
+            m_free.emplace(start + size, offset + freeSize - start - size);
+        m_used.emplace(start, size);
+
+        m_usedBytes += size;
+        m_highWater = std::max(m_highWater, m_usedBytes);
+        m_peakBuffers = std::max(m_peakBuffers, static_cast<unsigned>(m_used.size()));
+        m_allocations++;
+        return m_region + start;
+    }
+    m_failures++;
+    return nullptr;
+}
+
+void MemoryArena::Free(void* data)
+{
+    if (!data)
+        return;
+    std::scoped_lock l{m_mutex};
+    const auto used = m_used.find(static_cast<size_t>(static_cast<uint8_t*>(data) - m_region));
+    if (used == m_used.end())
+        return;
+    auto [offset, size] = *used;
+    m_used.erase(used);
+    m_usedBytes -= size;
+
+    // Merge with the free ranges right after and right before
+    const auto next = m_free.find(offset + size);
+    if (next != m_free.end())
+    {
+        size += next->second;
+        m_free.erase(next);
+    }
+    const auto after = m_free.lower_bound(offset);
+    if (after != m_free.begin())
+    {
+        const auto previous = std::prev(after);
+        if (previous->first + previous->second == offset)
+        {
+            previous->second += size;
+            return;
+        }
+    }
+    m_free.emplace(offset, size);
+}
+
+void* MemoryArena::AllocateRaw(MemoryArena* arena, size_t size, size_t alignment)
+{
+    if (arena)
+        return arena->Allocate(size, alignment);
+    return std::aligned_alloc(alignment, AlignUp(size, alignment));
+}
+
+MemoryArena::Stats MemoryArena::GetStats() const
+{
+    std::scoped_lock l{m_mutex};
+    size_t largestFree = 0;
+    for (const auto& [offset, size] : m_free)
+        largestFree = std::max(largestFree, size);
+    return {m_capacity, m_usedBytes, m_highWater, largestFree, static_cast<unsigned>(m_used.size()), m_peakBuffers,
+            m_allocations, m_failures};
+}
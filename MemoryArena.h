@@ -0,0 +1,81 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+
+// One region reserved and validated up front that long lived buffers are carved out of, so their memory doesn't
+// depend on the state of the heap. Freed buffers merge with free neighbours and the first fitting range is used,
+// which keeps the layout the same from run to run. Thread safe.
+class MemoryArena
+{
+  public:
+    // True if a range of memory can be used, H264Decoder::CheckMemory for memory the decoder works in
+    using Predicate = std::function<bool(const void* data, size_t size)>;
+
+    struct Stats
+    {
+        size_t capacity;
+        size_t used;
+        size_t highWater;
+        size_t largestFree;
+        unsigned buffers;
+        unsigned peakBuffers;
+        uint64_t allocations;
+        // Allocate calls that found no free range large enough
+        uint64_t failures;
+    };
+
+    // Frees into the arena, or with std::free for buffers allocated without one
+    struct Deleter
+    {
+        MemoryArena* arena = nullptr;
+        void operator()(void* data) const;
+    };
+    template <typename T> using Pointer = std::unique_ptr<T, Deleter>;
+
+    static constexpr size_t DEFAULT_ALIGNMENT = 0x100;
+    // Of the region itself, the most any buffer needs without wasting space in front of it
+    static constexpr size_t REGION_ALIGNMENT = 0x1000;
+    // Regions failing the predicate are held on to while retrying so the heap hands out a different one each time
+    static constexpr unsigned RESERVE_ATTEMPTS = 8;
+
+    // Throws std::bad_alloc if no region of capacity bytes passing predicate is found
+    explicit MemoryArena(size_t capacity, Predicate predicate = {});
+    ~MemoryArena();
+
+    MemoryArena(const MemoryArena&) = delete;
+    MemoryArena& operator=(const MemoryArena&) = delete;
+
+    // nullptr if no free range is large enough
+    void* Allocate(size_t size, size_t alignment = DEFAULT_ALIGNMENT);
+    void Free(void* data);
+
+    // From arena, or from the heap if it is nullptr
+    template <typename T>
+    static Pointer<T> Allocate(MemoryArena* arena, size_t size, size_t alignment = DEFAULT_ALIGNMENT)
+    {
+        return Pointer<T>(static_cast<T*>(AllocateRaw(arena, size, alignment)), Deleter{arena});
+    }
+
+    [[nodiscard]] Stats GetStats() const;
+
+  private:
+    static void* AllocateRaw(MemoryArena* arena, size_t size, size_t alignment);
+
+  private:
+    uint8_t* m_region = nullptr;
+    size_t m_capacity;
+
+    mutable std::mutex m_mutex;
+    // Offset to size, free ranges never touch each other
+    std::map<size_t, size_t> m_free;
+    std::map<size_t, size_t> m_used;
+    size_t m_usedBytes = 0;
+    size_t m_highWater = 0;
+    unsigned m_peakBuffers = 0;
+    uint64_t m_allocations = 0;
+    uint64_t m_failures = 0;
+};
@@ -0,0 +1,160 @@
+#include "OutputQueue.h"
+
+#include <algorithm>
+#include <utility>
+
+// Buffers held by the consumer are released without notifying, so stalls also recheck the pool this often
+constexpr auto STALL_RECHECK_INTERVAL = std::chrono::milliseconds(2);
+
+unsigned OutputQueue::DepthForBudget(size_t budgetBytes, size_t frameSize)
+{
+    if (frameSize == 0)
+        return 1;
+    return std::max<size_t>(budgetBytes / frameSize, 1);
+}
+
+OutputQueue::OutputQueue(size_t frameSize, unsigned depth, unsigned heldFrames, Policy policy, MemoryArena* arena)
+    : m_pool(frameSize, std::max(depth, 1u) + heldFrames, arena), m_frames(std::max(depth, 1u)), m_policy(policy)
+{
+}
+
+FramePool::Handle OutputQueue::AcquireBuffer(bool reference)
+{
+    std::unique_lock l{m_mutex};
+    bool stalled = false;
+    while (!m_closed)
+    {
+        if (m_count < m_frames.size())
+        {
+            if (auto buffer = m_pool.Acquire())
+                return buffer;
+        }
+
+        if (m_policy == Policy::DropOldest && m_count > 0)
+        {
+            EraseLocked(0);
+            m_stats.droppedOldest++;
+            continue;
+        }
+        if (m_policy == Policy::DropNonReference)
+        {
+            if (!reference)
+            {
+                m_stats.droppedNonReference++;
+                return {};
+            }
+            size_t position = 0;
+            while (position < m_count && m_frames[(m_head + position) % m_frames.size()]->reference)
+                position++;
+            if (position < m_count)
+            {
+                EraseLocked(position);
+                m_stats.droppedNonReference++;
+                continue;
+            }
+        }
+
+        // once per frame, however often the pool is rechecked
+        if (!std::exchange(stalled, true))
+            m_stats.stalls++;
+        const auto stallStart = std::chrono::steady_clock::now();
+        m_frameTaken.wait_for(l, STALL_RECHECK_INTERVAL);
+        m_stats.stallTime +=
+            std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - stallStart);
+    }
+    return {};
+}
+
+void OutputQueue::Push(DecodedFrame frame, unsigned epoch)
+{
+    std::scoped_lock l{m_mutex};
+    // AcquireBuffer made sure there is space
+    if (m_closed || epoch != m_epoch || m_count >= m_frames.size())
+        return;
+    m_frames[(m_head + m_count) % m_frames.size()].emplace(std::move(frame));
+    m_count++;
+    m_stats.queued++;
+}
+
+std::optional<DecodedFrame> OutputQueue::TryPop()
+{
+    std::unique_lock l{m_mutex};
+    if (m_count == 0)
+        return std::nullopt;
+    auto frame = std::move(m_frames[m_head]);
+    m_frames[m_head].reset();
+    m_head = (m_head + 1) % m_frames.size();
+    m_count--;
+    l.unlock();
+    m_frameTaken.notify_one();
+    return frame;
+}
+
+unsigned OutputQueue::GetEpoch() const
+{
+    std::scoped_lock l{m_mutex};
+    return m_epoch;
+}
+
+void OutputQueue::SetPolicy(Policy policy)
+{
+    std::scoped_lock l{m_mutex};
+    m_policy = policy;
+}
+
+void OutputQueue::Clear()
+{
+    {
+        std::scoped_lock l{m_mutex};
+        while (m_count > 0)
+            EraseLocked(0);
+        m_epoch++;
+    }
+    m_frameTaken.notify_all();
+}
+
+void OutputQueue::Close()
+{
+    {
+        std::scoped_lock l{m_mutex};
+        m_closed = true;
+    }
+    m_frameTaken.notify_all();
+}
+
+size_t OutputQueue::GetFrameSize() const
+{
+    return m_pool.GetFrameSize();
+}
+
+unsigned OutputQueue::GetDepth() const
+{
+    return m_frames.size();
+}
+
+OutputQueue::Stats OutputQueue::GetStats() const
+{
+    std::scoped_lock l{m_mutex};
+    return m_stats;
+}
+
+FramePool::Stats OutputQueue::GetPoolStats() const
+{
+    return m_pool.GetStats();
+}
+
+void OutputQueue::EraseLocked(size_t position)
+{
+    const auto size = m_frames.size();
+    if (position == 0)
+    {
+        m_frames[m_head].reset();
+        m_head = (m_head + 1) % size;
+        m_count--;
+        return;
+    }
+    for (auto i = position; i + 1 < m_count; ++i)
+        m_frames[(m_head + i) % size] = std::move(m_frames[(m_head + i + 1) % size]);
+    m_frames[(m_head + m_count - 1) % size].reset();
+    m_count--;
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include "FramePool.h"
+
+struct DecodedFrame
+{
+    // NV12, goes back to the frame pool once the last copy is dropped
+    FramePool::Handle buffer;
+    int32_t width;
+    int32_t height;
+    int32_t pitch;
+    // In timescale units of the track
+    int64_t timestamp;
+    // False if no slice of the picture had a nonzero nal_ref_idc
+    bool reference;
+};
+
+// Depth limited queue of decoded frames together with the pool backing them.
+// The policy decides what happens when the consumer falls behind and the queue or pool runs out of space.
+class OutputQueue
+{
+  public:
+    enum class Policy
+    {
+        // Stall the decoder until the consumer takes a frame
+        Block,
+        // Throw away the oldest queued frame
+        DropOldest,
+        // Throw away the new frame if it is a non-reference picture, otherwise the oldest queued non-reference picture.
+        // Stalls if there is neither.
+        DropNonReference,
+    };
+
+    struct Stats
+    {
+        uint64_t queued;
+        uint64_t droppedOldest;
+        uint64_t droppedNonReference;
+        // Frames the decoder had to wait for a buffer for, and the time it waited
+        uint64_t stalls;
+        std::chrono::microseconds stallTime;
+    };
+
+    // Number of queued frames that fit into budgetBytes, at least one
+    static unsigned DepthForBudget(size_t budgetBytes, size_t frameSize);
+
+    // The frame pool is carved from arena if there is one. It has room for heldFrames on top of the queue depth, the
+    // most the consumer holds on to at once, so the decoder doesn't stall on those.
+    OutputQueue(size_t frameSize, unsigned depth, unsigned heldFrames, Policy policy, MemoryArena* arena = nullptr);
+
+    // Decoder side. Returns an empty handle if the frame is to be dropped.
+    FramePool::Handle AcquireBuffer(bool reference);
+    // Dropped if the queue was cleared since epoch was taken with GetEpoch
+    void Push(DecodedFrame frame, unsigned epoch);
+    [[nodiscard]] unsigned GetEpoch() const;
+
+    // Consumer side, doesn't wait
+    std::optional<DecodedFrame> TryPop();
+
+    void SetPolicy(Policy policy);
+    // Drops all queued frames and starts a new epoch, so frames of the old one still being written are dropped too
+    void Clear();
+    // Wakes up a stalled decoder, every later AcquireBuffer fails
+    void Close();
+
+    [[nodiscard]] size_t GetFrameSize() const;
+    [[nodiscard]] unsigned GetDepth() const;
+    [[nodiscard]] Stats GetStats() const;
+    [[nodiscard]] FramePool::Stats GetPoolStats() const;
+
+  private:
+    void EraseLocked(size_t position);
+
+  private:
+    FramePool m_pool;
+    std::vector<std::optional<DecodedFrame>> m_frames;
+    size_t m_head = 0;
+    size_t m_count = 0;
+    unsigned m_epoch = 0;
+    Policy m_policy;
+    bool m_closed = false;
+    Stats m_stats{};
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_frameTaken;
+};
@@ -0,0 +1,394 @@
+#include "ParameterSets.h"
+#include "BitReader.h"
+
+#include <algorithm>
+#include <bit>
+#include <iterator>
+#include <vector>
+
+// Pictures are limited to 8192x8192, the console decoder does not go past 1920x1088 anyway
+constexpr unsigned MAX_SIZE_IN_MBS = 8192 / MACROBLOCK_SIZE;
+constexpr unsigned MAX_DPB_FRAMES = 16;
+constexpr uint8_t ASPECT_RATIO_EXTENDED_SAR = 255;
+
+struct LevelLimits
+{
+    uint8_t levelIdc;
+    // In macroblocks
+    uint32_t maxFrameSize;
+    uint32_t maxDpbSize;
+};
+
+// Table A-1, in ascending order. Level 1b is coded as 9 here, or as 11 with constraint_set3_flag in the Baseline and
+// Main profiles, which then just gets the larger limits of level 1.1.
+constexpr LevelLimits LEVEL_LIMITS[]{
+    {10, 99, 396},        {9, 99, 396},         {11, 396, 900},       {12, 396, 2376},     {13, 396, 2376},
+    {20, 396, 2376},      {21, 792, 4752},      {22, 1620, 8100},     {30, 1620, 8100},    {31, 3600, 18000},
+    {32, 5120, 20480},    {40, 8192, 32768},    {41, 8192, 32768},    {42, 8704, 34816},   {50, 22080, 110400},
+    {51, 36864, 184320},  {52, 36864, 184320},  {60, 139264, 696320}, {61, 139264, 696320}, {62, 139264, 696320},
+};
+
+// Table E-1, sample aspect ratios for aspect_ratio_idc 1 to 16
+constexpr uint16_t SAMPLE_ASPECT_RATIOS[][2]{
+    {1, 1},   {12, 11}, {10, 11}, {16, 11}, {40, 33}, {24, 11}, {20, 11}, {32, 11},
+    {80, 33}, {18, 11}, {15, 11}, {64, 33}, {160, 99}, {4, 3},  {3, 2},   {2, 1},
+};
+
+// Strips the emulation prevention byte of every 00 00 03
+static std::vector<uint8_t> ToRbsp(std::span<const uint8_t> nal)
+{
+    std::vector<uint8_t> rbsp;
+    rbsp.reserve(nal.size());
+    unsigned zeros = 0;
+    for (const uint8_t byte : nal)
+    {
+        if (zeros >= 2 && byte == 3)
+        {
+            zeros = 0;
+            continue;
+        }
+        zeros = byte == 0 ? zeros + 1 : 0;
+        rbsp.push_back(byte);
+    }
+    return rbsp;
+}
+
+static bool HasChromaFormat(uint8_t profileIdc)
+{
+    switch (profileIdc)
+    {
+    case 100:
+    case 110:
+    case 122:
+    case 244:
+    case 44:
+    case 83:
+    case 86:
+    case 118:
+    case 128:
+    case 138:
+    case 139:
+    case 134:
+    case 135:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// The lists themselves only matter to the decoder
+static void SkipScalingList(BitReader& reader, unsigned size)
+{
+    int lastScale = 8;
+    int nextScale = 8;
+    for (unsigned i = 0; i < size; ++i)
+    {
+        if (nextScale != 0)
+            nextScale = (lastScale + reader.ReadSE() + 256) % 256;
+        if (nextScale != 0)
+            lastScale = nextScale;
+    }
+}
+
+static void SkipScalingLists(BitReader& reader, unsigned count)
+{
+    for (unsigned i = 0; i < count && !reader.Overrun(); ++i)
+    {
+        if (reader.ReadFlag())
+            SkipScalingList(reader, i < 6 ? 16 : 64);
+    }
+}
+
+static bool SkipHrdParameters(BitReader& reader)
+{
+    const unsigned cpbCount = reader.ReadUE() + 1;
+    if (cpbCount > 32)
+        return false;
+    // bit_rate_scale, cpb_size_scale
+    reader.SkipBits(8);
+    for (unsigned i = 0; i < cpbCount && !reader.Overrun(); ++i)
+    {
+        reader.ReadUE();
+        reader.ReadUE();
+        reader.SkipBits(1);
+    }
+    // initial_cpb_removal_delay_length_minus1, cpb_removal_delay_length_minus1, dpb_output_delay_length_minus1,
+    // time_offset_length
+    reader.SkipBits(20);
+    return !reader.Overrun();
+}
+
+static bool ParseVui(BitReader& reader, SequenceParameterSet& sps)
+{
+    if (reader.ReadFlag())
+    {
+        const auto aspectRatioIdc = static_cast<uint8_t>(reader.ReadBits(8));
+        if (aspectRatioIdc == ASPECT_RATIO_EXTENDED_SAR)
+        {
+            sps.sarWidth = reader.ReadBits(16);
+            sps.sarHeight = reader.ReadBits(16);
+        }
+        else if (aspectRatioIdc >= 1 && aspectRatioIdc <= std::size(SAMPLE_ASPECT_RATIOS))
+        {
+            sps.sarWidth = SAMPLE_ASPECT_RATIOS[aspectRatioIdc - 1][0];
+            sps.sarHeight = SAMPLE_ASPECT_RATIOS[aspectRatioIdc - 1][1];
+        }
+    }
+    // overscan_info_present_flag, overscan_appropriate_flag
+    if (reader.ReadFlag())
+        reader.SkipBits(1);
+    if (reader.ReadFlag())
+    {
+        // video_format
+        reader.SkipBits(3);
+        sps.fullRange = reader.ReadFlag();
+        if (reader.ReadFlag())
+        {
+            sps.colourPrimaries = reader.ReadBits(8);
+            sps.transferCharacteristics = reader.ReadBits(8);
+            sps.matrixCoefficients = reader.ReadBits(8);
+        }
+    }
+    // chroma_loc_info_present_flag, chroma sample locations of both fields
+    if (reader.ReadFlag())
+    {
+        reader.ReadUE();
+        reader.ReadUE();
+    }
+    if (reader.ReadFlag())
+    {
+        sps.numUnitsInTick = reader.ReadBits(32);
+        sps.timeScale = reader.ReadBits(32);
+        sps.fixedFrameRate = reader.ReadFlag();
+    }
+    const bool nalHrd = reader.ReadFlag();
+    if (nalHrd && !SkipHrdParameters(reader))
+        return false;
+    const bool vclHrd = reader.ReadFlag();
+    if (vclHrd && !SkipHrdParameters(reader))
+        return false;
+    // low_delay_hrd_flag
+    if (nalHrd || vclHrd)
+        reader.SkipBits(1);
+    // pic_struct_present_flag
+    reader.SkipBits(1);
+    if (reader.ReadFlag())
+    {
+        // motion_vectors_over_pic_boundaries_flag, max_bytes_per_pic_denom, max_bits_per_mb_denom,
+        // log2_max_mv_length_horizontal, log2_max_mv_length_vertical
+        reader.SkipBits(1);
+        for (int i = 0; i < 4; ++i)
+            reader.ReadUE();
+        sps.maxNumReorderFrames = reader.ReadUE();
+        sps.maxDecFrameBuffering = reader.ReadUE();
+        if (sps.maxDecFrameBuffering > MAX_DPB_FRAMES || sps.maxNumReorderFrames > sps.maxDecFrameBuffering)
+            return false;
+    }
+    return !reader.Overrun();
+}
+
+std::optional<SequenceParameterSet> ParseSequenceParameterSet(std::span<const uint8_t> nal)
+{
+    if (nal.empty() || (nal[0] & 0x1F) != 7)
+        return std::nullopt;
+    const auto rbsp = ToRbsp(nal.subspan(1));
+    BitReader reader(rbsp);
+
+    SequenceParameterSet sps{};
+    sps.profileIdc = reader.ReadBits(8);
+    sps.constraintFlags = reader.ReadBits(8);
+    sps.levelIdc = reader.ReadBits(8);
+    sps.id = reader.ReadUE();
+    if (sps.id > 31)
+        return std::nullopt;
+
+    sps.chromaFormatIdc = 1;
+    bool separateColourPlanes = false;
+    if (HasChromaFormat(sps.profileIdc))
+    {
+        sps.chromaFormatIdc = reader.ReadUE();
+        if (sps.chromaFormatIdc > 3)
+            return std::nullopt;
+        if (sps.chromaFormatIdc == 3)
+            separateColourPlanes = reader.ReadFlag();
+        sps.bitDepthLuma = reader.ReadUE() + 8;
+        sps.bitDepthChroma = reader.ReadUE() + 8;
+        // qpprime_y_zero_transform_bypass_flag
+        reader.SkipBits(1);
+        if (reader.ReadFlag())
+            SkipScalingLists(reader, sps.chromaFormatIdc != 3 ? 8 : 12);
+    }
+    else
+    {
+        sps.bitDepthLuma = 8;
+        sps.bitDepthChroma = 8;
+    }
+
+    // log2_max_frame_num_minus4
+    reader.ReadUE();
+    const unsigned picOrderCntType = reader.ReadUE();
+    if (picOrderCntType == 0)
+    {
+        // log2_max_pic_order_cnt_lsb_minus4
+        reader.ReadUE();
+    }
+    else if (picOrderCntType == 1)
+    {
+        // delta_pic_order_always_zero_flag, offset_for_non_ref_pic, offset_for_top_to_bottom_field
+        reader.SkipBits(1);
+        reader.ReadSE();
+        reader.ReadSE();
+        const unsigned cycleLength = reader.ReadUE();
+        if (cycleLength > 255)
+            return std::nullopt;
+        for (unsigned i = 0; i < cycleLength && !reader.Overrun(); ++i)
+            reader.ReadSE();
+    }
+    else if (picOrderCntType != 2)
+    {
+        return std::nullopt;
+    }
+
+    sps.maxNumRefFrames = reader.ReadUE();
+    // gaps_in_frame_num_value_allowed_flag
+    reader.SkipBits(1);
+    const unsigned widthInMbs = reader.ReadUE() + 1;
+    const unsigned heightInMapUnits = reader.ReadUE() + 1;
+    sps.frameMbsOnly = reader.ReadFlag();
+    // mb_adaptive_frame_field_flag
+    if (!sps.frameMbsOnly)
+        reader.SkipBits(1);
+    // direct_8x8_inference_flag
+    reader.SkipBits(1);
+    const unsigned heightInMbs = heightInMapUnits * (sps.frameMbsOnly ? 1 : 2);
+    if (reader.Overrun() || sps.maxNumRefFrames > MAX_DPB_FRAMES || widthInMbs > MAX_SIZE_IN_MBS ||
+        heightInMbs > MAX_SIZE_IN_MBS)
+        return std::nullopt;
+    sps.codedWidth = widthInMbs * MACROBLOCK_SIZE;
+    sps.codedHeight = heightInMbs * MACROBLOCK_SIZE;
+
+    if (reader.ReadFlag())
+    {
+        // crop units of 7.4.2.1.1, monochrome and separately coded planes are cropped like luma
+        const unsigned chromaArrayType = separateColourPlanes ? 0 : sps.chromaFormatIdc;
+        const unsigned unitX = chromaArrayType == 1 || chromaArrayType == 2 ? 2 : 1;
+        const unsigned unitY = (chromaArrayType == 1 ? 2 : 1) * (sps.frameMbsOnly ? 1 : 2);
+        const uint64_t left = uint64_t{reader.ReadUE()} * unitX;
+        const uint64_t right = uint64_t{reader.ReadUE()} * unitX;
+        const uint64_t top = uint64_t{reader.ReadUE()} * unitY;
+        const uint64_t bottom = uint64_t{reader.ReadUE()} * unitY;
+        if (left + right >= sps.codedWidth || top + bottom >= sps.codedHeight)
+            return std::nullopt;
+        sps.cropLeft = left;
+        sps.cropRight = right;
+        sps.cropTop = top;
+        sps.cropBottom = bottom;
+    }
+
+    const unsigned levelDpbFrames = MaxDpbFrames(sps.levelIdc, widthInMbs, heightInMbs);
+    sps.maxDecFrameBuffering = levelDpbFrames != 0 ? levelDpbFrames : MAX_DPB_FRAMES;
+    sps.maxNumReorderFrames = sps.maxDecFrameBuffering;
+    if (reader.ReadFlag() && !ParseVui(reader, sps))
+        return std::nullopt;
+    if (reader.Overrun())
+        return std::nullopt;
+    return sps;
+}
+
+std::optional<PictureParameterSet> ParsePictureParameterSet(std::span<const uint8_t> nal, unsigned chromaFormatIdc)
+{
+    if (nal.empty() || (nal[0] & 0x1F) != 8)
+        return std::nullopt;
+    const auto rbsp = ToRbsp(nal.subspan(1));
+    BitReader reader(rbsp);
+
+    PictureParameterSet pps{};
+    pps.id = reader.ReadUE();
+    pps.spsId = reader.ReadUE();
+    if (pps.id > 255 || pps.spsId > 31)
+        return std::nullopt;
+    pps.entropyCodingMode = reader.ReadFlag();
+    pps.bottomFieldPicOrderInFramePresent = reader.ReadFlag();
+    pps.numSliceGroups = reader.ReadUE() + 1;
+    if (pps.numSliceGroups > 8)
+        return std::nullopt;
+    if (pps.numSliceGroups > 1)
+    {
+        const unsigned mapType = reader.ReadUE();
+        if (mapType == 0)
+        {
+            // run_length_minus1 of every group
+            for (unsigned i = 0; i < pps.numSliceGroups; ++i)
+                reader.ReadUE();
+        }
+        else if (mapType == 2)
+        {
+            // top_left and bottom_right of every group but the last
+            for (unsigned i = 0; i + 1 < pps.numSliceGroups; ++i)
+            {
+                reader.ReadUE();
+                reader.ReadUE();
+            }
+        }
+        else if (mapType >= 3 && mapType <= 5)
+        {
+            // slice_group_change_direction_flag, slice_group_change_rate_minus1
+            reader.SkipBits(1);
+            reader.ReadUE();
+        }
+        else if (mapType == 6)
+        {
+            const uint64_t mapUnits = uint64_t{reader.ReadUE()} + 1;
+            if (mapUnits > MAX_SIZE_IN_MBS * MAX_SIZE_IN_MBS)
+                return std::nullopt;
+            reader.SkipBits(mapUnits * std::bit_width(pps.numSliceGroups - 1));
+        }
+        else if (mapType > 6)
+        {
+            return std::nullopt;
+        }
+    }
+    pps.numRefIdxL0DefaultActive = reader.ReadUE() + 1;
+    pps.numRefIdxL1DefaultActive = reader.ReadUE() + 1;
+    pps.weightedPred = reader.ReadFlag();
+    pps.weightedBipredIdc = reader.ReadBits(2);
+    pps.picInitQp = 26 + reader.ReadSE();
+    // pic_init_qs_minus26, chroma_qp_index_offset
+    reader.ReadSE();
+    reader.ReadSE();
+    pps.deblockingFilterControlPresent = reader.ReadFlag();
+    pps.constrainedIntraPred = reader.ReadFlag();
+    pps.redundantPicCntPresent = reader.ReadFlag();
+    if (reader.HasMoreData())
+    {
+        pps.transform8x8Mode = reader.ReadFlag();
+        if (reader.ReadFlag())
+            SkipScalingLists(reader, 6 + (chromaFormatIdc != 3 ? 2 : 6) * pps.transform8x8Mode);
+        // second_chroma_qp_index_offset
+        reader.ReadSE();
+    }
+    if (reader.Overrun() || pps.numRefIdxL0DefaultActive > 32 || pps.numRefIdxL1DefaultActive > 32)
+        return std::nullopt;
+    return pps;
+}
+
+unsigned MaxDpbFrames(unsigned levelIdc, unsigned widthInMbs, unsigned heightInMbs)
+{
+    const auto* limits = std::find_if(std::begin(LEVEL_LIMITS), std::end(LEVEL_LIMITS),
+                                      [levelIdc](const LevelLimits& level) { return level.levelIdc == levelIdc; });
+    const uint64_t frameSize = uint64_t{widthInMbs} * heightInMbs;
+    if (limits == std::end(LEVEL_LIMITS) || frameSize == 0 || frameSize > limits->maxFrameSize)
+        return 0;
+    return std::min<uint64_t>(limits->maxDpbSize / frameSize, MAX_DPB_FRAMES);
+}
+
+unsigned LowestLevelFor(unsigned widthInMbs, unsigned heightInMbs, unsigned dpbFrames)
+{
+    for (const auto& level : LEVEL_LIMITS)
+    {
+        // 1b isn't a level_idc every decoder takes
+        if (level.levelIdc != 9 && MaxDpbFrames(level.levelIdc, widthInMbs, heightInMbs) >= dpbFrames)
+            return level.levelIdc;
+    }
+    return 0;
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include <cstdint>
+#include <optional>
+#include <span>
+
+// Pictures are coded in macroblocks of 16x16 luma samples
+constexpr unsigned MACROBLOCK_SIZE = 16;
+
+// Fields of an H.264 sequence parameter set needed to size buffers and present the pictures.
+// Sizes are in pixels, crop offsets already scaled by the crop units of the chroma format.
+struct SequenceParameterSet
+{
+    uint8_t profileIdc;
+    uint8_t constraintFlags;
+    uint8_t levelIdc;
+    unsigned id;
+    unsigned chromaFormatIdc;
+    unsigned bitDepthLuma;
+    unsigned bitDepthChroma;
+    unsigned maxNumRefFrames;
+    bool frameMbsOnly;
+
+    // Whole macroblocks, both fields of a frame for interlaced streams
+    unsigned codedWidth;
+    unsigned codedHeight;
+    unsigned cropLeft;
+    unsigned cropRight;
+    unsigned cropTop;
+    unsigned cropBottom;
+
+    // VUI, with the defaults of an SPS without one
+    uint16_t sarWidth = 1;
+    uint16_t sarHeight = 1;
+    bool fullRange = false;
+    // ISO/IEC 23091-2 codes, 2 is unspecified
+    uint8_t colourPrimaries = 2;
+    uint8_t transferCharacteristics = 2;
+    uint8_t matrixCoefficients = 2;
+    // Ticks of timeScale Hz, a frame lasts two ticks. 0 without timing info.
+    uint32_t numUnitsInTick = 0;
+    uint32_t timeScale = 0;
+    bool fixedFrameRate = false;
+    // From the bitstream restrictions, or the most the level allows if there are none
+    unsigned maxNumReorderFrames;
+    unsigned maxDecFrameBuffering;
+
+    // Size after cropping
+    [[nodiscard]] unsigned Width() const { return codedWidth - cropLeft - cropRight; }
+    [[nodiscard]] unsigned Height() const { return codedHeight - cropTop - cropBottom; }
+};
+
+struct PictureParameterSet
+{
+    unsigned id;
+    unsigned spsId;
+    // CABAC instead of CAVLC
+    bool entropyCodingMode;
+    bool bottomFieldPicOrderInFramePresent;
+    unsigned numSliceGroups;
+    unsigned numRefIdxL0DefaultActive;
+    unsigned numRefIdxL1DefaultActive;
+    bool weightedPred;
+    unsigned weightedBipredIdc;
+    int picInitQp;
+    bool deblockingFilterControlPresent;
+    bool constrainedIntraPred;
+    bool redundantPicCntPresent;
+    bool transform8x8Mode;
+};
+
+// nal starts with the NAL header byte and may still contain emulation prevention bytes.
+// Return std::nullopt for truncated or malformed parameter sets and for pictures larger than 8192x8192.
+std::optional<SequenceParameterSet> ParseSequenceParameterSet(std::span<const uint8_t> nal);
+// The chroma format of the referenced SPS decides the number of 8x8 scaling lists
+std::optional<PictureParameterSet> ParsePictureParameterSet(std::span<const uint8_t> nal, unsigned chromaFormatIdc = 1);
+
+// Frames of the given size in macroblocks that the decoded picture buffer holds at a level, from table A-1, at most 16.
+// 0 for unknown levels or pictures too large for the level.
+unsigned MaxDpbFrames(unsigned levelIdc, unsigned widthInMbs, unsigned heightInMbs);
+// Lowest level whose picture buffer holds dpbFrames frames of the size, 0 if none does
+unsigned LowestLevelFor(unsigned widthInMbs, unsigned heightInMbs, unsigned dpbFrames);
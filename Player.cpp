@@ -0,0 +1,707 @@
+#include "Player.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <utility>
+
+#include <whb/log.h>
+
+constexpr auto GROWING_FILE_POLL_INTERVAL = std::chrono::milliseconds(100);
+// How often trick play checks whether the decoder is done with the last sync frame
+constexpr auto TRICK_POLL_INTERVAL = std::chrono::milliseconds(5);
+// Trick play moves on by at most this much wall clock time per decoded frame, so a decoder slower than this shows
+// every sync frame it is given and the achieved speed drops instead of the pictures jumping further and further
+constexpr auto MAX_TRICK_STEP = std::chrono::milliseconds(250);
+// Read ahead of a queued file if its second sync sample doesn't come sooner
+constexpr size_t MAX_PREPARED_UNITS = 120;
+
+// Frame rate assumed for the end of the last frame of a file that doesn't tell
+constexpr uint32_t DEFAULT_FRAME_RATE = 30;
+
+static int64_t FrameDuration(const H264TrackInfo& info, uint64_t restampDuration)
+{
+    if (restampDuration != 0)
+        return static_cast<int64_t>(restampDuration);
+    if (info.duration != 0 && info.sampleCount != 0)
+        return static_cast<int64_t>(info.duration / info.sampleCount);
+    if (info.frameRateNumerator != 0)
+        return static_cast<int64_t>(uint64_t{info.timescale} * info.frameRateDenominator / info.frameRateNumerator);
+    return info.timescale / DEFAULT_FRAME_RATE;
+}
+
+// Whether the decoder created for one track can carry on with the next without being recreated
+static bool CanContinueDecoding(const H264TrackInfo& decoder, uint64_t decoderRestampDuration, uint32_t timescale,
+                                const H264TrackInfo& next, uint64_t nextRestampDuration)
+{
+    // Restamped output times count frames, they only line up at the same frame duration
+    if ((decoderRestampDuration != 0 || nextRestampDuration != 0) &&
+        (next.timescale != timescale || nextRestampDuration != decoderRestampDuration))
+        return false;
+    return next.profile == decoder.profile && next.level <= decoder.level && next.dpbFrames <= decoder.dpbFrames &&
+           next.codedWidth == decoder.codedWidth && next.codedHeight == decoder.codedHeight &&
+           next.width == decoder.width && next.height == decoder.height && next.cropLeft == decoder.cropLeft &&
+           next.cropTop == decoder.cropTop;
+}
+
+Player::Player(const PlayerConfig& config) : m_config(config)
+{
+}
+
+Player::~Player()
+{
+    Close();
+}
+
+bool Player::Open(const std::filesystem::path& path)
+{
+    Close();
+    m_openStart = StageStats::Clock::now();
+    m_timeToFirstFrame.reset();
+    m_source = CreateSampleSource(path, m_config.mp4, m_config.stream);
+    if (!m_source || !m_source->Open(path))
+    {
+        m_source.reset();
+        return false;
+    }
+
+    CreateDecoder();
+    if (m_config.presenterCore != ANY_CORE)
+        SetCurrentThreadCore(m_config.presenterCore);
+    m_itemCount = 1;
+    StartReader();
+    return true;
+}
+
+void Player::Close()
+{
+    StopReader();
+    if (m_preparer.joinable())
+        m_preparer.join();
+    m_decoder.reset();
+    m_scheduler.reset();
+    m_source.reset();
+    m_finishedSource.reset();
+    m_seekTarget.reset();
+    m_speed = 1;
+    m_activeSpeed = 1;
+    m_next.reset();
+    m_nextQueued = false;
+    m_itemEnded = false;
+    m_pendingUnits.clear();
+    m_itemCount = 0;
+}
+
+bool Player::QueueNext(const std::filesystem::path& path)
+{
+    if (!m_scheduler || m_nextQueued)
+        return false;
+    // Done with the last one, it either failed or was taken over
+    if (m_preparer.joinable())
+        m_preparer.join();
+    m_nextQueued = true;
+    m_preparer = std::thread([this, path] { PrepareNext(path); });
+    return true;
+}
+
+bool Player::HasQueuedNext() const
+{
+    return m_nextQueued;
+}
+
+unsigned Player::GetItemCount() const
+{
+    return m_itemCount;
+}
+
+void Player::CreateDecoder()
+{
+    const auto& info = m_source->GetTrackInfo();
+    auto decoderConfig = m_config.decoder;
+    decoderConfig.restampDuration = m_source->GetRestampDuration();
+    decoderConfig.timescale = info.timescale;
+    decoderConfig.consumerHeldFrames =
+        static_cast<unsigned>(FrameScheduler::MaxHeldFrames(m_config.reorderDepth)) + m_config.sinkHeldFrames;
+    m_decoder.emplace(static_cast<H264Profile>(info.profile), info.level, info.codedWidth, info.codedHeight,
+                      info.dpbFrames, decoderConfig);
+    m_scheduler.emplace(info.timescale, m_config.latePolicy, m_config.reorderDepth);
+    m_decoderInfo = info;
+    m_decoderRestampDuration = decoderConfig.restampDuration;
+    m_timescale = info.timescale;
+}
+
+void Player::StartReader()
+{
+    m_stopReader = false;
+    m_readerFinished = false;
+    m_itemOffset = 0;
+    m_itemTimescale = m_timescale;
+    m_itemFrameDuration = FrameDuration(m_source->GetTrackInfo(), m_source->GetRestampDuration());
+    m_itemEnd = 0;
+    m_reader = std::thread([this] { ReaderLoop(); });
+}
+
+void Player::StopReader()
+{
+    if (!m_reader.joinable())
+        return;
+    {
+        std::scoped_lock l{m_readerMutex};
+        m_stopReader = true;
+    }
+    m_readerWake.notify_one();
+    // The reader may be blocked on a full input ring
+    m_decoder->Interrupt();
+    m_reader.join();
+}
+
+void Player::PrepareNext(std::filesystem::path path)
+{
+    SetCurrentThreadName("Next item");
+    PreparedItem item{path, CreateSampleSource(path, m_config.mp4, m_config.stream), {}, 0};
+    if (!item.source || !item.source->Open(path))
+    {
+        WHBLogPrintf("Failed to open %s, skipped", path.c_str());
+        m_nextQueued = false;
+        return;
+    }
+    // Up to the start of the second GOP, so decoding the new file starts without waiting on a read
+    while (item.units.size() < MAX_PREPARED_UNITS)
+    {
+        auto unit = item.source->NextAccessUnit();
+        if (!unit)
+            break;
+        const bool secondGop = unit->sync && !item.units.empty();
+        item.units.push_back(std::move(*unit));
+        if (secondGop)
+            break;
+    }
+    if (item.units.empty())
+    {
+        WHBLogPrintf("No frames in %s, skipped", path.c_str());
+        m_nextQueued = false;
+        return;
+    }
+    item.firstPts = std::ranges::min(item.units, {}, &AccessUnit::pts).pts;
+    {
+        std::scoped_lock l{m_readerMutex};
+        m_next = std::move(item);
+    }
+    m_readerWake.notify_one();
+}
+
+void Player::StartNextItem()
+{
+    std::unique_lock l{m_readerMutex};
+    // Without a decoder the last item failed to start, the next one starts as soon as it is prepared
+    if (m_decoder ? !m_itemEnded : !m_next)
+        return;
+
+    if (m_decoder && m_nextCompatible)
+    {
+        // The reader goes on submitting the new item to the same decoder. It already flushed the last pictures of the
+        // current one and closes its source, which may take a while.
+        m_finishedSource = std::exchange(m_source, std::move(m_next->source));
+        m_pendingUnits = std::move(m_next->units);
+        m_nextPendingUnit = 0;
+        WHBLogPrintf("Playing %s, decoder kept", m_next->path.c_str());
+        m_next.reset();
+        m_itemEnded = false;
+        m_nextQueued = false;
+        m_itemCount++;
+        // The last item already played out, the clock starts over with the new one
+        if (m_scheduler->IsFinished())
+            m_scheduler->Reset();
+        l.unlock();
+        m_readerWake.notify_one();
+        return;
+    }
+
+    // The last frames of the current item play out on the old decoder first
+    if (m_decoder && !m_scheduler->IsFinished())
+        return;
+    auto next = std::move(*m_next);
+    m_next.reset();
+    m_itemEnded = false;
+    l.unlock();
+
+    StopReader();
+    m_decoder.reset();
+    // Closed by the new reader
+    m_finishedSource = std::exchange(m_source, std::move(next.source));
+    m_nextQueued = false;
+    try
+    {
+        CreateDecoder();
+    }
+    catch (const std::exception& e)
+    {
+        // Skipped, the finished scheduler of the last item stays so the player reports finished until the next one
+        WHBLogPrintf("Failed to create a decoder for %s, skipped: %s", next.path.c_str(), e.what());
+        m_source.reset();
+        return;
+    }
+    WHBLogPrintf("Playing %s, decoder recreated", next.path.c_str());
+    m_pendingUnits = std::move(next.units);
+    m_nextPendingUnit = 0;
+    m_itemCount++;
+    StartReader();
+}
+
+void Player::EndItem(std::unique_lock<std::mutex>& lock)
+{
+    const auto& info = m_next->source->GetTrackInfo();
+    const uint64_t restampDuration = m_next->source->GetRestampDuration();
+    m_nextCompatible =
+        CanContinueDecoding(m_decoderInfo, m_decoderRestampDuration, m_timescale, info, restampDuration);
+    // The first frame of the next item is shown when the last one of this one ends
+    m_nextOffset = m_itemEnd - m_next->firstPts * m_timescale / info.timescale;
+    m_itemEnded = true;
+    // Without a gapless switch the decoder has to run dry and the last frames play out before it is replaced
+    if (!m_nextCompatible)
+        m_readerFinished = true;
+
+    m_readerWake.wait(lock,
+                      [this] { return m_stopReader || !m_itemEnded || m_seekTarget || m_speed != m_activeSpeed; });
+    if (m_stopReader)
+        return;
+    if (m_itemEnded)
+    {
+        // A seek or trick play in the current item came first, the next one stays prepared
+        m_itemEnded = false;
+        m_readerFinished = false;
+        return;
+    }
+    m_itemOffset = m_nextOffset;
+    m_itemTimescale = info.timescale;
+    m_itemFrameDuration = FrameDuration(info, restampDuration) * m_timescale / m_itemTimescale;
+    m_itemEnd = m_itemOffset;
+    m_readerFinished = false;
+}
+
+int64_t Player::ToPlayerTime(int64_t time) const
+{
+    if (m_itemTimescale == m_timescale)
+        return m_itemOffset + time;
+    return m_itemOffset + time * m_timescale / m_itemTimescale;
+}
+
+uint64_t Player::ToItemTime(int64_t time) const
+{
+    const int64_t itemTime = std::max<int64_t>(time - m_itemOffset, 0);
+    if (m_itemTimescale == m_timescale)
+        return static_cast<uint64_t>(itemTime);
+    return static_cast<uint64_t>(itemTime * m_itemTimescale / m_timescale);
+}
+
+std::optional<DecodedFrame> Player::Present()
+{
+    TRACE_SCOPE("Present");
+    if (!m_scheduler)
+        return std::nullopt;
+
+    const auto start = StageStats::Clock::now();
+    StartNextItem();
+    if (!m_decoder)
+        return std::nullopt;
+    if (m_seeksApplied != m_seeksRequested)
+    {
+        m_presenterStats.AddBusy(StageStats::Clock::now() - start);
+        return std::nullopt;
+    }
+
+    if (m_activeSpeed != 1)
+    {
+        // Sync frames are shown as they come in, without a clock
+        std::optional<DecodedFrame> newest;
+        while (auto frame = m_decoder->GetDecodedFrame())
+            newest = std::move(frame);
+        m_presenterStats.AddBusy(StageStats::Clock::now() - start);
+        return newest;
+    }
+
+    // Checked before taking the output, so the last pictures the decoder outputs meanwhile are taken before the end
+    const bool endOfStream = m_readerFinished && m_decoder->IsIdle();
+    while (m_scheduler->CanPush())
+    {
+        auto frame = m_decoder->GetDecodedFrame();
+        if (!frame)
+            break;
+        m_scheduler->Push(std::move(*frame));
+    }
+    m_scheduler->SetEndOfStream(endOfStream);
+    auto frame = m_scheduler->Select();
+    const auto& clock = m_scheduler->GetClock();
+    m_decoder->SetClockTime(clock.IsRunning() ? std::make_optional(clock.Now()) : std::nullopt);
+    const auto end = StageStats::Clock::now();
+    if (frame && !m_timeToFirstFrame)
+        m_timeToFirstFrame = std::chrono::duration_cast<std::chrono::microseconds>(end - m_openStart);
+    m_presenterStats.AddBusy(end - start);
+    return frame;
+}
+
+void Player::Seek(uint64_t time)
+{
+    if (!m_decoder || !m_source->CanSeek())
+        return;
+    {
+        std::scoped_lock l{m_readerMutex};
+        m_seekTarget = time;
+        m_seeksRequested++;
+    }
+    m_readerWake.notify_one();
+    m_scheduler->Reset();
+    // Nothing takes decoder output until the reader applied the request, which it may only get to once the decoder
+    // takes what it is submitting
+    m_decoder->DropDecodedFrames();
+    m_decoder->SetClockTime(std::nullopt);
+}
+
+bool Player::IsFinished() const
+{
+    return m_scheduler && m_scheduler->IsFinished();
+}
+
+int64_t Player::GetPosition() const
+{
+    if (m_activeSpeed != 1)
+        return m_trickPosition;
+    return m_scheduler ? m_scheduler->GetClock().Now() : 0;
+}
+
+bool Player::SetSpeed(int speed)
+{
+    if (!m_decoder || speed == 0 || std::abs(speed) > MAX_TRICK_SPEED)
+        return false;
+    if (speed != 1 && !m_source->CanReadSyncSamples())
+    {
+        WHBLogPrintf("No trick play for %s, there is no sync sample table", m_source->GetFormatName());
+        return false;
+    }
+
+    const int64_t position = GetPosition();
+    {
+        std::scoped_lock l{m_readerMutex};
+        if (speed == m_speed)
+            return true;
+        // Normal play resumes where trick play got to, unless a seek is already on the way
+        if (speed == 1 && !m_seekTarget)
+            m_seekTarget = static_cast<uint64_t>(std::max<int64_t>(position, 0));
+        m_speed = speed;
+        m_speedPosition = position;
+        m_seeksRequested++;
+    }
+    m_readerWake.notify_one();
+    m_scheduler->Reset();
+    // Nothing takes decoder output until the reader applied the request, which it may only get to once the decoder
+    // takes what it is submitting
+    m_decoder->DropDecodedFrames();
+    m_decoder->SetClockTime(std::nullopt);
+    return true;
+}
+
+int Player::GetSpeed() const
+{
+    return m_activeSpeed;
+}
+
+double Player::GetAchievedSpeed() const
+{
+    return m_activeSpeed != 1 ? m_achievedSpeed.load() : 1.0;
+}
+
+const H264TrackInfo& Player::GetTrackInfo() const
+{
+    static const H264TrackInfo noTrack{};
+    return m_source ? m_source->GetTrackInfo() : noTrack;
+}
+
+StageStats& Player::GetPresenterStats()
+{
+    return m_presenterStats;
+}
+
+Player::Stats Player::GetStats() const
+{
+    Stats stats{};
+    stats.reader = m_readerStats.Get();
+    stats.presenter = m_presenterStats.Get();
+    if (m_decoder)
+    {
+        stats.decoder = m_decoder->GetStageStats();
+        stats.output = m_decoder->GetOutputStats();
+        stats.skip = m_decoder->GetSkipStats();
+    }
+    if (m_scheduler)
+        stats.scheduler = m_scheduler->GetStats();
+    if (m_source)
+    {
+        stats.io = m_source->GetIoStats();
+        stats.runs = m_source->GetRunStats();
+        stats.openTime = m_source->GetOpenTime();
+    }
+    stats.timeToFirstFrame = m_timeToFirstFrame.value_or(std::chrono::microseconds{0});
+    stats.requestedSpeed = m_trickSpeed;
+    stats.achievedSpeed = m_achievedSpeed;
+    stats.trickFrames = m_trickFrames;
+    return stats;
+}
+
+void Player::LogStats() const
+{
+    const auto stats = GetStats();
+    WHBLogPrintf("Opened %s in %lld ms, first frame after %lld ms", m_source ? m_source->GetFormatName() : "nothing",
+                 static_cast<long long>(stats.openTime.count() / 1000),
+                 static_cast<long long>(stats.timeToFirstFrame.count() / 1000));
+    WHBLogPrintf("Reader busy %lld ms (%.0f%%), decoder busy %lld ms (%.0f%%), presenter busy %lld ms (%.0f%%)",
+                 static_cast<long long>(stats.reader.busy.count() / 1000), stats.reader.Utilization() * 100,
+                 static_cast<long long>(stats.decoder.busy.count() / 1000), stats.decoder.Utilization() * 100,
+                 static_cast<long long>(stats.presenter.busy.count() / 1000), stats.presenter.Utilization() * 100);
+    WHBLogPrintf("Presented %llu frames, dropped %llu, repeated %llu, jitter mean %lld us max %lld us",
+                 static_cast<unsigned long long>(stats.scheduler.presented),
+                 static_cast<unsigned long long>(stats.scheduler.dropped),
+                 static_cast<unsigned long long>(stats.scheduler.repeated),
+                 static_cast<long long>(stats.scheduler.meanJitter.count()),
+                 static_cast<long long>(stats.scheduler.maxJitter.count()));
+    WHBLogPrintf("Output stalls %llu (%lld us), dropped oldest %llu, dropped non-reference %llu",
+                 static_cast<unsigned long long>(stats.output.stalls),
+                 static_cast<long long>(stats.output.stallTime.count()),
+                 static_cast<unsigned long long>(stats.output.droppedOldest),
+                 static_cast<unsigned long long>(stats.output.droppedNonReference));
+    WHBLogPrintf("Decoded %llu frames, skipped %llu non-reference and %llu before a sync frame, fell behind %llu "
+                 "times, skipped to sync %llu times, caught up %llu times",
+                 static_cast<unsigned long long>(stats.skip.decoded),
+                 static_cast<unsigned long long>(stats.skip.droppedNonReference),
+                 static_cast<unsigned long long>(stats.skip.droppedToSync),
+                 static_cast<unsigned long long>(stats.skip.nonReferenceSkips),
+                 static_cast<unsigned long long>(stats.skip.syncSkips),
+                 static_cast<unsigned long long>(stats.skip.recoveries));
+    WHBLogPrintf("Read %llu bytes in %llu calls, %llu blocks prefetched, cache hit rate %.1f%%",
+                 static_cast<unsigned long long>(stats.io.bytesRead),
+                 static_cast<unsigned long long>(stats.io.readCalls),
+                 static_cast<unsigned long long>(stats.io.prefetchedBlocks), stats.io.HitRate() * 100);
+    WHBLogPrintf("Read %llu samples in %llu runs, %llu direct reads, %llu copied across blocks",
+                 static_cast<unsigned long long>(stats.runs.runSamples),
+                 static_cast<unsigned long long>(stats.runs.runs),
+                 static_cast<unsigned long long>(stats.runs.directReads),
+                 static_cast<unsigned long long>(stats.runs.copiedSamples));
+    if (m_config.decoder.arena)
+    {
+        const auto arena = m_config.decoder.arena->GetStats();
+        WHBLogPrintf("Arena %zu of %zu KiB used, high water %zu KiB in at most %u buffers, largest free %zu KiB, "
+                     "%llu failed allocations",
+                     arena.used / 1024, arena.capacity / 1024, arena.highWater / 1024, arena.peakBuffers,
+                     arena.largestFree / 1024, static_cast<unsigned long long>(arena.failures));
+    }
+    if (stats.trickFrames != 0)
+        WHBLogPrintf("Trick play at %dx achieved %.1fx, %llu sync frames", stats.requestedSpeed, stats.achievedSpeed,
+                     static_cast<unsigned long long>(stats.trickFrames));
+}
+
+void Player::ReaderLoop()
+{
+    SetCurrentThreadName("Sample reader");
+    if (m_config.readerCore != ANY_CORE)
+        SetCurrentThreadCore(m_config.readerCore);
+
+    // Left by the last item when the decoder was recreated
+    m_finishedSource.reset();
+
+    auto busyStart = StageStats::Clock::now();
+    const auto hasRequest = [this] { return m_stopReader || m_seekTarget || m_speed != m_activeSpeed; };
+    const auto waitForRequest = [&](std::unique_lock<std::mutex>& l, StageStats::Clock::duration timeout) {
+        const auto waitStart = StageStats::Clock::now();
+        m_readerStats.AddBusy(waitStart - busyStart);
+        m_readerWake.wait_for(l, timeout, hasRequest);
+        busyStart = StageStats::Clock::now();
+        m_readerStats.AddIdle(busyStart - waitStart);
+    };
+
+    while (true)
+    {
+        std::optional<uint64_t> seekTarget;
+        std::optional<int> speed;
+        int64_t speedPosition = 0;
+        unsigned seeksRequested = 0;
+        {
+            std::unique_lock l{m_readerMutex};
+            if (m_readerFinished && m_activeSpeed == 1 && !hasRequest() && !m_next)
+            {
+                // Nothing left to read until the next seek or queued item
+                const auto waitStart = StageStats::Clock::now();
+                m_readerStats.AddBusy(waitStart - busyStart);
+                m_readerWake.wait(l, [&] { return hasRequest() || m_next; });
+                busyStart = StageStats::Clock::now();
+                m_readerStats.AddIdle(busyStart - waitStart);
+            }
+            if (m_stopReader)
+                break;
+            if (m_speed != m_activeSpeed)
+            {
+                speed = m_speed;
+                speedPosition = m_speedPosition;
+            }
+            seekTarget = std::exchange(m_seekTarget, std::nullopt);
+            // Several requests can be taken at once, the presenter waits for all of them
+            seeksRequested = m_seeksRequested;
+        }
+        if (speed)
+            ApplySpeed(*speed, speedPosition);
+        if (seekTarget)
+            ApplySeek(*seekTarget);
+        if (speed || seekTarget)
+            m_seeksApplied = seeksRequested;
+
+        while (auto buffer = m_decoder->TakeReleasedBuffer())
+        {
+            m_source->Recycle(std::move(*buffer));
+        }
+
+        if (m_activeSpeed != 1)
+        {
+            if (!TrickPlayStep())
+            {
+                std::unique_lock l{m_readerMutex};
+                waitForRequest(l, TRICK_POLL_INTERVAL);
+            }
+            continue;
+        }
+
+        std::optional<AccessUnit> unit;
+        if (m_nextPendingUnit < m_pendingUnits.size())
+        {
+            unit = std::move(m_pendingUnits[m_nextPendingUnit++]);
+        }
+        else
+        {
+            m_pendingUnits.clear();
+            m_nextPendingUnit = 0;
+            unit = m_source->NextAccessUnit();
+        }
+        if (!unit && m_source->MayGrow())
+        {
+            // Look for new fragments again after a while
+            std::unique_lock l{m_readerMutex};
+            waitForRequest(l, GROWING_FILE_POLL_INTERVAL);
+            continue;
+        }
+        if (!unit)
+        {
+            // The decoder outputs the pictures it holds for reordering, the item ends once they are queued. The next
+            // item's first sync frame can't be relied on for that, it may have no_output_of_prior_pics_flag set.
+            if (!m_readerFinished)
+                m_decoder->SubmitEndOfStream();
+            std::unique_lock l{m_readerMutex};
+            if (!m_next)
+            {
+                m_readerFinished = true;
+                continue;
+            }
+            const auto waitStart = StageStats::Clock::now();
+            m_readerStats.AddBusy(waitStart - busyStart);
+            EndItem(l);
+            busyStart = StageStats::Clock::now();
+            m_readerStats.AddIdle(busyStart - waitStart);
+            l.unlock();
+            m_finishedSource.reset();
+            continue;
+        }
+
+        const int64_t pts = ToPlayerTime(unit->pts);
+        m_itemEnd = std::max(m_itemEnd, pts + m_itemFrameDuration);
+        // Blocks while the input ring is full
+        const auto submitStart = StageStats::Clock::now();
+        m_readerStats.AddBusy(submitStart - busyStart);
+        m_decoder->SubmitFrame(std::move(unit->data), pts, unit->reference, unit->sync);
+        busyStart = StageStats::Clock::now();
+        m_readerStats.AddIdle(busyStart - submitStart);
+    }
+    m_readerStats.AddBusy(StageStats::Clock::now() - busyStart);
+}
+
+void Player::ApplySeek(uint64_t time)
+{
+    if (m_activeSpeed != 1)
+    {
+        // Trick play carries on from there
+        m_trickPosition = static_cast<int64_t>(time);
+        m_lastTrickSample.reset();
+        m_decoder->DropQueuedFrames();
+        return;
+    }
+    m_pendingUnits.clear();
+    m_nextPendingUnit = 0;
+    if (const auto point = m_source->Seek(ToItemTime(static_cast<int64_t>(time))))
+    {
+        m_decoder->BeginSeek(ToPlayerTime(point->targetPts));
+        WHBLogPrintf("Seeking to sample %u from sync sample %u", point->targetSample, point->syncSample);
+    }
+    m_readerFinished = false;
+}
+
+void Player::ApplySpeed(int speed, int64_t position)
+{
+    const int previous = m_activeSpeed.exchange(speed);
+    if (previous != 1)
+        WHBLogPrintf("Trick play at %dx achieved %.1fx", previous, m_achievedSpeed.load());
+
+    if (speed == 1)
+    {
+        // The seek that comes with it restarts normal play
+        m_decoder->SetOutputImmediately(false);
+        m_decoder->DropQueuedFrames();
+        return;
+    }
+    m_trickSpeed = speed;
+    if (previous == 1)
+    {
+        m_decoder->DropQueuedFrames();
+        m_decoder->SetOutputImmediately(true);
+        m_trickFrames = 0;
+        // Trick play reads from the sync sample table, normal play seeks back to where it got to
+        m_pendingUnits.clear();
+        m_nextPendingUnit = 0;
+    }
+    m_trickPosition = position;
+    m_trickStart = m_lastTrickStep = StageStats::Clock::now();
+    m_firstTrickPts.reset();
+    m_achievedSpeed = 0;
+    m_lastTrickSample.reset();
+}
+
+bool Player::TrickPlayStep()
+{
+    // One sync frame at a time, how fast they are decoded sets the pace
+    if (!m_decoder->IsIdle())
+        return false;
+
+    const auto now = StageStats::Clock::now();
+    const auto elapsed = std::min<StageStats::Clock::duration>(now - m_lastTrickStep, MAX_TRICK_STEP);
+    m_lastTrickStep = now;
+    const auto& info = m_source->GetTrackInfo();
+    const auto elapsedUs = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+    int64_t position = m_trickPosition + m_activeSpeed * elapsedUs * static_cast<int64_t>(m_timescale) / 1'000'000;
+    // Within the current item
+    position = std::max(position, m_itemOffset);
+    if (info.duration != 0)
+        position = std::min(position, ToPlayerTime(static_cast<int64_t>(info.duration)));
+    m_trickPosition = position;
+
+    const auto sample = m_source->FindSyncSample(ToItemTime(position));
+    if (!sample || sample == m_lastTrickSample)
+        return false;
+    auto unit = m_source->ReadSample(*sample);
+    if (!unit)
+        return false;
+    m_lastTrickSample = sample;
+
+    const int64_t pts = ToPlayerTime(unit->pts);
+    if (!m_firstTrickPts)
+        m_firstTrickPts = pts;
+    const auto wallTime = std::chrono::duration<double>(now - m_trickStart).count();
+    if (wallTime > 0)
+        m_achievedSpeed = static_cast<double>(pts - *m_firstTrickPts) / m_timescale / wallTime;
+    m_trickFrames++;
+    m_decoder->SubmitFrame(std::move(unit->data), pts, true, true);
+    return true;
+}
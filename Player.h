@@ -0,0 +1,197 @@
+#pragma once
+#include <condition_variable>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "H264.h"
+#include "MP4.h"
+#include "SampleSource.h"
+#include "Scheduler.h"
+#include "StageStats.h"
+#include "Thread.h"
+
+struct PlayerConfig
+{
+    MP4SourceConfig mp4{};
+    // Raw Annex-B and MPEG-TS files
+    StreamSourceConfig stream{};
+    // decoder.inputQueueDepth is the ring between the reader and the decoder. The memory use of decoder.arena, which
+    // may be shared with the textures, is logged with the stats.
+    H264DecoderConfig decoder{.core = 2};
+    int readerCore = 0;
+    // GX2 has to stay on the core it was initialised on, so this is left alone by default
+    int presenterCore = ANY_CORE;
+    FrameScheduler::LatePolicy latePolicy = FrameScheduler::LatePolicy::Drop;
+    size_t reorderDepth = FrameScheduler::DEFAULT_REORDER_DEPTH;
+    // Frames the sink keeps after SetFrameBuffer returned, Gfx::HELD_FRAMES for Gfx. The decoder's frame pool has room
+    // for them and the ones the scheduler holds, decoder.consumerHeldFrames is set from both.
+    unsigned sinkHeldFrames = 0;
+};
+
+// Plays the video track of an MP4 file, or a raw or transport stream H.264 file, on three threads:
+// a reader thread converts samples into the decoder's input ring, the decoder thread decodes them,
+// and the presenting thread pulls due frames through Present once per vsync.
+// A file queued with QueueNext is opened and its first GOP read on a fourth thread while the current one plays. If
+// the decoder can decode it as well it follows without a gap, its timestamps continuing where the current file ends.
+class Player
+{
+  public:
+    struct Stats
+    {
+        StageStats::Snapshot reader;
+        StageStats::Snapshot decoder;
+        StageStats::Snapshot presenter;
+        FrameScheduler::Stats scheduler;
+        OutputQueue::Stats output;
+        FrameSkipper::Stats skip;
+        BlockByteStream::Stats io;
+        SampleRunReader::Stats runs;
+        // From the start of Open, the time to first frame also counts until Present first returns a frame
+        std::chrono::microseconds openTime;
+        std::chrono::microseconds timeToFirstFrame;
+        // Of the current trick play, or the last one during normal play
+        int requestedSpeed;
+        double achievedSpeed;
+        uint64_t trickFrames;
+    };
+
+    // Fastest trick play speed either way
+    static constexpr int MAX_TRICK_SPEED = 32;
+
+    explicit Player(const PlayerConfig& config = {});
+    ~Player();
+
+    Player(const Player&) = delete;
+    Player& operator=(const Player&) = delete;
+
+    // Throws H264DecoderException if the decoder can't be created
+    bool Open(const std::filesystem::path& path);
+    void Close();
+
+    // Presenting thread. Plays path after the current file, false if another one is already queued.
+    bool QueueNext(const std::filesystem::path& path);
+    // Until the queued file starts playing, or is skipped because it fails to open or no decoder can be created for it
+    [[nodiscard]] bool HasQueuedNext() const;
+    // Files started since Open, including the opened one. Track info and picture size may change when this does.
+    [[nodiscard]] unsigned GetItemCount() const;
+
+    // Presenting thread, call once per vsync. Returns the frame to show if it changed.
+    std::optional<DecodedFrame> Present();
+    // Time in timescale units of the track, ignored if the source can't seek. Only seeks within the current file, the
+    // timeline of a playlist continues from file to file.
+    void Seek(uint64_t time);
+    [[nodiscard]] bool IsFinished() const;
+    // Media time of the presentation clock in timescale units, or of the trick play position
+    [[nodiscard]] int64_t GetPosition() const;
+
+    // Presenting thread. Any speed other than 1 is trick play, negative speeds rewind: only sync samples are decoded,
+    // each shown as soon as it is, as many as the decoder keeps up with. Going back to 1 resumes normal play where
+    // trick play got to. False if the source has no sync sample table to pick them from or the speed is out of range.
+    bool SetSpeed(int speed);
+    [[nodiscard]] int GetSpeed() const;
+    // Media time covered per wall clock time since the current speed was set, below the requested speed if the decoder
+    // can't decode sync frames fast enough or they are far apart
+    [[nodiscard]] double GetAchievedSpeed() const;
+
+    [[nodiscard]] const H264TrackInfo& GetTrackInfo() const;
+    // Accounting for the presenting thread's work outside of Present, like uploading and drawing
+    StageStats& GetPresenterStats();
+    [[nodiscard]] Stats GetStats() const;
+    void LogStats() const;
+
+  private:
+    // A queued file, opened and read up to its second sync sample
+    struct PreparedItem
+    {
+        std::filesystem::path path;
+        std::unique_ptr<SampleSource> source;
+        std::vector<AccessUnit> units;
+        int64_t firstPts;
+    };
+
+    void CreateDecoder();
+    void StartReader();
+    void StopReader();
+    void PrepareNext(std::filesystem::path path);
+    // Presenting thread, takes over the prepared item once the reader is done with the current one
+    void StartNextItem();
+    // Reader thread at the end of the current item with the next one prepared. Waits for the presenter to start it.
+    void EndItem(std::unique_lock<std::mutex>& lock);
+    // Item time to the time of the decoder and presentation clock
+    [[nodiscard]] int64_t ToPlayerTime(int64_t time) const;
+    [[nodiscard]] uint64_t ToItemTime(int64_t time) const;
+
+    void ReaderLoop();
+    void ApplySeek(uint64_t time);
+    void ApplySpeed(int speed, int64_t position);
+    // Submits the sync sample at the trick play position if it is a new one, returns false if there was nothing to do
+    bool TrickPlayStep();
+
+  private:
+    PlayerConfig m_config;
+    std::unique_ptr<SampleSource> m_source;
+    std::optional<H264Decoder> m_decoder;
+    std::optional<FrameScheduler> m_scheduler;
+
+    // What the decoder was created for, later items have to fit it
+    H264TrackInfo m_decoderInfo{};
+    uint64_t m_decoderRestampDuration = 0;
+    // Of the decoder and presentation clock, the one of the item the decoder was created for
+    uint32_t m_timescale = 1;
+    unsigned m_itemCount = 0;
+
+    std::thread m_preparer;
+    std::atomic_bool m_nextQueued{false};
+    // Guarded by m_readerMutex
+    std::optional<PreparedItem> m_next;
+    bool m_itemEnded = false;
+    bool m_nextCompatible = false;
+
+    // Only touched on the reader thread, or by the presenter while the reader waits in EndItem or is stopped
+    std::vector<AccessUnit> m_pendingUnits;
+    size_t m_nextPendingUnit = 0;
+    // Source of the item played before, closed by the reader rather than the presenter
+    std::unique_ptr<SampleSource> m_finishedSource;
+    // Player time of item time 0, the item's timescale, and the frame duration and end of the last frame submitted
+    // from it in player time
+    int64_t m_itemOffset = 0;
+    uint32_t m_itemTimescale = 1;
+    int64_t m_itemFrameDuration = 0;
+    int64_t m_itemEnd = 0;
+    int64_t m_nextOffset = 0;
+
+    std::thread m_reader;
+    std::mutex m_readerMutex;
+    std::condition_variable m_readerWake;
+    bool m_stopReader = false;
+    std::optional<uint64_t> m_seekTarget;
+    std::atomic_bool m_readerFinished{false};
+    // The presenter ignores decoder output while a seek is requested but not yet applied by the reader
+    std::atomic_uint m_seeksRequested{0};
+    std::atomic_uint m_seeksApplied{0};
+
+    // Set by SetSpeed, the reader applies it along with the position it was set at
+    int m_speed = 1;
+    int64_t m_speedPosition = 0;
+    // Only written by the reader
+    std::atomic_int m_activeSpeed{1};
+    std::atomic<int64_t> m_trickPosition{0};
+    std::atomic<double> m_achievedSpeed{1};
+    std::atomic<uint64_t> m_trickFrames{0};
+    std::atomic_int m_trickSpeed{1};
+    // Only touched on the reader thread
+    StageStats::Clock::time_point m_trickStart;
+    StageStats::Clock::time_point m_lastTrickStep;
+    std::optional<uint32_t> m_lastTrickSample;
+    std::optional<int64_t> m_firstTrickPts;
+
+    StageStats::Clock::time_point m_openStart;
+    std::optional<std::chrono::microseconds> m_timeToFirstFrame;
+
+    StageStats m_readerStats;
+    StageStats m_presenterStats;
+};
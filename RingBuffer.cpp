@@ -0,0 +1,52 @@
+#include "RingBuffer.h"
+
+#include <algorithm>
+
+RingBuffer::RingBuffer(size_t capacity)
+    : m_data(std::make_unique_for_overwrite<uint8_t[]>(std::max<size_t>(capacity, 1))),
+      m_capacity(std::max<size_t>(capacity, 1))
+{
+}
+
+std::span<uint8_t> RingBuffer::WriteSpan()
+{
+    const size_t tail = (m_head + m_size) % m_capacity;
+    const size_t end = tail < m_head || m_size == m_capacity ? m_head : m_capacity;
+    return {m_data.get() + tail, end - tail};
+}
+
+void RingBuffer::CommitWrite(size_t count)
+{
+    m_size = std::min(m_size + count, m_capacity);
+}
+
+std::span<const uint8_t> RingBuffer::ReadSpan() const
+{
+    return {m_data.get() + m_head, std::min(m_size, m_capacity - m_head)};
+}
+
+void RingBuffer::Consume(size_t count)
+{
+    count = std::min(count, m_size);
+    m_head = (m_head + count) % m_capacity;
+    m_size -= count;
+    // start over at the front while empty so writes get the longest span
+    if (m_size == 0)
+        m_head = 0;
+}
+
+void RingBuffer::Clear()
+{
+    m_head = 0;
+    m_size = 0;
+}
+
+size_t RingBuffer::Size() const
+{
+    return m_size;
+}
+
+size_t RingBuffer::Capacity() const
+{
+    return m_capacity;
+}
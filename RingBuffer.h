@@ -0,0 +1,31 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+
+// Fixed size byte ring for a single thread, filled at one end and drained at the other without moving data.
+// The spans it hands out stop at the end of the storage, so data written and consumed in multiples of a unit that
+// divides the capacity never wraps inside a unit.
+class RingBuffer
+{
+  public:
+    explicit RingBuffer(size_t capacity);
+
+    // Free space following the data, up to the end of the storage
+    std::span<uint8_t> WriteSpan();
+    void CommitWrite(size_t count);
+    // Data up to the end of the storage
+    [[nodiscard]] std::span<const uint8_t> ReadSpan() const;
+    void Consume(size_t count);
+    void Clear();
+
+    [[nodiscard]] size_t Size() const;
+    [[nodiscard]] size_t Capacity() const;
+
+  private:
+    std::unique_ptr<uint8_t[]> m_data;
+    size_t m_capacity;
+    size_t m_head = 0;
+    size_t m_size = 0;
+};
@@ -0,0 +1,99 @@
+#include "SampleIndex.h"
+
+#include <algorithm>
+
+void SampleIndex::Reserve(uint32_t count)
+{
+    m_offsets.reserve(count);
+    m_sizes.reserve(count);
+    m_dts.reserve(count);
+    m_ctsOffsets.reserve(count);
+}
+
+void SampleIndex::Clear()
+{
+    m_offsets.clear();
+    m_sizes.clear();
+    m_dts.clear();
+    m_ctsOffsets.clear();
+    m_syncSamples.clear();
+    m_duration = 0;
+}
+
+void SampleIndex::Append(uint64_t offset, uint32_t size, uint64_t dts, int32_t ctsOffset, bool sync)
+{
+    if (sync)
+        m_syncSamples.push_back(Count());
+    m_offsets.push_back(offset);
+    m_sizes.push_back(size);
+    m_dts.push_back(dts);
+    m_ctsOffsets.push_back(ctsOffset);
+}
+
+void SampleIndex::SetDuration(uint64_t duration)
+{
+    m_duration = duration;
+}
+
+uint32_t SampleIndex::Count() const
+{
+    return m_offsets.size();
+}
+
+uint64_t SampleIndex::Offset(uint32_t sample) const
+{
+    return m_offsets[sample];
+}
+
+uint32_t SampleIndex::Size(uint32_t sample) const
+{
+    return m_sizes[sample];
+}
+
+uint64_t SampleIndex::Dts(uint32_t sample) const
+{
+    return m_dts[sample];
+}
+
+int32_t SampleIndex::CtsOffset(uint32_t sample) const
+{
+    return m_ctsOffsets[sample];
+}
+
+uint64_t SampleIndex::Duration(uint32_t sample) const
+{
+    if (sample + 1 < Count())
+        return m_dts[sample + 1] - m_dts[sample];
+    return m_duration > m_dts[sample] ? m_duration - m_dts[sample] : 0;
+}
+
+bool SampleIndex::IsSync(uint32_t sample) const
+{
+    return std::binary_search(m_syncSamples.begin(), m_syncSamples.end(), sample);
+}
+
+uint32_t SampleIndex::FindSample(uint64_t time) const
+{
+    const auto next = std::upper_bound(m_dts.begin(), m_dts.end(), time);
+    if (next == m_dts.begin())
+        return 0;
+    return std::distance(m_dts.begin(), next) - 1;
+}
+
+uint32_t SampleIndex::FindSyncSample(uint32_t sample) const
+{
+    const auto next = std::upper_bound(m_syncSamples.begin(), m_syncSamples.end(), sample);
+    if (next == m_syncSamples.begin())
+        return 0;
+    return *std::prev(next);
+}
+
+uint32_t SampleIndex::SyncSampleCount() const
+{
+    return m_syncSamples.size();
+}
+
+const std::vector<uint32_t>& SampleIndex::GetSyncSamples() const
+{
+    return m_syncSamples;
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "SampleTable.h"
+
+// Sample table filled sample by sample, stored as one array per field so searches only touch the field they need.
+class SampleIndex : public SampleTable
+{
+  public:
+    void Reserve(uint32_t count);
+    void Clear();
+    // Samples have to be appended in decode order
+    void Append(uint64_t offset, uint32_t size, uint64_t dts, int32_t ctsOffset, bool sync);
+    // Duration of the track, used for the duration of the last sample
+    void SetDuration(uint64_t duration);
+
+    [[nodiscard]] uint32_t Count() const override;
+    [[nodiscard]] uint64_t Offset(uint32_t sample) const override;
+    [[nodiscard]] uint32_t Size(uint32_t sample) const override;
+    [[nodiscard]] uint64_t Dts(uint32_t sample) const override;
+    [[nodiscard]] int32_t CtsOffset(uint32_t sample) const override;
+    [[nodiscard]] uint64_t Duration(uint32_t sample) const override;
+    [[nodiscard]] bool IsSync(uint32_t sample) const override;
+
+    [[nodiscard]] uint32_t FindSample(uint64_t time) const override;
+    [[nodiscard]] uint32_t FindSyncSample(uint32_t sample) const override;
+    [[nodiscard]] uint32_t SyncSampleCount() const override;
+    // Sorted sample numbers of all sync samples
+    [[nodiscard]] const std::vector<uint32_t>& GetSyncSamples() const;
+
+  private:
+    // Loads the arrays in bulk
+    friend class IndexCache;
+
+    std::vector<uint64_t> m_offsets;
+    std::vector<uint32_t> m_sizes;
+    std::vector<uint64_t> m_dts;
+    std::vector<int32_t> m_ctsOffsets;
+    std::vector<uint32_t> m_syncSamples;
+    uint64_t m_duration = 0;
+};
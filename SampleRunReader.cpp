@@ -0,0 +1,94 @@
+#include "SampleRunReader.h"
+
+void SampleRunReader::Attach(BlockByteStream* stream, const SampleTable* table)
+{
+    ReleaseRun();
+    m_stream = stream;
+    m_table = table;
+    m_runs = 0;
+    m_runSamples = 0;
+    m_directReads = 0;
+    m_copiedSamples = 0;
+}
+
+void SampleRunReader::Detach()
+{
+    Attach(nullptr, nullptr);
+    m_copy.clear();
+    m_copy.shrink_to_fit();
+}
+
+std::optional<std::span<const uint8_t>> SampleRunReader::Fetch(uint32_t sample)
+{
+    const auto size = m_table->Size(sample);
+    if (size >= DIRECT_READ_SIZE)
+        return std::span<const uint8_t>{};
+
+    if ((sample < m_runFirst || sample >= m_runEnd) && !ReadRun(sample))
+        return std::nullopt;
+    return std::span<const uint8_t>{m_run + (m_table->Offset(sample) - m_runOffset), size};
+}
+
+bool SampleRunReader::ReadDirect(uint32_t sample, uint8_t* destination)
+{
+    m_directReads++;
+    AP4_Result result = m_stream->Seek(m_table->Offset(sample));
+    if (AP4_SUCCEEDED(result))
+        result = m_stream->Read(destination, m_table->Size(sample));
+    return AP4_SUCCEEDED(result);
+}
+
+SampleRunReader::Stats SampleRunReader::GetStats() const
+{
+    return {m_runs, m_runSamples, m_directReads, m_copiedSamples};
+}
+
+bool SampleRunReader::ReadRun(uint32_t first)
+{
+    ReleaseRun();
+    const auto offset = m_table->Offset(first);
+    uint64_t end = offset + m_table->Size(first);
+    uint32_t last = first + 1;
+    const auto view = m_stream->Pin(offset);
+    if (end - offset <= view.size())
+    {
+        // extend the run while the next sample starts where the previous one ended, within the block
+        while (last < m_table->Count() && m_table->Offset(last) == end && m_table->Size(last) < DIRECT_READ_SIZE &&
+               end + m_table->Size(last) - offset <= view.size())
+        {
+            end += m_table->Size(last);
+            last++;
+        }
+        m_pinned = view;
+        m_run = view.data();
+    }
+    else
+    {
+        // the sample goes on in the next block, or the read failed
+        m_stream->Unpin(view);
+        m_copy.resize(end - offset);
+        AP4_Result result = m_stream->Seek(offset);
+        if (AP4_SUCCEEDED(result))
+            result = m_stream->Read(m_copy.data(), static_cast<AP4_Size>(m_copy.size()));
+        if (AP4_FAILED(result))
+            return false;
+        m_run = m_copy.data();
+        m_copiedSamples++;
+    }
+
+    m_runFirst = first;
+    m_runEnd = last;
+    m_runOffset = offset;
+    m_runs++;
+    m_runSamples += last - first;
+    return true;
+}
+
+void SampleRunReader::ReleaseRun()
+{
+    if (m_stream)
+        m_stream->Unpin(m_pinned);
+    m_pinned = {};
+    m_run = nullptr;
+    m_runFirst = m_runEnd = 0;
+}
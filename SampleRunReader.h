@@ -0,0 +1,66 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "BlockByteStream.h"
+#include "SampleTable.h"
+
+// Reads samples of a track in runs: samples that lie back to back in the file, usually the samples of one or more
+// chunks, are handed out as slices of the stream's cached block holding them, which stays pinned while the run is
+// read. Only a sample crossing into the next block is copied together into a buffer of its own.
+// Samples of at least DIRECT_READ_SIZE are left to ReadDirect so they can go straight into their destination.
+// With several tracks, each gets its own reader and the caller reads from the one whose next sample has the lowest
+// offset, which keeps every read in file order. Each reader pins one block at a time.
+class SampleRunReader
+{
+  public:
+    static constexpr uint32_t DIRECT_READ_SIZE = 128 * 1024;
+
+    struct Stats
+    {
+        uint64_t runs;
+        uint64_t runSamples;
+        uint64_t directReads;
+        // Samples crossing a block boundary, copied once more on their way to the access unit
+        uint64_t copiedSamples;
+    };
+
+    // Both have to outlive the reader or the next Attach
+    void Attach(BlockByteStream* stream, const SampleTable* table);
+    void Detach();
+
+    // Returns the bytes of sample, reading the run starting at it if they aren't buffered.
+    // The span stays valid until the next call. It is empty for samples to be read with ReadDirect.
+    // std::nullopt on read errors.
+    std::optional<std::span<const uint8_t>> Fetch(uint32_t sample);
+    bool ReadDirect(uint32_t sample, uint8_t* destination);
+
+    // Safe to call from any thread
+    [[nodiscard]] Stats GetStats() const;
+
+  private:
+    bool ReadRun(uint32_t first);
+    void ReleaseRun();
+
+  private:
+    BlockByteStream* m_stream = nullptr;
+    const SampleTable* m_table = nullptr;
+
+    // Pinned in the stream while the run is read from it
+    std::span<const uint8_t> m_pinned;
+    // Holds a sample crossing a block boundary
+    std::vector<uint8_t> m_copy;
+    const uint8_t* m_run = nullptr;
+    // Samples [m_runFirst, m_runEnd) are at m_run
+    uint32_t m_runFirst = 0;
+    uint32_t m_runEnd = 0;
+    uint64_t m_runOffset = 0;
+
+    std::atomic<uint64_t> m_runs{0};
+    std::atomic<uint64_t> m_runSamples{0};
+    std::atomic<uint64_t> m_directReads{0};
+    std::atomic<uint64_t> m_copiedSamples{0};
+};
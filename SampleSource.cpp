@@ -0,0 +1,76 @@
+#include "SampleSource.h"
+#include "AnnexBSampleSource.h"
+#include "MP4.h"
+#include "ParameterSets.h"
+#include "TSSampleSource.h"
+
+#include <algorithm>
+
+#include <whb/log.h>
+
+// Enough for a few transport stream packets
+constexpr size_t SNIFF_SIZE = 1024;
+// Timing info outside of this is taken to be wrong
+constexpr double MIN_FRAME_RATE = 1;
+constexpr double MAX_FRAME_RATE = 240;
+
+std::unique_ptr<SampleSource> CreateSampleSource(const std::filesystem::path& path, const MP4SourceConfig& mp4Config,
+                                                 const StreamSourceConfig& streamConfig)
+{
+    const auto reader = FileBlockReader::Open(path);
+    if (!reader)
+    {
+        WHBLogPrint("ERROR: cannot open input");
+        return nullptr;
+    }
+    uint8_t header[SNIFF_SIZE];
+    const std::span<const uint8_t> sniffed{header, reader->ReadAt(0, header, sizeof(header))};
+
+    if (TSSampleSource::Detect(sniffed))
+        return std::make_unique<TSSampleSource>(streamConfig);
+    if (AnnexBSampleSource::Detect(sniffed))
+        return std::make_unique<AnnexBSampleSource>(streamConfig);
+    return std::make_unique<MP4SampleSource>(mp4Config);
+}
+
+bool ReadParameterSets(std::span<const uint8_t> data, H264TrackInfo& info)
+{
+    const auto spsNal = FindNalUnit(data, NAL_TYPE_SPS);
+    const auto sps = spsNal ? ParseSequenceParameterSet(*spsNal) : std::nullopt;
+    if (!sps)
+        return false;
+
+    info.profile = sps->profileIdc;
+    info.level = sps->levelIdc;
+    info.width = sps->Width();
+    info.height = sps->Height();
+    info.codedWidth = sps->codedWidth;
+    info.codedHeight = sps->codedHeight;
+    info.cropLeft = sps->cropLeft;
+    info.cropTop = sps->cropTop;
+    info.maxRefFrames = sps->maxNumRefFrames;
+    info.dpbFrames = std::max(sps->maxDecFrameBuffering, sps->maxNumRefFrames);
+    info.fullRange = sps->fullRange;
+    info.matrixCoefficients = sps->matrixCoefficients;
+    info.frameRateNumerator = 0;
+    info.frameRateDenominator = 0;
+    if (sps->numUnitsInTick != 0 && sps->timeScale != 0)
+    {
+        // two ticks per frame
+        const double rate = sps->timeScale / (2.0 * sps->numUnitsInTick);
+        if (rate >= MIN_FRAME_RATE && rate <= MAX_FRAME_RATE)
+        {
+            info.frameRateNumerator = sps->timeScale;
+            info.frameRateDenominator = 2 * sps->numUnitsInTick;
+        }
+    }
+
+    const auto ppsNal = FindNalUnit(data, NAL_TYPE_PPS);
+    const auto pps = ppsNal ? ParsePictureParameterSet(*ppsNal, sps->chromaFormatIdc) : std::nullopt;
+    WHBLogPrintf("SPS: profile %u level %u, %ux%u coded as %ux%u, %u reference frames, %u frame DPB, %s, %s range, "
+                 "matrix %u",
+                 info.profile, info.level, info.width, info.height, info.codedWidth, info.codedHeight,
+                 info.maxRefFrames, info.dpbFrames, pps ? (pps->entropyCodingMode ? "CABAC" : "CAVLC") : "no PPS",
+                 info.fullRange ? "full" : "limited", info.matrixCoefficients);
+    return true;
+}
@@ -0,0 +1,136 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "AnnexB.h"
+#include "BlockByteStream.h"
+#include "SampleRunReader.h"
+
+struct H264TrackInfo
+{
+    // Shown picture size, after cropping
+    unsigned width;
+    unsigned height;
+    // Decoded picture size in whole macroblocks, and the top left corner of the shown part in it
+    unsigned codedWidth;
+    unsigned codedHeight;
+    unsigned cropLeft;
+    unsigned cropTop;
+    unsigned profile;
+    unsigned level;
+    // Fragmented files only count the samples of the first fragment here, elementary streams report 0
+    unsigned sampleCount;
+    // Units per second of all sample times
+    uint32_t timescale;
+    // 0 if unknown
+    uint64_t duration;
+
+    // From the SPS, 0 if unknown
+    unsigned maxRefFrames;
+    // Frames the decoder has to hold for reference and reordering
+    unsigned dpbFrames;
+    // Frame rate of the VUI timing info
+    uint32_t frameRateNumerator;
+    uint32_t frameRateDenominator;
+    bool fullRange;
+    // ISO/IEC 23091-2 code, 2 if unspecified
+    uint8_t matrixCoefficients;
+};
+
+// A single sample converted to an Annex-B access unit
+struct AccessUnit
+{
+    std::vector<uint8_t> data;
+    // Every NAL unit in data, delimiters and parameter sets put in front included
+    NalIndex nals;
+    uint32_t sampleIndex;
+    // In timescale units of the track
+    int64_t dts;
+    int64_t pts;
+    bool sync;
+    // False if no slice has a nonzero nal_ref_idc, nothing else refers to it then
+    bool reference;
+};
+
+struct SeekPoint
+{
+    // Decoding restarts here
+    uint32_t syncSample;
+    uint32_t targetSample;
+    // Frames presented before this time are only decoded to reach the target
+    int64_t targetPts;
+};
+
+// Pull based reader of the access units of one H.264 video stream
+class SampleSource
+{
+  public:
+    virtual ~SampleSource() = default;
+
+    virtual bool Open(const std::filesystem::path& path) = 0;
+    virtual void Close() = 0;
+    [[nodiscard]] virtual bool IsOpen() const = 0;
+
+    // Returns std::nullopt once every access unit has been read, or every one written so far if MayGrow
+    virtual std::optional<AccessUnit> NextAccessUnit() = 0;
+    // More access units may appear later
+    [[nodiscard]] virtual bool MayGrow() const { return false; }
+    // Hands the buffer of a consumed access unit back for reuse by later reads
+    virtual void Recycle(std::vector<uint8_t>&& buffer) = 0;
+    void Recycle(AccessUnit&& unit) { Recycle(std::move(unit.data)); }
+
+    // Moves the read position to the sync sample preceding time, given in timescale units.
+    // Returns std::nullopt and keeps reading where it was if the source can't seek.
+    virtual std::optional<SeekPoint> Seek(uint64_t time) = 0;
+    [[nodiscard]] virtual bool CanSeek() const = 0;
+
+    // Trick play reads sync samples only, picked by time from the sync sample table
+    [[nodiscard]] virtual bool CanReadSyncSamples() const { return false; }
+    // Sync sample at or before time, std::nullopt without a sync sample table
+    virtual std::optional<uint32_t> FindSyncSample(uint64_t) { return std::nullopt; }
+    // Reads one sample out of order, NextAccessUnit carries on where it was
+    virtual std::optional<AccessUnit> ReadSample(uint32_t) { return std::nullopt; }
+
+    [[nodiscard]] virtual const H264TrackInfo& GetTrackInfo() const = 0;
+    // Sources without presentation times stamp access units in decode order at a fixed rate, so decoded frames have
+    // to be stamped again in output order, this many timescale units apart. 0 if the access units carry presentation
+    // times.
+    [[nodiscard]] virtual uint64_t GetRestampDuration() const { return 0; }
+
+    // Container and parser of the open file, for logs
+    [[nodiscard]] virtual const char* GetFormatName() const = 0;
+    [[nodiscard]] virtual std::chrono::microseconds GetOpenTime() const = 0;
+    // Zero while no file is open or for counters the source doesn't have
+    [[nodiscard]] virtual BlockByteStream::Stats GetIoStats() const = 0;
+    [[nodiscard]] virtual SampleRunReader::Stats GetRunStats() const { return {}; }
+};
+
+// Settings of the sources reading H.264 elementary streams, raw Annex-B and MPEG-TS
+struct StreamSourceConfig
+{
+    // The file is read through a ring of this size
+    size_t ringSize = 256 * 1024;
+    // Largest access unit accepted, bigger ones are dropped to keep memory bounded
+    size_t maxAccessUnitSize = 2 * 1024 * 1024;
+    // Raw streams have no timestamps and are played at this rate, unless their SPS has timing info
+    uint32_t frameRateNumerator = 30000;
+    uint32_t frameRateDenominator = 1001;
+    // PID of the video stream in a transport stream, 0 takes the first H.264 stream of the first program
+    uint16_t pid = 0;
+};
+
+struct MP4SourceConfig;
+
+// Fills in the picture size, cropping, buffering, timing and colour fields of info from the first SPS in Annex-B
+// data, the profile and level too. Returns false and leaves info alone if there is no SPS that can be parsed.
+bool ReadParameterSets(std::span<const uint8_t> data, H264TrackInfo& info);
+
+// Picks the source for the file by its first bytes: MPEG-TS, raw Annex-B, or MP4 for anything else.
+// Returns nullptr if the file can't be read.
+std::unique_ptr<SampleSource> CreateSampleSource(const std::filesystem::path& path, const MP4SourceConfig& mp4Config,
+                                                 const StreamSourceConfig& streamConfig);
@@ -0,0 +1,41 @@
+#pragma once
+#include <cstdint>
+
+// Per sample metadata of a track. Times are in the media timescale of the track.
+// Count and the searches only cover the samples known so far, see Extend.
+// Implementations may decode on demand behind const accessors, so a table must not be used by several threads at once.
+class SampleTable
+{
+  public:
+    virtual ~SampleTable() = default;
+
+    [[nodiscard]] virtual uint32_t Count() const = 0;
+    [[nodiscard]] virtual uint64_t Offset(uint32_t sample) const = 0;
+    [[nodiscard]] virtual uint32_t Size(uint32_t sample) const = 0;
+    [[nodiscard]] virtual uint64_t Dts(uint32_t sample) const = 0;
+    [[nodiscard]] virtual int32_t CtsOffset(uint32_t sample) const = 0;
+    [[nodiscard]] virtual uint64_t Duration(uint32_t sample) const = 0;
+    [[nodiscard]] virtual bool IsSync(uint32_t sample) const = 0;
+
+    // Last sample decoded at or before time
+    [[nodiscard]] virtual uint32_t FindSample(uint64_t time) const = 0;
+    // Closest sync sample at or before sample, the first sample is used if there is none
+    [[nodiscard]] virtual uint32_t FindSyncSample(uint32_t sample) const = 0;
+    [[nodiscard]] virtual uint32_t SyncSampleCount() const = 0;
+
+    // Tables of fragmented files only know the fragments read so far. Reads the next complete fragment,
+    // false if there is none (yet).
+    virtual bool Extend()
+    {
+        return false;
+    }
+    [[nodiscard]] virtual bool IsExtensible() const
+    {
+        return false;
+    }
+
+    [[nodiscard]] int64_t Pts(uint32_t sample) const
+    {
+        return static_cast<int64_t>(Dts(sample)) + CtsOffset(sample);
+    }
+};
@@ -0,0 +1,173 @@
+#include "Scheduler.h"
+
+#include <algorithm>
+
+constexpr int64_t NANOSECONDS_PER_SECOND = 1'000'000'000;
+
+MediaClock::MediaClock(uint32_t timescale) : m_timescale(timescale > 0 ? timescale : 1)
+{
+}
+
+void MediaClock::Start(int64_t mediaTime)
+{
+    m_startTime = Clock::now();
+    m_startMediaTime = mediaTime;
+    m_running = true;
+}
+
+void MediaClock::Stop()
+{
+    m_running = false;
+}
+
+bool MediaClock::IsRunning() const
+{
+    return m_running;
+}
+
+int64_t MediaClock::Now() const
+{
+    if (!m_running)
+        return m_startMediaTime;
+    return m_startMediaTime + ToMediaTime(Clock::now() - m_startTime);
+}
+
+int64_t MediaClock::ToMediaTime(Clock::duration duration) const
+{
+    // Split into seconds and the rest so long durations don't overflow
+    const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+    return ns / NANOSECONDS_PER_SECOND * m_timescale +
+           ns % NANOSECONDS_PER_SECOND * m_timescale / NANOSECONDS_PER_SECOND;
+}
+
+MediaClock::Clock::duration MediaClock::ToDuration(int64_t mediaTime) const
+{
+    const auto ns = mediaTime / m_timescale * NANOSECONDS_PER_SECOND +
+                    mediaTime % m_timescale * NANOSECONDS_PER_SECOND / m_timescale;
+    return std::chrono::duration_cast<Clock::duration>(std::chrono::nanoseconds(ns));
+}
+
+uint32_t MediaClock::GetTimescale() const
+{
+    return m_timescale;
+}
+
+FrameScheduler::FrameScheduler(uint32_t timescale, LatePolicy policy, size_t reorderDepth)
+    : m_clock(timescale), m_policy(policy), m_reorderDepth(std::max<size_t>(reorderDepth, 1))
+{
+    // One extra so a frame can be pushed while the buffer holds reorderDepth frames waiting for their time
+    m_frames.reserve(m_reorderDepth + 1);
+}
+
+size_t FrameScheduler::MaxHeldFrames(size_t reorderDepth)
+{
+    return std::max<size_t>(reorderDepth, 1) + 1;
+}
+
+bool FrameScheduler::CanPush() const
+{
+    return m_frames.size() <= m_reorderDepth;
+}
+
+void FrameScheduler::Push(DecodedFrame frame)
+{
+    const auto position = std::upper_bound(m_frames.begin(), m_frames.end(), frame.timestamp,
+                                           [](int64_t ts, const DecodedFrame& f) { return ts < f.timestamp; });
+    m_frames.insert(position, std::move(frame));
+}
+
+void FrameScheduler::SetEndOfStream(bool endOfStream)
+{
+    m_endOfStream = endOfStream;
+}
+
+void FrameScheduler::Reset()
+{
+    m_frames.clear();
+    m_endOfStream = false;
+    m_showedFrame = false;
+    m_lastPresentTime.reset();
+    m_clock.Stop();
+}
+
+std::optional<DecodedFrame> FrameScheduler::Select()
+{
+    if (!m_clock.IsRunning())
+    {
+        // The first frame starts the clock
+        if (!IsFrontReady())
+            return std::nullopt;
+        m_clock.Start(m_frames.front().timestamp);
+    }
+
+    const auto now = m_clock.Now();
+    if (!IsFrontReady() || m_frames.front().timestamp > now)
+    {
+        if (m_showedFrame)
+            m_repeated++;
+        return std::nullopt;
+    }
+
+    if (m_policy == LatePolicy::Drop)
+    {
+        // Everything but the newest due frame is late
+        while (m_frames.size() > 1 && m_frames[1].timestamp <= now && IsFrontReady())
+        {
+            m_frames.erase(m_frames.begin());
+            m_dropped++;
+        }
+    }
+
+    auto frame = std::make_optional(std::move(m_frames.front()));
+    m_frames.erase(m_frames.begin());
+    RecordPresentation(frame->timestamp);
+    return frame;
+}
+
+bool FrameScheduler::IsFinished() const
+{
+    return m_endOfStream && m_frames.empty();
+}
+
+void FrameScheduler::SetLatePolicy(LatePolicy policy)
+{
+    m_policy = policy;
+}
+
+const MediaClock& FrameScheduler::GetClock() const
+{
+    return m_clock;
+}
+
+FrameScheduler::Stats FrameScheduler::GetStats() const
+{
+    std::chrono::microseconds meanJitter{};
+    if (m_jitterSamples)
+        meanJitter = m_totalJitter / static_cast<int64_t>(m_jitterSamples);
+    return {m_presented, m_dropped, m_repeated, meanJitter, m_maxJitter};
+}
+
+bool FrameScheduler::IsFrontReady() const
+{
+    // With fewer frames buffered a frame with an earlier timestamp might still arrive
+    return !m_frames.empty() && (m_frames.size() >= m_reorderDepth || m_endOfStream);
+}
+
+void FrameScheduler::RecordPresentation(int64_t timestamp)
+{
+    const auto presentTime = MediaClock::Clock::now();
+    if (m_lastPresentTime)
+    {
+        const auto actual = presentTime - *m_lastPresentTime;
+        const auto expected = m_clock.ToDuration(timestamp - m_lastTimestamp);
+        const auto jitter = std::chrono::duration_cast<std::chrono::microseconds>(
+            actual > expected ? actual - expected : expected - actual);
+        m_totalJitter += jitter;
+        m_maxJitter = std::max(m_maxJitter, jitter);
+        m_jitterSamples++;
+    }
+    m_lastPresentTime = presentTime;
+    m_lastTimestamp = timestamp;
+    m_showedFrame = true;
+    m_presented++;
+}
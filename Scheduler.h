@@ -0,0 +1,104 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "OutputQueue.h"
+
+// Monotonic clock counting in the timescale units of a track
+class MediaClock
+{
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit MediaClock(uint32_t timescale);
+
+    // Starts running from mediaTime
+    void Start(int64_t mediaTime);
+    void Stop();
+    [[nodiscard]] bool IsRunning() const;
+
+    [[nodiscard]] int64_t Now() const;
+    [[nodiscard]] int64_t ToMediaTime(Clock::duration duration) const;
+    [[nodiscard]] Clock::duration ToDuration(int64_t mediaTime) const;
+    [[nodiscard]] uint32_t GetTimescale() const;
+
+  private:
+    uint32_t m_timescale;
+    bool m_running = false;
+    Clock::time_point m_startTime{};
+    int64_t m_startMediaTime = 0;
+};
+
+// Picks the decoded frame to show at each vsync by its timestamp.
+// Frames pass through a small reorder buffer so they come out in presentation order even if they were output in
+// decode order.
+class FrameScheduler
+{
+  public:
+    enum class LatePolicy
+    {
+        // Skip to the newest frame that is due
+        Drop,
+        // Show every frame for at least one vsync, playback falls behind the clock instead
+        ShowAll,
+    };
+
+    struct Stats
+    {
+        uint64_t presented;
+        uint64_t dropped;
+        // Vsyncs that showed the previous frame again
+        uint64_t repeated;
+        // Difference between the presentation interval and the timestamp interval of consecutive frames
+        std::chrono::microseconds meanJitter;
+        std::chrono::microseconds maxJitter;
+    };
+
+    static constexpr size_t DEFAULT_REORDER_DEPTH = 4;
+
+    FrameScheduler(uint32_t timescale, LatePolicy policy, size_t reorderDepth = DEFAULT_REORDER_DEPTH);
+
+    // Frames a scheduler holds at most, counting the one Select returned last
+    static size_t MaxHeldFrames(size_t reorderDepth);
+
+    // False if the reorder buffer is full, the frame has to be offered again later then
+    [[nodiscard]] bool CanPush() const;
+    void Push(DecodedFrame frame);
+    // No more frames will arrive, everything left may be shown
+    void SetEndOfStream(bool endOfStream);
+    // Drops all buffered frames and stops the clock, the next frame shown restarts it
+    void Reset();
+
+    // Called once per vsync. Returns the frame to show or std::nullopt to keep showing the current one.
+    std::optional<DecodedFrame> Select();
+    // True once the end of stream was reached and every frame was shown or dropped
+    [[nodiscard]] bool IsFinished() const;
+
+    void SetLatePolicy(LatePolicy policy);
+    [[nodiscard]] const MediaClock& GetClock() const;
+    [[nodiscard]] Stats GetStats() const;
+
+  private:
+    [[nodiscard]] bool IsFrontReady() const;
+    void RecordPresentation(int64_t timestamp);
+
+  private:
+    MediaClock m_clock;
+    LatePolicy m_policy;
+    size_t m_reorderDepth;
+    // Sorted by timestamp
+    std::vector<DecodedFrame> m_frames;
+    bool m_endOfStream = false;
+    bool m_showedFrame = false;
+
+    std::optional<MediaClock::Clock::time_point> m_lastPresentTime;
+    int64_t m_lastTimestamp = 0;
+    uint64_t m_presented = 0;
+    uint64_t m_dropped = 0;
+    uint64_t m_repeated = 0;
+    uint64_t m_jitterSamples = 0;
+    std::chrono::microseconds m_totalJitter{};
+    std::chrono::microseconds m_maxJitter{};
+};
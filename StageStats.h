@@ -0,0 +1,43 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// Time a pipeline stage spent working and waiting on its neighbours. Written by one thread, readable from any.
+class StageStats
+{
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Snapshot
+    {
+        std::chrono::microseconds busy;
+        std::chrono::microseconds idle;
+
+        // Share of the accounted time spent busy, between 0 and 1
+        [[nodiscard]] double Utilization() const
+        {
+            const auto total = busy + idle;
+            return total.count() ? static_cast<double>(busy.count()) / total.count() : 0.0;
+        }
+    };
+
+    void AddBusy(Clock::duration duration)
+    {
+        m_busy += std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+    }
+
+    void AddIdle(Clock::duration duration)
+    {
+        m_idle += std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+    }
+
+    [[nodiscard]] Snapshot Get() const
+    {
+        return {std::chrono::microseconds(m_busy.load()), std::chrono::microseconds(m_idle.load())};
+    }
+
+  private:
+    std::atomic<int64_t> m_busy{0};
+    std::atomic<int64_t> m_idle{0};
+};
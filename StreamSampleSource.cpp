@@ -0,0 +1,158 @@
+#include "StreamSampleSource.h"
+#include "H264.h"
+
+#include <algorithm>
+#include <utility>
+
+#include <whb/log.h>
+
+// Enough to recognise the format from
+constexpr size_t HEADER_SIZE = 1024;
+// Access units skipped looking for a start point before giving up on the file
+constexpr unsigned MAX_PROBE_UNITS = 300;
+
+StreamSampleSource::StreamSampleSource(const StreamSourceConfig& config)
+    : m_config(config), m_splitter(config.maxAccessUnitSize)
+{
+}
+
+StreamSampleSource::~StreamSampleSource()
+{
+    Close();
+}
+
+bool StreamSampleSource::Open(const std::filesystem::path& path)
+{
+    Close();
+    const auto openStart = std::chrono::steady_clock::now();
+
+    m_reader = FileBlockReader::Open(path);
+    if (!m_reader)
+    {
+        WHBLogPrint("ERROR: cannot open input");
+        return false;
+    }
+
+    uint8_t header[HEADER_SIZE];
+    const size_t headerSize = m_reader->ReadAt(0, header, sizeof(header));
+    m_splitter.Reset();
+    if (!OpenStream({header, headerSize}))
+    {
+        WHBLogPrintf("ERROR: not a %s file", GetFormatName());
+        Close();
+        return false;
+    }
+    const size_t unit = std::max<size_t>(GetReadUnit(), 1);
+    m_ring.emplace(std::max(m_config.ringSize / unit, size_t{1}) * unit);
+
+    for (unsigned skipped = 0; skipped < MAX_PROBE_UNITS; ++skipped)
+    {
+        AccessUnit unit{};
+        if (!ReadAccessUnit(unit))
+            break;
+        if (ProbeTrackInfo(unit))
+        {
+            if (skipped > 0)
+                WHBLogPrintf("Skipped %u access units before the first start point", skipped);
+            OnTrackInfo(unit);
+            m_first = std::move(unit);
+            break;
+        }
+        Recycle(std::move(unit));
+    }
+    if (!m_first)
+    {
+        WHBLogPrint("ERROR: no decoding start point found");
+        Close();
+        return false;
+    }
+
+    m_openTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - openStart);
+    WHBLogPrintf("Opened in %lld us as %s", static_cast<long long>(m_openTime.count()), GetFormatName());
+    return true;
+}
+
+void StreamSampleSource::Close()
+{
+    m_first.reset();
+    m_splitter.Reset();
+    m_ring.reset();
+    m_reader.reset();
+    m_inputOffset = 0;
+    m_ioStats = {};
+    m_info = {};
+    m_nextSample = 0;
+}
+
+bool StreamSampleSource::IsOpen() const
+{
+    return m_reader != nullptr && m_ring.has_value();
+}
+
+std::optional<AccessUnit> StreamSampleSource::NextAccessUnit()
+{
+    if (!IsOpen())
+        return std::nullopt;
+
+    std::optional<AccessUnit> unit;
+    if (m_first)
+        unit = std::exchange(m_first, std::nullopt);
+    else if (AccessUnit next{}; ReadAccessUnit(next))
+        unit = std::move(next);
+    if (unit)
+        unit->sampleIndex = m_nextSample++;
+    return unit;
+}
+
+void StreamSampleSource::Recycle(std::vector<uint8_t>&& buffer)
+{
+    m_splitter.Recycle(std::move(buffer));
+}
+
+std::optional<SeekPoint> StreamSampleSource::Seek(uint64_t)
+{
+    return std::nullopt;
+}
+
+bool StreamSampleSource::CanSeek() const
+{
+    return false;
+}
+
+const H264TrackInfo& StreamSampleSource::GetTrackInfo() const
+{
+    return m_info;
+}
+
+std::chrono::microseconds StreamSampleSource::GetOpenTime() const
+{
+    return m_openTime;
+}
+
+BlockByteStream::Stats StreamSampleSource::GetIoStats() const
+{
+    return m_ioStats;
+}
+
+size_t StreamSampleSource::ReadInput()
+{
+    const auto free = m_ring->WriteSpan();
+    if (free.empty())
+        return 0;
+    const size_t read = m_reader->ReadAt(m_inputOffset, free.data(), free.size());
+    m_ring->CommitWrite(read);
+    m_inputOffset += read;
+    m_ioStats.bytesRead += read;
+    m_ioStats.readCalls++;
+    return read;
+}
+
+bool StreamSampleSource::ProbeTrackInfo(const AccessUnit& unit)
+{
+    // only access units the index shows an SPS in are parsed
+    const auto* sps = FindNalUnit(unit.nals, NAL_TYPE_SPS);
+    if (!sps || H264Decoder::GetStartPoint(unit.data) < 0)
+        return false;
+    // from the last three bytes of its start code on
+    return ReadParameterSets(std::span(unit.data).subspan(sps->offset >= 3 ? sps->offset - 3 : 0), m_info);
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <memory>
+#include <optional>
+#include <span>
+
+#include "AnnexB.h"
+#include "BlockByteStream.h"
+#include "RingBuffer.h"
+#include "SampleSource.h"
+
+// Common part of the sources reading an H.264 elementary stream front to back, raw Annex-B or MPEG-TS.
+// The file streams through a fixed ring and is split into access units on the way, so memory use is bounded by the
+// ring and a few access units whatever the length of the file. Without an index these sources can't seek.
+class StreamSampleSource : public SampleSource
+{
+  public:
+    explicit StreamSampleSource(const StreamSourceConfig& config);
+    ~StreamSampleSource() override;
+
+    StreamSampleSource(const StreamSampleSource&) = delete;
+    StreamSampleSource& operator=(const StreamSampleSource&) = delete;
+
+    // Playback starts at the first access unit the decoder can start from
+    bool Open(const std::filesystem::path& path) final;
+    void Close() final;
+    [[nodiscard]] bool IsOpen() const final;
+
+    std::optional<AccessUnit> NextAccessUnit() final;
+    using SampleSource::Recycle;
+    void Recycle(std::vector<uint8_t>&& buffer) final;
+
+    std::optional<SeekPoint> Seek(uint64_t time) final;
+    [[nodiscard]] bool CanSeek() const final;
+
+    [[nodiscard]] const H264TrackInfo& GetTrackInfo() const final;
+    [[nodiscard]] std::chrono::microseconds GetOpenTime() const final;
+    [[nodiscard]] BlockByteStream::Stats GetIoStats() const final;
+
+  protected:
+    // Resets the parsing state for a file starting with header. Returns false if the file isn't in this format.
+    virtual bool OpenStream(std::span<const uint8_t> header) = 0;
+    // The ring is sized to a multiple of this, so units of it are never split by the wrap
+    [[nodiscard]] virtual size_t GetReadUnit() const = 0;
+    // Next access unit in decode order with everything but sampleIndex set. Returns false at the end of the file.
+    virtual bool ReadAccessUnit(AccessUnit& unit) = 0;
+    // Called on open with the access unit the track info was read from, before it is returned as the first one
+    virtual void OnTrackInfo(AccessUnit&) {}
+
+    // Reads more of the file into the free space of the ring, returns 0 at the end of the file
+    size_t ReadInput();
+
+  protected:
+    StreamSourceConfig m_config;
+    H264TrackInfo m_info{};
+    std::optional<RingBuffer> m_ring;
+    AnnexBSplitter m_splitter;
+
+  private:
+    bool ProbeTrackInfo(const AccessUnit& unit);
+
+  private:
+    std::unique_ptr<BlockReader> m_reader;
+    uint64_t m_inputOffset = 0;
+    BlockByteStream::Stats m_ioStats{};
+    std::chrono::microseconds m_openTime{0};
+
+    // The access unit the track info was read from, returned first
+    std::optional<AccessUnit> m_first;
+    uint32_t m_nextSample = 0;
+};
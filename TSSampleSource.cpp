@@ -0,0 +1,293 @@
+#include "TSSampleSource.h"
+
+#include <algorithm>
+
+#include <whb/log.h>
+
+constexpr size_t TS_PACKET_SIZE = 188;
+// M2TS and similar put a 4 byte timecode in front of every packet
+constexpr size_t TIMECODE_PACKET_SIZE = 192;
+constexpr uint8_t SYNC_BYTE = 0x47;
+constexpr uint16_t PAT_PID = 0;
+constexpr uint16_t NO_PID = 0x1FFF;
+constexpr uint8_t PAT_TABLE_ID = 0;
+constexpr uint8_t PMT_TABLE_ID = 2;
+constexpr uint8_t STREAM_TYPE_H264 = 0x1B;
+constexpr uint32_t TS_TIMESCALE = 90000;
+// PTS and DTS are 33 bits
+constexpr int64_t TIMESTAMP_WRAP = int64_t{1} << 33;
+constexpr size_t MAX_PES_TIMES = 64;
+// Packets checked for sync bytes on open
+constexpr unsigned DETECT_PACKETS = 3;
+
+static uint64_t ReadTimestamp(const uint8_t* data)
+{
+    return (uint64_t{data[0] & 0x0Eu} << 29) | (uint64_t{data[1]} << 22) | (uint64_t{data[2] & 0xFEu} << 14) |
+           (uint64_t{data[3]} << 7) | (data[4] >> 1);
+}
+
+// Section of a PSI packet payload, or an empty span if it doesn't start in this packet
+static std::span<const uint8_t> GetSection(std::span<const uint8_t> payload, uint8_t tableId)
+{
+    if (payload.empty() || 1u + payload[0] + 3 > payload.size())
+        return {};
+    const auto section = payload.subspan(1 + payload[0]);
+    if (section[0] != tableId)
+        return {};
+    const size_t length = ((section[1] & 0x0F) << 8) | section[2];
+    // without the CRC
+    const size_t end = std::min(section.size(), 3 + length);
+    return section.first(end >= 4 ? end - 4 : 0);
+}
+
+TSSampleSource::TSSampleSource(const StreamSourceConfig& config)
+    : StreamSampleSource(config), m_pmtPid(NO_PID), m_videoPid(NO_PID)
+{
+}
+
+const char* TSSampleSource::GetFormatName() const
+{
+    return "MPEG-TS";
+}
+
+bool TSSampleSource::Detect(std::span<const uint8_t> header)
+{
+    return DetectPacketSize(header).has_value();
+}
+
+std::optional<size_t> TSSampleSource::DetectPacketSize(std::span<const uint8_t> header)
+{
+    for (const size_t packetSize : {TS_PACKET_SIZE, TIMECODE_PACKET_SIZE})
+    {
+        const size_t syncOffset = packetSize - TS_PACKET_SIZE;
+        unsigned found = 0;
+        while (found < DETECT_PACKETS && syncOffset + found * packetSize < header.size() &&
+               header[syncOffset + found * packetSize] == SYNC_BYTE)
+            found++;
+        if (found == DETECT_PACKETS)
+            return packetSize;
+    }
+    return std::nullopt;
+}
+
+bool TSSampleSource::OpenStream(std::span<const uint8_t> header)
+{
+    const auto packetSize = DetectPacketSize(header);
+    if (!packetSize)
+        return false;
+    m_packetSize = *packetSize;
+    m_pmtPid = NO_PID;
+    m_videoPid = m_config.pid != 0 ? m_config.pid : NO_PID;
+    m_continuity = -1;
+    m_inPes = false;
+    m_flushed = false;
+    m_pesTimes.clear();
+    m_lastTimestamp.reset();
+    m_wrapOffset = 0;
+    m_lastDts.reset();
+    m_dtsStep = 0;
+    m_continuityErrors = 0;
+    m_packetErrors = 0;
+    m_info.timescale = TS_TIMESCALE;
+    return true;
+}
+
+size_t TSSampleSource::GetReadUnit() const
+{
+    return m_packetSize;
+}
+
+bool TSSampleSource::ReadAccessUnit(AccessUnit& unit)
+{
+    AnnexBSplitter::Unit split{};
+    while (!m_splitter.TakeUnit(split))
+    {
+        if (m_flushed)
+            return false;
+        if (!ReadPacket())
+        {
+            m_splitter.Flush();
+            m_flushed = true;
+            if (m_videoPid == NO_PID)
+                WHBLogPrint("ERROR: no H.264 stream found");
+            if (m_continuityErrors > 0 || m_packetErrors > 0)
+                WHBLogPrintf("Transport stream had %llu continuity errors and %llu bad packets",
+                             static_cast<unsigned long long>(m_continuityErrors),
+                             static_cast<unsigned long long>(m_packetErrors));
+        }
+    }
+
+    while (m_pesTimes.size() > 1 && m_pesTimes[1].position <= split.position)
+        m_pesTimes.pop_front();
+    if (!m_pesTimes.empty() && m_pesTimes.front().position <= split.position && !m_pesTimes.front().used)
+    {
+        unit.dts = m_pesTimes.front().dts;
+        unit.pts = m_pesTimes.front().pts;
+        m_pesTimes.front().used = true;
+    }
+    else
+    {
+        // more than one access unit in a PES packet, or one without a PTS
+        unit.dts = m_lastDts.value_or(0) + m_dtsStep;
+        unit.pts = unit.dts;
+    }
+    if (m_lastDts && unit.dts > *m_lastDts)
+        m_dtsStep = unit.dts - *m_lastDts;
+    m_lastDts = unit.dts;
+
+    unit.data = std::move(split.data);
+    unit.nals = std::move(split.nals);
+    unit.sync = split.sync;
+    unit.reference = split.reference;
+    return true;
+}
+
+bool TSSampleSource::ReadPacket()
+{
+    while (m_ring->Size() < m_packetSize)
+    {
+        // a partial packet at the end of the file is dropped
+        if (ReadInput() == 0)
+            return false;
+    }
+
+    auto packet = m_ring->ReadSpan();
+    if (packet.size() >= m_packetSize)
+    {
+        ParsePacket(packet.first(m_packetSize));
+        m_ring->Consume(m_packetSize);
+        return true;
+    }
+
+    // only after a short read in the middle of the file, the ring is a whole number of packets otherwise
+    uint8_t wrapped[TIMECODE_PACKET_SIZE];
+    const size_t first = packet.size();
+    std::copy(packet.begin(), packet.end(), wrapped);
+    m_ring->Consume(first);
+    packet = m_ring->ReadSpan();
+    std::copy_n(packet.begin(), m_packetSize - first, wrapped + first);
+    m_ring->Consume(m_packetSize - first);
+    ParsePacket({wrapped, m_packetSize});
+    return true;
+}
+
+void TSSampleSource::ParsePacket(std::span<const uint8_t> packet)
+{
+    packet = packet.subspan(m_packetSize - TS_PACKET_SIZE);
+    // no resync, a bad packet is just skipped
+    if (packet[0] != SYNC_BYTE || (packet[1] & 0x80))
+    {
+        m_packetErrors++;
+        return;
+    }
+
+    const bool unitStart = packet[1] & 0x40;
+    const uint16_t pid = ((packet[1] & 0x1F) << 8) | packet[2];
+    const uint8_t adaptation = (packet[3] >> 4) & 3;
+    const int continuity = packet[3] & 0x0F;
+    size_t offset = 4;
+    if (adaptation & 2)
+        offset += 1 + packet[4];
+    if (!(adaptation & 1) || offset >= TS_PACKET_SIZE)
+        return;
+    const auto payload = packet.subspan(offset);
+
+    if (pid == PAT_PID)
+    {
+        if (unitStart)
+            ParsePAT(payload);
+    }
+    else if (pid == m_videoPid)
+    {
+        if (continuity == m_continuity)
+            return; // duplicate packet
+        if (m_continuity >= 0 && continuity != ((m_continuity + 1) & 0x0F))
+            m_continuityErrors++;
+        m_continuity = continuity;
+        ParsePES(payload, unitStart);
+    }
+    else if (pid == m_pmtPid && unitStart)
+    {
+        ParsePMT(payload);
+    }
+}
+
+void TSSampleSource::ParsePAT(std::span<const uint8_t> payload)
+{
+    if (m_pmtPid != NO_PID || m_videoPid != NO_PID)
+        return;
+    const auto section = GetSection(payload, PAT_TABLE_ID);
+    for (size_t i = 8; i + 4 <= section.size(); i += 4)
+    {
+        const uint16_t program = (section[i] << 8) | section[i + 1];
+        // program 0 points to the network information table
+        if (program != 0)
+        {
+            m_pmtPid = ((section[i + 2] & 0x1F) << 8) | section[i + 3];
+            return;
+        }
+    }
+}
+
+void TSSampleSource::ParsePMT(std::span<const uint8_t> payload)
+{
+    if (m_videoPid != NO_PID)
+        return;
+    const auto section = GetSection(payload, PMT_TABLE_ID);
+    if (section.size() < 12)
+        return;
+    size_t i = 12 + (((section[10] & 0x0F) << 8) | section[11]);
+    while (i + 5 <= section.size())
+    {
+        const uint8_t streamType = section[i];
+        const uint16_t pid = ((section[i + 1] & 0x1F) << 8) | section[i + 2];
+        if (streamType == STREAM_TYPE_H264)
+        {
+            m_videoPid = pid;
+            WHBLogPrintf("H.264 stream on PID %u", pid);
+            return;
+        }
+        i += 5 + (((section[i + 3] & 0x0F) << 8) | section[i + 4]);
+    }
+}
+
+void TSSampleSource::ParsePES(std::span<const uint8_t> payload, bool unitStart)
+{
+    if (unitStart)
+    {
+        m_inPes = false;
+        if (payload.size() < 9 || payload[0] != 0 || payload[1] != 0 || payload[2] != 1)
+            return;
+        const uint8_t flags = payload[7];
+        const size_t headerLength = payload[8];
+        if (9 + headerLength > payload.size())
+            return;
+
+        if ((flags & 0x80) && headerLength >= 5)
+        {
+            PesTimes times{m_splitter.GetPosition(), 0, 0, false};
+            times.pts = UnwrapTimestamp(ReadTimestamp(payload.data() + 9));
+            times.dts = (flags & 0x40) && headerLength >= 10 ? UnwrapTimestamp(ReadTimestamp(payload.data() + 14))
+                                                             : times.pts;
+            if (m_pesTimes.size() >= MAX_PES_TIMES)
+                m_pesTimes.pop_front();
+            m_pesTimes.push_back(times);
+        }
+        m_inPes = true;
+        payload = payload.subspan(9 + headerLength);
+    }
+    if (m_inPes)
+        m_splitter.Feed(payload);
+}
+
+int64_t TSSampleSource::UnwrapTimestamp(uint64_t timestamp)
+{
+    int64_t value = static_cast<int64_t>(timestamp) + m_wrapOffset;
+    if (m_lastTimestamp && value < *m_lastTimestamp - TIMESTAMP_WRAP / 2)
+    {
+        m_wrapOffset += TIMESTAMP_WRAP;
+        value += TIMESTAMP_WRAP;
+    }
+    m_lastTimestamp = value;
+    return value;
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <deque>
+#include <optional>
+
+#include "StreamSampleSource.h"
+
+// H.264 stream of an MPEG transport stream, in plain 188 byte packets or 192 byte ones with a timecode in front.
+// The video PID comes from the PAT and PMT unless configured, its PES packets are reassembled into the splitter and
+// access units take the PTS and DTS of the PES packet they start in.
+class TSSampleSource : public StreamSampleSource
+{
+  public:
+    explicit TSSampleSource(const StreamSourceConfig& config = {});
+
+    [[nodiscard]] const char* GetFormatName() const override;
+
+    // Sync bytes a packet apart
+    static bool Detect(std::span<const uint8_t> header);
+
+  protected:
+    bool OpenStream(std::span<const uint8_t> header) override;
+    [[nodiscard]] size_t GetReadUnit() const override;
+    bool ReadAccessUnit(AccessUnit& unit) override;
+
+  private:
+    struct PesTimes
+    {
+        // Splitter position of the first payload byte
+        uint64_t position;
+        int64_t dts;
+        int64_t pts;
+        bool used;
+    };
+
+    static std::optional<size_t> DetectPacketSize(std::span<const uint8_t> header);
+    // Returns false at the end of the file
+    bool ReadPacket();
+    void ParsePacket(std::span<const uint8_t> packet);
+    void ParsePAT(std::span<const uint8_t> payload);
+    void ParsePMT(std::span<const uint8_t> payload);
+    void ParsePES(std::span<const uint8_t> payload, bool unitStart);
+    int64_t UnwrapTimestamp(uint64_t timestamp);
+
+  private:
+    size_t m_packetSize = 188;
+    uint16_t m_pmtPid;
+    uint16_t m_videoPid;
+    int m_continuity = -1;
+    // Payload before the first PES header of the video PID is dropped
+    bool m_inPes = false;
+    bool m_flushed = false;
+
+    std::deque<PesTimes> m_pesTimes;
+    std::optional<int64_t> m_lastTimestamp;
+    int64_t m_wrapOffset = 0;
+    // Access units without a PES timestamp of their own continue from the previous one
+    std::optional<int64_t> m_lastDts;
+    int64_t m_dtsStep = 0;
+
+    uint64_t m_continuityErrors = 0;
+    uint64_t m_packetErrors = 0;
+};
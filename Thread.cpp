@@ -0,0 +1,30 @@
+#include "Thread.h"
+#include "Trace.h"
+
+#include <coreinit/thread.h>
+
+void SetCurrentThreadCore(int core)
+{
+    uint32_t affinity = OS_THREAD_ATTRIB_AFFINITY_ANY;
+    switch (core)
+    {
+    case 0:
+        affinity = OS_THREAD_ATTRIB_AFFINITY_CPU0;
+        break;
+    case 1:
+        affinity = OS_THREAD_ATTRIB_AFFINITY_CPU1;
+        break;
+    case 2:
+        affinity = OS_THREAD_ATTRIB_AFFINITY_CPU2;
+        break;
+    default:
+        break;
+    }
+    OSSetThreadAffinity(OSGetCurrentThread(), affinity);
+}
+
+void SetCurrentThreadName(const char* name)
+{
+    OSSetThreadName(OSGetCurrentThread(), name);
+    Trace::SetThreadName(name);
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+// No core, the thread may run anywhere
+constexpr int ANY_CORE = -1;
+
+// Pins the calling thread to one of the three CPU cores
+void SetCurrentThreadCore(int core);
+// Also the name of the thread's track in the trace
+void SetCurrentThreadName(const char* name);
@@ -0,0 +1,409 @@
+#include "Trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <whb/log.h>
+
+using std::chrono::nanoseconds;
+
+constexpr size_t MAX_THREAD_NAME = 32;
+// Of every event, there is only the one process
+constexpr int PROCESS_ID = 1;
+// Longest JSON line, names included
+constexpr size_t MAX_JSON_LINE = 256;
+
+// Fields are written by the ring's thread and read by exports, relaxed atomics compile to plain loads and stores
+struct EventSlot
+{
+    std::atomic<int64_t> time;
+    std::atomic<const char*> name;
+    std::atomic<int64_t> value;
+    std::atomic<Trace::EventType> type;
+};
+
+struct StageSlot
+{
+    // nullptr while the slot is unused
+    std::atomic<const char*> name{nullptr};
+    std::atomic<uint64_t> count{0};
+    std::atomic<int64_t> total{0};
+    std::atomic<int64_t> max{0};
+    std::array<std::atomic<uint64_t>, Trace::HISTOGRAM_BUCKETS> buckets{};
+};
+
+struct ThreadRing
+{
+    std::array<EventSlot, Trace::RING_EVENTS> events;
+    // Events written so far, the last RING_EVENTS of them are in events
+    std::atomic<uint64_t> head{0};
+    std::array<StageSlot, Trace::MAX_STAGES> stages;
+
+    // Guarded by the registry's mutex
+    unsigned threadId = 0;
+    char threadName[MAX_THREAD_NAME]{};
+    bool owned = false;
+};
+
+// Never destroyed, threads may still exit after the static destructors ran
+struct Registry
+{
+    Trace::Clock::time_point epoch = Trace::Clock::now();
+    std::atomic_bool enabled{true};
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadRing>> rings;
+    unsigned nextThreadId = 1;
+};
+
+static Registry& GetRegistry()
+{
+    static auto* registry = new Registry;
+    return *registry;
+}
+
+// Takes a ring no thread owns, or a new one
+static ThreadRing* AcquireRing()
+{
+    auto& registry = GetRegistry();
+    std::scoped_lock l{registry.mutex};
+    ThreadRing* ring = nullptr;
+    for (auto& candidate : registry.rings)
+    {
+        if (!candidate->owned)
+        {
+            ring = candidate.get();
+            break;
+        }
+    }
+    // a new thread gets a new track, the events of the previous one are dropped but its histograms kept
+    if (!ring)
+        ring = registry.rings.emplace_back(std::make_unique<ThreadRing>()).get();
+    else
+        ring->head.store(0, std::memory_order_relaxed);
+    ring->owned = true;
+    ring->threadId = registry.nextThreadId++;
+    std::snprintf(ring->threadName, sizeof(ring->threadName), "Thread %u", ring->threadId);
+    return ring;
+}
+
+// Hands the ring back for reuse once its thread exits
+struct RingHandle
+{
+    ThreadRing* ring = nullptr;
+
+    ~RingHandle()
+    {
+        if (!ring)
+            return;
+        auto& registry = GetRegistry();
+        std::scoped_lock l{registry.mutex};
+        ring->owned = false;
+    }
+};
+
+static thread_local RingHandle t_ring;
+
+static ThreadRing& CurrentRing()
+{
+    if (!t_ring.ring)
+        t_ring.ring = AcquireRing();
+    return *t_ring.ring;
+}
+
+static nanoseconds Now()
+{
+    return std::chrono::duration_cast<nanoseconds>(Trace::Clock::now() - GetRegistry().epoch);
+}
+
+// Only the owning thread writes, so plain increments are enough
+template <typename T> static void Increase(std::atomic<T>& counter, T amount)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+static void Record(ThreadRing& ring, Trace::EventType type, const char* name, nanoseconds time, int64_t value)
+{
+    const uint64_t head = ring.head.load(std::memory_order_relaxed);
+    // Orders the slot stores after the previous head store, so a reader that sees them also sees that head
+    std::atomic_thread_fence(std::memory_order_release);
+    auto& slot = ring.events[head % Trace::RING_EVENTS];
+    slot.time.store(time.count(), std::memory_order_relaxed);
+    slot.name.store(name, std::memory_order_relaxed);
+    slot.value.store(value, std::memory_order_relaxed);
+    slot.type.store(type, std::memory_order_relaxed);
+    ring.head.store(head + 1, std::memory_order_release);
+}
+
+static void RecordDuration(ThreadRing& ring, const char* name, nanoseconds duration)
+{
+    StageSlot* stage = nullptr;
+    for (auto& candidate : ring.stages)
+    {
+        const auto* stageName = candidate.name.load(std::memory_order_relaxed);
+        if (stageName == name)
+        {
+            stage = &candidate;
+            break;
+        }
+        if (!stageName)
+        {
+            candidate.name.store(name, std::memory_order_release);
+            stage = &candidate;
+            break;
+        }
+    }
+    if (!stage)
+        return;
+
+    const auto micros = static_cast<uint64_t>(std::max<int64_t>(duration.count() / 1000, 0));
+    const auto bucket = std::min<unsigned>(std::bit_width(micros), Trace::HISTOGRAM_BUCKETS - 1);
+    Increase<uint64_t>(stage->count, 1);
+    Increase<int64_t>(stage->total, duration.count());
+    Increase<uint64_t>(stage->buckets[bucket], 1);
+    if (duration.count() > stage->max.load(std::memory_order_relaxed))
+        stage->max.store(duration.count(), std::memory_order_relaxed);
+}
+
+struct ThreadSnapshot
+{
+    unsigned threadId;
+    std::string name;
+    std::vector<Trace::Event> events;
+};
+
+static std::vector<ThreadSnapshot> TakeSnapshot()
+{
+    auto& registry = GetRegistry();
+    std::scoped_lock l{registry.mutex};
+    std::vector<ThreadSnapshot> snapshots;
+    for (const auto& ring : registry.rings)
+    {
+        if (!ring->owned && ring->head.load(std::memory_order_relaxed) == 0)
+            continue;
+        auto& snapshot = snapshots.emplace_back(ThreadSnapshot{ring->threadId, ring->threadName, {}});
+        const uint64_t end = ring->head.load(std::memory_order_acquire);
+        const uint64_t begin = end > Trace::RING_EVENTS ? end - Trace::RING_EVENTS : 0;
+        snapshot.events.reserve(end - begin);
+        for (uint64_t i = begin; i < end; ++i)
+        {
+            const auto& slot = ring->events[i % Trace::RING_EVENTS];
+            snapshot.events.push_back({nanoseconds(slot.time.load(std::memory_order_relaxed)),
+                                       slot.name.load(std::memory_order_relaxed),
+                                       slot.value.load(std::memory_order_relaxed),
+                                       slot.type.load(std::memory_order_relaxed)});
+        }
+        // Events overwritten while copying, including the one being written now, are dropped
+        std::atomic_thread_fence(std::memory_order_acquire);
+        const uint64_t after = ring->head.load(std::memory_order_relaxed);
+        const uint64_t valid = after + 1 > Trace::RING_EVENTS ? after + 1 - Trace::RING_EVENTS : 0;
+        if (valid > begin)
+            snapshot.events.erase(snapshot.events.begin(),
+                                  snapshot.events.begin() + static_cast<ptrdiff_t>(std::min(valid, end) - begin));
+    }
+    return snapshots;
+}
+
+// Names only ever come from string literals and SetThreadName, this keeps the JSON valid whatever they contain
+static void CopyName(char* target, size_t size, const char* name)
+{
+    size_t i = 0;
+    for (; name[i] && i + 1 < size; ++i)
+        target[i] = name[i] == '"' || name[i] == '\\' || static_cast<unsigned char>(name[i]) < 0x20 ? '_' : name[i];
+    target[i] = '\0';
+}
+
+// Calls write with each line of the JSON document
+template <typename Write> static void WriteJsonLines(Write write)
+{
+    char line[MAX_JSON_LINE];
+    char name[MAX_THREAD_NAME * 2];
+    write("{\"traceEvents\":[");
+    bool first = true;
+    const auto separator = [&first] {
+        const char* result = first ? "" : ",";
+        first = false;
+        return result;
+    };
+
+    for (const auto& thread : TakeSnapshot())
+    {
+        CopyName(name, sizeof(name), thread.name.c_str());
+        std::snprintf(line, sizeof(line),
+                      "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                      separator(), PROCESS_ID, thread.threadId, name);
+        write(line);
+
+        // Ends of scopes whose beginning was overwritten would close scopes that aren't open
+        unsigned depth = 0;
+        for (const auto& event : thread.events)
+        {
+            if (event.type == Trace::EventType::End && depth == 0)
+                continue;
+            CopyName(name, sizeof(name), event.name ? event.name : "");
+            const double time = event.time.count() / 1000.0;
+            switch (event.type)
+            {
+            case Trace::EventType::Begin:
+                depth++;
+                std::snprintf(line, sizeof(line),
+                              "%s{\"name\":\"%s\",\"ph\":\"B\",\"pid\":%d,\"tid\":%u,\"ts\":%.3f}", separator(), name,
+                              PROCESS_ID, thread.threadId, time);
+                break;
+            case Trace::EventType::End:
+                depth--;
+                std::snprintf(line, sizeof(line),
+                              "%s{\"name\":\"%s\",\"ph\":\"E\",\"pid\":%d,\"tid\":%u,\"ts\":%.3f}", separator(), name,
+                              PROCESS_ID, thread.threadId, time);
+                break;
+            case Trace::EventType::Instant:
+                std::snprintf(line, sizeof(line),
+                              "%s{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":%d,\"tid\":%u,\"ts\":%.3f,"
+                              "\"args\":{\"value\":%lld}}",
+                              separator(), name, PROCESS_ID, thread.threadId, time,
+                              static_cast<long long>(event.value));
+                break;
+            case Trace::EventType::Counter:
+                std::snprintf(line, sizeof(line),
+                              "%s{\"name\":\"%s\",\"ph\":\"C\",\"pid\":%d,\"tid\":%u,\"ts\":%.3f,"
+                              "\"args\":{\"value\":%lld}}",
+                              separator(), name, PROCESS_ID, thread.threadId, time,
+                              static_cast<long long>(event.value));
+                break;
+            }
+            write(line);
+        }
+    }
+    write("]}");
+}
+
+std::chrono::microseconds Trace::Histogram::Percentile(double quantile) const
+{
+    const auto target = static_cast<uint64_t>(quantile * count);
+    uint64_t seen = 0;
+    for (unsigned i = 0; i + 1 < HISTOGRAM_BUCKETS; ++i)
+    {
+        seen += buckets[i];
+        if (seen > target)
+            return std::chrono::microseconds(1ll << i);
+    }
+    return std::chrono::duration_cast<std::chrono::microseconds>(max);
+}
+
+Trace::Scope::Scope(const char* name) : m_name(name)
+{
+    if (!IsEnabled())
+        return;
+    m_start = Now();
+    Record(CurrentRing(), EventType::Begin, m_name, m_start, 0);
+}
+
+Trace::Scope::~Scope()
+{
+    if (m_start.count() == 0)
+        return;
+    const auto end = Now();
+    auto& ring = CurrentRing();
+    Record(ring, EventType::End, m_name, end, 0);
+    RecordDuration(ring, m_name, end - m_start);
+}
+
+void Trace::SetEnabled(bool enabled)
+{
+    GetRegistry().enabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool Trace::IsEnabled()
+{
+    return GetRegistry().enabled.load(std::memory_order_relaxed);
+}
+
+void Trace::SetThreadName(const char* name)
+{
+    auto& ring = CurrentRing();
+    std::scoped_lock l{GetRegistry().mutex};
+    std::snprintf(ring.threadName, sizeof(ring.threadName), "%s", name);
+}
+
+void Trace::Instant(const char* name, int64_t value)
+{
+    if (IsEnabled())
+        Record(CurrentRing(), EventType::Instant, name, Now(), value);
+}
+
+void Trace::Counter(const char* name, int64_t value)
+{
+    if (IsEnabled())
+        Record(CurrentRing(), EventType::Counter, name, Now(), value);
+}
+
+std::vector<Trace::Histogram> Trace::GetHistograms()
+{
+    auto& registry = GetRegistry();
+    std::scoped_lock l{registry.mutex};
+    std::vector<Histogram> histograms;
+    for (const auto& ring : registry.rings)
+    {
+        for (const auto& stage : ring->stages)
+        {
+            const auto* name = stage.name.load(std::memory_order_acquire);
+            if (!name)
+                break;
+            // the same literal may have a different address in another translation unit
+            auto it = std::find_if(histograms.begin(), histograms.end(),
+                                   [name](const Histogram& histogram) { return !std::strcmp(histogram.name, name); });
+            if (it == histograms.end())
+                it = histograms.insert(histograms.end(), Histogram{name, 0, {}, {}, {}});
+            it->count += stage.count.load(std::memory_order_relaxed);
+            it->total += nanoseconds(stage.total.load(std::memory_order_relaxed));
+            it->max = std::max(it->max, nanoseconds(stage.max.load(std::memory_order_relaxed)));
+            for (unsigned i = 0; i < HISTOGRAM_BUCKETS; ++i)
+                it->buckets[i] += stage.buckets[i].load(std::memory_order_relaxed);
+        }
+    }
+    return histograms;
+}
+
+void Trace::WriteJson(std::ostream& stream)
+{
+    WriteJsonLines([&stream](const char* line) { stream << line << '\n'; });
+}
+
+bool Trace::WriteJson(const std::filesystem::path& path)
+{
+    std::ofstream file(path);
+    if (!file)
+    {
+        WHBLogPrintf("Failed to write trace to %s", path.c_str());
+        return false;
+    }
+    WriteJson(file);
+    return static_cast<bool>(file);
+}
+
+void Trace::LogJson()
+{
+    WriteJsonLines([](const char* line) { WHBLogPrint(line); });
+}
+
+void Trace::LogHistograms()
+{
+    for (const auto& histogram : GetHistograms())
+    {
+        if (histogram.count == 0)
+            continue;
+        const auto mean = std::chrono::duration_cast<std::chrono::microseconds>(
+            histogram.total / static_cast<int64_t>(histogram.count));
+        const auto max = std::chrono::duration_cast<std::chrono::microseconds>(histogram.max);
+        WHBLogPrintf("%s: %llu times, mean %lld us, p50 < %lld us, p99 < %lld us, max %lld us", histogram.name,
+                     static_cast<unsigned long long>(histogram.count), static_cast<long long>(mean.count()),
+                     static_cast<long long>(histogram.Percentile(0.5).count()),
+                     static_cast<long long>(histogram.Percentile(0.99).count()), static_cast<long long>(max.count()));
+    }
+}
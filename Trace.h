@@ -0,0 +1,100 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <ostream>
+#include <vector>
+
+// Timeline of the hot paths for diagnosing stutters. Every thread records fixed size events into a ring of its own
+// without locking, the oldest ones are overwritten, and keeps a histogram of the durations of each of its scopes.
+// The rings are exported as Chrome trace JSON, which Perfetto and chrome://tracing load.
+// The TRACE_ macros compile to nothing unless VIDEOPLAYER_TRACE is defined, recording can also be turned off at run
+// time. Event names have to be string literals, only the pointer is kept.
+class Trace
+{
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    enum class EventType : uint8_t
+    {
+        Begin,
+        End,
+        Instant,
+        Counter,
+    };
+
+    struct Event
+    {
+        // Since the start of the process
+        std::chrono::nanoseconds time;
+        const char* name;
+        int64_t value;
+        EventType type;
+    };
+
+    // Durations of one scope, bucket i counts those under 2^i microseconds that aren't in bucket i - 1
+    static constexpr unsigned HISTOGRAM_BUCKETS = 24;
+    struct Histogram
+    {
+        const char* name;
+        uint64_t count;
+        std::chrono::nanoseconds total;
+        std::chrono::nanoseconds max;
+        std::array<uint64_t, HISTOGRAM_BUCKETS> buckets;
+
+        // Upper bound of the bucket the quantile falls into
+        [[nodiscard]] std::chrono::microseconds Percentile(double quantile) const;
+    };
+
+    // Events kept per thread
+    static constexpr size_t RING_EVENTS = 4096;
+    // Scopes with a histogram per thread, the ones after that are only recorded as events
+    static constexpr unsigned MAX_STAGES = 16;
+
+    // Records the begin and end events of the enclosing scope and its duration in the histogram
+    class Scope
+    {
+      public:
+        explicit Scope(const char* name);
+        ~Scope();
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+      private:
+        const char* m_name;
+        // Zero while recording is off
+        std::chrono::nanoseconds m_start{};
+    };
+
+    // On by default
+    static void SetEnabled(bool enabled);
+    [[nodiscard]] static bool IsEnabled();
+    // Shown as the name of the calling thread's track
+    static void SetThreadName(const char* name);
+
+    static void Instant(const char* name, int64_t value = 0);
+    static void Counter(const char* name, int64_t value);
+
+    // Merged over the threads by name
+    [[nodiscard]] static std::vector<Histogram> GetHistograms();
+    // A snapshot of every ring, recording carries on meanwhile
+    static void WriteJson(std::ostream& stream);
+    static bool WriteJson(const std::filesystem::path& path);
+    // Over the log, one event per line, to be joined up by whoever receives it
+    static void LogJson();
+    static void LogHistograms();
+};
+
+#ifdef VIDEOPLAYER_TRACE
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(name) Trace::Scope TRACE_CONCAT(traceScope, __LINE__)(name)
+#define TRACE_INSTANT(name, value) Trace::Instant(name, value)
+#define TRACE_COUNTER(name, value) Trace::Counter(name, value)
+#else
+#define TRACE_SCOPE(name)
+#define TRACE_INSTANT(name, value) ((void)0)
+#define TRACE_COUNTER(name, value) ((void)0)
+#endif
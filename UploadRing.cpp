@@ -0,0 +1,74 @@
+#include "UploadRing.h"
+
+#include <algorithm>
+
+UploadRing::UploadRing(unsigned slots) : m_slotCount(std::clamp(slots, 2u, MAX_SLOTS))
+{
+}
+
+unsigned UploadRing::GetSlotCount() const
+{
+    return m_slotCount;
+}
+
+unsigned UploadRing::FindLocked(State state) const
+{
+    return static_cast<unsigned>(std::find(m_states.begin(), m_states.begin() + m_slotCount, state) -
+                                 m_states.begin());
+}
+
+unsigned UploadRing::BeginUpload()
+{
+    std::scoped_lock l{m_mutex};
+    unsigned slot = FindLocked(State::Free);
+    if (slot == m_slotCount)
+    {
+        // with a slot drawn and none uploading, the other ones can only be ready
+        slot = FindLocked(State::Ready);
+        m_dropped++;
+    }
+    m_states[slot] = State::Uploading;
+    return slot;
+}
+
+void UploadRing::FinishUpload(unsigned slot)
+{
+    std::scoped_lock l{m_mutex};
+    if (const unsigned ready = FindLocked(State::Ready); ready != m_slotCount)
+    {
+        m_states[ready] = State::Free;
+        m_dropped++;
+    }
+    m_states[slot] = State::Ready;
+}
+
+std::optional<unsigned> UploadRing::TakeReady()
+{
+    std::scoped_lock l{m_mutex};
+    const unsigned ready = FindLocked(State::Ready);
+    if (ready == m_slotCount)
+        return std::nullopt;
+    if (const unsigned drawn = FindLocked(State::Drawn); drawn != m_slotCount)
+        m_states[drawn] = State::Free;
+    m_states[ready] = State::Drawn;
+    return ready;
+}
+
+std::optional<unsigned> UploadRing::GetDrawn() const
+{
+    std::scoped_lock l{m_mutex};
+    const unsigned drawn = FindLocked(State::Drawn);
+    return drawn != m_slotCount ? std::optional{drawn} : std::nullopt;
+}
+
+void UploadRing::Reset()
+{
+    std::scoped_lock l{m_mutex};
+    m_states.fill(State::Free);
+}
+
+uint64_t UploadRing::GetDroppedCount() const
+{
+    std::scoped_lock l{m_mutex};
+    return m_dropped;
+}
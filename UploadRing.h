@@ -0,0 +1,55 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+
+// Which of a few sets of textures frames are uploaded into and which one is drawn, between one uploading and one
+// drawing thread. Uploads never go into the drawn set or wait for the drawing thread: they take a free set, or the
+// finished one that wasn't drawn yet if there is none, which then is dropped. With three sets that only happens if
+// two uploads finish between draws.
+class UploadRing
+{
+  public:
+    static constexpr unsigned MAX_SLOTS = 3;
+
+    // Clamped to 2 to MAX_SLOTS
+    explicit UploadRing(unsigned slots);
+
+    [[nodiscard]] unsigned GetSlotCount() const;
+
+    // Uploading thread, one upload at a time
+    [[nodiscard]] unsigned BeginUpload();
+    // The slot is drawn next, a finished one that wasn't drawn yet is dropped
+    void FinishUpload(unsigned slot);
+
+    // Drawing thread. The newest finished slot, which is drawn from now on, std::nullopt if nothing finished since the
+    // last call.
+    [[nodiscard]] std::optional<unsigned> TakeReady();
+    // Drawing thread, std::nullopt before the first upload was taken
+    [[nodiscard]] std::optional<unsigned> GetDrawn() const;
+
+    // Frees every slot, only while nothing is being uploaded
+    void Reset();
+
+    // Uploads that were never drawn
+    [[nodiscard]] uint64_t GetDroppedCount() const;
+
+  private:
+    enum class State
+    {
+        Free,
+        Uploading,
+        Ready,
+        Drawn,
+    };
+
+    // Of the slot in state, or the slot count
+    [[nodiscard]] unsigned FindLocked(State state) const;
+
+  private:
+    unsigned m_slotCount;
+    mutable std::mutex m_mutex;
+    std::array<State, MAX_SLOTS> m_states{};
+    uint64_t m_dropped = 0;
+};
@@ -0,0 +1,117 @@
+// NV12 to RGBA conversion throughput and its error against the shader's math, for every colour space.
+// Usage: colorconvert-bench [frames per kernel, default 100]
+#include "ColorConvert.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+constexpr unsigned WIDTH = 1920;
+constexpr unsigned HEIGHT = 1080;
+// Coded size and pitch of a 1080p frame from the decoder
+constexpr unsigned CODED_HEIGHT = 1088;
+constexpr unsigned PITCH = 2048;
+
+// Random samples over the whole byte range, out of range values of limited range streams included
+static void FillFrame(uint8_t* data)
+{
+    uint64_t state = 0x9E3779B97F4A7C15ull;
+    for (size_t i = 0; i < size_t{PITCH} * CODED_HEIGHT * 3 / 2; ++i)
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        data[i] = static_cast<uint8_t>(state);
+    }
+}
+
+// nv12torgb.frag in floats, with the coefficients of the other colour spaces, and the render target's rounding
+static void ShaderReference(const NV12Image& image, const ColorSpace& space, uint8_t* rgba)
+{
+    struct
+    {
+        float y, rv, gu, gv, bu;
+    } m;
+    if (space.matrix == ColorMatrix::Bt709)
+        m = space.fullRange ? decltype(m){1.0f, 1.5748f, -0.187324f, -0.468124f, 1.8556f}
+                            : decltype(m){1.164383f, 1.792741f, -0.213249f, -0.532909f, 2.112402f};
+    else
+        m = space.fullRange ? decltype(m){1.0f, 1.402f, -0.344136f, -0.714136f, 1.772f}
+                            : decltype(m){1.164383f, 1.596027f, -0.391762f, -0.812968f, 2.017232f};
+    const auto store = [](float value) {
+        return static_cast<uint8_t>(std::lround(std::clamp(value, 0.0f, 1.0f) * 255.0f));
+    };
+
+    for (unsigned line = 0; line < image.height; ++line)
+    {
+        for (unsigned x = 0; x < image.width; ++x)
+        {
+            const uint8_t* chroma = image.chroma + line / 2 * image.pitch + (x & ~1u);
+            const float y = image.luma[line * image.pitch + x] / 255.0f - (space.fullRange ? 0.0f : 0.0625f);
+            const float u = chroma[0] / 255.0f - 0.5f;
+            const float v = chroma[1] / 255.0f - 0.5f;
+            uint8_t* out = rgba + (size_t{line} * image.width + x) * 4;
+            out[0] = store(m.y * y + m.rv * v);
+            out[1] = store(m.y * y + m.gu * u + m.gv * v);
+            out[2] = store(m.y * y + m.bu * u);
+            out[3] = 255;
+        }
+    }
+}
+
+template <typename Convert>
+static void Run(const char* name, const NV12Image& image, const ColorSpace& space, unsigned frames,
+                const std::vector<uint8_t>& reference, Convert convert)
+{
+    std::vector<uint8_t> rgba(size_t{image.width} * image.height * 4);
+    const size_t rgbaPitch = size_t{image.width} * 4;
+    const auto start = std::chrono::steady_clock::now();
+    for (unsigned i = 0; i < frames; ++i)
+        convert(image, space, rgba.data(), rgbaPitch);
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    int maxError = 0;
+    size_t exact = 0;
+    for (size_t i = 0; i < rgba.size(); ++i)
+    {
+        const int error = std::abs(rgba[i] - reference[i]);
+        maxError = std::max(maxError, error);
+        exact += error == 0;
+    }
+    const double megapixels = static_cast<double>(image.width) * image.height * frames / 1e6;
+    std::printf("  %-8s %8.2f ms/frame %8.1f MP/s   max error %d, %.3f%% exact\n", name,
+                elapsed.count() * 1000 / frames, megapixels / elapsed.count(), maxError, 100.0 * exact / rgba.size());
+}
+
+int main(int argc, char** argv)
+{
+    const unsigned frames = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100;
+    FramePool pool(size_t{PITCH} * CODED_HEIGHT * 3 / 2, 1);
+    DecodedFrame frame{pool.Acquire(), WIDTH, CODED_HEIGHT, PITCH, 0, true};
+    FillFrame(frame.buffer.data());
+    const NV12Image image = CropFrame(frame, WIDTH, HEIGHT, 0, 0);
+
+    const struct
+    {
+        const char* name;
+        ColorSpace space;
+    } spaces[]{
+        {"BT.601 limited", {ColorMatrix::Bt601, false}},
+        {"BT.601 full", {ColorMatrix::Bt601, true}},
+        {"BT.709 limited", {ColorMatrix::Bt709, false}},
+        {"BT.709 full", {ColorMatrix::Bt709, true}},
+    };
+    for (const auto& [name, space] : spaces)
+    {
+        std::printf("%s, %ux%u\n", name, WIDTH, HEIGHT);
+        std::vector<uint8_t> reference(size_t{WIDTH} * HEIGHT * 4);
+        ShaderReference(image, space, reference.data());
+        Run("scalar", image, space, frames, reference, ConvertNV12ToRGBAScalar);
+        Run("blocks", image, space, frames, reference, ConvertNV12ToRGBABlocks);
+        Run("best", image, space, frames, reference, ConvertNV12ToRGBA);
+    }
+    return 0;
+}
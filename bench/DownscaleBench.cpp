@@ -0,0 +1,113 @@
+// NV12 downscaling throughput from 1080p to the DRC's size, and the error against averaging in doubles.
+// Usage: downscale-bench [frames per kernel, default 100] [width, default 854] [height, default 480]
+#include "Downscaler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+constexpr unsigned SOURCE_WIDTH = 1920;
+constexpr unsigned SOURCE_HEIGHT = 1080;
+// Coded height and pitch of a 1080p frame from the decoder
+constexpr unsigned CODED_HEIGHT = 1088;
+constexpr unsigned PITCH = 2048;
+
+// Gradients with noise on top, so the averages aren't all the same
+static void FillFrame(uint8_t* data)
+{
+    uint64_t state = 0x9E3779B97F4A7C15ull;
+    for (size_t line = 0; line < CODED_HEIGHT * 3 / 2; ++line)
+    {
+        for (size_t x = 0; x < PITCH; ++x)
+        {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            data[line * PITCH + x] = static_cast<uint8_t>((x + line) / 8 + state % 64);
+        }
+    }
+}
+
+// Area average of one plane with channels interleaved samples per pixel
+static void ReferencePlane(const uint8_t* source, unsigned sourceWidth, unsigned sourceHeight, unsigned channels,
+                           uint8_t* destination, unsigned width, unsigned height)
+{
+    const double scaleX = static_cast<double>(sourceWidth) / width;
+    const double scaleY = static_cast<double>(sourceHeight) / height;
+    for (unsigned y = 0; y < height; ++y)
+    {
+        for (unsigned x = 0; x < width; ++x)
+        {
+            for (unsigned channel = 0; channel < channels; ++channel)
+            {
+                double sum = 0;
+                for (auto sy = static_cast<unsigned>(y * scaleY); sy < std::ceil((y + 1) * scaleY); ++sy)
+                {
+                    const double coveredY = std::min((y + 1) * scaleY, sy + 1.0) - std::max(y * scaleY, 1.0 * sy);
+                    for (auto sx = static_cast<unsigned>(x * scaleX); sx < std::ceil((x + 1) * scaleX); ++sx)
+                    {
+                        const double coveredX =
+                            std::min((x + 1) * scaleX, sx + 1.0) - std::max(x * scaleX, 1.0 * sx);
+                        sum += coveredX * coveredY * source[sy * PITCH + sx * channels + channel];
+                    }
+                }
+                destination[(y * width + x) * channels + channel] =
+                    static_cast<uint8_t>(std::lround(sum / (scaleX * scaleY)));
+            }
+        }
+    }
+}
+
+template <typename Scale>
+static void Run(const char* name, const NV12Image& source, unsigned frames, const std::vector<uint8_t>& reference,
+                Scale scale)
+{
+    const unsigned width = SOURCE_WIDTH;
+    std::vector<uint8_t> output(reference.size());
+    const auto start = std::chrono::steady_clock::now();
+    for (unsigned i = 0; i < frames; ++i)
+        scale(source, output.data(), width, output.data() + reference.size() * 2 / 3, width);
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    int maxError = 0;
+    for (size_t i = 0; i < output.size(); ++i)
+        maxError = std::max(maxError, std::abs(output[i] - reference[i]));
+    const double megapixels = static_cast<double>(source.width) * source.height * frames / 1e6;
+    std::printf("  %-8s %8.2f ms/frame %8.1f source MP/s   max error %d\n", name, elapsed.count() * 1000 / frames,
+                megapixels / elapsed.count(), maxError);
+}
+
+int main(int argc, char** argv)
+{
+    const unsigned frames = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100;
+    const unsigned width = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 854;
+    const unsigned height = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 480;
+
+    std::vector<uint8_t> frame(size_t{PITCH} * CODED_HEIGHT * 3 / 2);
+    FillFrame(frame.data());
+    const NV12Image source{frame.data(), frame.data() + size_t{PITCH} * CODED_HEIGHT, PITCH, SOURCE_WIDTH,
+                           SOURCE_HEIGHT};
+    NV12Downscaler scaler(SOURCE_WIDTH, SOURCE_HEIGHT, width, height);
+    std::printf("%ux%u to %ux%u\n", SOURCE_WIDTH, SOURCE_HEIGHT, scaler.GetWidth(), scaler.GetHeight());
+
+    // both planes packed at the pitch of the benchmark's own output, a row of the source width
+    std::vector<uint8_t> reference(size_t{SOURCE_WIDTH} * scaler.GetHeight() * 3 / 2);
+    std::vector<uint8_t> luma(size_t{scaler.GetWidth()} * scaler.GetHeight());
+    std::vector<uint8_t> chroma(luma.size() / 2);
+    ReferencePlane(source.luma, SOURCE_WIDTH, SOURCE_HEIGHT, 1, luma.data(), scaler.GetWidth(), scaler.GetHeight());
+    ReferencePlane(source.chroma, SOURCE_WIDTH / 2, SOURCE_HEIGHT / 2, 2, chroma.data(), scaler.GetWidth() / 2,
+                   scaler.GetHeight() / 2);
+    for (unsigned line = 0; line < scaler.GetHeight(); ++line)
+        std::copy_n(luma.data() + line * scaler.GetWidth(), scaler.GetWidth(), reference.data() + line * SOURCE_WIDTH);
+    for (unsigned line = 0; line < scaler.GetHeight() / 2; ++line)
+        std::copy_n(chroma.data() + line * scaler.GetWidth(), scaler.GetWidth(),
+                    reference.data() + reference.size() * 2 / 3 + line * SOURCE_WIDTH);
+
+    Run("scalar", source, frames, reference, [&](auto&&... args) { scaler.ScaleScalar(args...); });
+    Run("words", source, frames, reference, [&](auto&&... args) { scaler.ScaleWords(args...); });
+    Run("best", source, frames, reference, [&](auto&&... args) { scaler.Scale(args...); });
+    return 0;
+}
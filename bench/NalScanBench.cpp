@@ -0,0 +1,87 @@
+// Start code search throughput on a synthetic Annex-B stream.
+// Usage: nalscan-bench [size in MiB, default 256]
+#include "AnnexB.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+// Random payloads with emulation prevention, NAL units of up to 64 KiB behind 4 byte start codes
+static std::vector<uint8_t> MakeStream(size_t size)
+{
+    std::vector<uint8_t> stream;
+    stream.reserve(size + 128 * 1024);
+    uint64_t state = 0x9E3779B97F4A7C15ull;
+    const auto next = [&state] {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    };
+
+    while (stream.size() < size)
+    {
+        stream.insert(stream.end(), START_CODE, START_CODE + sizeof(START_CODE));
+        stream.push_back(0x41);
+        const size_t nalSize = 16 + next() % (64 * 1024);
+        unsigned zeros = 0;
+        for (size_t i = 0; i < nalSize; ++i)
+        {
+            const auto byte = static_cast<uint8_t>(next());
+            if (zeros >= 2 && byte <= 3)
+            {
+                stream.push_back(3);
+                zeros = 0;
+            }
+            stream.push_back(byte);
+            zeros = byte == 0 ? zeros + 1 : 0;
+        }
+        if (stream.back() == 0)
+            stream.push_back(0x80);
+    }
+    return stream;
+}
+
+static size_t NaiveFind(std::span<const uint8_t> data, size_t from)
+{
+    for (size_t i = from; i + 3 <= data.size(); ++i)
+    {
+        if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1)
+            return i;
+    }
+    return data.size();
+}
+
+template <typename Find>
+static void Run(const char* name, std::span<const uint8_t> data, Find find)
+{
+    const auto start = std::chrono::steady_clock::now();
+    size_t count = 0;
+    for (size_t i = find(data, 0); i < data.size(); i = find(data, i + 3))
+        count++;
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::printf("%-10s %8zu start codes %8.1f ms %8.1f MiB/s\n", name, count, elapsed.count() * 1000,
+                data.size() / elapsed.count() / (1024 * 1024));
+}
+
+int main(int argc, char** argv)
+{
+    const size_t mebibytes = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 256;
+    const auto stream = MakeStream(mebibytes * 1024 * 1024);
+    const std::span<const uint8_t> data{stream};
+    std::printf("%zu bytes\n", stream.size());
+
+    Run("naive", data, NaiveFind);
+    Run("scalar", data, [](std::span<const uint8_t> d, size_t from) { return FindStartCodeScalar(d, from); });
+    Run("words", data, [](std::span<const uint8_t> d, size_t from) { return FindStartCodeWords(d, from); });
+    Run("best", data, [](std::span<const uint8_t> d, size_t from) { return FindStartCode(d, from); });
+
+    const auto start = std::chrono::steady_clock::now();
+    NalIndex index;
+    IndexNalUnits(data, index);
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::printf("%-10s %8zu NAL units   %8.1f ms %8.1f MiB/s\n", "index", index.size(), elapsed.count() * 1000,
+                data.size() / elapsed.count() / (1024 * 1024));
+    return 0;
+}
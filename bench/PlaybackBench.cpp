@@ -0,0 +1,457 @@
+// Plays a file end to end on the host platform, with the fake decoder standing in for the console's and a software
+// sink for Gfx, in four passes:
+//   demux   reads every access unit as fast as the source delivers them
+//   io      reads every sample of an MP4 file through BlockByteStream and with an fseeko and fread per sample
+//   decode  feeds them through the decoder into the sink without a clock, as fast as the pipeline goes
+//   play    plays the file through Player, presenting once per vsync like main.cpp
+// Usage: videoplayer-bench <file> [--latency us] [--idr-latency us] [--reorder frames] [--sink null|copy|rgba]
+//                          [--vsync hz] [--play-seconds s, 0 skips the play pass] [--parser native|bento4]
+//                          [--no-index-cache] [--trace file.json] [--verbose]
+// The histograms of the traced scopes are printed at the end, with --trace the timeline is saved as well.
+#include "BlockByteStream.h"
+#include "FakeDecoder.h"
+#include "HostPlatform.h"
+#include "MP4.h"
+#include "Player.h"
+#include "SoftwareSink.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/resource.h>
+
+using Clock = std::chrono::steady_clock;
+using std::chrono::microseconds;
+
+// Same as main.cpp, so the arena stats compare with the console's
+constexpr size_t VIDEO_ARENA_SIZE = 96 * 1024 * 1024;
+// How often the decode pass looks for output frames
+constexpr microseconds OUTPUT_POLL_INTERVAL{200};
+
+struct Options
+{
+    const char* path = nullptr;
+    FakeDecoderConfig decoder{};
+    SoftwareSink::Mode sink = SoftwareSink::Mode::Copy;
+    // Every pass opens the file again, with the index cache on all but the first load it from the cache
+    MP4SourceConfig mp4{};
+    unsigned vsyncRate = 60;
+    // Negative plays the whole file
+    double playSeconds = -1;
+    const char* tracePath = nullptr;
+    bool verbose = false;
+};
+
+static bool ParseOptions(int argc, char** argv, Options& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string_view arg = argv[i];
+        if (arg == "--verbose")
+        {
+            options.verbose = true;
+            continue;
+        }
+        if (arg == "--no-index-cache")
+        {
+            options.mp4.indexCache = false;
+            continue;
+        }
+        if (!arg.starts_with("--"))
+        {
+            options.path = argv[i];
+            continue;
+        }
+        if (i + 1 >= argc)
+            return false;
+        const char* value = argv[++i];
+        if (arg == "--latency")
+            options.decoder.frameLatency = microseconds(std::strtoll(value, nullptr, 10));
+        else if (arg == "--idr-latency")
+            options.decoder.idrLatency = microseconds(std::strtoll(value, nullptr, 10));
+        else if (arg == "--reorder")
+            options.decoder.reorderDepth = std::strtoul(value, nullptr, 10);
+        else if (arg == "--sink")
+            options.sink = std::strcmp(value, "null") == 0   ? SoftwareSink::Mode::Null
+                           : std::strcmp(value, "rgba") == 0 ? SoftwareSink::Mode::Rgba
+                                                             : SoftwareSink::Mode::Copy;
+        else if (arg == "--vsync")
+            options.vsyncRate = std::max(1ul, std::strtoul(value, nullptr, 10));
+        else if (arg == "--play-seconds")
+            options.playSeconds = std::strtod(value, nullptr);
+        else if (arg == "--parser")
+            options.mp4.parser = std::strcmp(value, "bento4") == 0 ? MP4Parser::Bento4 : MP4Parser::Native;
+        else if (arg == "--trace")
+            options.tracePath = value;
+        else
+            return false;
+    }
+    return options.path != nullptr;
+}
+
+static double Milliseconds(Clock::duration duration)
+{
+    return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+static void PrintLatencies(const char* stage, std::vector<microseconds> samples)
+{
+    if (samples.empty())
+    {
+        std::printf("  %-8s no samples\n", stage);
+        return;
+    }
+    std::sort(samples.begin(), samples.end());
+    const auto at = [&samples](double quantile) {
+        return static_cast<long long>(
+            samples[std::min(samples.size() - 1, static_cast<size_t>(quantile * samples.size()))].count());
+    };
+    std::printf("  %-8s p50 %7lld us  p90 %7lld us  p99 %7lld us  max %7lld us  (%zu)\n", stage, at(0.5), at(0.9),
+                at(0.99), static_cast<long long>(samples.back().count()), samples.size());
+}
+
+static std::unique_ptr<SampleSource> OpenSource(const Options& options)
+{
+    auto source = CreateSampleSource(options.path, options.mp4, StreamSourceConfig{});
+    if (!source || !source->Open(options.path))
+    {
+        std::fprintf(stderr, "Failed to open %s\n", options.path);
+        return nullptr;
+    }
+    return source;
+}
+
+static bool RunDemux(const Options& options)
+{
+    auto source = OpenSource(options);
+    if (!source)
+        return false;
+    const auto& info = source->GetTrackInfo();
+    std::printf("%s, %s, %ux%u, profile %u level %u, %u frame DPB\n", options.path, source->GetFormatName(),
+                info.width, info.height, info.profile, info.level, info.dpbFrames);
+
+    std::vector<microseconds> reads;
+    uint64_t bytes = 0;
+    const auto start = Clock::now();
+    while (true)
+    {
+        const auto readStart = Clock::now();
+        auto unit = source->NextAccessUnit();
+        if (!unit)
+            break;
+        reads.push_back(std::chrono::duration_cast<microseconds>(Clock::now() - readStart));
+        bytes += unit->data.size();
+        source->Recycle(std::move(*unit));
+    }
+    const std::chrono::duration<double> elapsed = Clock::now() - start;
+
+    std::printf("demux:  %zu access units, %.1f MiB in %.1f ms, %.1f MiB/s, %.0f units/s, opened in %.1f ms\n",
+                reads.size(), bytes / (1024.0 * 1024), elapsed.count() * 1000,
+                bytes / elapsed.count() / (1024 * 1024), reads.size() / elapsed.count(),
+                Milliseconds(source->GetOpenTime()));
+    PrintLatencies("read", std::move(reads));
+    return true;
+}
+
+// Both read from the page cache the demux pass filled, so only the calls and copies differ
+static bool RunIo(const Options& options)
+{
+    auto source = OpenSource(options);
+    if (!source)
+        return false;
+    const auto* mp4 = dynamic_cast<const MP4SampleSource*>(source.get());
+    if (!mp4)
+        return true;
+    const auto& table = mp4->GetSampleTable();
+    std::vector<std::pair<uint64_t, uint32_t>> samples;
+    samples.reserve(table.Count());
+    uint64_t bytes = 0;
+    uint32_t largest = 0;
+    for (uint32_t i = 0; i < table.Count(); ++i)
+    {
+        samples.emplace_back(table.Offset(i), table.Size(i));
+        bytes += table.Size(i);
+        largest = std::max(largest, table.Size(i));
+    }
+    source.reset();
+    std::vector<uint8_t> buffer(largest);
+
+    BlockByteStream* stream = nullptr;
+    if (AP4_FAILED(BlockByteStream::Create(options.path, options.mp4.stream, stream)))
+    {
+        std::fprintf(stderr, "Failed to open %s\n", options.path);
+        return false;
+    }
+    auto start = Clock::now();
+    for (const auto& [offset, size] : samples)
+    {
+        if (AP4_FAILED(stream->Seek(offset)) || AP4_FAILED(stream->Read(buffer.data(), size)))
+        {
+            std::fprintf(stderr, "Failed to read the sample at %llu through BlockByteStream\n",
+                         static_cast<unsigned long long>(offset));
+            stream->Release();
+            return false;
+        }
+    }
+    const std::chrono::duration<double> streamElapsed = Clock::now() - start;
+    const auto streamStats = stream->GetStats();
+    stream->Release();
+
+    std::FILE* file = std::fopen(options.path, "rb");
+    if (!file)
+    {
+        std::fprintf(stderr, "Failed to open %s\n", options.path);
+        return false;
+    }
+    start = Clock::now();
+    for (const auto& [offset, size] : samples)
+    {
+        if (fseeko(file, static_cast<off_t>(offset), SEEK_SET) != 0 ||
+            std::fread(buffer.data(), 1, size, file) != size)
+        {
+            std::fprintf(stderr, "Failed to read the sample at %llu with fread\n",
+                         static_cast<unsigned long long>(offset));
+            std::fclose(file);
+            return false;
+        }
+    }
+    const std::chrono::duration<double> freadElapsed = Clock::now() - start;
+    std::fclose(file);
+
+    const double mebibytes = bytes / (1024.0 * 1024);
+    std::printf("io:     %zu samples, %.1f MiB\n", samples.size(), mebibytes);
+    std::printf("  stream  %.1f ms, %.1f MiB/s, %llu read calls for %.1f MiB, %.0f%% cache hits\n",
+                streamElapsed.count() * 1000, mebibytes / streamElapsed.count(),
+                static_cast<unsigned long long>(streamStats.readCalls), streamStats.bytesRead / (1024.0 * 1024),
+                streamStats.HitRate() * 100);
+    std::printf("  fread   %.1f ms, %.1f MiB/s, %zu read calls\n", freadElapsed.count() * 1000,
+                mebibytes / freadElapsed.count(), samples.size());
+    return true;
+}
+
+static bool RunDecode(const Options& options, MemoryArena& arena)
+{
+    auto source = OpenSource(options);
+    if (!source)
+        return false;
+    const auto& info = source->GetTrackInfo();
+    SoftwareSink sink(options.sink, &arena);
+    sink.SetFrameDimensions(info.width, info.height, info.cropLeft, info.cropTop);
+    sink.SetColorSpace(ColorSpaceFor(info.matrixCoefficients, info.fullRange));
+
+    // No clock to skip frames against, and output keeps the submitted timestamps so latencies can be matched up
+    H264DecoderConfig config{.core = 2, .arena = &arena};
+    H264Decoder decoder(static_cast<H264Profile>(info.profile), info.level, info.codedWidth, info.codedHeight,
+                        info.dpbFrames, config);
+
+    std::mutex mutex;
+    std::unordered_map<int64_t, Clock::time_point> submitTimes;
+    std::vector<microseconds> decodeLatencies;
+    std::vector<microseconds> sinkLatencies;
+    std::atomic_bool submitted{false};
+    const auto start = Clock::now();
+    auto lastOutput = start;
+    std::thread consumer([&] {
+        SetCurrentThreadName("Bench sink");
+        while (true)
+        {
+            auto frame = decoder.GetDecodedFrame();
+            if (!frame && !(submitted && decoder.IsIdle()))
+            {
+                std::this_thread::sleep_for(OUTPUT_POLL_INTERVAL);
+                continue;
+            }
+            // once idle after the end of stream the pictures the decoder held are output as well
+            if (!frame && !(frame = decoder.GetDecodedFrame()))
+                break;
+            const auto outputTime = Clock::now();
+            {
+                std::scoped_lock l{mutex};
+                const auto it = submitTimes.find(frame->timestamp);
+                if (it != submitTimes.end())
+                {
+                    decodeLatencies.push_back(std::chrono::duration_cast<microseconds>(outputTime - it->second));
+                    submitTimes.erase(it);
+                }
+            }
+            sink.SetFrameBuffer(*frame);
+            lastOutput = Clock::now();
+            sinkLatencies.push_back(std::chrono::duration_cast<microseconds>(lastOutput - outputTime));
+        }
+    });
+
+    uint64_t frames = 0;
+    while (auto unit = source->NextAccessUnit())
+    {
+        while (auto buffer = decoder.TakeReleasedBuffer())
+            source->Recycle(std::move(*buffer));
+        {
+            std::scoped_lock l{mutex};
+            submitTimes[unit->pts] = Clock::now();
+        }
+        decoder.SubmitFrame(std::move(unit->data), unit->pts, unit->reference, unit->sync);
+        frames++;
+    }
+    decoder.SubmitEndOfStream();
+    submitted = true;
+    consumer.join();
+    const std::chrono::duration<double> elapsed = lastOutput - start;
+
+    const auto pool = decoder.GetFramePoolStats();
+    const auto stage = decoder.GetStageStats();
+    std::printf("decode: %llu of %llu frames out in %.1f ms, %.1f fps, decoder busy %.0f%%, pool peak %u of %u, "
+                "checksum %016llx\n",
+                static_cast<unsigned long long>(sink.GetFrameCount()), static_cast<unsigned long long>(frames),
+                elapsed.count() * 1000, sink.GetFrameCount() / elapsed.count(), stage.Utilization() * 100,
+                pool.peakInUse, pool.capacity, static_cast<unsigned long long>(sink.GetChecksum()));
+    PrintLatencies("decode", std::move(decodeLatencies));
+    PrintLatencies("sink", std::move(sinkLatencies));
+    return true;
+}
+
+static bool RunPlay(const Options& options, MemoryArena& arena)
+{
+    PlayerConfig config;
+    config.mp4 = options.mp4;
+    config.decoder.arena = &arena;
+    Player player(config);
+    try
+    {
+        if (!player.Open(options.path))
+        {
+            std::fprintf(stderr, "Failed to open %s\n", options.path);
+            return false;
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::fprintf(stderr, "%s\n", e.what());
+        return false;
+    }
+    const auto& info = player.GetTrackInfo();
+    SoftwareSink sink(options.sink, &arena);
+    sink.SetFrameDimensions(info.width, info.height, info.cropLeft, info.cropTop);
+    sink.SetColorSpace(ColorSpaceFor(info.matrixCoefficients, info.fullRange));
+
+    auto& presenterStats = player.GetPresenterStats();
+    std::vector<microseconds> presentLatencies;
+    std::vector<microseconds> sinkLatencies;
+    const auto vsyncInterval = std::chrono::duration_cast<Clock::duration>(std::chrono::seconds(1)) /
+                               options.vsyncRate;
+    const auto limit = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(options.playSeconds));
+    const auto start = Clock::now();
+    auto vsync = start;
+    uint64_t vsyncs = 0;
+    while (!player.IsFinished() && (options.playSeconds < 0 || vsync - start < limit))
+    {
+        vsyncs++;
+        const auto presentStart = Clock::now();
+        auto frame = player.Present();
+        const auto presentEnd = Clock::now();
+        presentLatencies.push_back(std::chrono::duration_cast<microseconds>(presentEnd - presentStart));
+        if (frame)
+        {
+            sink.SetFrameBuffer(*frame);
+            const auto sinkEnd = Clock::now();
+            presenterStats.AddBusy(sinkEnd - presentEnd);
+            sinkLatencies.push_back(std::chrono::duration_cast<microseconds>(sinkEnd - presentEnd));
+        }
+        sink.Draw();
+        // stands in for waiting on the vsync in Gfx::Draw
+        const auto waitStart = Clock::now();
+        vsync += vsyncInterval;
+        std::this_thread::sleep_until(vsync);
+        presenterStats.AddIdle(Clock::now() - waitStart);
+    }
+    const std::chrono::duration<double> elapsed = Clock::now() - start;
+
+    const auto stats = player.GetStats();
+    std::printf("play:   %llu frames in %.1f ms, %.1f fps, dropped %llu, repeated %llu, jitter mean %lld us max %lld "
+                "us, opened in %.1f ms, first frame after %.1f ms\n",
+                static_cast<unsigned long long>(stats.scheduler.presented), elapsed.count() * 1000,
+                stats.scheduler.presented / elapsed.count(), static_cast<unsigned long long>(stats.scheduler.dropped),
+                static_cast<unsigned long long>(stats.scheduler.repeated),
+                static_cast<long long>(stats.scheduler.meanJitter.count()),
+                static_cast<long long>(stats.scheduler.maxJitter.count()), Milliseconds(stats.openTime),
+                Milliseconds(stats.timeToFirstFrame));
+    std::printf("  busy    reader %.0f%%, decoder %.0f%%, presenter %.0f%%, skipped %llu frames, output stalls %llu\n",
+                stats.reader.Utilization() * 100, stats.decoder.Utilization() * 100,
+                stats.presenter.Utilization() * 100,
+                static_cast<unsigned long long>(stats.skip.droppedNonReference + stats.skip.droppedToSync),
+                static_cast<unsigned long long>(stats.output.stalls));
+    PrintLatencies("present", std::move(presentLatencies));
+    PrintLatencies("sink", std::move(sinkLatencies));
+    std::printf("  draws   %llu of %llu vsyncs rendered, %llu uploads never drawn\n",
+                static_cast<unsigned long long>(sink.GetDrawCount()), static_cast<unsigned long long>(vsyncs),
+                static_cast<unsigned long long>(sink.GetDroppedCount()));
+    if (options.verbose)
+        player.LogStats();
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    if (!ParseOptions(argc, argv, options))
+    {
+        std::fprintf(stderr, "Usage: %s <file> [--latency us] [--idr-latency us] [--reorder frames] "
+                             "[--sink null|copy|rgba] [--vsync hz] [--play-seconds s] [--parser native|bento4] "
+                             "[--no-index-cache] [--trace file.json] [--verbose]\n",
+                     argv[0]);
+        return 1;
+    }
+    SetHostLogEnabled(options.verbose);
+    SetFakeDecoderConfig(options.decoder);
+
+    // Like main.cpp everything the decoder and sink keep comes from one arena, whose high water is the peak
+    MemoryArena arena(VIDEO_ARENA_SIZE, H264Decoder::CheckMemory);
+    try
+    {
+        if (!RunDemux(options) || !RunIo(options) || !RunDecode(options, arena))
+            return 1;
+        if (options.playSeconds != 0 && !RunPlay(options, arena))
+            return 1;
+    }
+    catch (const std::exception& e)
+    {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+
+    for (const auto& histogram : Trace::GetHistograms())
+    {
+        if (histogram.count == 0)
+            continue;
+        std::printf("trace:  %-24s %8llu times, mean %7.1f us, p50 < %lld us, p99 < %lld us, max %.1f us\n",
+                    histogram.name, static_cast<unsigned long long>(histogram.count),
+                    histogram.total.count() / 1000.0 / histogram.count,
+                    static_cast<long long>(histogram.Percentile(0.5).count()),
+                    static_cast<long long>(histogram.Percentile(0.99).count()), histogram.max.count() / 1000.0);
+    }
+    if (options.tracePath && !Trace::WriteJson(std::filesystem::path(options.tracePath)))
+        return 1;
+
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    const auto arenaStats = arena.GetStats();
+    const auto decoderStats = GetFakeDecoderStats();
+    std::printf("memory: peak RSS %.1f MiB, arena high water %.1f of %.1f MiB in at most %u buffers\n",
+                usage.ru_maxrss / 1024.0, arenaStats.highWater / (1024.0 * 1024),
+                arenaStats.capacity / (1024.0 * 1024), arenaStats.peakBuffers);
+    std::printf("fake decoder: %llu executed, %llu output, %llu flushes, %llu errors\n",
+                static_cast<unsigned long long>(decoderStats.executed),
+                static_cast<unsigned long long>(decoderStats.output),
+                static_cast<unsigned long long>(decoderStats.flushes),
+                static_cast<unsigned long long>(decoderStats.errors));
+    return 0;
+}
@@ -0,0 +1,76 @@
+// UploadRing under contention: one thread uploads as fast as it can while another draws, checking that the drawn slot
+// is never written and that the frames drawn only move forward. Build with -fsanitize=thread to have the slot data
+// checked for races as well.
+// Usage: uploadring-bench [uploads, default 1000000] [slots, default 3]
+#include "UploadRing.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+// Stands in for the textures, only written by the uploading thread between BeginUpload and FinishUpload
+struct SlotData
+{
+    uint64_t frame = 0;
+    // Filled with the low byte of frame, the copy keeps the uploads slow enough for draws to come in between
+    std::array<uint8_t, 4096> pixels{};
+};
+
+int main(int argc, char** argv)
+{
+    const uint64_t uploads = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+    const unsigned slots = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : UploadRing::MAX_SLOTS;
+
+    UploadRing ring(slots);
+    std::array<SlotData, UploadRing::MAX_SLOTS> data{};
+    std::atomic_bool done{false};
+    uint64_t draws = 0;
+    uint64_t errors = 0;
+
+    const auto start = std::chrono::steady_clock::now();
+    std::thread drawer([&] {
+        uint64_t lastFrame = 0;
+        while (!done)
+        {
+            const auto ready = ring.TakeReady();
+            if (!ready)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            const SlotData& slot = data[*ready];
+            const auto frame = slot.frame;
+            bool intact = true;
+            for (const auto pixel : slot.pixels)
+                intact = intact && pixel == static_cast<uint8_t>(frame);
+            if (!intact || slot.frame != frame || frame <= lastFrame)
+                errors++;
+            lastFrame = frame;
+            draws++;
+        }
+    });
+
+    for (uint64_t frame = 1; frame <= uploads; ++frame)
+    {
+        const unsigned slot = ring.BeginUpload();
+        data[slot].frame = frame;
+        std::memset(data[slot].pixels.data(), static_cast<uint8_t>(frame), data[slot].pixels.size());
+        ring.FinishUpload(slot);
+        // lets draws in between even with a single core
+        if (frame % 4 == 0)
+            std::this_thread::yield();
+    }
+    done = true;
+    drawer.join();
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::printf("%u slots: %llu uploads in %.1f ms, %.0f ns each, %llu drawn, %llu dropped, %llu errors\n",
+                ring.GetSlotCount(), static_cast<unsigned long long>(uploads), elapsed.count() * 1000,
+                elapsed.count() * 1e9 / uploads, static_cast<unsigned long long>(draws),
+                static_cast<unsigned long long>(ring.GetDroppedCount()), static_cast<unsigned long long>(errors));
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,284 @@
+#include "FakeDecoder.h"
+
+#include "AnnexB.h"
+#include "ParameterSets.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <thread>
+#include <vector>
+
+#include <h264/decode.h>
+
+using Clock = std::chrono::steady_clock;
+
+constexpr unsigned OUTPUT_PITCH_ALIGNMENT = 0x100;
+// On top of the picture buffer, for the decoder's own state
+constexpr uint32_t CONTEXT_SIZE = 0x80000;
+
+struct FakeDecoderState
+{
+    FakeDecoderConfig config;
+    H264DECFptrOutputFn output = nullptr;
+    void* userMemory = nullptr;
+    bool open = false;
+
+    std::span<const uint8_t> bitstream;
+    double timestamp = 0;
+    // Of the last Execute, flushed pictures are written there as well
+    void* frameBuffer = nullptr;
+    // Of the last SPS
+    std::optional<SequenceParameterSet> sps;
+    // Timestamps of the pictures not output yet, in output order
+    std::vector<double> held;
+};
+
+static std::mutex g_mutex;
+static FakeDecoderConfig g_config;
+// Keyed by the memory handed to H264DECInitParam
+static std::map<void*, std::unique_ptr<FakeDecoderState>> g_decoders;
+
+static std::atomic<uint64_t> g_executed{0};
+static std::atomic<uint64_t> g_output{0};
+static std::atomic<uint64_t> g_flushes{0};
+static std::atomic<uint64_t> g_errors{0};
+
+static unsigned AlignUp(unsigned value, unsigned alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+static FakeDecoderState* FindDecoder(void* memory)
+{
+    std::scoped_lock l{g_mutex};
+    const auto it = g_decoders.find(memory);
+    return it != g_decoders.end() ? it->second.get() : nullptr;
+}
+
+// Rows of luma stepping from a value picked by the timestamp, neutral chroma
+static void FillPicture(const SequenceParameterSet& sps, double timestamp, uint8_t* frameBuffer)
+{
+    const unsigned pitch = AlignUp(sps.codedWidth, OUTPUT_PITCH_ALIGNMENT);
+    const auto seed = static_cast<uint8_t>(std::llround(timestamp) * 37);
+    for (unsigned line = 0; line < sps.codedHeight; ++line)
+        std::memset(frameBuffer + line * pitch, static_cast<uint8_t>(seed + line), sps.codedWidth);
+    for (unsigned line = 0; line < sps.codedHeight / 2; ++line)
+        std::memset(frameBuffer + (sps.codedHeight + line) * pitch, 0x80, sps.codedWidth);
+}
+
+static void OutputPicture(FakeDecoderState& decoder, double timestamp, void* frameBuffer)
+{
+    const auto& sps = *decoder.sps;
+    if (decoder.config.fillPictures)
+        FillPicture(sps, timestamp, static_cast<uint8_t*>(frameBuffer));
+
+    H264DecodeResult result{};
+    result.timestamp = timestamp;
+    result.framebuffer = frameBuffer;
+    result.width = static_cast<int32_t>(sps.codedWidth);
+    result.height = static_cast<int32_t>(sps.codedHeight);
+    result.nextLine = static_cast<int32_t>(AlignUp(sps.codedWidth, OUTPUT_PITCH_ALIGNMENT));
+    result.cropEnableFlag = sps.Width() != sps.codedWidth || sps.Height() != sps.codedHeight;
+    result.cropLeft = static_cast<int32_t>(sps.cropLeft);
+    result.cropTop = static_cast<int32_t>(sps.cropTop);
+    result.cropRight = static_cast<int32_t>(sps.codedWidth - sps.Width() - sps.cropLeft);
+    result.cropBottom = static_cast<int32_t>(sps.codedHeight - sps.Height() - sps.cropTop);
+    H264DecodeResult* results[]{&result};
+    H264DecodeOutput output{1, results, decoder.userMemory};
+    g_output++;
+    if (decoder.output)
+        decoder.output(&output);
+}
+
+// Outputs the oldest pictures until only keep are held
+static void BumpPictures(FakeDecoderState& decoder, void* frameBuffer, size_t keep)
+{
+    while (decoder.held.size() > keep)
+    {
+        const double timestamp = decoder.held.front();
+        decoder.held.erase(decoder.held.begin());
+        OutputPicture(decoder, timestamp, frameBuffer);
+    }
+}
+
+void SetFakeDecoderConfig(const FakeDecoderConfig& config)
+{
+    std::scoped_lock l{g_mutex};
+    g_config = config;
+}
+
+FakeDecoderStats GetFakeDecoderStats()
+{
+    return {g_executed, g_output, g_flushes, g_errors};
+}
+
+H264Error H264DECMemoryRequirement(int32_t profile, int32_t level, int32_t maxWidth, int32_t maxHeight,
+                                   uint32_t* outMemoryRequirement)
+{
+    if (profile != 66 && profile != 77 && profile != 100)
+        return H264_ERROR_INVALID_PROFILE;
+    if (maxWidth <= 0 || maxHeight <= 0 || !outMemoryRequirement)
+        return H264_ERROR_INVALID_PARAMETER;
+
+    const unsigned width = AlignUp(maxWidth, MACROBLOCK_SIZE);
+    const unsigned height = AlignUp(maxHeight, MACROBLOCK_SIZE);
+    // the whole picture buffer of the level plus the picture being decoded, like the console's decoder
+    const unsigned frames = MaxDpbFrames(level, width / MACROBLOCK_SIZE, height / MACROBLOCK_SIZE);
+    if (frames == 0)
+        return H264_ERROR_INVALID_PARAMETER;
+    const uint64_t frameSize = uint64_t{AlignUp(width, OUTPUT_PITCH_ALIGNMENT)} * height * 3 / 2;
+    *outMemoryRequirement = static_cast<uint32_t>((frames + 1) * frameSize + CONTEXT_SIZE);
+    return H264_ERROR_OK;
+}
+
+H264Error H264DECInitParam(int32_t memorySize, void* memory)
+{
+    if (!memory)
+        return H264_ERROR_INVALID_PARAMETER;
+    if (memorySize < static_cast<int32_t>(CONTEXT_SIZE))
+        return H264_ERROR_OUT_OF_MEMORY;
+
+    auto decoder = std::make_unique<FakeDecoderState>();
+    std::scoped_lock l{g_mutex};
+    decoder->config = g_config;
+    g_decoders[memory] = std::move(decoder);
+    return H264_ERROR_OK;
+}
+
+H264Error H264DECSetParam_FPTR_OUTPUT(void* memory, H264DECFptrOutputFn value)
+{
+    auto* decoder = FindDecoder(memory);
+    if (!decoder)
+        return H264_ERROR_INVALID_PARAMETER;
+    decoder->output = value;
+    return H264_ERROR_OK;
+}
+
+H264Error H264DECSetParam_USER_MEMORY(void* memory, void* value)
+{
+    auto* decoder = FindDecoder(memory);
+    if (!decoder || !value)
+        return H264_ERROR_INVALID_PARAMETER;
+    decoder->userMemory = *static_cast<void**>(value);
+    return H264_ERROR_OK;
+}
+
+H264Error H264DECOpen(void* memory)
+{
+    auto* decoder = FindDecoder(memory);
+    if (!decoder)
+        return H264_ERROR_INVALID_PARAMETER;
+    decoder->open = true;
+    return H264_ERROR_OK;
+}
+
+H264Error H264DECBegin(void* memory)
+{
+    auto* decoder = FindDecoder(memory);
+    if (!decoder || !decoder->open)
+        return H264_ERROR_INVALID_PARAMETER;
+    decoder->bitstream = {};
+    return H264_ERROR_OK;
+}
+
+H264Error H264DECSetBitstream(void* memory, uint8_t* buffer, uint32_t bufferLength, double timestamp)
+{
+    auto* decoder = FindDecoder(memory);
+    if (!decoder || !buffer)
+        return H264_ERROR_INVALID_PARAMETER;
+    decoder->bitstream = {buffer, bufferLength};
+    decoder->timestamp = timestamp;
+    return H264_ERROR_OK;
+}
+
+H264Error H264DECExecute(void* memory, void* frameBuffer)
+{
+    auto* decoder = FindDecoder(memory);
+    if (!decoder || !decoder->open || !frameBuffer)
+        return H264_ERROR_INVALID_PARAMETER;
+    const auto start = Clock::now();
+    g_executed++;
+    decoder->frameBuffer = frameBuffer;
+
+    NalIndex nals;
+    IndexNalUnits(decoder->bitstream, nals);
+    if (const auto* spsNal = FindNalUnit(nals, NAL_TYPE_SPS))
+    {
+        if (auto sps = ParseSequenceParameterSet(decoder->bitstream.subspan(spsNal->offset, spsNal->size)))
+            decoder->sps = sps;
+    }
+    const bool idr = FindNalUnit(nals, NAL_TYPE_IDR_SLICE) != nullptr;
+    if (!idr && !FindNalUnit(nals, NAL_TYPE_SLICE))
+        return H264_ERROR_OK;
+    if (!decoder->sps)
+    {
+        g_errors++;
+        return H264_ERROR_INVALID_SPS;
+    }
+
+    // an IDR picture empties the picture buffer, nothing after it refers to what came before
+    if (idr)
+        BumpPictures(*decoder, frameBuffer, 0);
+    const auto position = std::upper_bound(decoder->held.begin(), decoder->held.end(), decoder->timestamp);
+    decoder->held.insert(position, decoder->timestamp);
+    const unsigned depth =
+        decoder->config.reorderDepth != 0
+            ? decoder->config.reorderDepth
+            : std::max({decoder->sps->maxDecFrameBuffering, decoder->sps->maxNumRefFrames, 1u});
+    BumpPictures(*decoder, frameBuffer, depth);
+
+    const auto latency = idr && decoder->config.idrLatency.count() != 0 ? decoder->config.idrLatency
+                                                                          : decoder->config.frameLatency;
+    std::this_thread::sleep_until(start + latency);
+    return H264_ERROR_OK;
+}
+
+H264Error H264DECEnd(void* memory)
+{
+    return FindDecoder(memory) ? H264_ERROR_OK : H264_ERROR_INVALID_PARAMETER;
+}
+
+H264Error H264DECFlush(void* memory)
+{
+    auto* decoder = FindDecoder(memory);
+    if (!decoder)
+        return H264_ERROR_INVALID_PARAMETER;
+    g_flushes++;
+    BumpPictures(*decoder, decoder->frameBuffer, 0);
+    return H264_ERROR_OK;
+}
+
+H264Error H264DECClose(void* memory)
+{
+    std::scoped_lock l{g_mutex};
+    return g_decoders.erase(memory) != 0 ? H264_ERROR_OK : H264_ERROR_INVALID_PARAMETER;
+}
+
+H264Error H264DECCheckMemSegmentation(void* memory, uint32_t size)
+{
+    return memory && size != 0 ? H264_ERROR_OK : H264_ERROR_INVALID_PARAMETER;
+}
+
+H264Error H264DECFindDecstartpoint(const uint8_t* buffer, uint32_t bufferLength, int32_t* outOffset)
+{
+    if (!buffer || !outOffset)
+        return H264_ERROR_INVALID_PARAMETER;
+    // decoding can start at an SPS, the start code in front of it included
+    NalIndex nals;
+    IndexNalUnits({buffer, bufferLength}, nals);
+    const auto* sps = FindNalUnit(nals, NAL_TYPE_SPS);
+    if (!sps)
+        return H264_ERROR_GENERIC;
+    unsigned start = sps->offset - 3;
+    if (start > 0 && buffer[start - 1] == 0)
+        start--;
+    *outOffset = static_cast<int32_t>(start);
+    return H264_ERROR_OK;
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+
+// Stands in for the console's H.264 decoder on host builds, behind the H264DEC functions. Nothing is decoded: every
+// access unit with a slice takes a fixed time and becomes an NV12 picture of the size of the last SPS, filled with a
+// pattern that only depends on its timestamp. Pictures are held and output in timestamp order the way a decoded
+// picture buffer bumps them, an IDR picture or a flush outputs everything held.
+struct FakeDecoderConfig
+{
+    // Time H264DECExecute takes per picture, slept so it doesn't compete with the other threads for the CPU
+    std::chrono::microseconds frameLatency{0};
+    // For IDR pictures instead, if nonzero
+    std::chrono::microseconds idrLatency{0};
+    // Pictures held before the oldest one is output, 0 for the DPB size of the SPS
+    unsigned reorderDepth = 0;
+    // Skips writing the pattern, leaving the frame buffer as it was
+    bool fillPictures = true;
+};
+
+struct FakeDecoderStats
+{
+    uint64_t executed;
+    uint64_t output;
+    uint64_t flushes;
+    // Access units rejected for coming before any SPS
+    uint64_t errors;
+};
+
+// Applies to decoders created afterwards
+void SetFakeDecoderConfig(const FakeDecoderConfig& config);
+// Summed over every decoder since the start
+FakeDecoderStats GetFakeDecoderStats();
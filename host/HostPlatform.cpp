@@ -0,0 +1,99 @@
+#include "HostPlatform.h"
+
+#include <atomic>
+#include <cstdarg>
+#include <cstdio>
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <coreinit/debug.h>
+#include <coreinit/thread.h>
+#include <whb/log.h>
+
+// Console cores there are affinity bits for
+constexpr int CORE_COUNT = 3;
+// pthread names are limited to 15 characters and the terminator
+constexpr size_t MAX_THREAD_NAME = 15;
+
+static std::atomic_bool g_logEnabled{true};
+
+// Only ever compared and passed back, the calling thread is the one meant
+struct OSThread
+{
+};
+static thread_local OSThread g_currentThread;
+
+static void LogLine(const char* fmt, va_list args)
+{
+    if (!g_logEnabled)
+        return;
+    std::vfprintf(stderr, fmt, args);
+    std::fputc('\n', stderr);
+}
+
+void SetHostLogEnabled(bool enabled)
+{
+    g_logEnabled = enabled;
+}
+
+BOOL WHBLogPrint(const char* str)
+{
+    if (g_logEnabled)
+        std::fprintf(stderr, "%s\n", str);
+    return TRUE;
+}
+
+BOOL WHBLogPrintf(const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    LogLine(fmt, args);
+    va_end(args);
+    return TRUE;
+}
+
+void OSReport(const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    LogLine(fmt, args);
+    va_end(args);
+}
+
+OSThread* OSGetCurrentThread()
+{
+    return &g_currentThread;
+}
+
+BOOL OSSetThreadAffinity(OSThread* thread, uint32_t affinity)
+{
+    if (thread != &g_currentThread)
+        return FALSE;
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (int core = 0; core < CORE_COUNT; ++core)
+    {
+        if (affinity & (1u << core))
+            CPU_SET(core, &cpus);
+    }
+    // hosts with fewer CPUs keep running wherever they are
+    if (affinity == OS_THREAD_ATTRIB_AFFINITY_ANY ||
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0)
+    {
+        CPU_ZERO(&cpus);
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+            CPU_SET(cpu, &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
+    return TRUE;
+}
+
+void OSSetThreadName(OSThread* thread, const char* name)
+{
+    if (thread != &g_currentThread || !name)
+        return;
+    char truncated[MAX_THREAD_NAME + 1]{};
+    std::snprintf(truncated, sizeof(truncated), "%s", name);
+    pthread_setname_np(pthread_self(), truncated);
+}
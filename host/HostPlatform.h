@@ -0,0 +1,4 @@
+#pragma once
+
+// Host builds log to stderr, benchmarks turn it off so logging doesn't show up in their timings
+void SetHostLogEnabled(bool enabled);
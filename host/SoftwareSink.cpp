@@ -0,0 +1,142 @@
+#include "SoftwareSink.h"
+#include "Trace.h"
+
+#include <cstring>
+#include <new>
+
+// Of the decoder's output
+constexpr unsigned PITCH_ALIGNMENT = 0x100;
+
+// FNV-1a
+constexpr uint64_t CHECKSUM_BASIS = 0xCBF29CE484222325ull;
+constexpr uint64_t CHECKSUM_PRIME = 0x100000001B3ull;
+
+static uint64_t Mix(uint64_t checksum, uint64_t value)
+{
+    for (int byte = 0; byte < 8; ++byte)
+    {
+        checksum ^= (value >> (byte * 8)) & 0xFF;
+        checksum *= CHECKSUM_PRIME;
+    }
+    return checksum;
+}
+
+// Like CopyToSurface in Gfx
+static void CopyPlane(uint8_t* destination, unsigned destinationPitch, const uint8_t* source, unsigned sourcePitch,
+                      unsigned width, unsigned height)
+{
+    if (destinationPitch == sourcePitch)
+    {
+        std::memcpy(destination, source, (height - 1) * sourcePitch + width);
+        return;
+    }
+    for (unsigned line = 0; line < height; ++line)
+        std::memcpy(destination + line * destinationPitch, source + line * sourcePitch, width);
+}
+
+SoftwareSink::SoftwareSink(Mode mode, MemoryArena* arena, unsigned planeSets)
+    : m_mode(mode), m_arena(arena), m_ring(planeSets), m_planes(mode == Mode::Copy ? m_ring.GetSlotCount() : 0),
+      m_checksum(CHECKSUM_BASIS)
+{
+}
+
+void SoftwareSink::SetFrameDimensions(unsigned width, unsigned height, unsigned cropLeft, unsigned cropTop)
+{
+    if (m_pitch != 0 && m_width == width && m_height == height && m_cropLeft == (cropLeft & ~1u) &&
+        m_cropTop == (cropTop & ~1u))
+        return;
+    m_width = width;
+    m_height = height;
+    m_cropLeft = cropLeft & ~1u;
+    m_cropTop = cropTop & ~1u;
+    m_pitch = (width + PITCH_ALIGNMENT - 1) / PITCH_ALIGNMENT * PITCH_ALIGNMENT;
+    if (m_mode == Mode::Null)
+        return;
+
+    // Freed first, so a new size reuses the same space in the arena
+    m_ring.Reset();
+    for (auto& planes : m_planes)
+        planes = {};
+    m_rgba.reset();
+    if (m_mode == Mode::Rgba)
+    {
+        m_rgba = MemoryArena::Allocate<uint8_t>(m_arena, width * height * 4);
+        if (!m_rgba)
+            throw std::bad_alloc();
+        return;
+    }
+    for (auto& planes : m_planes)
+    {
+        planes.y = MemoryArena::Allocate<uint8_t>(m_arena, m_pitch * height);
+        planes.uv = MemoryArena::Allocate<uint8_t>(m_arena, m_pitch * (height / 2));
+        if (!planes.y || !planes.uv)
+            throw std::bad_alloc();
+    }
+}
+
+void SoftwareSink::SetColorSpace(const ColorSpace& space)
+{
+    m_colorSpace = space;
+}
+
+bool SoftwareSink::SetFrameBuffer(const DecodedFrame& frame)
+{
+    TRACE_SCOPE("SoftwareSink copy");
+    m_frameCount++;
+    m_checksum = Mix(m_checksum, static_cast<uint64_t>(frame.timestamp));
+    if (m_rgba)
+    {
+        const NV12Image image = CropFrame(frame, m_width, m_height, m_cropLeft, m_cropTop);
+        ConvertNV12ToRGBA(image, m_colorSpace, m_rgba.get(), size_t{m_width} * 4);
+        uint32_t pixel;
+        std::memcpy(&pixel, m_rgba.get() + (size_t{m_width} * (m_height / 2) + m_width / 2) * 4, sizeof(pixel));
+        m_checksum = Mix(m_checksum, pixel);
+        return true;
+    }
+    if (m_mode == Mode::Null || m_pitch == 0)
+        return true;
+
+    const unsigned slot = m_ring.BeginUpload();
+    const Planes& planes = m_planes[slot];
+    const uint8_t* luma = frame.buffer.data() + m_cropTop * frame.pitch + m_cropLeft;
+    CopyPlane(planes.y.get(), m_pitch, luma, frame.pitch, m_width, m_height);
+    // interleaved UV, so the chroma of m_cropLeft pixels is m_cropLeft bytes in as well
+    const uint8_t* chroma = frame.buffer.data() + (frame.height + m_cropTop / 2) * frame.pitch + m_cropLeft;
+    CopyPlane(planes.uv.get(), m_pitch, chroma, frame.pitch, m_width, m_height / 2);
+    m_ring.FinishUpload(slot);
+
+    // a sample per plane rather than every pixel, which would cost more than the copy
+    m_checksum = Mix(m_checksum, planes.y.get()[m_pitch * (m_height / 2) + m_width / 2]);
+    m_checksum = Mix(m_checksum, planes.uv.get()[m_pitch * (m_height / 4) + m_width / 2]);
+    return true;
+}
+
+bool SoftwareSink::Draw()
+{
+    // the other modes have nothing to take, a new frame is enough
+    const bool newFrame = m_mode == Mode::Copy ? m_ring.TakeReady().has_value() : m_lastDrawnFrame != m_frameCount;
+    m_lastDrawnFrame = m_frameCount;
+    if (newFrame)
+        m_drawCount++;
+    return newFrame;
+}
+
+uint64_t SoftwareSink::GetFrameCount() const
+{
+    return m_frameCount;
+}
+
+uint64_t SoftwareSink::GetDrawCount() const
+{
+    return m_drawCount;
+}
+
+uint64_t SoftwareSink::GetDroppedCount() const
+{
+    return m_ring.GetDroppedCount();
+}
+
+uint64_t SoftwareSink::GetChecksum() const
+{
+    return m_checksum;
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "ColorConvert.h"
+#include "MemoryArena.h"
+#include "OutputQueue.h"
+#include "UploadRing.h"
+
+// Stands in for Gfx on host builds with the same calls. Copy mode copies the shown part of every frame into a ring of
+// planes the way Gfx uploads it to its textures, only on the calling thread, and Draw takes the newest one like Gfx
+// does. Rgba mode converts it to RGBA8 on the CPU like the shader draws it, Null mode only counts frames.
+class SoftwareSink
+{
+  public:
+    enum class Mode
+    {
+        Null,
+        Copy,
+        Rgba,
+    };
+
+    // Planes are carved from arena if there is one. Throws std::bad_alloc if they don't fit.
+    explicit SoftwareSink(Mode mode, MemoryArena* arena = nullptr, unsigned planeSets = UploadRing::MAX_SLOTS);
+
+    void SetFrameDimensions(unsigned width, unsigned height, unsigned cropLeft = 0, unsigned cropTop = 0);
+    void SetColorSpace(const ColorSpace& space);
+    bool SetFrameBuffer(const DecodedFrame& frame);
+    // Once per vsync, false if Gfx would have skipped rendering as no frame was uploaded since the last call
+    bool Draw();
+
+    [[nodiscard]] uint64_t GetFrameCount() const;
+    [[nodiscard]] uint64_t GetDrawCount() const;
+    // Uploaded frames that were replaced by a newer one before a Draw took them
+    [[nodiscard]] uint64_t GetDroppedCount() const;
+    // Of the timestamps and copied pixels of every frame in order, equal between runs that showed the same frames
+    [[nodiscard]] uint64_t GetChecksum() const;
+
+  private:
+    struct Planes
+    {
+        MemoryArena::Pointer<uint8_t> y;
+        MemoryArena::Pointer<uint8_t> uv;
+    };
+
+    Mode m_mode;
+    MemoryArena* m_arena;
+    unsigned m_width = 0;
+    unsigned m_height = 0;
+    unsigned m_cropLeft = 0;
+    unsigned m_cropTop = 0;
+    ColorSpace m_colorSpace;
+    // Of the planes, aligned like the decoder's so whole planes can be copied at once
+    unsigned m_pitch = 0;
+    UploadRing m_ring;
+    std::vector<Planes> m_planes;
+    MemoryArena::Pointer<uint8_t> m_rgba;
+
+    uint64_t m_frameCount = 0;
+    uint64_t m_drawCount = 0;
+    // Frame count at the last Draw
+    uint64_t m_lastDrawnFrame = 0;
+    uint64_t m_checksum;
+};
@@ -0,0 +1,4 @@
+#pragma once
+#include <wut.h>
+
+void OSReport(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
@@ -0,0 +1,19 @@
+#pragma once
+#include <wut.h>
+
+// Stands for the calling host thread, one per thread
+struct OSThread;
+
+enum OSThreadAttributes
+{
+    OS_THREAD_ATTRIB_AFFINITY_CPU0 = 1 << 0,
+    OS_THREAD_ATTRIB_AFFINITY_CPU1 = 1 << 1,
+    OS_THREAD_ATTRIB_AFFINITY_CPU2 = 1 << 2,
+    OS_THREAD_ATTRIB_AFFINITY_ANY = OS_THREAD_ATTRIB_AFFINITY_CPU0 | OS_THREAD_ATTRIB_AFFINITY_CPU1 |
+                                    OS_THREAD_ATTRIB_AFFINITY_CPU2,
+};
+
+OSThread* OSGetCurrentThread();
+// The three console cores map to the first three host CPUs
+BOOL OSSetThreadAffinity(OSThread* thread, uint32_t affinity);
+void OSSetThreadName(OSThread* thread, const char* name);
@@ -0,0 +1,56 @@
+#pragma once
+#include <wut.h>
+
+// Decoded by the fake in FakeDecoder.cpp
+
+enum H264Error
+{
+    H264_ERROR_OK = 0,
+    H264_ERROR_INVALID_PPS = 24,
+    H264_ERROR_INVALID_SPS = 26,
+    H264_ERROR_INVALID_SLICEHEADER = 61,
+    H264_ERROR_GENERIC = 0x1000000,
+    H264_ERROR_INVALID_PARAMETER = 0x1010000,
+    H264_ERROR_OUT_OF_MEMORY = 0x1020000,
+    H264_ERROR_INVALID_PROFILE = 0x1080000,
+};
+
+struct H264DecodeResult
+{
+    int32_t status;
+    double timestamp;
+    void* framebuffer;
+    int32_t width;
+    int32_t height;
+    int32_t nextLine;
+    uint8_t cropEnableFlag;
+    int32_t cropTop;
+    int32_t cropBottom;
+    int32_t cropLeft;
+    int32_t cropRight;
+};
+
+struct H264DecodeOutput
+{
+    int32_t frameCount;
+    H264DecodeResult** decodeResults;
+    void* userMemory;
+};
+
+typedef void (*H264DECFptrOutputFn)(H264DecodeOutput* output);
+
+H264Error H264DECMemoryRequirement(int32_t profile, int32_t level, int32_t maxWidth, int32_t maxHeight,
+                                   uint32_t* outMemoryRequirement);
+H264Error H264DECInitParam(int32_t memorySize, void* memory);
+H264Error H264DECSetParam_FPTR_OUTPUT(void* memory, H264DECFptrOutputFn value);
+// value points to the user memory pointer
+H264Error H264DECSetParam_USER_MEMORY(void* memory, void* value);
+H264Error H264DECOpen(void* memory);
+H264Error H264DECBegin(void* memory);
+H264Error H264DECSetBitstream(void* memory, uint8_t* buffer, uint32_t bufferLength, double timestamp);
+H264Error H264DECExecute(void* memory, void* frameBuffer);
+H264Error H264DECEnd(void* memory);
+H264Error H264DECFlush(void* memory);
+H264Error H264DECClose(void* memory);
+H264Error H264DECCheckMemSegmentation(void* memory, uint32_t size);
+H264Error H264DECFindDecstartpoint(const uint8_t* buffer, uint32_t bufferLength, int32_t* outOffset);
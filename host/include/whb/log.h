@@ -0,0 +1,6 @@
+#pragma once
+#include <wut.h>
+
+// Written to stderr, see SetHostLogEnabled
+BOOL WHBLogPrint(const char* str);
+BOOL WHBLogPrintf(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
@@ -0,0 +1,13 @@
+#pragma once
+// The parts of wut's headers the player's sources include, declared for host builds. Implemented by HostPlatform.cpp
+// and FakeDecoder.cpp.
+#include <cstdint>
+
+typedef int32_t BOOL;
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+#ifndef FALSE
+#define FALSE 0
+#endif
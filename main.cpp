@@ -1,10 +1,13 @@
 #include "Gfx.h"
-#include "H264.h"
-#include "MP4.h"
+#include "Player.h"
+#include "Trace.h"
+#include <algorithm>
 #include <filesystem>
-#include <span>
-#include <sysapp/launch.h>
+#include <fstream>
+#include <iterator>
+#include <string>
 #include <vector>
+#include <sysapp/launch.h>
 #include <vpad/input.h>
 #include <whb/log.h>
 #include <whb/log_cafe.h>
@@ -40,35 +43,132 @@ void ExitToMenu()
     }
 }
 
-int main()
+// The first of these in the videos folder is played, whatever the extension the format is detected from the content
+constexpr const char* VIDEO_NAMES[]{"videoplayback.mp4", "videoplayback.ts", "videoplayback.h264"};
+
+std::filesystem::path VideoFolder()
 {
-    Libs libs{};
-    auto sdPath = std::filesystem::path(WHBGetSdCardMountPath()) / "wiiu" / "videos" / "videoplayback.mp4";
+    return std::filesystem::path(WHBGetSdCardMountPath()) / "wiiu" / "videos";
+}
 
-    H264TrackData trackData{};
-    trackData.stream.reserve(23'000'000u);
-    if (!LoadAVCTrackFromMP4(sdPath, trackData))
+std::filesystem::path FindVideo()
+{
+    const auto folder = VideoFolder();
+    for (const auto* name : VIDEO_NAMES)
     {
-        WHBLogPrint("Failed to load track");
-        ExitToMenu();
-        return -1;
+        std::error_code error;
+        if (std::filesystem::exists(folder / name, error))
+            return folder / name;
     }
-    WHBLogPrintf("Loaded track with dim %d x %d", trackData.width, trackData.height);
+    return folder / VIDEO_NAMES[0];
+}
 
-    const auto decStartOffset = H264Decoder::GetStartPoint(trackData.stream);
-    if (decStartOffset < 0)
-    {
-        WHBLogPrint("Failed to find start");
-    }
-    else
+// Played in order and looped if it exists in the videos folder, one file name per line relative to it. Lines starting
+// with # are skipped, so extended M3U files work too.
+constexpr const char* PLAYLIST_NAME = "playlist.m3u";
+
+std::vector<std::filesystem::path> LoadPlaylist()
+{
+    const auto folder = VideoFolder();
+    std::vector<std::filesystem::path> items;
+    std::ifstream file(folder / PLAYLIST_NAME);
+    std::string line;
+    while (std::getline(file, line))
     {
-        WHBLogPrintf("Found start at %d", decStartOffset);
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (!line.empty() && line.front() != '#')
+            items.push_back(folder / line);
     }
+    return items;
+}
 
+void ShowTrack(Gfx& gfx, const Player& player)
+{
+    const auto& trackInfo = player.GetTrackInfo();
+    WHBLogPrintf("Loaded track with dim %d x %d", trackInfo.width, trackInfo.height);
+    gfx.SetFrameDimensions(trackInfo.width, trackInfo.height, trackInfo.cropLeft, trackInfo.cropTop);
+}
+
+// Holds the decoder memory, its frame pools and the texture surfaces. Enough for a 1080p decoder at level 4.2 with
+// the default 16 MiB output budget, fitted levels need less.
+constexpr size_t VIDEO_ARENA_SIZE = 96 * 1024 * 1024;
+
+// Written to the videos folder by the Y button, X sends the trace over the log instead
+constexpr const char* TRACE_NAME = "trace.json";
+
+void SaveTrace()
+{
+    const auto path = VideoFolder() / TRACE_NAME;
+    if (Trace::WriteJson(path))
+        WHBLogPrintf("Saved trace to %s", path.c_str());
+    Trace::LogHistograms();
+}
+
+// Seek step of the L and R buttons
+constexpr int64_t SEEK_STEP_SECONDS = 10;
+// Right and left step through these, A goes back to normal play
+constexpr int TRICK_SPEEDS[]{-16, -8, -4, -2, 1, 2, 4, 8, 16};
+
+void ChangeSpeed(Player& player, int direction)
+{
+    const auto* current = std::find(std::begin(TRICK_SPEEDS), std::end(TRICK_SPEEDS), player.GetSpeed());
+    if (current == std::end(TRICK_SPEEDS))
+        return;
+    const auto next = current - std::begin(TRICK_SPEEDS) + direction;
+    if (next < 0 || next >= static_cast<ptrdiff_t>(std::size(TRICK_SPEEDS)))
+        return;
+    if (player.SetSpeed(TRICK_SPEEDS[next]))
+        WHBLogPrintf("Speed %dx", TRICK_SPEEDS[next]);
+}
+
+void HandleInput(Player& player)
+{
+    VPADStatus status{};
+    VPADReadError error;
+    if (VPADRead(VPAD_CHAN_0, &status, 1, &error) < 1 || error != VPAD_READ_SUCCESS)
+        return;
+
+    if (status.trigger & VPAD_BUTTON_RIGHT)
+        ChangeSpeed(player, 1);
+    if (status.trigger & VPAD_BUTTON_LEFT)
+        ChangeSpeed(player, -1);
+    if (status.trigger & VPAD_BUTTON_A)
+        player.SetSpeed(1);
+    if (status.trigger & VPAD_BUTTON_Y)
+        SaveTrace();
+    if (status.trigger & VPAD_BUTTON_X)
+        Trace::LogJson();
+
+    int64_t step = 0;
+    if (status.trigger & VPAD_BUTTON_L)
+        step = -SEEK_STEP_SECONDS;
+    if (status.trigger & VPAD_BUTTON_R)
+        step = SEEK_STEP_SECONDS;
+    if (step == 0)
+        return;
+
+    const auto target = player.GetPosition() + step * player.GetTrackInfo().timescale;
+    player.Seek(static_cast<uint64_t>(std::max<int64_t>(target, 0)));
+}
+
+int main()
+{
+    Libs libs{};
+    SetCurrentThreadName("Presenter");
+    auto playlist = LoadPlaylist();
+    const bool loop = !playlist.empty();
+    if (playlist.empty())
+        playlist.push_back(FindVideo());
+    size_t nextItem = 1 % playlist.size();
+
+    std::unique_ptr<MemoryArena> arena;
     std::unique_ptr<Gfx> gfx;
     try
     {
-        gfx = std::make_unique<Gfx>();
+        // Everything in it has to be usable by the decoder, so the region is checked once instead of every buffer
+        arena = std::make_unique<MemoryArena>(VIDEO_ARENA_SIZE, H264Decoder::CheckMemory);
+        gfx = std::make_unique<Gfx>(arena.get());
     }
     catch (const std::exception& e)
     {
@@ -76,14 +176,19 @@ int main()
         ExitToMenu();
         return -1;
     }
-    gfx->SetFrameDimensions(trackData.width, trackData.height);
-    gfx->SetVideoDrawTargets(Gfx::DrawTargets::TV | Gfx::DrawTargets::DRC);
 
-    std::optional<H264Decoder> decoder;
+    PlayerConfig playerConfig;
+    playerConfig.decoder.arena = arena.get();
+    playerConfig.sinkHeldFrames = Gfx::HELD_FRAMES;
+    Player player(playerConfig);
     try
     {
-        decoder.emplace(static_cast<H264Profile>(trackData.profile), trackData.level, trackData.width,
-                        trackData.height);
+        if (!player.Open(playlist.front()))
+        {
+            WHBLogPrint("Failed to load track");
+            ExitToMenu();
+            return -1;
+        }
     }
     catch (const std::exception& e)
     {
@@ -91,19 +196,48 @@ int main()
         ExitToMenu();
         return -1;
     }
+    ShowTrack(*gfx, player);
+    // The DRC is a fraction of the size of most videos
+    gfx->SetVideoDrawTargets(Gfx::DrawTargets::TV | Gfx::DrawTargets::DRC, Gfx::DrawTargets::DRC);
 
-    decoder->SubmitFrame(std::span(trackData.stream).subspan(decStartOffset), 0);
-
-    auto frameInfo = decoder->GetDecodedFrame();
-    while (!frameInfo)
-    {
-        frameInfo = decoder->GetDecodedFrame();
-    }
-
-    gfx->SetFrameBuffer(*frameInfo);
+    auto& presenterStats = player.GetPresenterStats();
+    bool loggedStats = false;
+    unsigned itemCount = player.GetItemCount();
     while (WHBProcIsRunning())
     {
+        // The next file is opened and read ahead while this one plays
+        if (loop && !player.HasQueuedNext())
+        {
+            player.QueueNext(playlist[nextItem]);
+            nextItem = (nextItem + 1) % playlist.size();
+        }
+        HandleInput(player);
+
+        auto frame = player.Present();
+        if (player.GetItemCount() != itemCount)
+        {
+            itemCount = player.GetItemCount();
+            ShowTrack(*gfx, player);
+            loggedStats = false;
+        }
+        // Only hands the frame to the upload thread, it's on screen from the first Draw after the upload finished
+        if (frame)
+        {
+            const auto uploadStart = StageStats::Clock::now();
+            gfx->SetFrameBuffer(*frame);
+            presenterStats.AddBusy(StageStats::Clock::now() - uploadStart);
+        }
+        // Mostly waiting for vsync
+        const auto drawStart = StageStats::Clock::now();
         gfx->Draw();
+        presenterStats.AddIdle(StageStats::Clock::now() - drawStart);
+
+        if (player.IsFinished() && !loggedStats)
+        {
+            player.LogStats();
+            Trace::LogHistograms();
+            loggedStats = true;
+        }
     }
 
     return 0;